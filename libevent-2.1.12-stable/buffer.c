@@ -117,6 +117,19 @@
 #define SENDFILE_IS_SOLARIS	1
 #endif
 
+/* zero-copy send support */
+#if defined(EVENT__HAVE_MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define USE_ZEROCOPY		1
+#include <netinet/in.h>
+#include <time.h>
+#include <linux/errqueue.h>
+#endif
+
+/* ring buffer support */
+#if defined(EVENT__HAVE_MEMFD_CREATE) && defined(EVENT__HAVE_MMAP) && defined(EVENT__HAVE_SYS_MMAN_H)
+#define USE_RING_BUFFER		1
+#endif
+
 /* Mask of user-selectable callback flags. */
 #define EVBUFFER_CB_USER_FLAGS	    0xffff
 /* Mask of all internal-use-only flags. */
@@ -125,6 +138,10 @@
 /* Flag set if the callback is using the cb_obsolete function pointer  */
 #define EVBUFFER_CB_OBSOLETE	       0x00040000
 
+/* The size evbuffer_read() starts out reading at, and the smallest it will
+ * shrink back down to. */
+#define EVBUFFER_MIN_READ	4096
+
 /* evbuffer_chain support */
 #define CHAIN_SPACE_PTR(ch) ((ch)->buffer + (ch)->misalign + (ch)->off)
 #define CHAIN_SPACE_LEN(ch) ((ch)->flags & EVBUFFER_IMMUTABLE ? \
@@ -133,6 +150,98 @@
 #define CHAIN_PINNED(ch)  (((ch)->flags & EVBUFFER_MEM_PINNED_ANY) != 0)
 #define CHAIN_PINNED_R(ch)  (((ch)->flags & EVBUFFER_MEM_PINNED_R) != 0)
 
+/* evbuffer_remove_buffer_reference() shares a partial chain with the
+ * destination buffer instead of copying it once it is at least this long.
+ * Below that, copying is cheaper than setting up a reference to the
+ * memory. */
+#define EVBUFFER_SHARE_MIN 1536
+
+/* Ring chain support.  Data moves through a ring chain by sliding its
+ * buffer pointer; once that passes the end of the first copy of the ring,
+ * it wraps back by the size of the ring, which is the same memory. */
+static inline void
+evbuffer_ring_advance(struct evbuffer_chain *chain, size_t n)
+{
+	struct evbuffer_chain_ring *info =
+	    EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_ring, chain);
+
+	EVUTIL_ASSERT(n <= chain->off);
+	chain->off -= n;
+	if (chain->off == 0) {
+		/* Start over at the front, so that a buffer that is
+		 * emptied often keeps using the same few pages. */
+		chain->buffer = info->base;
+		return;
+	}
+	chain->buffer += n;
+	if (chain->buffer >= info->base + info->size)
+		chain->buffer -= info->size;
+}
+
+static inline void
+evbuffer_ring_rewind(struct evbuffer_chain *chain, size_t n)
+{
+	struct evbuffer_chain_ring *info =
+	    EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_ring, chain);
+
+	EVUTIL_ASSERT(n <= (size_t)CHAIN_SPACE_LEN(chain));
+	if (chain->buffer < info->base + n)
+		chain->buffer += info->size;
+	chain->buffer -= n;
+	chain->off += n;
+}
+
+static void evbuffer_mem_domain_update(struct evbuffer *buffer);
+
+#ifdef USE_ZEROCOPY
+/* One chain that the kernel may still be reading from. */
+struct evbuffer_zerocopy_send {
+	/* Sequence number of the sendmsg() call that sent from it. */
+	ev_uint32_t seq;
+	/* Our reference to the chain. */
+	struct evbuffer_chain *chain;
+	/* How many bytes of the chain that call sent. */
+	size_t len;
+	/* True if we made the chain immutable, and must undo that once the
+	 * kernel is done with it. */
+	unsigned set_immutable;
+};
+
+struct evbuffer_zerocopy {
+	/* The socket we are allowed to use MSG_ZEROCOPY on. */
+	evutil_socket_t fd;
+	/* Which socket fd was, so that we can tell once it has been closed
+	 * or reused. */
+	dev_t sock_dev;
+	ino_t sock_ino;
+	/* Chains holding fewer bytes than this get copied as usual. */
+	size_t threshold;
+	/* The sequence number the kernel will give our next send. */
+	ev_uint32_t next_seq;
+	/* Total of len over sends. */
+	size_t pending_bytes;
+	struct evbuffer_zerocopy_send *sends;
+	size_t n_sends;
+	size_t n_sends_alloc;
+	/* Next on the list of orphans. */
+	struct evbuffer_zerocopy *next;
+};
+
+/* Zero-copy state left behind by freed buffers, or by buffers that moved to
+ * another socket.  Each is kept until the kernel is done with all of its
+ * chains and its socket is closed: the kernel numbers sends per socket, so
+ * a later buffer on the same socket has to carry on where it left off. */
+static struct evbuffer_zerocopy *zerocopy_orphans;
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+static void *zerocopy_orphans_lock;
+#endif
+
+#define ZEROCOPY_CHAIN_OK(zc, fd, chain)				\
+	((zc) != NULL && (zc)->fd == (fd) &&				\
+	    (chain)->off >= (zc)->threshold &&				\
+	    !((chain)->flags & (EVBUFFER_SENDFILE|EVBUFFER_RING)))
+#endif
+
 /* evbuffer_ptr support */
 #define PTR_NOT_FOUND(ptr) do {			\
 	(ptr)->pos = -1;					\
@@ -144,6 +253,7 @@ static void evbuffer_chain_align(struct evbuffer_chain *chain);
 static int evbuffer_chain_should_realign(struct evbuffer_chain *chain,
     size_t datalen);
 static void evbuffer_deferred_callback(struct event_callback *cb, void *arg);
+static void evbuffer_zerocopy_free(struct evbuffer *buffer);
 static int evbuffer_ptr_memcmp(const struct evbuffer *buf,
     const struct evbuffer_ptr *pos, const char *mem, size_t len);
 static struct evbuffer_chain *evbuffer_expand_singlechain(struct evbuffer *buf,
@@ -153,6 +263,176 @@ static int evbuffer_ptr_subtract(struct evbuffer *buf, struct evbuffer_ptr *pos,
 static int evbuffer_file_segment_materialize(struct evbuffer_file_segment *seg);
 static inline void evbuffer_chain_incref(struct evbuffer_chain *chain);
 
+/* Chain cache support.
+ *
+ * Plain chains (the ones whose memory holds nothing but the chain header and
+ * its own data) are always a power of two in size, starting at
+ * MIN_BUFFER_SIZE.  Rather than handing each one back to mm_free(), we keep
+ * a small LIFO freelist per size class, so that a buffer which keeps adding
+ * and draining about the same amount of data reuses the same few blocks
+ * instead of going through the allocator every time.
+ *
+ * The cache is per thread where the compiler gives us thread-local storage,
+ * so that no locking is needed; without it, it is shared, and only used when
+ * threading support is compiled out.  A thread only caches chains once
+ * event_thread_cache_usable_() says that its cache will be emptied when the
+ * thread exits.  Only the owning thread ever touches its cache.
+ */
+#define CHAIN_CACHE_NCLASSES 8
+#define CHAIN_CACHE_MAX_SIZE (MIN_BUFFER_SIZE << (CHAIN_CACHE_NCLASSES - 1))
+
+#if defined(EVENT__DISABLE_THREAD_SUPPORT)
+#define CHAIN_CACHE_STORAGE static
+#elif defined(_MSC_VER)
+#define CHAIN_CACHE_STORAGE static __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__) || defined(__SUNPRO_C)
+#define CHAIN_CACHE_STORAGE static __thread
+#endif
+
+#ifdef CHAIN_CACHE_STORAGE
+struct evbuffer_chain_cache {
+	/** Must be first: see evbuffer_chain_cache_empty(). */
+	struct event_thread_cache_ cache;
+	/** Free chains of each size class, linked through their next
+	 * pointers. */
+	struct evbuffer_chain *freelist[CHAIN_CACHE_NCLASSES];
+	/** Total allocation size of every chain in the cache. */
+	size_t n_bytes;
+};
+CHAIN_CACHE_STORAGE struct evbuffer_chain_cache chain_cache;
+#endif
+
+/* These are only written by evbuffer_set_chain_cache_limits(), which should
+ * be called before any other thread is using evbuffers. */
+static size_t chain_cache_max_chain = 65536;
+static size_t chain_cache_max_bytes = 262144;
+
+/* Return the size class for a chain allocation of to_alloc bytes, or -1 if
+ * chains of that size are not cached. */
+static inline int
+evbuffer_chain_cache_class(size_t to_alloc)
+{
+	int idx = 0;
+	size_t sz = MIN_BUFFER_SIZE;
+
+	if (to_alloc > chain_cache_max_chain)
+		return -1;
+	while (sz < to_alloc) {
+		sz <<= 1;
+		++idx;
+	}
+	return sz == to_alloc ? idx : -1;
+}
+
+#ifdef CHAIN_CACHE_STORAGE
+/* Free cached chains in cache, largest first, until it holds no more than
+ * max_bytes.  Returns the number of bytes freed. */
+static size_t
+evbuffer_chain_cache_shrink(struct evbuffer_chain_cache *cache,
+    size_t max_bytes)
+{
+	size_t freed = 0;
+	int idx;
+
+	/* Drop the largest chains first: they are the least likely to be
+	 * asked for again, and they get us under the limit soonest. */
+	for (idx = CHAIN_CACHE_NCLASSES - 1;
+	     idx >= 0 && cache->n_bytes > max_bytes; --idx) {
+		size_t sz = (size_t)MIN_BUFFER_SIZE << idx;
+		struct evbuffer_chain *chain;
+		while ((chain = cache->freelist[idx]) != NULL &&
+		    cache->n_bytes > max_bytes) {
+			cache->freelist[idx] = chain->next;
+			cache->n_bytes -= sz;
+			freed += sz;
+			mm_free(chain);
+		}
+	}
+	return freed;
+}
+
+static void
+evbuffer_chain_cache_empty(struct event_thread_cache_ *cache)
+{
+	evbuffer_chain_cache_shrink((struct evbuffer_chain_cache *)cache, 0);
+}
+#endif
+
+static inline void *
+evbuffer_chain_cache_get(size_t to_alloc)
+{
+#ifdef CHAIN_CACHE_STORAGE
+	struct evbuffer_chain *chain;
+	int idx = evbuffer_chain_cache_class(to_alloc);
+
+	if (idx < 0 || (chain = chain_cache.freelist[idx]) == NULL)
+		return mm_malloc(to_alloc);
+	chain_cache.freelist[idx] = chain->next;
+	chain_cache.n_bytes -= to_alloc;
+	return chain;
+#else
+	return mm_malloc(to_alloc);
+#endif
+}
+
+/* Release the memory of a chain that nothing refers to any more. */
+static inline void
+evbuffer_chain_cache_put(struct evbuffer_chain *chain)
+{
+#ifdef CHAIN_CACHE_STORAGE
+	size_t to_alloc;
+	int idx;
+
+	if (chain->flags & EVBUFFER_MULTICAST) {
+		/* Only the buffer of a multicast chain points elsewhere; the
+		 * chain itself was allocated with just enough room for its
+		 * parent information, which always fits in the smallest
+		 * size class. */
+		to_alloc = MIN_BUFFER_SIZE;
+	} else if ((chain->flags & (EVBUFFER_REFERENCE|EVBUFFER_FILESEGMENT)) ||
+	    chain->buffer != EVBUFFER_CHAIN_EXTRA(unsigned char, chain)) {
+		mm_free(chain);
+		return;
+	} else {
+		to_alloc = chain->buffer_len + EVBUFFER_CHAIN_SIZE;
+	}
+
+	if (chain_cache.n_bytes + to_alloc > chain_cache_max_bytes ||
+	    (idx = evbuffer_chain_cache_class(to_alloc)) < 0 ||
+	    !event_thread_cache_usable_(&chain_cache.cache,
+		evbuffer_chain_cache_empty)) {
+		mm_free(chain);
+		return;
+	}
+	chain->next = chain_cache.freelist[idx];
+	chain_cache.freelist[idx] = chain;
+	chain_cache.n_bytes += to_alloc;
+#else
+	mm_free(chain);
+#endif
+}
+
+size_t
+evbuffer_chain_cache_trim(size_t max_bytes)
+{
+#ifdef CHAIN_CACHE_STORAGE
+	return evbuffer_chain_cache_shrink(&chain_cache, max_bytes);
+#else
+	return 0;
+#endif
+}
+
+int
+evbuffer_set_chain_cache_limits(size_t max_chain_size, size_t max_bytes)
+{
+	if (max_chain_size > CHAIN_CACHE_MAX_SIZE)
+		return -1;
+	chain_cache_max_chain = max_chain_size;
+	chain_cache_max_bytes = max_bytes;
+	evbuffer_chain_cache_trim(max_bytes);
+	return 0;
+}
+
 static struct evbuffer_chain *
 evbuffer_chain_new(size_t size)
 {
@@ -175,7 +455,7 @@ evbuffer_chain_new(size_t size)
 	}
 
 	/* we get everything in one chunk */
-	if ((chain = mm_malloc(to_alloc)) == NULL)
+	if ((chain = evbuffer_chain_cache_get(to_alloc)) == NULL)
 		return (NULL);
 
 	memset(chain, 0, EVBUFFER_CHAIN_SIZE);
@@ -233,6 +513,13 @@ evbuffer_chain_free(struct evbuffer_chain *chain)
 			evbuffer_file_segment_free(info->segment);
 		}
 	}
+#ifdef USE_RING_BUFFER
+	if (chain->flags & EVBUFFER_RING) {
+		struct evbuffer_chain_ring *info =
+		    EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_ring, chain);
+		munmap(info->base, info->size * 2);
+	}
+#endif
 	if (chain->flags & EVBUFFER_MULTICAST) {
 		struct evbuffer_multicast_parent *info =
 		    EVBUFFER_CHAIN_EXTRA(
@@ -245,11 +532,12 @@ evbuffer_chain_free(struct evbuffer_chain *chain)
 		EVUTIL_ASSERT(info->source != NULL);
 		EVUTIL_ASSERT(info->parent != NULL);
 		EVBUFFER_LOCK(info->source);
+		--info->source->n_multicast_refs;
 		evbuffer_chain_free(info->parent);
 		evbuffer_decref_and_unlock_(info->source);
 	}
 
-	mm_free(chain);
+	evbuffer_chain_cache_put(chain);
 }
 
 static void
@@ -370,10 +658,37 @@ evbuffer_new(void)
 	LIST_INIT(&buffer->callbacks);
 	buffer->refcnt = 1;
 	buffer->last_with_datap = &buffer->first;
+	buffer->max_read = EVBUFFER_MAX_READ_DEFAULT;
+	buffer->read_size = EVBUFFER_MIN_READ;
 
 	return (buffer);
 }
 
+int
+evbuffer_set_max_read(struct evbuffer *buf, size_t max)
+{
+	if (max > INT_MAX)
+		return -1;
+	EVBUFFER_LOCK(buf);
+	if (max == 0)
+		max = EVBUFFER_MAX_READ_DEFAULT;
+	buf->max_read = max;
+	buf->read_size = max < EVBUFFER_MIN_READ ? max : EVBUFFER_MIN_READ;
+	buf->n_short_reads = 0;
+	EVBUFFER_UNLOCK(buf);
+	return 0;
+}
+
+size_t
+evbuffer_get_max_read(struct evbuffer *buf)
+{
+	size_t result;
+	EVBUFFER_LOCK(buf);
+	result = buf->max_read;
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
 int
 evbuffer_set_flags(struct evbuffer *buf, ev_uint64_t flags)
 {
@@ -513,6 +828,9 @@ evbuffer_run_callbacks(struct evbuffer *buffer, int running_deferred)
 void
 evbuffer_invoke_callbacks_(struct evbuffer *buffer)
 {
+	if (buffer->mem_domain && buffer->mem_counted != buffer->total_len)
+		evbuffer_mem_domain_update(buffer);
+
 	if (LIST_EMPTY(&buffer->callbacks)) {
 		buffer->n_add_for_cb = buffer->n_del_for_cb = 0;
 		return;
@@ -570,10 +888,13 @@ evbuffer_decref_and_unlock_(struct evbuffer *buffer)
 		return;
 	}
 
+	if (buffer->mem_domain)
+		evbuffer_set_mem_domain(buffer, NULL);
 	for (chain = buffer->first; chain != NULL; chain = next) {
 		next = chain->next;
 		evbuffer_chain_free(chain);
 	}
+	evbuffer_zerocopy_free(buffer);
 	evbuffer_remove_all_callbacks(buffer);
 	if (buffer->deferred_cbs)
 		event_deferred_cb_cancel_(buffer->cb_queue, &buffer->deferred);
@@ -904,12 +1225,62 @@ APPEND_CHAIN(struct evbuffer *dst, struct evbuffer *src)
 	dst->total_len += src->total_len;
 }
 
+/** Helper: return a new multicast chain that refers to the 'len' bytes at
+ * 'off' in 'chain', which belongs to 'src', without copying them.  If
+ * 'chain' is itself a multicast chain, the new chain refers to the chain
+ * that owns the memory instead, so that references never nest.  The chain
+ * that owns the memory becomes immutable: anything appended to it later
+ * goes into a new chain instead.  Returns NULL on allocation failure. */
+static struct evbuffer_chain *
+evbuffer_chain_share(struct evbuffer *src, struct evbuffer_chain *chain,
+    size_t off, size_t len)
+{
+	struct evbuffer_chain *tmp;
+	struct evbuffer_multicast_parent *extra;
+	struct evbuffer *source = src;
+	struct evbuffer_chain *parent = chain;
+
+	ASSERT_EVBUFFER_LOCKED(src);
+	EVUTIL_ASSERT(off + len <= chain->off);
+
+	tmp = evbuffer_chain_new(sizeof(struct evbuffer_multicast_parent));
+	if (!tmp)
+		return NULL;
+	if (chain->flags & EVBUFFER_MULTICAST) {
+		struct evbuffer_multicast_parent *info =
+		    EVBUFFER_CHAIN_EXTRA(struct evbuffer_multicast_parent,
+			chain);
+		source = info->source;
+		parent = info->parent;
+	}
+	extra = EVBUFFER_CHAIN_EXTRA(struct evbuffer_multicast_parent, tmp);
+	/* reference evbuffer containing source chain so it
+	 * doesn't get released while the chain is still
+	 * being referenced to */
+	EVBUFFER_LOCK(source);
+	evbuffer_incref_(source);
+	++source->n_multicast_refs;
+	extra->source = source;
+	/* reference source chain which now becomes immutable */
+	evbuffer_chain_incref(parent);
+	extra->parent = parent;
+	parent->flags |= EVBUFFER_IMMUTABLE;
+	EVBUFFER_UNLOCK(source);
+	/* End the new chain where the shared bytes end, so that nothing
+	 * mistakes the rest of the parent for free space. */
+	tmp->misalign = chain->misalign + off;
+	tmp->buffer_len = tmp->misalign + len;
+	tmp->off = len;
+	tmp->flags |= EVBUFFER_MULTICAST|EVBUFFER_IMMUTABLE;
+	tmp->buffer = chain->buffer;
+	return tmp;
+}
+
 static inline void
 APPEND_CHAIN_MULTICAST(struct evbuffer *dst, struct evbuffer *src)
 {
 	struct evbuffer_chain *tmp;
 	struct evbuffer_chain *chain = src->first;
-	struct evbuffer_multicast_parent *extra;
 
 	ASSERT_EVBUFFER_LOCKED(dst);
 	ASSERT_EVBUFFER_LOCKED(src);
@@ -920,26 +1291,11 @@ APPEND_CHAIN_MULTICAST(struct evbuffer *dst, struct evbuffer *src)
 			continue;
 		}
 
-		tmp = evbuffer_chain_new(sizeof(struct evbuffer_multicast_parent));
+		tmp = evbuffer_chain_share(src, chain, 0, chain->off);
 		if (!tmp) {
 			event_warn("%s: out of memory", __func__);
 			return;
 		}
-		extra = EVBUFFER_CHAIN_EXTRA(struct evbuffer_multicast_parent, tmp);
-		/* reference evbuffer containing source chain so it
-		 * doesn't get released while the chain is still
-		 * being referenced to */
-		evbuffer_incref_(src);
-		extra->source = src;
-		/* reference source chain which now becomes immutable */
-		evbuffer_chain_incref(chain);
-		extra->parent = chain;
-		chain->flags |= EVBUFFER_IMMUTABLE;
-		tmp->buffer_len = chain->buffer_len;
-		tmp->misalign = chain->misalign;
-		tmp->off = chain->off;
-		tmp->flags |= EVBUFFER_MULTICAST|EVBUFFER_IMMUTABLE;
-		tmp->buffer = chain->buffer;
 		evbuffer_chain_insert(dst, tmp);
 	}
 }
@@ -962,6 +1318,60 @@ PREPEND_CHAIN(struct evbuffer *dst, struct evbuffer *src)
 	}
 }
 
+/* Helper: copy up to datlen bytes from the front of src to the end of dst,
+ * and drain them from src.  This is how data gets into and out of a ring
+ * buffer, whose memory can't be handed over to another buffer.  Returns
+ * the number of bytes moved.  Requires both locks. */
+static size_t
+evbuffer_copy_and_drain(struct evbuffer *dst, struct evbuffer *src,
+    size_t datlen)
+{
+	struct evbuffer_chain *chain;
+	size_t n, moved = 0;
+
+	ASSERT_EVBUFFER_LOCKED(dst);
+	ASSERT_EVBUFFER_LOCKED(src);
+
+	for (chain = src->first; chain && moved < datlen;
+	     chain = chain->next) {
+		if (chain->flags & EVBUFFER_SENDFILE)
+			break;
+		n = chain->off;
+		if (n > datlen - moved)
+			n = datlen - moved;
+		if (n && evbuffer_add(dst, chain->buffer + chain->misalign,
+			n) < 0)
+			break;
+		moved += n;
+	}
+	evbuffer_drain(src, moved);
+	return moved;
+}
+
+/* Return true iff one of the whole chains starting at 'chain' that hold
+ * the first 'len' bytes refers to memory in 'buf'.  Moving such a chain
+ * into 'buf' would make 'buf' hold a reference to itself, so that it could
+ * never be freed. */
+static int
+evbuffer_chains_refer_to(struct evbuffer_chain *chain, size_t len,
+    struct evbuffer *buf)
+{
+	struct evbuffer_multicast_parent *info;
+
+	if (buf->n_multicast_refs == 0)
+		return 0;
+	for (; chain && chain->off <= len; chain = chain->next) {
+		if (chain->flags & EVBUFFER_MULTICAST) {
+			info = EVBUFFER_CHAIN_EXTRA(
+			    struct evbuffer_multicast_parent, chain);
+			if (info->source == buf)
+				return 1;
+		}
+		len -= chain->off;
+	}
+	return 0;
+}
+
 int
 evbuffer_add_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 {
@@ -981,6 +1391,20 @@ evbuffer_add_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 		goto done;
 	}
 
+	if (inbuf->ring || outbuf->ring) {
+		if ((outbuf->ring &&
+			in_total_len > (size_t)CHAIN_SPACE_LEN(outbuf->ring)) ||
+		    evbuffer_copy_and_drain(outbuf, inbuf, in_total_len) <
+		    in_total_len)
+			result = -1;
+		goto done;
+	}
+
+	if (evbuffer_chains_refer_to(inbuf->first, in_total_len, outbuf)) {
+		result = -1;
+		goto done;
+	}
+
 	if (PRESERVE_PINNED(inbuf, &pinned, &last) < 0) {
 		result = -1;
 		goto done;
@@ -1023,7 +1447,8 @@ evbuffer_add_buffer_reference(struct evbuffer *outbuf, struct evbuffer *inbuf)
 	if (in_total_len == 0)
 		goto done;
 
-	if (outbuf->freeze_end || outbuf == inbuf) {
+	if (outbuf->freeze_end || outbuf == inbuf ||
+	    outbuf->ring || inbuf->ring) {
 		result = -1;
 		goto done;
 	}
@@ -1066,7 +1491,9 @@ evbuffer_prepend_buffer(struct evbuffer *outbuf, struct evbuffer *inbuf)
 	if (!in_total_len || inbuf == outbuf)
 		goto done;
 
-	if (outbuf->freeze_start || inbuf->freeze_start) {
+	if (outbuf->freeze_start || inbuf->freeze_start ||
+	    outbuf->ring || inbuf->ring ||
+	    evbuffer_chains_refer_to(inbuf->first, in_total_len, outbuf)) {
 		result = -1;
 		goto done;
 	}
@@ -1115,7 +1542,12 @@ evbuffer_drain(struct evbuffer *buf, size_t len)
 		goto done;
 	}
 
-	if (len >= old_len && !HAS_PINNED_R(buf)) {
+	if (buf->ring) {
+		if (len > old_len)
+			len = old_len;
+		evbuffer_ring_advance(buf->ring, len);
+		buf->total_len -= len;
+	} else if (len >= old_len && !HAS_PINNED_R(buf)) {
 		len = old_len;
 		for (chain = buf->first; chain != NULL; chain = next) {
 			next = chain->next;
@@ -1253,17 +1685,25 @@ done:
 	return result;
 }
 
+/* Return true iff nothing but buf itself keeps its lock and callbacks
+ * alive, so that a reference to buf may outlive whoever else uses it. */
+static int
+evbuffer_is_standalone(struct evbuffer *buf)
+{
+	return buf->parent == NULL && !buf->deferred_cbs &&
+	    (buf->lock == NULL || buf->own_lock);
+}
+
 /* reads data from the src buffer to the dst buffer, avoids memcpy as
- * possible. */
+ * possible.  If 'share' is set, a large piece of a chain left over at
+ * the end is shared with dst instead of copied. */
 /*  XXXX should return ev_ssize_t */
-int
-evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
-    size_t datlen)
+static int
+evbuffer_remove_buffer_impl(struct evbuffer *src, struct evbuffer *dst,
+    size_t datlen, int share)
 {
-	/*XXX We should have an option to force this to be zero-copy.*/
-
 	/*XXX can fail badly on sendfile case. */
-	struct evbuffer_chain *chain, *previous;
+	struct evbuffer_chain *chain, *previous, *tmp;
 	size_t nread = 0;
 	int result;
 
@@ -1271,6 +1711,11 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 
 	chain = previous = src->first;
 
+	if (share && !evbuffer_is_standalone(src)) {
+		result = -1;
+		goto done;
+	}
+
 	if (datlen == 0 || dst == src) {
 		result = 0;
 		goto done;
@@ -1281,11 +1726,25 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 		goto done;
 	}
 
+	if (src->ring || dst->ring) {
+		if (dst->ring && datlen > (size_t)CHAIN_SPACE_LEN(dst->ring))
+			datlen = (size_t)CHAIN_SPACE_LEN(dst->ring);
+		result = (int)evbuffer_copy_and_drain(dst, src, datlen);
+		goto done;
+	}
+
 	/* short-cut if there is no more data buffered */
 	if (datlen >= src->total_len) {
 		datlen = src->total_len;
-		evbuffer_add_buffer(dst, src);
-		result = (int)datlen; /*XXXX should return ev_ssize_t*/
+		if (evbuffer_add_buffer(dst, src) < 0)
+			result = -1;
+		else
+			result = (int)datlen; /*XXXX should return ev_ssize_t*/
+		goto done;
+	}
+
+	if (evbuffer_chains_refer_to(chain, datlen, dst)) {
+		result = -1;
 		goto done;
 	}
 
@@ -1323,14 +1782,25 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 	}
 
 	/* we know that there is more data in the src buffer than
-	 * we want to read, so we manually drain the chain */
-	evbuffer_add(dst, chain->buffer + chain->misalign, datlen);
+	 * we want to read, so we manually drain the chain.  When asked
+	 * to, share large pieces with dst rather than copy them, unless
+	 * some other buffer already refers to dst's memory: sharing would
+	 * then risk a reference cycle that keeps both buffers alive. */
+	if (share && datlen >= EVBUFFER_SHARE_MIN && !CHAIN_PINNED(chain) &&
+	    !(chain->flags & (EVBUFFER_FILESEGMENT|EVBUFFER_SENDFILE)) &&
+	    dst->n_multicast_refs == 0 &&
+	    (tmp = evbuffer_chain_share(src, chain, 0, datlen)) != NULL) {
+		evbuffer_chain_insert(dst, tmp);
+		dst->n_add_for_cb += datlen;
+	} else {
+		evbuffer_add(dst, chain->buffer + chain->misalign, datlen);
+	}
 	chain->misalign += datlen;
 	chain->off -= datlen;
 	nread += datlen;
 
 	/* You might think we would want to increment dst->n_add_for_cb
-	 * here too.  But evbuffer_add above already took care of that.
+	 * here too.  But the code above already took care of that.
 	 */
 	src->total_len -= nread;
 	src->n_del_for_cb += nread;
@@ -1346,6 +1816,20 @@ done:
 	return result;
 }
 
+int
+evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
+    size_t datlen)
+{
+	return evbuffer_remove_buffer_impl(src, dst, datlen, 0);
+}
+
+int
+evbuffer_remove_buffer_reference(struct evbuffer *src, struct evbuffer *dst,
+    size_t datlen)
+{
+	return evbuffer_remove_buffer_impl(src, dst, datlen, 1);
+}
+
 unsigned char *
 evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 {
@@ -1492,33 +1976,6 @@ evbuffer_strchr(struct evbuffer_ptr *it, const char chr)
 	return (-1);
 }
 
-static inline char *
-find_eol_char(char *s, size_t len)
-{
-#define CHUNK_SZ 128
-	/* Lots of benchmarking found this approach to be faster in practice
-	 * than doing two memchrs over the whole buffer, doin a memchr on each
-	 * char of the buffer, or trying to emulate memchr by hand. */
-	char *s_end, *cr, *lf;
-	s_end = s+len;
-	while (s < s_end) {
-		size_t chunk = (s + CHUNK_SZ < s_end) ? CHUNK_SZ : (s_end - s);
-		cr = memchr(s, '\r', chunk);
-		lf = memchr(s, '\n', chunk);
-		if (cr) {
-			if (lf && lf < cr)
-				return lf;
-			return cr;
-		} else if (lf) {
-			return lf;
-		}
-		s += CHUNK_SZ;
-	}
-
-	return NULL;
-#undef CHUNK_SZ
-}
-
 static ev_ssize_t
 evbuffer_find_eol_char(struct evbuffer_ptr *it)
 {
@@ -1526,7 +1983,8 @@ evbuffer_find_eol_char(struct evbuffer_ptr *it)
 	size_t i = it->internal_.pos_in_chain;
 	while (chain != NULL) {
 		char *buffer = (char *)chain->buffer + chain->misalign;
-		char *cp = find_eol_char(buffer+i, chain->off-i);
+		const char *cp = evutil_memchr2_(buffer+i, chain->off-i,
+		    '\r', '\n');
 		if (cp) {
 			it->internal_.chain = chain;
 			it->internal_.pos_in_chain = cp - buffer;
@@ -1743,6 +2201,10 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 	if (datlen > EV_SIZE_MAX - buf->total_len) {
 		goto done;
 	}
+	/* A ring can't grow */
+	if (buf->ring && datlen > (size_t)CHAIN_SPACE_LEN(buf->ring)) {
+		goto done;
+	}
 
 	if (*buf->last_with_datap == NULL) {
 		chain = buf->last;
@@ -1842,6 +2304,17 @@ evbuffer_prepend(struct evbuffer *buf, const void *data, size_t datlen)
 		goto done;
 	}
 
+	if (buf->ring) {
+		chain = buf->ring;
+		if (datlen > (size_t)CHAIN_SPACE_LEN(chain))
+			goto done;
+		evbuffer_ring_rewind(chain, datlen);
+		memcpy(chain->buffer, data, datlen);
+		buf->total_len += datlen;
+		buf->n_add_for_cb += datlen;
+		goto out;
+	}
+
 	chain = buf->first;
 
 	if (chain == NULL) {
@@ -1942,6 +2415,13 @@ evbuffer_expand_singlechain(struct evbuffer *buf, size_t datlen)
 	struct evbuffer_chain *result = NULL;
 	ASSERT_EVBUFFER_LOCKED(buf);
 
+	if (buf->ring) {
+		/* A ring can't grow */
+		if ((size_t)CHAIN_SPACE_LEN(buf->ring) >= datlen)
+			result = buf->ring;
+		return result;
+	}
+
 	chainp = buf->last_with_datap;
 
 	/* XXX If *chainp is no longer writeable, but has enough space in its
@@ -2057,6 +2537,9 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 	ASSERT_EVBUFFER_LOCKED(buf);
 	EVUTIL_ASSERT(n >= 2);
 
+	if (buf->ring)
+		return (size_t)CHAIN_SPACE_LEN(buf->ring) >= datlen ? 0 : -1;
+
 	if (chain == NULL || (chain->flags & EVBUFFER_IMMUTABLE)) {
 		/* There is no last chunk, or we can't touch the last chunk.
 		 * Just add a new chunk. */
@@ -2206,8 +2689,6 @@ evbuffer_expand(struct evbuffer *buf, size_t datlen)
 #endif
 #define NUM_READ_IOVEC 4
 
-#define EVBUFFER_MAX_READ	4096
-
 /** Helper function to figure out which space to use for reading data into
     an evbuffer.  Internal use only.
 
@@ -2263,29 +2744,82 @@ static int
 get_n_bytes_readable_on_socket(evutil_socket_t fd)
 {
 #if defined(FIONREAD) && defined(_WIN32)
-	unsigned long lng = EVBUFFER_MAX_READ;
+	unsigned long lng = EVBUFFER_MIN_READ;
 	if (ioctlsocket(fd, FIONREAD, &lng) < 0)
 		return -1;
 	/* Can overflow, but mostly harmlessly. XXXX */
 	return (int)lng;
 #elif defined(FIONREAD)
-	int n = EVBUFFER_MAX_READ;
+	int n = EVBUFFER_MIN_READ;
 	if (ioctl(fd, FIONREAD, &n) < 0)
 		return -1;
 	return n;
 #else
-	return EVBUFFER_MAX_READ;
+	return EVBUFFER_MIN_READ;
 #endif
 }
 
+/* Return how much evbuffer_read() should ask for next.  Once we read more
+ * than EVBUFFER_MIN_READ at a time, leave room for the chain header, so that
+ * reading into an empty buffer allocates a chain of exactly read_size
+ * bytes. */
+static inline int
+evbuffer_read_size(const struct evbuffer *buf)
+{
+	if (buf->read_size > EVBUFFER_MIN_READ)
+		return (int)(buf->read_size - EVBUFFER_CHAIN_SIZE);
+	return (int)buf->read_size;
+}
+
+size_t
+evbuffer_get_read_cap_(struct evbuffer *buf)
+{
+	size_t cap;
+
+	EVBUFFER_LOCK(buf);
+	cap = evbuffer_read_size(buf);
+	if (buf->ring && cap > (size_t)CHAIN_SPACE_LEN(buf->ring))
+		cap = CHAIN_SPACE_LEN(buf->ring);
+	EVBUFFER_UNLOCK(buf);
+	return cap;
+}
+
+/* Adjust the read size after a read of 'got' bytes, when we asked for as
+ * much as evbuffer_read_size() allowed.  A read that fills it means the peer
+ * is sending faster than we read, so double it; two reads in a row that use
+ * less than a quarter of it mean the traffic is interactive, so halve it. */
+static void
+evbuffer_adapt_read_size(struct evbuffer *buf, int got)
+{
+	if (got >= evbuffer_read_size(buf)) {
+		buf->n_short_reads = 0;
+		if (buf->read_size < buf->max_read) {
+			buf->read_size <<= 1;
+			if (buf->read_size > buf->max_read)
+				buf->read_size = buf->max_read;
+		}
+	} else if (got < evbuffer_read_size(buf) / 4 &&
+	    buf->read_size > EVBUFFER_MIN_READ) {
+		if (++buf->n_short_reads >= 2) {
+			buf->n_short_reads = 0;
+			buf->read_size >>= 1;
+			if (buf->read_size < EVBUFFER_MIN_READ)
+				buf->read_size = EVBUFFER_MIN_READ;
+		}
+	} else {
+		buf->n_short_reads = 0;
+	}
+}
+
 /* TODO(niels): should this function return ev_ssize_t and take ev_ssize_t
  * as howmuch? */
 int
 evbuffer_read(struct evbuffer *buf, evutil_socket_t fd, int howmuch)
 {
 	struct evbuffer_chain **chainp;
-	int n;
+	int n, max;
 	int result;
+	int adapt;
 
 #ifdef USE_IOVEC_IMPL
 	int nvecs, i, remaining;
@@ -2301,11 +2835,24 @@ evbuffer_read(struct evbuffer *buf, evutil_socket_t fd, int howmuch)
 		goto done;
 	}
 
+	max = evbuffer_read_size(buf);
 	n = get_n_bytes_readable_on_socket(fd);
-	if (n <= 0 || n > EVBUFFER_MAX_READ)
-		n = EVBUFFER_MAX_READ;
+	if (n <= 0 || n > max)
+		n = max;
+	/* Only learn from reads that the caller did not cut short. */
+	adapt = howmuch < 0 || howmuch >= max;
 	if (howmuch < 0 || howmuch > n)
 		howmuch = n;
+	if (buf->ring && (size_t)howmuch > (size_t)CHAIN_SPACE_LEN(buf->ring)) {
+		/* Don't report a full ring as end-of-file. */
+		howmuch = (int)CHAIN_SPACE_LEN(buf->ring);
+		adapt = 0;
+		if (howmuch == 0) {
+			EVUTIL_SET_SOCKET_ERROR(ENOBUFS);
+			result = -1;
+			goto done;
+		}
+	}
 
 #ifdef USE_IOVEC_IMPL
 	/* Since we can use iovecs, we're willing to use the last
@@ -2402,6 +2949,8 @@ evbuffer_read(struct evbuffer *buf, evutil_socket_t fd, int howmuch)
 #endif
 	buf->total_len += n;
 	buf->n_add_for_cb += n;
+	if (adapt)
+		evbuffer_adapt_read_size(buf, n);
 
 	/* Tell someone about changes in this buffer */
 	evbuffer_invoke_callbacks_(buf);
@@ -2432,6 +2981,11 @@ evbuffer_write_iovec(struct evbuffer *buffer, evutil_socket_t fd,
 		/* we cannot write the file info via writev */
 		if (chain->flags & EVBUFFER_SENDFILE)
 			break;
+#endif
+#ifdef USE_ZEROCOPY
+		/* leave large chains for evbuffer_write_zerocopy */
+		if (i && ZEROCOPY_CHAIN_OK(buffer->zerocopy, fd, chain))
+			break;
 #endif
 		iov[i].IOV_PTR_FIELD = (void *) (chain->buffer + chain->misalign);
 		if ((size_t)howmuch >= chain->off) {
@@ -2520,20 +3074,427 @@ evbuffer_write_sendfile(struct evbuffer *buffer, evutil_socket_t dest_fd,
 }
 #endif
 
-int
-evbuffer_write_atmost(struct evbuffer *buffer, evutil_socket_t fd,
-    ev_ssize_t howmuch)
-{
-	int n = -1;
+#ifdef USE_ZEROCOPY
+/* Never hand one sendmsg() call more chains than this. */
+#define ZEROCOPY_MAX_IOVEC 16
 
-	EVBUFFER_LOCK(buffer);
+static void
+evbuffer_zerocopy_release(struct evbuffer_zerocopy *zc, size_t i)
+{
+	struct evbuffer_zerocopy_send *send = &zc->sends[i];
+	struct evbuffer_chain *chain = send->chain;
+	size_t j;
+
+	zc->pending_bytes -= send->len;
+	if (send->set_immutable) {
+		/* Another send from the same chain keeps it immutable. */
+		for (j = 0; j < zc->n_sends; ++j) {
+			if (j != i && zc->sends[j].chain == chain)
+				break;
+		}
+		if (j < zc->n_sends)
+			zc->sends[j].set_immutable = 1;
+		else if (chain->refcnt == 2)
+			/* Nothing but its buffer holds it, so its free
+			 * space may be used again.  With more references,
+			 * it has been shared, and must stay read-only. */
+			chain->flags &= ~EVBUFFER_IMMUTABLE;
+	}
+	zc->sends[i] = zc->sends[--zc->n_sends];
+	evbuffer_chain_free(chain);
+}
 
-	if (buffer->freeze_start) {
-		goto done;
-	}
+/* Make room to track n more chains. */
+static int
+evbuffer_zerocopy_reserve(struct evbuffer_zerocopy *zc, size_t n)
+{
+	size_t want = zc->n_sends_alloc ? zc->n_sends_alloc : 8;
+	void *p;
 
-	if (howmuch < 0 || (size_t)howmuch > buffer->total_len)
-		howmuch = buffer->total_len;
+	if (zc->n_sends + n <= zc->n_sends_alloc)
+		return 0;
+	while (want < zc->n_sends + n)
+		want <<= 1;
+	if ((p = mm_realloc(zc->sends, want * sizeof(*zc->sends))) == NULL)
+		return -1;
+	zc->sends = p;
+	zc->n_sends_alloc = want;
+	return 0;
+}
+
+/* Record that the send numbered seq took len bytes from chain.  The caller
+ * must have made room with evbuffer_zerocopy_reserve(). */
+static void
+evbuffer_zerocopy_track(struct evbuffer_zerocopy *zc, ev_uint32_t seq,
+    struct evbuffer_chain *chain, size_t len)
+{
+	struct evbuffer_zerocopy_send *send;
+
+	EVUTIL_ASSERT(zc->n_sends < zc->n_sends_alloc);
+	send = &zc->sends[zc->n_sends++];
+	send->seq = seq;
+	send->chain = chain;
+	send->len = len;
+	evbuffer_chain_incref(chain);
+	/* Nothing may move or overwrite these bytes until the kernel is
+	 * done with them. */
+	send->set_immutable = !(chain->flags & EVBUFFER_IMMUTABLE);
+	chain->flags |= EVBUFFER_IMMUTABLE;
+	zc->pending_bytes += len;
+}
+
+/* Handle one completion: every send numbered lo through hi is done. */
+static void
+evbuffer_zerocopy_complete(struct evbuffer_zerocopy *zc, ev_uint32_t lo,
+    ev_uint32_t hi)
+{
+	size_t i = 0;
+
+	/* The range may wrap around, so compare offsets from lo. */
+	while (i < zc->n_sends) {
+		if ((ev_uint32_t)(zc->sends[i].seq - lo) <=
+		    (ev_uint32_t)(hi - lo))
+			evbuffer_zerocopy_release(zc, i);
+		else
+			++i;
+	}
+}
+
+static int
+evbuffer_zerocopy_reap(struct evbuffer_zerocopy *zc)
+{
+	int n_done = 0;
+
+	while (zc->n_sends) {
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+		    CMSG_SPACE(sizeof(struct sockaddr_in6))];
+		struct msghdr msg;
+		struct cmsghdr *cm;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) < 0) {
+			if (EVUTIL_ERR_RW_RETRIABLE(errno))
+				break;
+			return -1;
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *ee;
+			if (!(cm->cmsg_level == IPPROTO_IP &&
+				cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == IPPROTO_IPV6 &&
+				cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			ee = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (ee->ee_errno != 0 ||
+			    ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			/* We don't care whether the kernel ended up copying
+			 * (SO_EE_CODE_ZEROCOPY_COPIED): the chain is free to
+			 * go either way. */
+			evbuffer_zerocopy_complete(zc, ee->ee_info,
+			    ee->ee_data);
+			++n_done;
+		}
+	}
+	return n_done;
+}
+
+/* Return true iff zc->fd is still the socket that zc was set up on. */
+static int
+evbuffer_zerocopy_same_socket(const struct evbuffer_zerocopy *zc)
+{
+	struct stat st;
+
+	return fstat(zc->fd, &st) == 0 && st.st_dev == zc->sock_dev &&
+	    st.st_ino == zc->sock_ino;
+}
+
+/* Drop every outstanding send, whether or not the kernel is done with it. */
+static void
+evbuffer_zerocopy_release_all(struct evbuffer_zerocopy *zc)
+{
+	while (zc->n_sends)
+		evbuffer_zerocopy_release(zc, zc->n_sends - 1);
+}
+
+static void
+evbuffer_zerocopy_state_free(struct evbuffer_zerocopy *zc)
+{
+	evbuffer_zerocopy_release_all(zc);
+	mm_free(zc->sends);
+	mm_free(zc);
+}
+
+/* Read what completions we can for the orphans, and free each one that has
+ * nothing left to wait for.  Requires zerocopy_orphans_lock. */
+static void
+evbuffer_zerocopy_reap_orphans(void)
+{
+	struct evbuffer_zerocopy **zcp = &zerocopy_orphans, *zc;
+
+	while ((zc = *zcp) != NULL) {
+		int open = evbuffer_zerocopy_same_socket(zc);
+		if (open && zc->n_sends)
+			evbuffer_zerocopy_reap(zc);
+		/* Once the socket is closed, the kernel's completions can't
+		 * be read any more, so chains still pending are kept until
+		 * libevent_global_shutdown(). */
+		if (!open && zc->n_sends == 0) {
+			*zcp = zc->next;
+			evbuffer_zerocopy_state_free(zc);
+		} else {
+			zcp = &zc->next;
+		}
+	}
+}
+
+/* Give up zc, which no buffer uses any more, without letting the kernel's
+ * chains go before it is done with them. */
+static void
+evbuffer_zerocopy_orphan(struct evbuffer_zerocopy *zc)
+{
+	EVLOCK_LOCK(zerocopy_orphans_lock, 0);
+	zc->next = zerocopy_orphans;
+	zerocopy_orphans = zc;
+	evbuffer_zerocopy_reap_orphans();
+	EVLOCK_UNLOCK(zerocopy_orphans_lock, 0);
+}
+
+/* Take back the orphan left on the socket that fd is, if any. */
+static struct evbuffer_zerocopy *
+evbuffer_zerocopy_adopt(evutil_socket_t fd, const struct stat *st)
+{
+	struct evbuffer_zerocopy **zcp, *zc;
+
+	EVLOCK_LOCK(zerocopy_orphans_lock, 0);
+	evbuffer_zerocopy_reap_orphans();
+	for (zcp = &zerocopy_orphans; (zc = *zcp) != NULL; zcp = &zc->next) {
+		if (zc->fd == fd && zc->sock_dev == st->st_dev &&
+		    zc->sock_ino == st->st_ino) {
+			*zcp = zc->next;
+			zc->next = NULL;
+			break;
+		}
+	}
+	EVLOCK_UNLOCK(zerocopy_orphans_lock, 0);
+	return zc;
+}
+
+/* Send the run of large chains at the front of buffer with MSG_ZEROCOPY,
+ * keeping a reference to each until the kernel says it is done.  Returns
+ * like writev(). */
+static inline int
+evbuffer_write_zerocopy(struct evbuffer *buffer, evutil_socket_t fd,
+    ev_ssize_t howmuch)
+{
+	struct evbuffer_zerocopy *zc = buffer->zerocopy;
+	struct iovec iov[ZEROCOPY_MAX_IOVEC];
+	struct evbuffer_chain *chain = buffer->first;
+	struct msghdr msg;
+	ev_ssize_t n, left;
+	int i = 0;
+
+	ASSERT_EVBUFFER_LOCKED(buffer);
+
+	while (chain != NULL && i < ZEROCOPY_MAX_IOVEC && howmuch &&
+	    ZEROCOPY_CHAIN_OK(zc, fd, chain)) {
+		iov[i].iov_base = chain->buffer + chain->misalign;
+		if ((size_t)howmuch >= chain->off) {
+			iov[i++].iov_len = chain->off;
+			howmuch -= chain->off;
+		} else {
+			iov[i++].iov_len = howmuch;
+			break;
+		}
+		chain = chain->next;
+	}
+
+	if (evbuffer_zerocopy_reserve(zc, i) < 0)
+		return writev(fd, iov, i);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = i;
+	n = sendmsg(fd, &msg, MSG_ZEROCOPY);
+	if (n < 0 && errno == ENOBUFS) {
+		/* Out of option memory for the notifications: copy. */
+		return writev(fd, iov, i);
+	}
+	if (n <= 0)
+		return (int)n;
+
+	left = n;
+	for (chain = buffer->first, i = 0; left > 0; chain = chain->next, ++i) {
+		size_t len = (size_t)left < iov[i].iov_len ?
+		    (size_t)left : iov[i].iov_len;
+		evbuffer_zerocopy_track(zc, zc->next_seq, chain, len);
+		left -= len;
+	}
+	++zc->next_seq;
+	return (int)n;
+}
+#endif
+
+static void
+evbuffer_zerocopy_free(struct evbuffer *buffer)
+{
+#ifdef USE_ZEROCOPY
+	struct evbuffer_zerocopy *zc = buffer->zerocopy;
+
+	if (zc == NULL)
+		return;
+	buffer->zerocopy = NULL;
+	evbuffer_zerocopy_orphan(zc);
+#endif
+}
+
+void
+evbuffer_free_globals_(void)
+{
+#ifdef USE_ZEROCOPY
+	struct evbuffer_zerocopy *zc;
+
+	/* Nothing is sending any more: let go of whatever is left. */
+	while ((zc = zerocopy_orphans) != NULL) {
+		zerocopy_orphans = zc->next;
+		if (zc->n_sends && evbuffer_zerocopy_same_socket(zc))
+			evbuffer_zerocopy_reap(zc);
+		evbuffer_zerocopy_state_free(zc);
+	}
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+	if (zerocopy_orphans_lock != NULL) {
+		EVTHREAD_FREE_LOCK(zerocopy_orphans_lock, 0);
+		zerocopy_orphans_lock = NULL;
+	}
+#endif
+#endif
+}
+
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+int
+evbuffer_global_setup_locks_(const int enable_locks)
+{
+#ifdef USE_ZEROCOPY
+	EVTHREAD_SETUP_GLOBAL_LOCK(zerocopy_orphans_lock, 0);
+#endif
+	return 0;
+}
+#endif
+
+int
+evbuffer_enable_zerocopy(struct evbuffer *buf, evutil_socket_t fd,
+    size_t threshold)
+{
+#ifdef USE_ZEROCOPY
+	struct evbuffer_zerocopy *zc;
+	struct stat st;
+	int one = 1;
+	int result = -1;
+
+	if (threshold == 0)
+		threshold = EVBUFFER_ZEROCOPY_THRESHOLD_DEFAULT;
+
+	EVBUFFER_LOCK(buf);
+	if (fstat(fd, &st) < 0)
+		goto done;
+	zc = buf->zerocopy;
+	if (zc != NULL && zc->fd == fd && zc->sock_dev == st.st_dev &&
+	    zc->sock_ino == st.st_ino) {
+		zc->threshold = threshold;
+		result = 0;
+		goto done;
+	}
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+		goto done;
+	/* The old socket's sends stay pinned until the kernel is done. */
+	if (zc != NULL) {
+		buf->zerocopy = NULL;
+		evbuffer_zerocopy_orphan(zc);
+	}
+	/* If an earlier buffer used this socket, carry on from its last
+	 * sequence number, and take over the sends it left behind. */
+	zc = evbuffer_zerocopy_adopt(fd, &st);
+	if (zc == NULL) {
+		zc = mm_calloc(1, sizeof(*zc));
+		if (zc == NULL)
+			goto done;
+		zc->fd = fd;
+		zc->sock_dev = st.st_dev;
+		zc->sock_ino = st.st_ino;
+	}
+	zc->threshold = threshold;
+	buf->zerocopy = zc;
+	result = 0;
+done:
+	EVBUFFER_UNLOCK(buf);
+	return result;
+#else
+	return -1;
+#endif
+}
+
+int
+evbuffer_reap_zerocopy_(struct evbuffer *buf)
+{
+#ifdef USE_ZEROCOPY
+	ASSERT_EVBUFFER_LOCKED(buf);
+	if (buf->zerocopy != NULL && buf->zerocopy->n_sends)
+		return evbuffer_zerocopy_reap(buf->zerocopy);
+#endif
+	return 0;
+}
+
+int
+evbuffer_reap_zerocopy(struct evbuffer *buf)
+{
+	int result;
+	EVBUFFER_LOCK(buf);
+	result = evbuffer_reap_zerocopy_(buf);
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
+size_t
+evbuffer_get_zerocopy_pending(struct evbuffer *buf)
+{
+	size_t result = 0;
+#ifdef USE_ZEROCOPY
+	EVBUFFER_LOCK(buf);
+	if (buf->zerocopy)
+		result = buf->zerocopy->pending_bytes;
+	EVBUFFER_UNLOCK(buf);
+#endif
+	return result;
+}
+
+int
+evbuffer_write_atmost(struct evbuffer *buffer, evutil_socket_t fd,
+    ev_ssize_t howmuch)
+{
+	int n = -1;
+
+	EVBUFFER_LOCK(buffer);
+
+	if (buffer->freeze_start) {
+		goto done;
+	}
+
+	if (howmuch < 0 || (size_t)howmuch > buffer->total_len)
+		howmuch = buffer->total_len;
+
+#ifdef USE_ZEROCOPY
+	if (howmuch > 0 && buffer->zerocopy != NULL &&
+	    buffer->zerocopy->fd == fd) {
+		if (buffer->zerocopy->n_sends)
+			evbuffer_zerocopy_reap(buffer->zerocopy);
+		if (ZEROCOPY_CHAIN_OK(buffer->zerocopy, fd, buffer->first)) {
+			n = evbuffer_write_zerocopy(buffer, fd, howmuch);
+			goto drain;
+		}
+	}
+#endif
 
 	if (howmuch > 0) {
 #ifdef USE_SENDFILE
@@ -2560,6 +3521,9 @@ evbuffer_write_atmost(struct evbuffer *buffer, evutil_socket_t fd,
 #endif
 	}
 
+#ifdef USE_ZEROCOPY
+drain:
+#endif
 	if (n > 0)
 		evbuffer_drain(buffer, n);
 
@@ -2722,8 +3686,6 @@ evbuffer_search_range(struct evbuffer *buffer, const char *what, size_t len, con
 {
 	struct evbuffer_ptr pos;
 	struct evbuffer_chain *chain, *last_chain = NULL;
-	const unsigned char *p;
-	char first;
 
 	EVBUFFER_LOCK(buffer);
 
@@ -2742,36 +3704,53 @@ evbuffer_search_range(struct evbuffer *buffer, const char *what, size_t len, con
 	if (!len || len > EV_SSIZE_MAX)
 		goto done;
 
-	first = what[0];
-
 	while (chain) {
-		const unsigned char *start_at =
-		    chain->buffer + chain->misalign +
-		    pos.internal_.pos_in_chain;
-		p = memchr(start_at, first,
-		    chain->off - pos.internal_.pos_in_chain);
-		if (p) {
-			pos.pos += p - start_at;
-			pos.internal_.pos_in_chain += p - start_at;
-			if (!evbuffer_ptr_memcmp(buffer, &pos, what, len)) {
-				if (end && pos.pos + (ev_ssize_t)len > end->pos)
-					goto not_found;
-				else
-					goto done;
-			}
-			++pos.pos;
-			++pos.internal_.pos_in_chain;
-			if (pos.internal_.pos_in_chain == chain->off) {
-				chain = pos.internal_.chain = chain->next;
-				pos.internal_.pos_in_chain = 0;
-			}
+		const unsigned char *data = chain->buffer + chain->misalign;
+		size_t off = pos.internal_.pos_in_chain;
+		size_t avail = chain->off - off;
+		const unsigned char *p = NULL;
+
+		if (len == 1) {
+			p = memchr(data + off, what[0], avail);
 		} else {
-			if (chain == last_chain)
+			/* First look for a match that fits in this chain... */
+			if (avail >= len)
+				p = (const unsigned char *)evutil_memmem_(
+					(const char *)data + off, avail,
+					what, len);
+			/* ...and then for one that starts in its last few
+			 * bytes and runs on into the next chains. */
+			if (!p && chain->next) {
+				const unsigned char *q = data +
+				    (avail >= len ? chain->off - len + 1 : off);
+				const unsigned char *chain_end =
+				    data + chain->off;
+				while (q < chain_end &&
+				    (q = memchr(q, what[0], chain_end - q))) {
+					struct evbuffer_ptr cand = pos;
+					cand.pos += q - (data + off);
+					cand.internal_.pos_in_chain = q - data;
+					if (!evbuffer_ptr_memcmp(buffer, &cand,
+						what, len)) {
+						p = q;
+						break;
+					}
+					++q;
+				}
+			}
+		}
+		if (p) {
+			pos.pos += p - (data + off);
+			pos.internal_.pos_in_chain = p - data;
+			if (end && pos.pos + (ev_ssize_t)len > end->pos)
 				goto not_found;
-			pos.pos += chain->off - pos.internal_.pos_in_chain;
-			chain = pos.internal_.chain = chain->next;
-			pos.internal_.pos_in_chain = 0;
+			goto done;
 		}
+		if (chain == last_chain)
+			goto not_found;
+		pos.pos += avail;
+		chain = pos.internal_.chain = chain->next;
+		pos.internal_.pos_in_chain = 0;
 	}
 
 not_found:
@@ -2917,6 +3896,150 @@ evbuffer_add_printf(struct evbuffer *buf, const char *fmt, ...)
 	return (res);
 }
 
+/* Helpers for the appenders below, which write straight into the space at
+ * the end of the buffer.  evbuffer_append_space() returns the chain to
+ * write at least len bytes into at CHAIN_SPACE_PTR(), or NULL.
+ * evbuffer_append_commit() records that len bytes were written there. */
+static inline struct evbuffer_chain *
+evbuffer_append_space(struct evbuffer *buf, size_t len)
+{
+	ASSERT_EVBUFFER_LOCKED(buf);
+	if (buf->freeze_end)
+		return NULL;
+	return evbuffer_expand_singlechain(buf, len);
+}
+
+static inline int
+evbuffer_append_commit(struct evbuffer *buf, struct evbuffer_chain *chain,
+    size_t len)
+{
+	ASSERT_EVBUFFER_LOCKED(buf);
+	chain->off += len;
+	buf->total_len += len;
+	buf->n_add_for_cb += len;
+	advance_last_with_data(buf);
+	evbuffer_invoke_callbacks_(buf);
+	return (int)len;
+}
+
+static const char evbuffer_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/* Helper: write n in decimal, with a leading '-' if neg is set, and
+ * return the number of bytes written.  Requires lock. */
+static int
+evbuffer_add_decimal(struct evbuffer *buf, ev_uint64_t n, int neg)
+{
+	struct evbuffer_chain *chain;
+	unsigned char *p;
+	ev_uint64_t t;
+	size_t len = 1;
+	int result = -1;
+
+	EVBUFFER_LOCK(buf);
+	for (t = n; t >= 10; t /= 10)
+		++len;
+	if ((chain = evbuffer_append_space(buf, len + neg)) == NULL)
+		goto done;
+	p = CHAIN_SPACE_PTR(chain);
+	if (neg)
+		*p++ = '-';
+	/* Fill in the digits from the end, two at a time. */
+	p += len;
+	while (n >= 100) {
+		unsigned i = (unsigned)(n % 100) * 2;
+		n /= 100;
+		*--p = evbuffer_digit_pairs[i + 1];
+		*--p = evbuffer_digit_pairs[i];
+	}
+	if (n >= 10) {
+		*--p = evbuffer_digit_pairs[n * 2 + 1];
+		*--p = evbuffer_digit_pairs[n * 2];
+	} else {
+		*--p = (unsigned char)('0' + n);
+	}
+	result = evbuffer_append_commit(buf, chain, len + neg);
+done:
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
+int
+evbuffer_add_int(struct evbuffer *buf, ev_int64_t n)
+{
+	if (n < 0)
+		return evbuffer_add_decimal(buf, (ev_uint64_t)0 - (ev_uint64_t)n,
+		    1);
+	return evbuffer_add_decimal(buf, (ev_uint64_t)n, 0);
+}
+
+int
+evbuffer_add_uint(struct evbuffer *buf, ev_uint64_t n)
+{
+	return evbuffer_add_decimal(buf, n, 0);
+}
+
+int
+evbuffer_add_hex(struct evbuffer *buf, ev_uint64_t n)
+{
+	static const char hex[] = "0123456789abcdef";
+	struct evbuffer_chain *chain;
+	unsigned char *p;
+	size_t len = 1;
+	int result = -1;
+
+	EVBUFFER_LOCK(buf);
+	while (len < 16 && (n >> (len * 4)))
+		++len;
+	if ((chain = evbuffer_append_space(buf, len)) == NULL)
+		goto done;
+	p = CHAIN_SPACE_PTR(chain) + len;
+	do {
+		*--p = hex[n & 0xf];
+		n >>= 4;
+	} while (n);
+	result = evbuffer_append_commit(buf, chain, len);
+done:
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
+int
+evbuffer_add_header_line(struct evbuffer *buf, const char *key,
+    size_t key_len, const char *value, size_t value_len)
+{
+	struct evbuffer_chain *chain;
+	unsigned char *p;
+	size_t len;
+	int result = -1;
+
+	if (key_len > EVBUFFER_CHAIN_MAX / 2 ||
+	    value_len > EVBUFFER_CHAIN_MAX / 2 ||
+	    key_len + value_len + 4 > INT_MAX)
+		return -1;
+	len = key_len + value_len + 4;
+
+	EVBUFFER_LOCK(buf);
+	if ((chain = evbuffer_append_space(buf, len)) == NULL)
+		goto done;
+	p = CHAIN_SPACE_PTR(chain);
+	memcpy(p, key, key_len);
+	p += key_len;
+	*p++ = ':';
+	*p++ = ' ';
+	memcpy(p, value, value_len);
+	p += value_len;
+	*p++ = '\r';
+	*p = '\n';
+	result = evbuffer_append_commit(buf, chain, len);
+done:
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
 int
 evbuffer_add_reference(struct evbuffer *outbuf,
     const void *data, size_t datlen,
@@ -2945,6 +4068,17 @@ evbuffer_add_reference(struct evbuffer *outbuf,
 		mm_free(chain);
 		goto done;
 	}
+	if (outbuf->ring) {
+		/* A ring can't refer to outside memory: copy the data, and
+		 * let go of it right away. */
+		mm_free(chain);
+		if (evbuffer_add(outbuf, data, datlen) < 0)
+			goto done;
+		if (cleanupfn)
+			(*cleanupfn)(data, datlen, extra);
+		result = 0;
+		goto done;
+	}
 	evbuffer_chain_insert(outbuf, chain);
 	outbuf->n_add_for_cb += datlen;
 
@@ -3034,6 +4168,299 @@ get_page_size(void)
 }
 #endif
 
+int
+evbuffer_enable_ring(struct evbuffer *buf, size_t size)
+{
+#ifdef USE_RING_BUFFER
+	struct evbuffer_chain *chain = NULL;
+	struct evbuffer_chain_ring *info;
+	unsigned char *base;
+	size_t page_size = (size_t)get_page_size();
+	int fd = -1;
+	int result = -1;
+
+	if (size == 0 || size > EVBUFFER_CHAIN_MAX / 4)
+		return -1;
+	size = (size + page_size - 1) / page_size * page_size;
+
+	EVBUFFER_LOCK(buf);
+	if (buf->ring || buf->total_len || buf->freeze_start ||
+	    buf->freeze_end)
+		goto done;
+
+	chain = evbuffer_chain_new(sizeof(struct evbuffer_chain_ring));
+	if (!chain)
+		goto done;
+	fd = memfd_create("evbuffer", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, (off_t)size) < 0)
+		goto done;
+	/* Reserve room for two copies, then map the memory into each. */
+	base = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS,
+	    -1, 0);
+	if (base == MAP_FAILED)
+		goto done;
+	if (mmap(base, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+		fd, 0) == MAP_FAILED ||
+	    mmap(base + size, size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED) {
+		event_warn("%s: mmap", __func__);
+		munmap(base, size * 2);
+		goto done;
+	}
+
+	info = EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_ring, chain);
+	info->base = base;
+	info->size = size;
+	chain->flags |= EVBUFFER_RING;
+	chain->buffer = base;
+	chain->buffer_len = size;
+
+	/* There is no data, but there may be empty chains. */
+	evbuffer_free_all_chains(buf->first);
+	buf->first = buf->last = buf->ring = chain;
+	buf->last_with_datap = &buf->first;
+	chain = NULL;
+	result = 0;
+done:
+	if (chain)
+		mm_free(chain);
+	if (fd >= 0)
+		close(fd);
+	EVBUFFER_UNLOCK(buf);
+	return result;
+#else
+	return -1;
+#endif
+}
+
+#define LOCK_MEM_DOMAIN(d) EVLOCK_LOCK((d)->lock, 0)
+#define UNLOCK_MEM_DOMAIN(d) EVLOCK_UNLOCK((d)->lock, 0)
+
+/* How many members evbuffer_mem_domain_apply() takes on at a time. */
+#define MEM_DOMAIN_APPLY_BATCH 64
+
+/* Helper: make every member of domain read, or not, to match domain->over.
+ *
+ * Suspending or unsuspending a bufferevent can run code that comes back to
+ * the domain, so we never do it with the domain lock held.  Instead, we
+ * pick out the members that need a change under the lock, keeping each of
+ * them locked, and change them once the domain lock is released.  The
+ * domain lock nests inside bufferevent locks, so we can only try to lock
+ * the members; any that we can't lock get another try from the domain's
+ * deferred callback.
+ *
+ * Every member stops reading, not just the ones that hold the most data:
+ * reading is the only way Libevent itself adds to the domain, and any
+ * member's read can push it further over budget.  Writing goes on, which
+ * is what brings the total back down.
+ *
+ * Must be called without the lock on domain. */
+static void
+evbuffer_mem_domain_apply(struct evbuffer_mem_domain *domain)
+{
+	struct bufferevent_private *todo[MEM_DOMAIN_APPLY_BATCH];
+	struct bufferevent_private *bevp;
+	int i, n, over, schedule;
+
+	do {
+		n = 0;
+		LOCK_MEM_DOMAIN(domain);
+		domain->pending_members = 0;
+		LIST_FOREACH(bevp, &domain->members, next_in_mem_domain) {
+			int suspended;
+			if (n == MEM_DOMAIN_APPLY_BATCH)
+				break;
+			if (!EVLOCK_TRY_LOCK_(bevp->lock)) {
+				domain->pending_members = 1;
+				continue;
+			}
+			suspended =
+			    (bevp->read_suspended & BEV_SUSPEND_BUDGET) != 0;
+			if (suspended == (int)domain->over) {
+				EVLOCK_UNLOCK(bevp->lock, 0);
+				continue;
+			}
+			/* Keep it alive once we let go of the domain. */
+			bufferevent_incref_(&bevp->bev);
+			todo[n++] = bevp;
+		}
+		UNLOCK_MEM_DOMAIN(domain);
+
+		for (i = 0; i < n; ++i) {
+			bevp = todo[i];
+			LOCK_MEM_DOMAIN(domain);
+			over = domain->over;
+			UNLOCK_MEM_DOMAIN(domain);
+			if (over)
+				bufferevent_suspend_read_(&bevp->bev,
+				    BEV_SUSPEND_BUDGET);
+			else if (bevp->read_suspended & BEV_SUSPEND_BUDGET)
+				bufferevent_unsuspend_read_(&bevp->bev,
+				    BEV_SUSPEND_BUDGET);
+			bufferevent_decref_and_unlock_(&bevp->bev);
+		}
+	} while (n == MEM_DOMAIN_APPLY_BATCH);
+
+	LOCK_MEM_DOMAIN(domain);
+	schedule = domain->pending_members || domain->cb;
+	UNLOCK_MEM_DOMAIN(domain);
+	if (schedule)
+		event_deferred_cb_schedule_(domain->base, &domain->deferred);
+}
+
+/* Helper: move the domain's total from 'from' bytes to 'to' bytes for one
+ * of its buffers, and go over or under budget if we cross a watermark.
+ * Returns true iff the caller must call evbuffer_mem_domain_apply() once
+ * it has released the domain.  Requires lock on domain. */
+static int
+evbuffer_mem_domain_account(struct evbuffer_mem_domain *domain,
+    size_t from, size_t to)
+{
+	domain->held = domain->held - from + to;
+	if (!domain->over && domain->held > domain->high) {
+		domain->over = 1;
+		return 1;
+	} else if (domain->over && domain->held <= domain->low) {
+		domain->over = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/* Called from evbuffer_invoke_callbacks_() whenever total_len has changed.
+ * Requires lock on buffer. */
+static void
+evbuffer_mem_domain_update(struct evbuffer *buffer)
+{
+	struct evbuffer_mem_domain *domain = buffer->mem_domain;
+	int apply;
+
+	ASSERT_EVBUFFER_LOCKED(buffer);
+	LOCK_MEM_DOMAIN(domain);
+	apply = evbuffer_mem_domain_account(domain, buffer->mem_counted,
+	    buffer->total_len);
+	UNLOCK_MEM_DOMAIN(domain);
+	buffer->mem_counted = buffer->total_len;
+	if (apply)
+		evbuffer_mem_domain_apply(domain);
+}
+
+static void
+evbuffer_mem_domain_deferred_cb(struct event_callback *cb, void *arg)
+{
+	struct evbuffer_mem_domain *domain = arg;
+	evbuffer_mem_domain_cb pressure_cb = NULL;
+	void *cbarg = NULL;
+	size_t held;
+	int over, pending;
+
+	LOCK_MEM_DOMAIN(domain);
+	pending = domain->pending_members;
+	UNLOCK_MEM_DOMAIN(domain);
+	if (pending)
+		evbuffer_mem_domain_apply(domain);
+
+	LOCK_MEM_DOMAIN(domain);
+	over = domain->over;
+	held = domain->held;
+	if (domain->reported_over != domain->over) {
+		domain->reported_over = domain->over;
+		pressure_cb = domain->cb;
+		cbarg = domain->cbarg;
+	}
+	UNLOCK_MEM_DOMAIN(domain);
+
+	if (pressure_cb)
+		pressure_cb(domain, over, held, cbarg);
+}
+
+struct evbuffer_mem_domain *
+evbuffer_mem_domain_new(struct event_base *base, size_t high, size_t low)
+{
+	struct evbuffer_mem_domain *domain;
+
+	if (base == NULL || low > high)
+		return NULL;
+	domain = mm_calloc(1, sizeof(struct evbuffer_mem_domain));
+	if (domain == NULL)
+		return NULL;
+	domain->base = base;
+	domain->high = high;
+	domain->low = low;
+	LIST_INIT(&domain->members);
+	event_deferred_cb_init_(&domain->deferred,
+	    event_base_get_npriorities(base) / 2,
+	    evbuffer_mem_domain_deferred_cb, domain);
+	EVTHREAD_ALLOC_LOCK(domain->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	return domain;
+}
+
+void
+evbuffer_mem_domain_free(struct evbuffer_mem_domain *domain)
+{
+	LOCK_MEM_DOMAIN(domain);
+	EVUTIL_ASSERT(domain->n_buffers == 0);
+	EVUTIL_ASSERT(LIST_EMPTY(&domain->members));
+	event_deferred_cb_cancel_(domain->base, &domain->deferred);
+	UNLOCK_MEM_DOMAIN(domain);
+	EVTHREAD_FREE_LOCK(domain->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	mm_free(domain);
+}
+
+void
+evbuffer_mem_domain_setcb(struct evbuffer_mem_domain *domain,
+    evbuffer_mem_domain_cb cb, void *arg)
+{
+	LOCK_MEM_DOMAIN(domain);
+	domain->cb = cb;
+	domain->cbarg = arg;
+	UNLOCK_MEM_DOMAIN(domain);
+}
+
+size_t
+evbuffer_mem_domain_get_held(struct evbuffer_mem_domain *domain)
+{
+	size_t held;
+
+	LOCK_MEM_DOMAIN(domain);
+	held = domain->held;
+	UNLOCK_MEM_DOMAIN(domain);
+	return held;
+}
+
+int
+evbuffer_set_mem_domain(struct evbuffer *buf,
+    struct evbuffer_mem_domain *domain)
+{
+	struct evbuffer_mem_domain *old;
+	int apply_old = 0, apply_new = 0;
+
+	EVBUFFER_LOCK(buf);
+	if ((old = buf->mem_domain) != NULL) {
+		LOCK_MEM_DOMAIN(old);
+		apply_old = evbuffer_mem_domain_account(old,
+		    buf->mem_counted, 0);
+		--old->n_buffers;
+		UNLOCK_MEM_DOMAIN(old);
+	}
+	buf->mem_domain = domain;
+	buf->mem_counted = 0;
+	if (domain) {
+		LOCK_MEM_DOMAIN(domain);
+		++domain->n_buffers;
+		apply_new = evbuffer_mem_domain_account(domain, 0,
+		    buf->total_len);
+		UNLOCK_MEM_DOMAIN(domain);
+		buf->mem_counted = buf->total_len;
+	}
+	if (apply_old)
+		evbuffer_mem_domain_apply(old);
+	if (apply_new)
+		evbuffer_mem_domain_apply(domain);
+	EVBUFFER_UNLOCK(buf);
+	return 0;
+}
+
 /* DOCDOC */
 /* Requires lock */
 static int
@@ -3213,7 +4640,7 @@ evbuffer_add_file_segment(struct evbuffer *buf,
 	}
 	EVLOCK_UNLOCK(seg->lock, 0);
 
-	if (buf->freeze_end)
+	if (buf->freeze_end || buf->ring)
 		goto err;
 
 	if (length < 0) {
@@ -73,6 +73,12 @@ extern "C" {
 /* On a base bufferevent, for reading: used when a filter has choked this
  * (underlying) bufferevent because it has stopped reading from it. */
 #define BEV_SUSPEND_FILT_READ 0x10
+/* On a socket bufferevent, for reading: used when the pipe we relay its
+ * input through is full. */
+#define BEV_SUSPEND_RELAY 0x20
+/* On a bufferevent in a memory domain, for reading: used when the domain
+ * is over budget. */
+#define BEV_SUSPEND_BUDGET 0x40
 
 typedef ev_uint16_t bufferevent_suspend_flags;
 
@@ -172,6 +178,17 @@ struct bufferevent_private {
 	/** Flag: set if a connect failed prematurely; this is a hack for
 	 * getting around the bufferevent abstraction. */
 	unsigned connection_refused : 1;
+
+	/** Set on a socket bufferevent created with BEV_OPT_STICKY_EVENTS,
+	 * if the backend supports EV_ET.  Its events then stay added for as
+	 * long as it has a socket, and it remembers readiness in read_ready
+	 * and write_ready instead of adding and deleting them. */
+	unsigned sticky_events : 1;
+	/** Sticky events only: true iff the socket may have data to read
+	 * that we haven't read yet. */
+	unsigned read_ready : 1;
+	/** Sticky events only: true iff the socket can take more data. */
+	unsigned write_ready : 1;
 	/** Set to the events pending if we have deferred callbacks and
 	 * an events callback is pending. */
 	short eventcb_pending;
@@ -230,6 +247,24 @@ struct bufferevent_private {
 	} conn_address;
 
 	struct evdns_getaddrinfo_request *dns_request;
+
+	/** If set, a relay that splices our input straight to another
+	 * bufferevent's socket.  See bufferevent_socket_relay(). */
+	struct bufferevent_relay_ *relay_out;
+	/** If set, a relay that splices another bufferevent's input straight
+	 * to our socket. */
+	struct bufferevent_relay_ *relay_in;
+
+	/** The memory domain we belong to, or NULL.  See
+	 * bufferevent_set_mem_domain(). */
+	struct evbuffer_mem_domain *mem_domain;
+	/** Link in mem_domain's list of members. */
+	LIST_ENTRY(bufferevent_private) next_in_mem_domain;
+
+	/** Used with BEV_OPT_COALESCE_WRITES: the deferred callback that
+	 * flushes the output buffer at the end of the current batch of
+	 * callbacks. */
+	struct event_callback deferred_flush;
 };
 
 /** Possible operations for a control callback. */
@@ -301,6 +336,7 @@ struct bufferevent_ops {
 extern const struct bufferevent_ops bufferevent_ops_socket;
 extern const struct bufferevent_ops bufferevent_ops_filter;
 extern const struct bufferevent_ops bufferevent_ops_pair;
+extern const struct bufferevent_ops bufferevent_ops_pair_cross;
 
 #define BEV_IS_SOCKET(bevp) ((bevp)->be_ops == &bufferevent_ops_socket)
 #define BEV_IS_FILTER(bevp) ((bevp)->be_ops == &bufferevent_ops_filter)
@@ -62,6 +62,7 @@
 
 static void bufferevent_cancel_all_(struct bufferevent *bev);
 static void bufferevent_finalize_cb_(struct event_callback *evcb, void *arg_);
+static void bufferevent_leave_mem_domain_(struct bufferevent_private *bevp);
 
 void
 bufferevent_suspend_read_(struct bufferevent *bufev, bufferevent_suspend_flags what)
@@ -148,6 +149,12 @@ bufferevent_inbuf_wm_cb(struct evbuffer *buf,
 		bufferevent_wm_unsuspend_read(bufev);
 }
 
+/* Tell the callback profiler that the time spent from here on belongs to
+ * the user's callback cb. */
+#define BEV_PROFILE_NOTE(bufev, cb)					\
+	EVENT_PROFILE_NOTE_((bufev)->ev_base, (cb),			\
+	    EVENT_PROFILE_KIND_BUFFEREVENT)
+
 static void
 bufferevent_run_deferred_callbacks_locked(struct event_callback *cb, void *arg)
 {
@@ -160,15 +167,18 @@ bufferevent_run_deferred_callbacks_locked(struct event_callback *cb, void *arg)
 		/* The "connected" happened before any reads or writes, so
 		   send it first. */
 		bufev_private->eventcb_pending &= ~BEV_EVENT_CONNECTED;
+		BEV_PROFILE_NOTE(bufev, bufev->errorcb);
 		bufev->errorcb(bufev, BEV_EVENT_CONNECTED, bufev->cbarg);
 	}
 	if (bufev_private->readcb_pending && bufev->readcb) {
 		bufev_private->readcb_pending = 0;
+		BEV_PROFILE_NOTE(bufev, bufev->readcb);
 		bufev->readcb(bufev, bufev->cbarg);
 		bufferevent_inbuf_wm_check(bufev);
 	}
 	if (bufev_private->writecb_pending && bufev->writecb) {
 		bufev_private->writecb_pending = 0;
+		BEV_PROFILE_NOTE(bufev, bufev->writecb);
 		bufev->writecb(bufev, bufev->cbarg);
 	}
 	if (bufev_private->eventcb_pending && bufev->errorcb) {
@@ -177,6 +187,7 @@ bufferevent_run_deferred_callbacks_locked(struct event_callback *cb, void *arg)
 		bufev_private->eventcb_pending = 0;
 		bufev_private->errno_pending = 0;
 		EVUTIL_SET_SOCKET_ERROR(err);
+		BEV_PROFILE_NOTE(bufev, bufev->errorcb);
 		bufev->errorcb(bufev, what, bufev->cbarg);
 	}
 	bufferevent_decref_and_unlock_(bufev);
@@ -199,12 +210,14 @@ bufferevent_run_deferred_callbacks_unlocked(struct event_callback *cb, void *arg
 		bufferevent_event_cb errorcb = bufev->errorcb;
 		void *cbarg = bufev->cbarg;
 		bufev_private->eventcb_pending &= ~BEV_EVENT_CONNECTED;
+		BEV_PROFILE_NOTE(bufev, errorcb);
 		UNLOCKED(errorcb(bufev, BEV_EVENT_CONNECTED, cbarg));
 	}
 	if (bufev_private->readcb_pending && bufev->readcb) {
 		bufferevent_data_cb readcb = bufev->readcb;
 		void *cbarg = bufev->cbarg;
 		bufev_private->readcb_pending = 0;
+		BEV_PROFILE_NOTE(bufev, readcb);
 		UNLOCKED(readcb(bufev, cbarg));
 		bufferevent_inbuf_wm_check(bufev);
 	}
@@ -212,6 +225,7 @@ bufferevent_run_deferred_callbacks_unlocked(struct event_callback *cb, void *arg
 		bufferevent_data_cb writecb = bufev->writecb;
 		void *cbarg = bufev->cbarg;
 		bufev_private->writecb_pending = 0;
+		BEV_PROFILE_NOTE(bufev, writecb);
 		UNLOCKED(writecb(bufev, cbarg));
 	}
 	if (bufev_private->eventcb_pending && bufev->errorcb) {
@@ -222,6 +236,7 @@ bufferevent_run_deferred_callbacks_unlocked(struct event_callback *cb, void *arg
 		bufev_private->eventcb_pending = 0;
 		bufev_private->errno_pending = 0;
 		EVUTIL_SET_SOCKET_ERROR(err);
+		BEV_PROFILE_NOTE(bufev, errorcb);
 		UNLOCKED(errorcb(bufev,what,cbarg));
 	}
 	bufferevent_decref_and_unlock_(bufev);
@@ -248,6 +263,7 @@ bufferevent_run_readcb_(struct bufferevent *bufev, int options)
 		p->readcb_pending = 1;
 		SCHEDULE_DEFERRED(p);
 	} else {
+		BEV_PROFILE_NOTE(bufev, bufev->readcb);
 		bufev->readcb(bufev, bufev->cbarg);
 		bufferevent_inbuf_wm_check(bufev);
 	}
@@ -264,6 +280,7 @@ bufferevent_run_writecb_(struct bufferevent *bufev, int options)
 		p->writecb_pending = 1;
 		SCHEDULE_DEFERRED(p);
 	} else {
+		BEV_PROFILE_NOTE(bufev, bufev->writecb);
 		bufev->writecb(bufev, bufev->cbarg);
 	}
 }
@@ -293,6 +310,7 @@ bufferevent_run_eventcb_(struct bufferevent *bufev, short what, int options)
 		p->errno_pending = EVUTIL_SOCKET_ERROR();
 		SCHEDULE_DEFERRED(p);
 	} else {
+		BEV_PROFILE_NOTE(bufev, bufev->errorcb);
 		bufev->errorcb(bufev, what, bufev->cbarg);
 	}
 }
@@ -720,6 +738,14 @@ bufferevent_decref_and_unlock_(struct bufferevent *bufev)
 	if (bufev->be_ops->unlink)
 		bufev->be_ops->unlink(bufev);
 
+	/* Leave our memory domain now, so that it can be freed as soon as
+	 * we are. */
+	if (bufev_private->mem_domain) {
+		bufferevent_leave_mem_domain_(bufev_private);
+		evbuffer_set_mem_domain(bufev->input, NULL);
+		evbuffer_set_mem_domain(bufev->output, NULL);
+	}
+
 	/* Okay, we're out of references. Let's finalize this once all the
 	 * callbacks are done running. */
 	cbs[0] = &bufev->ev_read.ev_evcallback;
@@ -779,7 +805,8 @@ bufferevent_finalize_cb_(struct event_callback *evcb, void *arg_)
 		    EVTHREAD_LOCKTYPE_RECURSIVE);
 
 	/* Free the actual allocated memory. */
-	mm_free(((char*)bufev) - bufev->be_ops->mem_offset);
+	event_base_obj_free_(bufev->ev_base,
+	    ((char*)bufev) - bufev->be_ops->mem_offset);
 
 	/* Release the reference to underlying now that we no longer need the
 	 * reference to it.  We wait this long mainly in case our lock is
@@ -938,6 +965,51 @@ bufferevent_get_underlying(struct bufferevent *bev)
 	return (res<0) ? NULL : d.ptr;
 }
 
+/* Helper: take bev out of its memory domain, if it has one.  Requires lock
+ * on bev. */
+static void
+bufferevent_leave_mem_domain_(struct bufferevent_private *bevp)
+{
+	struct evbuffer_mem_domain *domain = bevp->mem_domain;
+
+	if (!domain)
+		return;
+	EVLOCK_LOCK(domain->lock, 0);
+	LIST_REMOVE(bevp, next_in_mem_domain);
+	EVLOCK_UNLOCK(domain->lock, 0);
+	bevp->mem_domain = NULL;
+}
+
+int
+bufferevent_set_mem_domain(struct bufferevent *bev,
+    struct evbuffer_mem_domain *domain)
+{
+	struct bufferevent_private *bevp = BEV_UPCAST(bev);
+	int over = 0;
+
+	BEV_LOCK(bev);
+	if (bevp->mem_domain == domain) {
+		BEV_UNLOCK(bev);
+		return 0;
+	}
+	bufferevent_leave_mem_domain_(bevp);
+	evbuffer_set_mem_domain(bev->input, domain);
+	evbuffer_set_mem_domain(bev->output, domain);
+	if (domain) {
+		EVLOCK_LOCK(domain->lock, 0);
+		LIST_INSERT_HEAD(&domain->members, bevp, next_in_mem_domain);
+		over = domain->over;
+		EVLOCK_UNLOCK(domain->lock, 0);
+		bevp->mem_domain = domain;
+	}
+	if (over)
+		bufferevent_suspend_read_(bev, BEV_SUSPEND_BUDGET);
+	else if (bevp->read_suspended & BEV_SUSPEND_BUDGET)
+		bufferevent_unsuspend_read_(bev, BEV_SUSPEND_BUDGET);
+	BEV_UNLOCK(bev);
+	return 0;
+}
+
 static void
 bufferevent_generic_read_timeout_cb(evutil_socket_t fd, short event, void *ctx)
 {
@@ -0,0 +1,595 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos, Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+#include <limits.h>
+#include <string.h>
+
+#include <zlib.h>
+#ifdef EVENT__HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/bufferevent_compress.h"
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "defer-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+
+/* How many input chains we hand to the compressor per round, and the
+ * most and least output space we reserve for it each time.  We ask for
+ * about as much as we expect it to write: evbuffer_reserve_space() hands
+ * back all the free space in the chains it uses anyway, and asking for too
+ * much would add a mostly empty chain to dst every round. */
+#define COMPRESS_N_IOV 8
+#define COMPRESS_OUT_MAX 16384
+#define COMPRESS_OUT_MIN 1024
+
+/* What we ask the compressor to do at the end of its input. */
+#define CODEC_NO_FLUSH 0
+#define CODEC_SYNC_FLUSH 1
+#define CODEC_FINISH 2
+
+/* A compressor or decompressor, and what it was set up to do. */
+struct compress_codec {
+	enum bufferevent_compress_format format;
+	/* Compression level, or -1 for a decompressor. */
+	int level;
+	union {
+		/* zlib keeps a pointer to the z_stream, so the codec must not
+		 * move once it is initialized. */
+		z_stream z;
+#ifdef EVENT__HAVE_ZSTD
+		ZSTD_CCtx *zc;
+		ZSTD_DCtx *zd;
+#endif
+	} u;
+	struct compress_codec *next;
+};
+
+/* Codec pool support.
+ *
+ * Setting up a codec is expensive (deflateInit() allocates about 256 KB),
+ * and resetting one is cheap, so when a filter is freed we reset its codec
+ * and keep it for the next filter that asks for the same format and level.
+ * A pool of COMPRESS_POOL_MAX idle zlib compressors holds a couple of
+ * megabytes, so it must never be left behind: a thread only pools codecs
+ * once event_thread_cache_usable_() has agreed to have codec_pool_empty()
+ * called when the thread exits.  The pool lives in thread-local storage and
+ * is only ever touched by its own thread, so taking a codec needs no lock.
+ */
+#define COMPRESS_POOL_MAX 8
+
+#if defined(EVENT__DISABLE_THREAD_SUPPORT)
+#define COMPRESS_POOL_STORAGE static
+#elif defined(_MSC_VER)
+#define COMPRESS_POOL_STORAGE static __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__) || defined(__SUNPRO_C)
+#define COMPRESS_POOL_STORAGE static __thread
+#endif
+
+#ifdef COMPRESS_POOL_STORAGE
+struct compress_pool {
+	/* Must be first: see codec_pool_empty(). */
+	struct event_thread_cache_ cache;
+	/* Idle codecs, linked through their next pointers. */
+	struct compress_codec *codecs;
+	int len;
+};
+COMPRESS_POOL_STORAGE struct compress_pool codec_pool;
+#endif
+
+static int
+codec_window_bits(enum bufferevent_compress_format format)
+{
+	return format == BEV_COMPRESS_GZIP ? 15 + 16 : 15;
+}
+
+static void
+codec_free(struct compress_codec *c)
+{
+	switch (c->format) {
+	case BEV_COMPRESS_ZLIB:
+	case BEV_COMPRESS_GZIP:
+		if (c->level >= 0)
+			deflateEnd(&c->u.z);
+		else
+			inflateEnd(&c->u.z);
+		break;
+#ifdef EVENT__HAVE_ZSTD
+	case BEV_COMPRESS_ZSTD:
+		if (c->level >= 0)
+			ZSTD_freeCCtx(c->u.zc);
+		else
+			ZSTD_freeDCtx(c->u.zd);
+		break;
+#endif
+	default:
+		break;
+	}
+	mm_free(c);
+}
+
+#ifdef COMPRESS_POOL_STORAGE
+static void
+codec_pool_empty(struct event_thread_cache_ *cache)
+{
+	struct compress_pool *pool = (struct compress_pool *)cache;
+	struct compress_codec *c;
+
+	while ((c = pool->codecs) != NULL) {
+		pool->codecs = c->next;
+		codec_free(c);
+	}
+	pool->len = 0;
+}
+#endif
+
+/* Return a codec for format: a compressor at level if level >= 0, and a
+ * decompressor otherwise. */
+static struct compress_codec *
+codec_get(enum bufferevent_compress_format format, int level)
+{
+	struct compress_codec *c;
+	int r = -1;
+
+#ifdef COMPRESS_POOL_STORAGE
+	struct compress_codec **cp;
+	for (cp = &codec_pool.codecs; (c = *cp); cp = &c->next) {
+		if (c->format == format && c->level == level) {
+			*cp = c->next;
+			--codec_pool.len;
+			return c;
+		}
+	}
+#endif
+
+	if (!(c = mm_calloc(1, sizeof(*c))))
+		return NULL;
+	c->format = format;
+	c->level = level;
+	switch (format) {
+	case BEV_COMPRESS_ZLIB:
+	case BEV_COMPRESS_GZIP:
+		if (level >= 0)
+			r = deflateInit2(&c->u.z, level, Z_DEFLATED,
+			    codec_window_bits(format), 8,
+			    Z_DEFAULT_STRATEGY) == Z_OK ? 0 : -1;
+		else
+			r = inflateInit2(&c->u.z,
+			    codec_window_bits(format)) == Z_OK ? 0 : -1;
+		break;
+#ifdef EVENT__HAVE_ZSTD
+	case BEV_COMPRESS_ZSTD:
+		if (level >= 0) {
+			if ((c->u.zc = ZSTD_createCCtx()) != NULL)
+				r = ZSTD_isError(ZSTD_CCtx_setParameter(c->u.zc,
+					ZSTD_c_compressionLevel, level)) ? -1 : 0;
+		} else {
+			if ((c->u.zd = ZSTD_createDCtx()) != NULL)
+				r = 0;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	if (r < 0) {
+		event_warnx("%s: cannot set up a codec for format %d",
+		    __func__, (int)format);
+		/* Only free what was actually set up. */
+		if (format == BEV_COMPRESS_ZLIB || format == BEV_COMPRESS_GZIP)
+			mm_free(c);
+		else
+			codec_free(c);
+		return NULL;
+	}
+	return c;
+}
+
+/* Reset c and give it back to the pool, or free it if the pool is full. */
+static void
+codec_put(struct compress_codec *c)
+{
+#ifdef COMPRESS_POOL_STORAGE
+	int r = -1;
+
+	if (codec_pool.len < COMPRESS_POOL_MAX &&
+	    event_thread_cache_usable_(&codec_pool.cache, codec_pool_empty)) {
+		switch (c->format) {
+		case BEV_COMPRESS_ZLIB:
+		case BEV_COMPRESS_GZIP:
+			if (c->level >= 0)
+				r = deflateReset(&c->u.z) == Z_OK ? 0 : -1;
+			else
+				r = inflateReset(&c->u.z) == Z_OK ? 0 : -1;
+			break;
+#ifdef EVENT__HAVE_ZSTD
+		case BEV_COMPRESS_ZSTD:
+			if (c->level >= 0)
+				r = ZSTD_isError(ZSTD_CCtx_reset(c->u.zc,
+					ZSTD_reset_session_only)) ? -1 : 0;
+			else
+				r = ZSTD_isError(ZSTD_DCtx_reset(c->u.zd,
+					ZSTD_reset_session_only)) ? -1 : 0;
+			break;
+#endif
+		default:
+			break;
+		}
+	}
+	if (r == 0) {
+		c->next = codec_pool.codecs;
+		codec_pool.codecs = c;
+		++codec_pool.len;
+		return;
+	}
+#endif
+	codec_free(c);
+}
+
+/* Run c over *in_len bytes at *in into *out_len bytes of space at *out,
+ * advancing all four by what it used.  Set *done if c has nothing more to
+ * do with this input: it has taken all of it, and if flush asked for it,
+ * everything it holds has been written.  Return -1 on error. */
+static int
+codec_run(struct compress_codec *c, const unsigned char **in,
+    size_t *in_len, unsigned char **out, size_t *out_len, int flush,
+    int *done)
+{
+	*done = 0;
+	switch (c->format) {
+	case BEV_COMPRESS_ZLIB:
+	case BEV_COMPRESS_GZIP: {
+		z_stream *z = &c->u.z;
+		uInt avail_in = *in_len > UINT_MAX ? UINT_MAX : (uInt)*in_len;
+		uInt avail_out = *out_len > UINT_MAX ?
+		    UINT_MAX : (uInt)*out_len;
+		int r;
+
+		z->next_in = (Bytef *)*in;
+		z->avail_in = avail_in;
+		z->next_out = *out;
+		z->avail_out = avail_out;
+		if (c->level >= 0) {
+			r = deflate(z, flush == CODEC_FINISH ? Z_FINISH :
+			    flush == CODEC_SYNC_FLUSH ? Z_SYNC_FLUSH :
+			    Z_NO_FLUSH);
+			if (r == Z_STREAM_ERROR)
+				return -1;
+			if (r == Z_STREAM_END) {
+				/* Anything written after this starts a new
+				 * stream. */
+				deflateReset(z);
+				*done = 1;
+			} else if (z->avail_in == 0 && avail_in == *in_len) {
+				*done = flush == CODEC_NO_FLUSH ||
+				    (flush == CODEC_SYNC_FLUSH &&
+					z->avail_out != 0);
+			}
+		} else {
+			r = inflate(z, Z_NO_FLUSH);
+			if (r == Z_STREAM_END) {
+				/* Accept several streams back to back, as
+				 * gzip does. */
+				inflateReset(z);
+			} else if (r != Z_OK && r != Z_BUF_ERROR) {
+				return -1;
+			}
+			*done = z->avail_in == 0 && avail_in == *in_len &&
+			    z->avail_out != 0;
+		}
+		*in += avail_in - z->avail_in;
+		*in_len -= avail_in - z->avail_in;
+		*out += avail_out - z->avail_out;
+		*out_len -= avail_out - z->avail_out;
+		return 0;
+	}
+#ifdef EVENT__HAVE_ZSTD
+	case BEV_COMPRESS_ZSTD: {
+		ZSTD_inBuffer zin;
+		ZSTD_outBuffer zout;
+		size_t r;
+
+		zin.src = *in;
+		zin.size = *in_len;
+		zin.pos = 0;
+		zout.dst = *out;
+		zout.size = *out_len;
+		zout.pos = 0;
+		if (c->level >= 0) {
+			r = ZSTD_compressStream2(c->u.zc, &zout, &zin,
+			    flush == CODEC_FINISH ? ZSTD_e_end :
+			    flush == CODEC_SYNC_FLUSH ? ZSTD_e_flush :
+			    ZSTD_e_continue);
+			if (ZSTD_isError(r))
+				return -1;
+			*done = zin.pos == zin.size &&
+			    (flush == CODEC_NO_FLUSH || r == 0);
+		} else {
+			r = ZSTD_decompressStream(c->u.zd, &zout, &zin);
+			if (ZSTD_isError(r))
+				return -1;
+			*done = zin.pos == zin.size && zout.pos < zout.size;
+		}
+		*in += zin.pos;
+		*in_len -= zin.pos;
+		*out += zout.pos;
+		*out_len -= zout.pos;
+		return 0;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+/* Run c over everything in src, straight from its chains into space
+ * reserved in dst, adding no more than about lim bytes to dst if lim is
+ * not negative.  If flush is set, ask c to flush once it has seen all of
+ * src.  Set *flushed if it did. */
+static enum bufferevent_filter_result
+codec_process(struct compress_codec *c, struct evbuffer *src,
+    struct evbuffer *dst, ev_ssize_t lim, int flush, int *flushed)
+{
+	struct evbuffer_iovec v_in[COMPRESS_N_IOV], v_out[2];
+	size_t added = 0, consumed = 0, total_in = 0;
+	int progress = 0;
+
+	*flushed = 0;
+	if (!evbuffer_get_length(src) && flush == CODEC_NO_FLUSH)
+		return BEV_NEED_MORE;
+
+	for (;;) {
+		const unsigned char *ip = NULL;
+		unsigned char *op;
+		size_t il = 0, ol, peeked = 0, produced, want;
+		int n_in, n_out, i_in = 0, i_out = 0, all_in, done = 0, i;
+
+		if (lim >= 0 && added >= (size_t)lim)
+			break;
+
+		n_in = evbuffer_peek(src, -1, NULL, v_in, COMPRESS_N_IOV);
+		if (n_in > COMPRESS_N_IOV)
+			n_in = COMPRESS_N_IOV;
+		for (i = 0; i < n_in; ++i)
+			peeked += v_in[i].iov_len;
+		all_in = peeked == evbuffer_get_length(src);
+		if (n_in) {
+			ip = v_in[0].iov_base;
+			il = v_in[0].iov_len;
+		}
+
+		/* Compressed data rarely grows by more than a few bytes;
+		 * guess that decompressed data grows by 4x. */
+		want = c->level >= 0 ? peeked + 64 : peeked * 4;
+		if (want > COMPRESS_OUT_MAX)
+			want = COMPRESS_OUT_MAX;
+		else if (want < COMPRESS_OUT_MIN)
+			want = COMPRESS_OUT_MIN;
+		n_out = evbuffer_reserve_space(dst, want, v_out, 2);
+		if (n_out <= 0)
+			return BEV_ERROR;
+		op = v_out[0].iov_base;
+		ol = v_out[0].iov_len;
+
+		consumed = 0;
+		for (;;) {
+			size_t il_before = il;
+			int f = (all_in && i_in >= n_in - 1) ?
+			    flush : CODEC_NO_FLUSH;
+
+			if (codec_run(c, &ip, &il, &op, &ol, f, &done) < 0)
+				return BEV_ERROR;
+			consumed += il_before - il;
+			if (il == 0 && i_in + 1 < n_in) {
+				++i_in;
+				ip = v_in[i_in].iov_base;
+				il = v_in[i_in].iov_len;
+				continue;
+			}
+			if (ol == 0 && !done && i_out + 1 < n_out) {
+				++i_out;
+				op = v_out[i_out].iov_base;
+				ol = v_out[i_out].iov_len;
+				continue;
+			}
+			break;
+		}
+
+		v_out[i_out].iov_len -= ol;
+		produced = 0;
+		for (i = 0; i <= i_out; ++i)
+			produced += v_out[i].iov_len;
+		if (evbuffer_commit_space(dst, v_out, i_out + 1) < 0)
+			return BEV_ERROR;
+		evbuffer_drain(src, consumed);
+		added += produced;
+		total_in += consumed;
+		if (produced || consumed)
+			progress = 1;
+
+		if (done && all_in && i_in >= n_in - 1) {
+			*flushed = flush != CODEC_NO_FLUSH;
+			break;
+		}
+		if (!produced && !consumed)
+			break;
+	}
+
+	return progress ? BEV_OK : BEV_NEED_MORE;
+}
+
+struct bufferevent_compress {
+	struct bufferevent *bev;
+	struct bufferevent *underlying;
+	struct compress_codec *enc;
+	struct compress_codec *dec;
+	enum bufferevent_compress_flush flush;
+	size_t flush_bytes;
+	/* Bytes compressed since we last flushed the compressor. */
+	size_t unflushed;
+	/* For BEV_COMPRESS_FLUSH_LOOP: flushes the compressor once the
+	 * callbacks that are running now are done. */
+	struct event_callback deferred_flush;
+};
+
+static enum bufferevent_filter_result
+compress_input_filter(struct evbuffer *src, struct evbuffer *dst,
+    ev_ssize_t lim, enum bufferevent_flush_mode mode, void *ctx)
+{
+	struct bufferevent_compress *bc = ctx;
+	int flushed;
+
+	return codec_process(bc->dec, src, dst, lim, CODEC_NO_FLUSH,
+	    &flushed);
+}
+
+static enum bufferevent_filter_result
+compress_output_filter(struct evbuffer *src, struct evbuffer *dst,
+    ev_ssize_t lim, enum bufferevent_flush_mode mode, void *ctx)
+{
+	struct bufferevent_compress *bc = ctx;
+	enum bufferevent_filter_result res;
+	size_t len = evbuffer_get_length(src);
+	int flush = CODEC_NO_FLUSH, flushed;
+
+	if (mode == BEV_FINISHED) {
+		flush = CODEC_FINISH;
+	} else if (mode == BEV_FLUSH) {
+		if (bc->unflushed || len)
+			flush = CODEC_SYNC_FLUSH;
+	} else if (bc->flush == BEV_COMPRESS_FLUSH_WRITE) {
+		flush = CODEC_SYNC_FLUSH;
+	} else if (bc->flush == BEV_COMPRESS_FLUSH_BYTES) {
+		if (bc->unflushed + len >= bc->flush_bytes)
+			flush = CODEC_SYNC_FLUSH;
+	}
+
+	res = codec_process(bc->enc, src, dst, lim, flush, &flushed);
+	bc->unflushed += len - evbuffer_get_length(src);
+	if (flushed)
+		bc->unflushed = 0;
+
+	if (bc->flush == BEV_COMPRESS_FLUSH_LOOP && bc->unflushed &&
+	    bc->bev) {
+		struct event_base *base = bufferevent_get_base(bc->bev);
+		int priority = bufferevent_get_priority(bc->underlying);
+		/* Flush at whatever priority the bufferevent we write to
+		 * has now. */
+		if (bc->deferred_flush.evcb_pri != priority)
+			event_deferred_cb_set_priority_(base,
+			    &bc->deferred_flush, priority);
+		/* Hold a reference until the flush has run. */
+		if (event_deferred_cb_schedule_(base, &bc->deferred_flush))
+			bufferevent_incref(bc->bev);
+	}
+	return res;
+}
+
+static void
+compress_deferred_flush_cb(struct event_callback *cb, void *arg)
+{
+	struct bufferevent_compress *bc = arg;
+	struct bufferevent *bev = bc->bev;
+
+	bufferevent_flush(bev, EV_WRITE, BEV_FLUSH);
+	bufferevent_decref(bev);
+}
+
+static void
+compress_free(void *ctx)
+{
+	struct bufferevent_compress *bc = ctx;
+
+	if (bc->enc)
+		codec_put(bc->enc);
+	if (bc->dec)
+		codec_put(bc->dec);
+	mm_free(bc);
+}
+
+struct bufferevent *
+bufferevent_compress_new(struct bufferevent *underlying,
+    enum bufferevent_compress_format format, int level,
+    enum bufferevent_compress_flush flush, size_t flush_bytes, int options)
+{
+	struct bufferevent_compress *bc;
+	struct bufferevent *bev;
+
+	switch (format) {
+	case BEV_COMPRESS_ZLIB:
+	case BEV_COMPRESS_GZIP:
+		/* What Z_DEFAULT_COMPRESSION means; we keep levels positive
+		 * so that they can tell compressors from decompressors. */
+		if (level < 0)
+			level = 6;
+		if (level > Z_BEST_COMPRESSION)
+			return NULL;
+		break;
+#ifdef EVENT__HAVE_ZSTD
+	case BEV_COMPRESS_ZSTD:
+		if (level < 0)
+			level = ZSTD_CLEVEL_DEFAULT;
+		if (level > ZSTD_maxCLevel())
+			return NULL;
+		break;
+#endif
+	default:
+		return NULL;
+	}
+	if (flush == BEV_COMPRESS_FLUSH_BYTES && flush_bytes == 0)
+		return NULL;
+
+	if (!(bc = mm_calloc(1, sizeof(*bc))))
+		return NULL;
+	bc->underlying = underlying;
+	bc->flush = flush;
+	bc->flush_bytes = flush_bytes;
+	event_deferred_cb_init_(&bc->deferred_flush,
+	    bufferevent_get_priority(underlying),
+	    compress_deferred_flush_cb, bc);
+	if (!(bc->enc = codec_get(format, level)) ||
+	    !(bc->dec = codec_get(format, -1))) {
+		compress_free(bc);
+		return NULL;
+	}
+
+	bev = bufferevent_filter_new(underlying, compress_input_filter,
+	    compress_output_filter, options, compress_free, bc);
+	if (!bev) {
+		compress_free(bc);
+		return NULL;
+	}
+	bc->bev = bev;
+	return bev;
+}
@@ -185,13 +185,14 @@ bufferevent_filter_new(struct bufferevent *underlying,
 	if (!output_filter)
 		output_filter = be_null_filter;
 
-	bufev_f = mm_calloc(1, sizeof(struct bufferevent_filtered));
+	bufev_f = event_base_obj_calloc_(underlying->ev_base,
+	    sizeof(struct bufferevent_filtered));
 	if (!bufev_f)
 		return NULL;
 
 	if (bufferevent_init_common_(&bufev_f->bev, underlying->ev_base,
 				    &bufferevent_ops_filter, tmp_options) < 0) {
-		mm_free(bufev_f);
+		event_base_obj_free_(underlying->ev_base, bufev_f);
 		return NULL;
 	}
 	if (options & BEV_OPT_THREADSAFE) {
@@ -67,6 +67,14 @@
 #include <openssl/err.h>
 #include "openssl-compat.h"
 
+/* OpenSSL 3 can hand record encryption and decryption to the kernel (kTLS)
+ * once the handshake is done, if SSL_OP_ENABLE_KTLS is set and the kernel
+ * supports the negotiated cipher. */
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_CTRL_GET_KTLS_SEND) && \
+	!defined(OPENSSL_NO_KTLS)
+#define USE_KTLS
+#endif
+
 /*
  * Define an OpenSSL bio that targets a bufferevent.
  */
@@ -308,6 +316,11 @@ struct bufferevent_openssl {
 	 * and we need to try it again with this many bytes. */
 	ev_ssize_t last_write;
 
+	/* How many bytes to ask SSL_read for when no high-water mark says
+	 * otherwise.  Grows while reads come back full and shrinks after
+	 * short ones. */
+	int read_hint;
+
 #define NUM_ERRORS 3
 	ev_uint32_t errors[NUM_ERRORS];
 
@@ -321,6 +334,9 @@ struct bufferevent_openssl {
 	unsigned allow_dirty_shutdown : 1;
 	/* XXX */
 	unsigned n_errors : 2;
+	/* The kernel encrypts what we write to the socket, so we write the
+	 * output buffer to it directly instead of through SSL_write. */
+	unsigned ktls_send : 1;
 
 	/* Are we currently connecting, accepting, or doing IO? */
 	unsigned state : 2;
@@ -578,6 +594,12 @@ decrement_buckets(struct bufferevent_openssl *bev_ssl)
 #define OP_BLOCKED 2
 #define OP_ERR 4
 
+/* The most plaintext a single TLS record can carry. */
+#define SSL_RECORD_MAX 16384
+
+#define READ_DEFAULT 4096
+#define READ_MAX SSL_RECORD_MAX
+
 /* Return a bitmask of OP_MADE_PROGRESS (if we read anything); OP_BLOCKED (if
    we're now blocked); and OP_ERR (if an error occurred). */
 static int
@@ -585,7 +607,7 @@ do_read(struct bufferevent_openssl *bev_ssl, int n_to_read) {
 	/* Requires lock */
 	struct bufferevent *bev = &bev_ssl->bev.bev;
 	struct evbuffer *input = bev->input;
-	int r, n, i, n_used = 0, atmost;
+	int r, n, i, n_used = 0, n_read = 0, atmost;
 	struct evbuffer_iovec space[2];
 	int result = 0;
 
@@ -611,6 +633,7 @@ do_read(struct bufferevent_openssl *bev_ssl, int n_to_read) {
 				if (clear_rbow(bev_ssl) < 0)
 					return OP_ERR | result;
 			++n_used;
+			n_read += r;
 			space[i].iov_len = r;
 			decrement_buckets(bev_ssl);
 		} else {
@@ -645,44 +668,123 @@ do_read(struct bufferevent_openssl *bev_ssl, int n_to_read) {
 			BEV_RESET_GENERIC_READ_TIMEOUT(bev);
 	}
 
+	/* A peer sending full records fills whatever we ask for; one sending
+	 * small messages doesn't come close.  Size the next read for it. */
+	if (n_read >= bev_ssl->read_hint) {
+		if (bev_ssl->read_hint < READ_MAX)
+			bev_ssl->read_hint *= 2;
+	} else if (n_read && n_read < bev_ssl->read_hint / 4) {
+		if (bev_ssl->read_hint > READ_DEFAULT)
+			bev_ssl->read_hint /= 2;
+	}
+
 	return result;
 }
 
+#ifdef USE_KTLS
+/* Note whether OpenSSL has handed record encryption to the kernel.  If it
+ * has, file segments added to the output from now on can go out with
+ * sendfile(). */
+static void
+check_ktls(struct bufferevent_openssl *bev_ssl)
+{
+	struct evbuffer *output = bev_ssl->bev.bev.output;
+	BIO *wbio = SSL_get_wbio(bev_ssl->ssl);
+
+	bev_ssl->ktls_send = !bev_ssl->underlying && wbio &&
+	    BIO_get_ktls_send(wbio);
+	if (bev_ssl->ktls_send)
+		evbuffer_set_flags(output, EVBUFFER_FLAG_DRAINS_TO_FD);
+	else
+		evbuffer_clear_flags(output, EVBUFFER_FLAG_DRAINS_TO_FD);
+}
+
+/* Like do_write, but for when the kernel does the encryption: hand the
+ * output buffer to writev() or sendfile() as a plain socket would. */
+static int
+do_write_ktls(struct bufferevent_openssl *bev_ssl)
+{
+	struct bufferevent *bev = &bev_ssl->bev.bev;
+	evutil_socket_t fd = event_get_fd(&bev->ev_write);
+	int n, atmost;
+
+	if (bev_ssl->bev.write_suspended)
+		return 0;
+
+	atmost = bufferevent_get_write_max_(&bev_ssl->bev);
+	n = evbuffer_write_atmost(bev->output, fd, atmost);
+	if (n < 0) {
+		int err = evutil_socket_geterror(fd);
+		if (EVUTIL_ERR_RW_RETRIABLE(err))
+			return OP_BLOCKED;
+		stop_reading(bev_ssl);
+		stop_writing(bev_ssl);
+		bufferevent_run_eventcb_(bev,
+		    BEV_EVENT_WRITING|BEV_EVENT_ERROR, 0);
+		return OP_ERR;
+	}
+	if (n == 0)
+		return OP_BLOCKED;
+
+	bufferevent_decrement_write_buckets_(&bev_ssl->bev, n);
+	bufferevent_trigger_nolock_(bev, EV_WRITE, BEV_OPT_DEFER_CALLBACKS);
+	return OP_MADE_PROGRESS;
+}
+#endif
+
 /* Return a bitmask of OP_MADE_PROGRESS (if we wrote anything); OP_BLOCKED (if
    we're now blocked); and OP_ERR (if an error occurred). */
 static int
 do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 {
-	int i, r, n, n_written = 0;
+	int r, n_written = 0;
 	struct bufferevent *bev = &bev_ssl->bev.bev;
 	struct evbuffer *output = bev->output;
-	struct evbuffer_iovec space[8];
+	struct evbuffer_iovec v;
 	int result = 0;
 
+#ifdef USE_KTLS
+	/* An SSL_write that blocked has to be retried as it was. */
+	if (bev_ssl->ktls_send && bev_ssl->last_write <= 0)
+		return do_write_ktls(bev_ssl);
+#endif
+
 	if (bev_ssl->last_write > 0)
 		atmost = bev_ssl->last_write;
 	else
 		atmost = bufferevent_get_write_max_(&bev_ssl->bev);
 
-	n = evbuffer_peek(output, atmost, NULL, space, 8);
-	if (n < 0)
-		return OP_ERR | result;
+	while (n_written < atmost) {
+		size_t len = evbuffer_get_length(output);
 
-	if (n > 8)
-		n = 8;
-	for (i=0; i < n; ++i) {
 		if (bev_ssl->bev.write_suspended)
 			break;
+		if (len > (size_t)(atmost - n_written))
+			len = atmost - n_written;
+		if (!len)
+			break;
 
-		/* SSL_write will (reasonably) return 0 if we tell it to
-		   send 0 data.  Skip this case so we don't interpret the
-		   result as an error */
-		if (space[i].iov_len == 0)
-			continue;
+		/* Every SSL_write ends in at least one record, and on a
+		   socket in at least one send(); don't spend one of each
+		   on every small chain.  If the front chain is short of a
+		   full record, gather what follows it into one. */
+		if (evbuffer_peek(output, len, NULL, &v, 1) < 1)
+			break;
+		if (v.iov_len < len && v.iov_len < SSL_RECORD_MAX) {
+			/* A retry has to ask for the same length again. */
+			if (len > SSL_RECORD_MAX && bev_ssl->last_write <= 0)
+				len = SSL_RECORD_MAX;
+			v.iov_base = evbuffer_pullup(output, len);
+			if (!v.iov_base)
+				return OP_ERR | result;
+		} else if (v.iov_len < len) {
+			len = v.iov_len;
+		}
 
+		/* SSL_write will (reasonably) return 0 if we tell it to
+		   send 0 data; the loop above never does. */
 		ERR_clear_error();
-		r = SSL_write(bev_ssl->ssl, space[i].iov_base,
-		    space[i].iov_len);
+		r = SSL_write(bev_ssl->ssl, v.iov_base, (int)len);
 		if (r > 0) {
 			result |= OP_MADE_PROGRESS;
 			if (bev_ssl->write_blocked_on_read)
@@ -691,6 +793,7 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 			n_written += r;
 			bev_ssl->last_write = -1;
 			decrement_buckets(bev_ssl);
+			evbuffer_drain(output, r);
 		} else {
 			int err = SSL_get_error(bev_ssl->ssl, r);
 			print_err(err);
@@ -700,7 +803,7 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 				if (bev_ssl->write_blocked_on_read)
 					if (clear_wbor(bev_ssl) < 0)
 						return OP_ERR | result;
-				bev_ssl->last_write = space[i].iov_len;
+				bev_ssl->last_write = len;
 				break;
 			case SSL_ERROR_WANT_READ:
 				/* This read operation requires a write, and the
@@ -708,7 +811,7 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 				if (!bev_ssl->write_blocked_on_read)
 					if (set_wbor(bev_ssl) < 0)
 						return OP_ERR | result;
-				bev_ssl->last_write = space[i].iov_len;
+				bev_ssl->last_write = len;
 				break;
 			default:
 				conn_closed(bev_ssl, BEV_EVENT_WRITING, err, r);
@@ -720,7 +823,6 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 		}
 	}
 	if (n_written) {
-		evbuffer_drain(output, n_written);
 		if (bev_ssl->underlying)
 			BEV_RESET_GENERIC_WRITE_TIMEOUT(bev);
 
@@ -731,7 +833,6 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 
 #define WRITE_FRAME 15000
 
-#define READ_DEFAULT 4096
 
 /* Try to figure out how many bytes to read; return 0 if we shouldn't be
  * reading. */
@@ -740,7 +841,7 @@ bytes_to_read(struct bufferevent_openssl *bev)
 {
 	struct evbuffer *input = bev->bev.bev.input;
 	struct event_watermark *wm = &bev->bev.bev.wm_read;
-	int result = READ_DEFAULT;
+	int result = bev->read_hint;
 	ev_ssize_t limit;
 	/* XXX 99% of this is generic code that nearly all bufferevents will
 	 * want. */
@@ -764,7 +865,7 @@ bytes_to_read(struct bufferevent_openssl *bev)
 
 		result = wm->high - evbuffer_get_length(input);
 	} else {
-		result = READ_DEFAULT;
+		result = bev->read_hint;
 	}
 
 	/* Respect the rate limit */
@@ -991,6 +1092,10 @@ set_open_callbacks(struct bufferevent_openssl *bev_ssl, evutil_socket_t fd)
 		struct bufferevent *bev = &bev_ssl->bev.bev;
 		int rpending=0, wpending=0, r1=0, r2=0;
 
+#ifdef USE_KTLS
+		check_ktls(bev_ssl);
+#endif
+
 		if (event_initialized(&bev->ev_read)) {
 			rpending = event_pending(&bev->ev_read, EV_READ, NULL);
 			wpending = event_pending(&bev->ev_write, EV_WRITE, NULL);
@@ -1355,7 +1460,8 @@ bufferevent_openssl_new_impl(struct event_base *base,
 	if (underlying != NULL && fd >= 0)
 		goto err;
 
-	if (!(bev_ssl = mm_calloc(1, sizeof(struct bufferevent_openssl))))
+	if (!(bev_ssl = event_base_obj_calloc_(base,
+		    sizeof(struct bufferevent_openssl))))
 		goto err;
 
 	bev_p = &bev_ssl->bev;
@@ -1384,6 +1490,7 @@ bufferevent_openssl_new_impl(struct event_base *base,
 
 	bev_ssl->old_state = state;
 	bev_ssl->last_write = -1;
+	bev_ssl->read_hint = READ_DEFAULT;
 
 	init_bio_counts(bev_ssl);
 
@@ -1509,6 +1616,55 @@ bufferevent_openssl_set_allow_dirty_shutdown(struct bufferevent *bev,
 	BEV_UNLOCK(bev);
 }
 
+int
+bufferevent_openssl_set_ktls(struct bufferevent *bev, int enable)
+{
+	int r = -1;
+	struct bufferevent_openssl *bev_ssl;
+	BEV_LOCK(bev);
+	bev_ssl = upcast(bev);
+#ifdef USE_KTLS
+	/* The keys go to the kernel as the handshake finishes, so it is too
+	 * late once we are open; and only a socket BIO can take them. */
+	if (bev_ssl && !bev_ssl->underlying &&
+	    bev_ssl->state != BUFFEREVENT_SSL_OPEN) {
+		if (enable)
+			SSL_set_options(bev_ssl->ssl, SSL_OP_ENABLE_KTLS);
+		else
+			SSL_clear_options(bev_ssl->ssl, SSL_OP_ENABLE_KTLS);
+		r = 0;
+	}
+#else
+	(void)bev_ssl;
+	(void)enable;
+#endif
+	BEV_UNLOCK(bev);
+	return r;
+}
+
+short
+bufferevent_openssl_get_ktls(struct bufferevent *bev)
+{
+	short what = 0;
+	struct bufferevent_openssl *bev_ssl;
+	BEV_LOCK(bev);
+	bev_ssl = upcast(bev);
+#ifdef USE_KTLS
+	if (bev_ssl && !bev_ssl->underlying &&
+	    bev_ssl->state == BUFFEREVENT_SSL_OPEN) {
+		BIO *rbio = SSL_get_rbio(bev_ssl->ssl);
+		if (bev_ssl->ktls_send)
+			what |= EV_WRITE;
+		if (rbio && BIO_get_ktls_recv(rbio))
+			what |= EV_READ;
+	}
+#else
+	(void)bev_ssl;
+#endif
+	BEV_UNLOCK(bev);
+	return what;
+}
+
 unsigned long
 bufferevent_get_openssl_error(struct bufferevent *bev)
 {
@@ -40,7 +40,9 @@
 #include "defer-internal.h"
 #include "bufferevent-internal.h"
 #include "mm-internal.h"
+#include "mpsc-internal.h"
 #include "util-internal.h"
+#include "evthread-internal.h"
 
 struct bufferevent_pair {
 	struct bufferevent_private bev;
@@ -94,11 +96,12 @@ bufferevent_pair_elt_new(struct event_base *base,
     int options)
 {
 	struct bufferevent_pair *bufev;
-	if (! (bufev = mm_calloc(1, sizeof(struct bufferevent_pair))))
+	if (! (bufev = event_base_obj_calloc_(base,
+		    sizeof(struct bufferevent_pair))))
 		return NULL;
 	if (bufferevent_init_common_(&bufev->bev, base, &bufferevent_ops_pair,
 		options)) {
-		mm_free(bufev);
+		event_base_obj_free_(base, bufev);
 		return NULL;
 	}
 	if (!evbuffer_add_cb(bufev->bev.bev.output, be_pair_outbuf_cb, bufev)) {
@@ -363,3 +366,448 @@ const struct bufferevent_ops bufferevent_ops_pair = {
 	be_pair_flush,
 	NULL, /* ctrl */
 };
+
+/* Cross-thread pairs.
+ *
+ * The two ends of a cross-thread pair live on different event_bases, and
+ * each end is only used from the thread that runs its own base.  Data
+ * moves in batches: a batch is an evbuffer that the sending end fills from
+ * its output with evbuffer_add_buffer(), and that the receiving end empties
+ * into its input the same way, so that no bytes are copied.  Full batches
+ * go to the receiver, and empty ones go back to the sender, on lock-free
+ * queues.  The only lock is the channel lock, which keeps an end from
+ * going away while the other end is waking it up.
+ */
+
+/* How many batches one end may have in flight before it waits for the
+ * other end to give some back. */
+#define XPAIR_MAX_BATCHES 64
+
+struct bufferevent_xpair_batch {
+	struct mpsc_node node;
+	struct evbuffer *buf;
+};
+
+struct bufferevent_xpair_channel {
+	void *lock;
+	/* Protected by lock: the ends that are still alive, and how many
+	 * ends still refer to the channel. */
+	struct bufferevent_xpair *end[2];
+	int refcnt;
+	/* Protected by lock: true once the partner of end[i] is gone. */
+	int peer_gone[2];
+	/* Full batches for end[i] to read. */
+	struct mpsc_queue full[2];
+	/* Empty batches going back to end[i], which allocated them. */
+	struct mpsc_queue empty[2];
+	/* True if end[i] has been woken up and has not run yet. */
+	int wake_pending[2];
+	/* True if end[i] ran out of batches, and wants to be woken up when
+	 * one comes back. */
+	int send_blocked[2];
+};
+
+struct bufferevent_xpair {
+	struct bufferevent_private bev;
+	struct bufferevent_xpair_channel *chan;
+	/* Our index in chan->end. */
+	int idx;
+	/* Activated by the other end when there is something for us. */
+	struct event wakeup_ev;
+	/* Full batches we have taken from our queue but not emptied yet,
+	 * oldest first. */
+	struct mpsc_node *received;
+	/* Empty batches that we can fill. */
+	struct mpsc_node *spare;
+	/* How many batches we have allocated. */
+	int n_batches;
+	/* True while we are in xpair_receive(): adding to our input can
+	 * unsuspend reading, which would call it again. */
+	unsigned receiving : 1;
+	unsigned eof_reported : 1;
+};
+
+static inline struct bufferevent_xpair *
+xpair_upcast(struct bufferevent *bev)
+{
+	if (bev->be_ops != &bufferevent_ops_pair_cross)
+		return NULL;
+	return EVUTIL_UPCAST(bev, struct bufferevent_xpair, bev.bev);
+}
+
+#define xpair_downcast(xp) (&(xp)->bev.bev)
+
+static void
+xpair_push(struct bufferevent_xpair_channel *chan, struct mpsc_queue *q,
+    struct bufferevent_xpair_batch *batch)
+{
+#ifdef MPSC_NEEDS_LOCK_
+	EVLOCK_LOCK(chan->lock, 0);
+#endif
+	mpsc_push_(q, &batch->node);
+#ifdef MPSC_NEEDS_LOCK_
+	EVLOCK_UNLOCK(chan->lock, 0);
+#endif
+}
+
+static struct mpsc_node *
+xpair_take(struct bufferevent_xpair_channel *chan, struct mpsc_queue *q)
+{
+	struct mpsc_node *n;
+#ifdef MPSC_NEEDS_LOCK_
+	EVLOCK_LOCK(chan->lock, 0);
+#endif
+	n = mpsc_take_all_(q);
+#ifdef MPSC_NEEDS_LOCK_
+	EVLOCK_UNLOCK(chan->lock, 0);
+#endif
+	return n;
+}
+
+static int
+xpair_xchg(struct bufferevent_xpair_channel *chan, int *p, int v)
+{
+	int old;
+#ifdef MPSC_NEEDS_LOCK_
+	EVLOCK_LOCK(chan->lock, 0);
+#endif
+	old = MPSC_XCHG_INT_(p, v);
+#ifdef MPSC_NEEDS_LOCK_
+	EVLOCK_UNLOCK(chan->lock, 0);
+#endif
+	return old;
+}
+
+static void
+xpair_batch_free_list(struct mpsc_node *n)
+{
+	while (n) {
+		struct bufferevent_xpair_batch *batch =
+		    (struct bufferevent_xpair_batch *)n;
+		n = n->next;
+		evbuffer_free(batch->buf);
+		mm_free(batch);
+	}
+}
+
+/* Wake up end i, unless it has been woken up already and has not run
+ * since: it will see everything we queued when it does. */
+static void
+xpair_wake(struct bufferevent_xpair_channel *chan, int i)
+{
+	if (xpair_xchg(chan, &chan->wake_pending[i], 1))
+		return;
+	EVLOCK_LOCK(chan->lock, 0);
+	if (chan->end[i])
+		event_active(&chan->end[i]->wakeup_ev, EV_READ, 1);
+	EVLOCK_UNLOCK(chan->lock, 0);
+}
+
+/* Return an empty batch for xp to fill, or NULL if all of its batches are
+ * in flight. */
+static struct bufferevent_xpair_batch *
+xpair_get_spare(struct bufferevent_xpair *xp)
+{
+	struct bufferevent_xpair_channel *chan = xp->chan;
+	struct bufferevent_xpair_batch *batch;
+
+	if (!xp->spare)
+		xp->spare = xpair_take(chan, &chan->empty[xp->idx]);
+	if (!xp->spare && xp->n_batches < XPAIR_MAX_BATCHES) {
+		if (!(batch = mm_malloc(sizeof(*batch))))
+			return NULL;
+		if (!(batch->buf = evbuffer_new())) {
+			mm_free(batch);
+			return NULL;
+		}
+		++xp->n_batches;
+		return batch;
+	}
+	if (!xp->spare) {
+		/* Ask to hear about the next batch that comes back, then
+		 * look once more in case it came back before we asked. */
+		xpair_xchg(chan, &chan->send_blocked[xp->idx], 1);
+		xp->spare = xpair_take(chan, &chan->empty[xp->idx]);
+		if (!xp->spare)
+			return NULL;
+	}
+	batch = (struct bufferevent_xpair_batch *)xp->spare;
+	xp->spare = xp->spare->next;
+	return batch;
+}
+
+/* Hand everything in our output to the other end. */
+static void
+xpair_send(struct bufferevent_xpair *xp, int ignore_enabled)
+{
+	struct bufferevent *bev = xpair_downcast(xp);
+	struct bufferevent_xpair_channel *chan = xp->chan;
+	struct bufferevent_xpair_batch *batch;
+	int other = !xp->idx;
+
+	if (!ignore_enabled && !(bev->enabled & EV_WRITE))
+		return;
+	if (!evbuffer_get_length(bev->output))
+		return;
+	if (!(batch = xpair_get_spare(xp)))
+		return;
+
+	evbuffer_unfreeze(bev->output, 1);
+	evbuffer_add_buffer(batch->buf, bev->output);
+	evbuffer_freeze(bev->output, 1);
+
+	xpair_push(chan, &chan->full[other], batch);
+	xpair_wake(chan, other);
+
+	BEV_DEL_GENERIC_WRITE_TIMEOUT(bev);
+	bufferevent_trigger_nolock_(bev, EV_WRITE, 0);
+}
+
+/* Move what the other end has sent us into our input, as far as our
+ * watermark allows. */
+static void
+xpair_receive(struct bufferevent_xpair *xp)
+{
+	struct bufferevent *bev = xpair_downcast(xp);
+	struct bufferevent_xpair_channel *chan = xp->chan;
+	struct mpsc_node *n, **tail;
+	size_t moved = 0, len;
+	int peer_gone, other = !xp->idx;
+
+	if (!(bev->enabled & EV_READ) || xp->bev.read_suspended ||
+	    xp->receiving)
+		return;
+	xp->receiving = 1;
+
+	/* If the other end is gone, everything it sent is already queued. */
+	EVLOCK_LOCK(chan->lock, 0);
+	peer_gone = chan->peer_gone[xp->idx];
+	EVLOCK_UNLOCK(chan->lock, 0);
+
+	tail = &xp->received;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = xpair_take(chan, &chan->full[xp->idx]);
+
+	evbuffer_unfreeze(bev->input, 0);
+	while ((n = xp->received)) {
+		struct bufferevent_xpair_batch *batch =
+		    (struct bufferevent_xpair_batch *)n;
+		len = evbuffer_get_length(batch->buf);
+		if (bev->wm_read.high) {
+			size_t have = evbuffer_get_length(bev->input);
+			if (have >= bev->wm_read.high)
+				break;
+			if (len > bev->wm_read.high - have)
+				len = bev->wm_read.high - have;
+			evbuffer_remove_buffer(batch->buf, bev->input, len);
+		} else {
+			evbuffer_add_buffer(bev->input, batch->buf);
+		}
+		moved += len;
+		if (evbuffer_get_length(batch->buf))
+			break;
+
+		xp->received = n->next;
+		xpair_push(chan, &chan->empty[other], batch);
+		if (xpair_xchg(chan, &chan->send_blocked[other], 0))
+			xpair_wake(chan, other);
+	}
+	evbuffer_freeze(bev->input, 0);
+	xp->receiving = 0;
+
+	if (moved) {
+		BEV_RESET_GENERIC_READ_TIMEOUT(bev);
+		bufferevent_trigger_nolock_(bev, EV_READ, 0);
+	}
+	if (peer_gone && !xp->received && !xp->eof_reported) {
+		xp->eof_reported = 1;
+		bufferevent_run_eventcb_(bev, BEV_EVENT_EOF|BEV_EVENT_READING, 0);
+	}
+}
+
+static void
+xpair_wakeup_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct bufferevent_xpair *xp = arg;
+	struct bufferevent *bev = xpair_downcast(xp);
+
+	bufferevent_incref_and_lock_(bev);
+	xpair_xchg(xp->chan, &xp->chan->wake_pending[xp->idx], 0);
+	xpair_receive(xp);
+	xpair_send(xp, 0);
+	bufferevent_decref_and_unlock_(bev);
+}
+
+static void
+xpair_outbuf_cb(struct evbuffer *outbuf,
+    const struct evbuffer_cb_info *info, void *arg)
+{
+	struct bufferevent_xpair *xp = arg;
+
+	if (info->n_added > info->n_deleted) {
+		bufferevent_incref_and_lock_(xpair_downcast(xp));
+		xpair_send(xp, 0);
+		bufferevent_decref_and_unlock_(xpair_downcast(xp));
+	}
+}
+
+static struct bufferevent_xpair *
+xpair_elt_new(struct event_base *base, int options,
+    struct bufferevent_xpair_channel *chan, int idx)
+{
+	struct bufferevent_xpair *xp;
+	if (! (xp = event_base_obj_calloc_(base,
+		    sizeof(struct bufferevent_xpair))))
+		return NULL;
+	xp->chan = chan;
+	xp->idx = idx;
+	event_assign(&xp->wakeup_ev, base, -1, 0, xpair_wakeup_cb, xp);
+	if (bufferevent_init_common_(&xp->bev, base,
+		&bufferevent_ops_pair_cross, options)) {
+		event_base_obj_free_(base, xp);
+		return NULL;
+	}
+	if (!evbuffer_add_cb(xp->bev.bev.output, xpair_outbuf_cb, xp)) {
+		bufferevent_free(xpair_downcast(xp));
+		return NULL;
+	}
+	bufferevent_init_generic_timeout_cbs_(&xp->bev.bev);
+	evbuffer_freeze(xp->bev.bev.input, 0);
+	evbuffer_freeze(xp->bev.bev.output, 1);
+	return xp;
+}
+
+int
+bufferevent_pair_new_cross(struct event_base *base0,
+    struct event_base *base1, int options, struct bufferevent *pair[2])
+{
+	struct bufferevent_xpair_channel *chan;
+	struct bufferevent_xpair *xp0, *xp1;
+	int i;
+
+	if (!(chan = mm_calloc(1, sizeof(*chan))))
+		return -1;
+	EVTHREAD_ALLOC_LOCK(chan->lock, 0);
+	for (i = 0; i < 2; ++i) {
+		mpsc_ctor_(&chan->full[i]);
+		mpsc_ctor_(&chan->empty[i]);
+	}
+	/* Each end drops one reference when it is destroyed; the last one
+	 * frees the channel. */
+	chan->refcnt = 2;
+
+	options |= BEV_OPT_DEFER_CALLBACKS;
+
+	if (!(xp0 = xpair_elt_new(base0, options, chan, 0))) {
+		EVTHREAD_FREE_LOCK(chan->lock, 0);
+		mm_free(chan);
+		return -1;
+	}
+	if (!(xp1 = xpair_elt_new(base1, options, chan, 1))) {
+		chan->refcnt = 1;
+		bufferevent_free(xpair_downcast(xp0));
+		return -1;
+	}
+
+	chan->end[0] = xp0;
+	chan->end[1] = xp1;
+
+	pair[0] = xpair_downcast(xp0);
+	pair[1] = xpair_downcast(xp1);
+	return 0;
+}
+
+static int
+be_xpair_enable(struct bufferevent *bev, short events)
+{
+	struct bufferevent_xpair *xp = xpair_upcast(bev);
+
+	bufferevent_incref_and_lock_(bev);
+	if (events & EV_READ)
+		BEV_RESET_GENERIC_READ_TIMEOUT(bev);
+	if ((events & EV_WRITE) && evbuffer_get_length(bev->output))
+		BEV_RESET_GENERIC_WRITE_TIMEOUT(bev);
+	if (events & EV_READ)
+		xpair_receive(xp);
+	if (events & EV_WRITE)
+		xpair_send(xp, 0);
+	bufferevent_decref_and_unlock_(bev);
+	return 0;
+}
+
+static void
+be_xpair_unlink(struct bufferevent *bev)
+{
+	struct bufferevent_xpair *xp = xpair_upcast(bev);
+	struct bufferevent_xpair_channel *chan = xp->chan;
+	int other = !xp->idx;
+
+	/* Once we are out of chan->end, the other end will not touch our
+	 * wakeup event any more; tell it that we are gone. */
+	EVLOCK_LOCK(chan->lock, 0);
+	chan->end[xp->idx] = NULL;
+	chan->peer_gone[other] = 1;
+	if (chan->end[other]) {
+		MPSC_STORE_INT_(&chan->wake_pending[other], 1);
+		event_active(&chan->end[other]->wakeup_ev, EV_READ, 1);
+	}
+	EVLOCK_UNLOCK(chan->lock, 0);
+
+	event_del(&xp->wakeup_ev);
+}
+
+static void
+be_xpair_destruct(struct bufferevent *bev)
+{
+	struct bufferevent_xpair *xp = xpair_upcast(bev);
+	struct bufferevent_xpair_channel *chan = xp->chan;
+	int i, last;
+
+	xpair_batch_free_list(xp->spare);
+	xpair_batch_free_list(xp->received);
+	xp->spare = xp->received = NULL;
+
+	EVLOCK_LOCK(chan->lock, 0);
+	last = --chan->refcnt == 0;
+	EVLOCK_UNLOCK(chan->lock, 0);
+	if (!last)
+		return;
+
+	for (i = 0; i < 2; ++i) {
+		xpair_batch_free_list(mpsc_take_all_(&chan->full[i]));
+		xpair_batch_free_list(mpsc_take_all_(&chan->empty[i]));
+	}
+	EVTHREAD_FREE_LOCK(chan->lock, 0);
+	mm_free(chan);
+}
+
+static int
+be_xpair_flush(struct bufferevent *bev, short iotype,
+    enum bufferevent_flush_mode mode)
+{
+	struct bufferevent_xpair *xp = xpair_upcast(bev);
+
+	if (mode == BEV_NORMAL)
+		return 0;
+
+	bufferevent_incref_and_lock_(bev);
+	if (iotype & EV_READ)
+		xpair_receive(xp);
+	if (iotype & EV_WRITE)
+		xpair_send(xp, 1);
+	bufferevent_decref_and_unlock_(bev);
+	return 0;
+}
+
+const struct bufferevent_ops bufferevent_ops_pair_cross = {
+	"pair_cross",
+	evutil_offsetof(struct bufferevent_xpair, bev.bev),
+	be_xpair_enable,
+	be_pair_disable,
+	be_xpair_unlink,
+	be_xpair_destruct,
+	bufferevent_generic_adj_timeouts_,
+	be_xpair_flush,
+	NULL, /* ctrl */
+};
@@ -178,8 +178,9 @@ ev_token_bucket_cfg_free(struct ev_token_bucket_cfg *cfg)
 	mm_free(cfg);
 }
 
-/* Default values for max_single_read & max_single_write variables. */
-#define MAX_SINGLE_READ_DEFAULT 16384
+/* Default values for max_single_read & max_single_write variables.  Reads
+ * are allowed to go as high as evbuffer_read() will adaptively take them. */
+#define MAX_SINGLE_READ_DEFAULT EVBUFFER_MAX_READ_DEFAULT
 #define MAX_SINGLE_WRITE_DEFAULT 16384
 
 #define LOCK_GROUP(g) EVLOCK_LOCK((g)->lock, 0)
@@ -45,6 +45,9 @@
 #ifdef EVENT__HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef EVENT__HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -64,17 +67,25 @@
 #include "event2/util.h"
 #include "event2/bufferevent.h"
 #include "event2/buffer.h"
+#include "event2/buffer_compat.h"
 #include "event2/bufferevent_struct.h"
 #include "event2/bufferevent_compat.h"
 #include "event2/event.h"
 #include "log-internal.h"
 #include "mm-internal.h"
 #include "bufferevent-internal.h"
+#include "evbuffer-internal.h"
 #include "util-internal.h"
 #ifdef _WIN32
 #include "iocp-internal.h"
 #endif
 
+/* splice() relay support */
+#if defined(EVENT__HAVE_SPLICE) && defined(EVENT__HAVE_PIPE2) && \
+    defined(SPLICE_F_NONBLOCK) && defined(F_GETPIPE_SZ)
+#define USE_SPLICE_RELAY 1
+#endif
+
 /* prototypes */
 static int be_socket_enable(struct bufferevent *, short);
 static int be_socket_disable(struct bufferevent *, short);
@@ -82,16 +93,68 @@ static void be_socket_destruct(struct bufferevent *);
 static int be_socket_flush(struct bufferevent *, short, enum bufferevent_flush_mode);
 static int be_socket_ctrl(struct bufferevent *, enum bufferevent_ctrl_op, union bufferevent_ctrl_data *);
 
+static void be_socket_unlink(struct bufferevent *);
+
 static void be_socket_setfd(struct bufferevent *, evutil_socket_t);
+static int be_socket_adj_timeouts(struct bufferevent *);
+
+#ifdef USE_SPLICE_RELAY
+/* How much we ask the relay pipe to hold; the kernel may give us less. */
+#define BEV_RELAY_PIPE_SIZE (256*1024)
+
+/* One direction of a relay set up by bufferevent_socket_relay(): bytes are
+ * spliced from src's socket into a pipe, and from the pipe into dst's
+ * socket, without ever reaching user space.
+ *
+ * Each side changes only its own bufferevent, under its own lock, so that
+ * neither ever waits for the other's lock while holding its own.  The
+ * relay's lock protects the fields below and is never held while taking a
+ * bufferevent lock.  When one side needs the other to do something, it
+ * makes the other's read or write event active. */
+struct bufferevent_relay_ {
+	void *lock;
+	/* Each side sets its pointer to NULL when it lets go of the relay;
+	 * the last one to let go frees it. */
+	struct bufferevent *src;
+	struct bufferevent *dst;
+	/* Read end, write end. */
+	int pipe[2];
+	/* How many bytes are in the pipe, and how many it can take. */
+	size_t in_pipe;
+	size_t pipe_size;
+	/* Set while src waits for dst to drain the pipe. */
+	unsigned src_waiting : 1;
+	/* Set once src has hit EOF. */
+	unsigned eof : 1;
+	/* Set once dst has passed the EOF on. */
+	unsigned shut : 1;
+	/* Set once src has reported the EOF. */
+	unsigned reported : 1;
+};
+
+#define RELAY_LOCK(r) EVLOCK_LOCK((r)->lock, 0)
+#define RELAY_UNLOCK(r) EVLOCK_UNLOCK((r)->lock, 0)
+
+static ev_ssize_t bev_relay_splice_in(struct bufferevent_private *,
+    evutil_socket_t, ev_ssize_t);
+static ev_ssize_t bev_relay_splice_out(struct bufferevent_private *,
+    evutil_socket_t, ev_ssize_t);
+static int bev_relay_src_wake(struct bufferevent_private *);
+static void bev_relay_push(struct bufferevent_private *);
+static void bev_relay_drained(struct bufferevent_private *);
+static int bev_relay_want_write(struct bufferevent_private *);
+static void bev_relay_eof(struct bufferevent_private *);
+static void bev_relay_unlink(struct bufferevent_private *);
+#endif
 
 const struct bufferevent_ops bufferevent_ops_socket = {
 	"socket",
 	evutil_offsetof(struct bufferevent_private, bev),
 	be_socket_enable,
 	be_socket_disable,
-	NULL, /* unlink */
+	be_socket_unlink,
 	be_socket_destruct,
-	bufferevent_generic_adj_existing_timeouts_,
+	be_socket_adj_timeouts,
 	be_socket_flush,
 	be_socket_ctrl,
 };
@@ -125,6 +188,53 @@ bufferevent_socket_set_conn_address_(struct bufferevent *bev,
 	memcpy(&bev_p->conn_address, addr, addrlen);
 }
 
+/* The flags for a socket bufferevent's read and write events. */
+#define BEV_SOCKET_EV_FLAGS(bufev_p) \
+	(EV_PERSIST|EV_FINALIZE|((bufev_p)->sticky_events ? EV_ET : 0))
+
+/* Sticky events: make sure that both events are added, without a timeout.
+ * They stay added until the socket changes. */
+static int
+bev_sticky_add(struct bufferevent *bufev)
+{
+	if (event_get_fd(&bufev->ev_read) == EVUTIL_INVALID_SOCKET)
+		return 0;
+	if (!event_pending(&bufev->ev_read, EV_READ, NULL) &&
+	    event_add(&bufev->ev_read, NULL) < 0)
+		return -1;
+	if (!event_pending(&bufev->ev_write, EV_WRITE, NULL) &&
+	    event_add(&bufev->ev_write, NULL) < 0)
+		return -1;
+	return 0;
+}
+
+/* Sticky events: we have output to write.  If the socket can take it,
+ * write it from the write callback once this batch of callbacks is done;
+ * otherwise, start the write timeout while we wait for the socket. */
+static void
+bev_sticky_want_write(struct bufferevent *bufev)
+{
+	struct bufferevent_private *bufev_p = BEV_UPCAST(bufev);
+
+	if (bufev_p->connecting || evbuffer_get_length(bufev->output) == 0)
+		return;
+	if (bufev_p->write_ready)
+		event_active(&bufev->ev_write, EV_WRITE, 1);
+	else if (!event_pending(&bufev->ev_write, EV_TIMEOUT, NULL))
+		bufferevent_add_event_(&bufev->ev_write, &bufev->timeout_write);
+}
+
+/* Stop waiting to write: delete the write event, or with sticky events,
+ * just its timeout. */
+static void
+bev_socket_stop_writing(struct bufferevent *bufev)
+{
+	if (BEV_UPCAST(bufev)->sticky_events)
+		event_remove_timer(&bufev->ev_write);
+	else
+		event_del(&bufev->ev_write);
+}
+
 static void
 bufferevent_socket_outbuf_cb(struct evbuffer *buf,
     const struct evbuffer_cb_info *cbinfo,
@@ -133,10 +243,25 @@ bufferevent_socket_outbuf_cb(struct evbuffer *buf,
 	struct bufferevent *bufev = arg;
 	struct bufferevent_private *bufev_p = BEV_UPCAST(bufev);
 
+	if (bufev_p->sticky_events) {
+		if (cbinfo->n_added && (bufev->enabled & EV_WRITE) &&
+		    !bufev_p->write_suspended)
+			bev_sticky_want_write(bufev);
+		return;
+	}
 	if (cbinfo->n_added &&
 	    (bufev->enabled & EV_WRITE) &&
 	    !event_pending(&bufev->ev_write, EV_WRITE, NULL) &&
 	    !bufev_p->write_suspended) {
+		if ((bufev_p->options & BEV_OPT_COALESCE_WRITES) &&
+		    !bufev_p->relay_in) {
+			/* Write once the current callbacks are done adding
+			 * to the buffer. */
+			if (event_deferred_cb_schedule_(bufev->ev_base,
+				&bufev_p->deferred_flush))
+				bufferevent_incref_(bufev);
+			return;
+		}
 		/* Somebody added data to the buffer, and we would like to
 		 * write, and we were not writing.  So, start writing. */
 		if (bufferevent_add_event_(&bufev->ev_write, &bufev->timeout_write) == -1) {
@@ -145,6 +270,44 @@ bufferevent_socket_outbuf_cb(struct evbuffer *buf,
 	}
 }
 
+/* Used with BEV_OPT_COALESCE_WRITES: write out what this batch of callbacks
+ * added to the output buffer with one call, and only wait for the socket to
+ * become writable if it didn't take all of it. */
+static void
+bufferevent_socket_flush_cb(struct event_callback *cb, void *arg)
+{
+	struct bufferevent *bufev = arg;
+	struct bufferevent_private *bufev_p = BEV_UPCAST(bufev);
+	evutil_socket_t fd;
+	ev_ssize_t atmost;
+	int res = 0;
+
+	BEV_LOCK(bufev);
+	fd = event_get_fd(&bufev->ev_write);
+	if (fd < 0 || !(bufev->enabled & EV_WRITE) ||
+	    bufev_p->write_suspended || bufev_p->connecting ||
+	    event_pending(&bufev->ev_write, EV_WRITE, NULL))
+		goto done;
+
+	atmost = bufferevent_get_write_max_(bufev_p);
+	if (atmost > 0 && evbuffer_get_length(bufev->output)) {
+		evbuffer_unfreeze(bufev->output, 1);
+		res = evbuffer_write_atmost(bufev->output, fd, atmost);
+		evbuffer_freeze(bufev->output, 1);
+		if (res > 0)
+			bufferevent_decrement_write_buckets_(bufev_p, res);
+	}
+
+	/* Leave the rest, and any error, to bufferevent_writecb(). */
+	if (evbuffer_get_length(bufev->output))
+		bufferevent_add_event_(&bufev->ev_write, &bufev->timeout_write);
+	else
+		bufferevent_trigger_nolock_(bufev, EV_WRITE, 0);
+
+done:
+	bufferevent_decref_and_unlock_(bufev);
+}
+
 static void
 bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 {
@@ -154,6 +317,7 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 	int res = 0;
 	short what = BEV_EVENT_READING;
 	ev_ssize_t howmuch = -1, readmax=-1;
+	size_t cap = 0;
 
 	bufferevent_incref_and_lock_(bufev);
 
@@ -165,8 +329,27 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 		goto error;
 	}
 
+	/* Zero-copy completions show up as errors on the socket, which wake
+	 * us as readable. */
+	evbuffer_reap_zerocopy_(bufev->output);
+
 	input = bufev->input;
 
+#ifdef USE_SPLICE_RELAY
+	/* The destination wakes us up to read again, or to report how the
+	 * relay ended. */
+	if (bufev_p->relay_out && !bev_relay_src_wake(bufev_p))
+		goto done;
+#endif
+
+	if (bufev_p->sticky_events) {
+		/* Our event fires whenever the socket becomes readable.
+		 * Remember that, and come back to it once we want to read. */
+		bufev_p->read_ready = 1;
+		if (!(bufev->enabled & EV_READ) || bufev_p->read_suspended)
+			goto done;
+	}
+
 	/*
 	 * If we have a high watermark configured then we don't want to
 	 * read more data than would make us reach the watermark.
@@ -185,10 +368,22 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 		howmuch = readmax;
 	if (bufev_p->read_suspended)
 		goto done;
+	if (bufev_p->sticky_events) {
+		cap = evbuffer_get_read_cap_(input);
+		if (howmuch >= 0 && (size_t)howmuch < cap)
+			cap = howmuch;
+	}
 
-	evbuffer_unfreeze(input, 0);
-	res = evbuffer_read(input, fd, (int)howmuch); /* XXXX evbuffer_read would do better to take and return ev_ssize_t */
-	evbuffer_freeze(input, 0);
+#ifdef USE_SPLICE_RELAY
+	if (bufev_p->relay_out) {
+		res = (int)bev_relay_splice_in(bufev_p, fd, howmuch);
+	} else
+#endif
+	{
+		evbuffer_unfreeze(input, 0);
+		res = evbuffer_read(input, fd, (int)howmuch); /* XXXX evbuffer_read would do better to take and return ev_ssize_t */
+		evbuffer_freeze(input, 0);
+	}
 
 	if (res == -1) {
 		int err = evutil_socket_geterror(fd);
@@ -203,6 +398,14 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 	} else if (res == 0) {
 		/* eof case */
 		what |= BEV_EVENT_EOF;
+#ifdef USE_SPLICE_RELAY
+		/* Don't report it until the relay has passed everything on
+		 * and shut down its side. */
+		if (bufev_p->relay_out) {
+			bev_relay_eof(bufev_p);
+			goto done;
+		}
+#endif
 	}
 
 	if (res <= 0)
@@ -210,12 +413,31 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 
 	bufferevent_decrement_read_buckets_(bufev_p, res);
 
+	if (bufev_p->sticky_events) {
+		/* A short read emptied the socket, and we will hear when more
+		 * arrives.  Otherwise there may be more: read again once this
+		 * batch of callbacks is done. */
+		if ((size_t)res < cap)
+			bufev_p->read_ready = 0;
+		else
+			event_active(&bufev->ev_read, EV_READ, 1);
+	}
+
+#ifdef USE_SPLICE_RELAY
+	if (bufev_p->relay_out) {
+		/* Nothing went into our input, so there is no one to tell. */
+		bev_relay_push(bufev_p);
+		goto done;
+	}
+#endif
+
 	/* Invoke the user callback - must always be called last */
 	bufferevent_trigger_nolock_(bufev, EV_READ, 0);
 
 	goto done;
 
  reschedule:
+	bufev_p->read_ready = 0;
 	goto done;
 
  error:
@@ -235,6 +457,7 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 	short what = BEV_EVENT_WRITING;
 	int connected = 0;
 	ev_ssize_t atmost = -1;
+	size_t want = 0;
 
 	bufferevent_incref_and_lock_(bufev);
 
@@ -245,6 +468,9 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 		what |= BEV_EVENT_TIMEOUT;
 		goto error;
 	}
+	if (bufev_p->sticky_events)
+		bufev_p->write_ready = 1;
+	evbuffer_reap_zerocopy_(bufev->output);
 	if (bufev_p->connecting) {
 		int c = evutil_socket_finished_connecting_(fd);
 		/* we need to fake the error if the connection was refused
@@ -279,18 +505,33 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 					BEV_EVENT_CONNECTED, 0);
 			if (!(bufev->enabled & EV_WRITE) ||
 			    bufev_p->write_suspended) {
-				event_del(&bufev->ev_write);
+				bev_socket_stop_writing(bufev);
 				goto done;
 			}
 		}
 	}
 
+#ifdef USE_SPLICE_RELAY
+	/* The source wakes us up whether or not we are writing. */
+	if (bufev_p->relay_in && !(bufev->enabled & EV_WRITE))
+		goto done;
+#endif
+
 	atmost = bufferevent_get_write_max_(bufev_p);
 
 	if (bufev_p->write_suspended)
 		goto done;
+	/* With sticky events, we also hear about the socket becoming
+	 * writable when we have nothing to write. */
+	if (bufev_p->sticky_events &&
+	    (!(bufev->enabled & EV_WRITE) ||
+		evbuffer_get_length(bufev->output) == 0))
+		goto done;
 
 	if (evbuffer_get_length(bufev->output)) {
+		want = evbuffer_get_length(bufev->output);
+		if (atmost >= 0 && (size_t)atmost < want)
+			want = atmost;
 		evbuffer_unfreeze(bufev->output, 1);
 		res = evbuffer_write_atmost(bufev->output, fd, atmost);
 		evbuffer_freeze(bufev->output, 1);
@@ -310,10 +551,34 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 			goto error;
 
 		bufferevent_decrement_write_buckets_(bufev_p, res);
+		/* A short write means the socket is full; we will hear when
+		 * it has room again. */
+		if ((size_t)res < want)
+			bufev_p->write_ready = 0;
+	}
+
+#ifdef USE_SPLICE_RELAY
+	if (bufev_p->relay_in && evbuffer_get_length(bufev->output) == 0) {
+		ev_ssize_t n = bev_relay_splice_out(bufev_p, fd, atmost - res);
+		if (n < 0) {
+			int err = evutil_socket_geterror(fd);
+			if (EVUTIL_ERR_RW_RETRIABLE(err))
+				goto reschedule;
+			what |= BEV_EVENT_ERROR;
+			goto error;
+		}
+		bufferevent_decrement_write_buckets_(bufev_p, n);
+		/* This may let go of the relay. */
+		bev_relay_drained(bufev_p);
 	}
+	if (bufev_p->relay_in && bev_relay_want_write(bufev_p))
+		goto done;
+#endif
 
 	if (evbuffer_get_length(bufev->output) == 0) {
-		event_del(&bufev->ev_write);
+		bev_socket_stop_writing(bufev);
+	} else if (bufev_p->sticky_events) {
+		bev_sticky_want_write(bufev);
 	}
 
 	/*
@@ -327,7 +592,14 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 	goto done;
 
  reschedule:
-	if (evbuffer_get_length(bufev->output) == 0) {
+	if (bufev_p->sticky_events) {
+		bufev_p->write_ready = 0;
+		bev_sticky_want_write(bufev);
+	} else if (evbuffer_get_length(bufev->output) == 0
+#ifdef USE_SPLICE_RELAY
+	    && !(bufev_p->relay_in && bev_relay_want_write(bufev_p))
+#endif
+	    ) {
 		event_del(&bufev->ev_write);
 	}
 	goto done;
@@ -352,23 +624,32 @@ bufferevent_socket_new(struct event_base *base, evutil_socket_t fd,
 		return bufferevent_async_new_(base, fd, options);
 #endif
 
-	if ((bufev_p = mm_calloc(1, sizeof(struct bufferevent_private)))== NULL)
+	if ((bufev_p = event_base_obj_calloc_(base,
+		    sizeof(struct bufferevent_private))) == NULL)
 		return NULL;
 
 	if (bufferevent_init_common_(bufev_p, base, &bufferevent_ops_socket,
 				    options) < 0) {
-		mm_free(bufev_p);
+		event_base_obj_free_(base, bufev_p);
 		return NULL;
 	}
 	bufev = &bufev_p->bev;
 	evbuffer_set_flags(bufev->output, EVBUFFER_FLAG_DRAINS_TO_FD);
 
+	if ((options & BEV_OPT_STICKY_EVENTS) &&
+	    (event_base_get_features(base) & EV_FEATURE_ET))
+		bufev_p->sticky_events = 1;
+
 	event_assign(&bufev->ev_read, bufev->ev_base, fd,
-	    EV_READ|EV_PERSIST|EV_FINALIZE, bufferevent_readcb, bufev);
+	    EV_READ|BEV_SOCKET_EV_FLAGS(bufev_p), bufferevent_readcb, bufev);
 	event_assign(&bufev->ev_write, bufev->ev_base, fd,
-	    EV_WRITE|EV_PERSIST|EV_FINALIZE, bufferevent_writecb, bufev);
+	    EV_WRITE|BEV_SOCKET_EV_FLAGS(bufev_p), bufferevent_writecb, bufev);
 
 	evbuffer_add_cb(bufev->output, bufferevent_socket_outbuf_cb, bufev);
+	if (options & BEV_OPT_COALESCE_WRITES)
+		event_deferred_cb_init_(&bufev_p->deferred_flush,
+		    event_base_get_npriorities(base) / 2,
+		    bufferevent_socket_flush_cb, bufev);
 
 	evbuffer_freeze(bufev->input, 0);
 	evbuffer_freeze(bufev->output, 1);
@@ -426,11 +707,14 @@ bufferevent_socket_connect(struct bufferevent *bev,
 #endif
 	bufferevent_setfd(bev, fd);
 	if (r == 0) {
+		/* Set connecting first, so that we wait for EV_WRITE even
+		 * with BEV_OPT_COALESCE_WRITES. */
+		bufev_p->connecting = 1;
 		if (! be_socket_enable(bev, EV_WRITE)) {
-			bufev_p->connecting = 1;
 			result = 0;
 			goto done;
 		}
+		bufev_p->connecting = 0;
 	} else if (r == 1) {
 		/* The connect succeeded already. How very BSD of it. */
 		result = 0;
@@ -537,6 +821,336 @@ bufferevent_socket_get_dns_error(struct bufferevent *bev)
 	return rv;
 }
 
+int
+bufferevent_socket_enable_zerocopy(struct bufferevent *bev, size_t threshold)
+{
+	evutil_socket_t fd;
+	int rv = -1;
+
+	BEV_LOCK(bev);
+	if (!BEV_IS_SOCKET(bev))
+		goto done;
+	fd = event_get_fd(&bev->ev_write);
+	if (fd == EVUTIL_INVALID_SOCKET)
+		goto done;
+	rv = evbuffer_enable_zerocopy(bev->output, fd, threshold);
+done:
+	BEV_UNLOCK(bev);
+	return rv;
+}
+
+#ifdef USE_SPLICE_RELAY
+static void
+bev_relay_free(struct bufferevent_relay_ *relay)
+{
+	close(relay->pipe[0]);
+	close(relay->pipe[1]);
+	EVTHREAD_FREE_LOCK(relay->lock, 0);
+	mm_free(relay);
+}
+
+/* Splice up to howmuch bytes from the source's socket into its relay
+ * pipe.  Returns like read(). */
+static ev_ssize_t
+bev_relay_splice_in(struct bufferevent_private *src_p, evutil_socket_t fd,
+    ev_ssize_t howmuch)
+{
+	struct bufferevent_relay_ *relay = src_p->relay_out;
+	size_t room;
+	ev_ssize_t n = -1;
+	int err = EAGAIN;
+
+	RELAY_LOCK(relay);
+	/* If the destination is gone, it has woken us up to find out. */
+	if (!relay->dst)
+		goto done;
+	/* The read high-water mark bounds what may wait in the pipe, as it
+	 * would bound our input buffer. */
+	room = relay->pipe_size;
+	if (src_p->bev.wm_read.high && src_p->bev.wm_read.high < room)
+		room = src_p->bev.wm_read.high;
+	room = room > relay->in_pipe ? room - relay->in_pipe : 0;
+	if (howmuch < 0 || (size_t)howmuch > room)
+		howmuch = room;
+	if (howmuch == 0) {
+		relay->src_waiting = 1;
+		bufferevent_suspend_read_(&src_p->bev, BEV_SUSPEND_RELAY);
+		goto done;
+	}
+
+	n = splice(fd, NULL, relay->pipe[1], NULL, howmuch,
+	    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	err = errno;
+	if (n > 0) {
+		relay->in_pipe += n;
+	} else if (n < 0 && err == EAGAIN && relay->in_pipe) {
+		/* Either the socket is empty, or the pipe ran out of slots
+		 * before it ran out of bytes.  We can't tell which, so wait
+		 * until the other side has drained some. */
+		relay->src_waiting = 1;
+		bufferevent_suspend_read_(&src_p->bev, BEV_SUSPEND_RELAY);
+	}
+done:
+	RELAY_UNLOCK(relay);
+	errno = err;
+	return n;
+}
+
+/* Splice up to atmost bytes out of the relay pipe into the destination's
+ * socket.  Returns like write(), or 0 if there was nothing to do. */
+static ev_ssize_t
+bev_relay_splice_out(struct bufferevent_private *dst_p, evutil_socket_t fd,
+    ev_ssize_t atmost)
+{
+	struct bufferevent_relay_ *relay = dst_p->relay_in;
+	ev_ssize_t n = 0;
+	int err = 0;
+
+	RELAY_LOCK(relay);
+	if (atmost <= 0 || relay->in_pipe == 0)
+		goto done;
+	if ((size_t)atmost > relay->in_pipe)
+		atmost = relay->in_pipe;
+	n = splice(relay->pipe[0], NULL, fd, NULL, atmost,
+	    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	err = errno;
+	if (n > 0) {
+		relay->in_pipe -= n;
+		if (relay->src_waiting && relay->src) {
+			relay->src_waiting = 0;
+			event_active(&relay->src->ev_read, EV_READ, 1);
+		}
+	}
+done:
+	RELAY_UNLOCK(relay);
+	errno = err;
+	return n;
+}
+
+/* Called on the source when its read event runs: go back to reading once
+ * the pipe has room, report the EOF once the destination has passed it on,
+ * and let go of the relay once the destination is gone.  Returns 1 if the
+ * source should go on to read, and 0 if not. */
+static int
+bev_relay_src_wake(struct bufferevent_private *src_p)
+{
+	struct bufferevent *bev = &src_p->bev;
+	struct bufferevent_relay_ *relay = src_p->relay_out;
+	short what = 0;
+	int unlinked = 0;
+
+	RELAY_LOCK(relay);
+	if (!relay->dst) {
+		/* Nothing can take what is still in the pipe now. */
+		if (relay->in_pipe)
+			what = BEV_EVENT_ERROR;
+		else if (relay->eof && !relay->reported)
+			what = BEV_EVENT_EOF;
+		relay->src = NULL;
+		src_p->relay_out = NULL;
+		unlinked = 1;
+	} else if (relay->eof) {
+		if (relay->shut && !relay->reported) {
+			relay->reported = 1;
+			what = BEV_EVENT_EOF;
+		}
+	} else if (!relay->src_waiting &&
+	    (src_p->read_suspended & BEV_SUSPEND_RELAY)) {
+		bufferevent_unsuspend_read_(bev, BEV_SUSPEND_RELAY);
+	}
+	RELAY_UNLOCK(relay);
+
+	if (unlinked) {
+		bev_relay_free(relay);
+		/* Read into our input buffer from now on. */
+		if (src_p->read_suspended & BEV_SUSPEND_RELAY)
+			bufferevent_unsuspend_read_(bev, BEV_SUSPEND_RELAY);
+	}
+	if (what) {
+		bufferevent_disable(bev, EV_READ);
+		bufferevent_run_eventcb_(bev, BEV_EVENT_READING|what, 0);
+		return 0;
+	}
+	return (bev->enabled & EV_READ) != 0;
+}
+
+/* Called on the source after it has put bytes in the pipe: have the
+ * destination write them. */
+static void
+bev_relay_push(struct bufferevent_private *src_p)
+{
+	struct bufferevent_relay_ *relay = src_p->relay_out;
+
+	RELAY_LOCK(relay);
+	if (relay->dst)
+		event_active(&relay->dst->ev_write, EV_WRITE, 1);
+	RELAY_UNLOCK(relay);
+}
+
+/* Called on the destination after it has written from the pipe: if the
+ * source is at EOF and everything has been passed on, shut down our
+ * sending side and have the source report the EOF.  Once the source is
+ * gone and the pipe is empty, let go of the relay. */
+static void
+bev_relay_drained(struct bufferevent_private *dst_p)
+{
+	struct bufferevent_relay_ *relay = dst_p->relay_in;
+	int unlinked = 0;
+
+	RELAY_LOCK(relay);
+	if (relay->eof && !relay->shut && relay->in_pipe == 0 &&
+	    evbuffer_get_length(dst_p->bev.output) == 0) {
+		relay->shut = 1;
+		shutdown(event_get_fd(&dst_p->bev.ev_write), SHUT_WR);
+		if (relay->src)
+			event_active(&relay->src->ev_read, EV_READ, 1);
+	}
+	if (!relay->src && relay->in_pipe == 0) {
+		relay->dst = NULL;
+		dst_p->relay_in = NULL;
+		unlinked = 1;
+	}
+	RELAY_UNLOCK(relay);
+
+	if (unlinked)
+		bev_relay_free(relay);
+}
+
+/* Return 1 if the destination still has bytes to send from the pipe, after
+ * making sure that it will hear when it can send them; 0 otherwise. */
+static int
+bev_relay_want_write(struct bufferevent_private *dst_p)
+{
+	struct bufferevent *bev = &dst_p->bev;
+	size_t in_pipe;
+
+	RELAY_LOCK(dst_p->relay_in);
+	in_pipe = dst_p->relay_in->in_pipe;
+	RELAY_UNLOCK(dst_p->relay_in);
+
+	if (!in_pipe)
+		return 0;
+	if (!event_pending(&bev->ev_write, EV_WRITE, NULL))
+		bufferevent_add_event_(&bev->ev_write, &bev->timeout_write);
+	return 1;
+}
+
+/* Called on the source when it hits EOF.  The destination passes the EOF on
+ * once it has drained the pipe, and then wakes us up to report it. */
+static void
+bev_relay_eof(struct bufferevent_private *src_p)
+{
+	struct bufferevent_relay_ *relay = src_p->relay_out;
+
+	RELAY_LOCK(relay);
+	relay->eof = 1;
+	relay->src_waiting = 0;
+	bufferevent_suspend_read_(&src_p->bev, BEV_SUSPEND_RELAY);
+	if (relay->dst)
+		event_active(&relay->dst->ev_write, EV_WRITE, 1);
+	RELAY_UNLOCK(relay);
+}
+
+/* Let go of any relay that bev is part of, as it is being freed.  If we
+ * were the source, the destination still sends what is in the pipe; if we
+ * were the destination, the source finds out what it lost. */
+static void
+bev_relay_unlink(struct bufferevent_private *bufev_p)
+{
+	struct bufferevent_relay_ *relay;
+	int last;
+
+	if ((relay = bufev_p->relay_out)) {
+		RELAY_LOCK(relay);
+		relay->src = NULL;
+		last = relay->dst == NULL;
+		if (!last)
+			event_active(&relay->dst->ev_write, EV_WRITE, 1);
+		RELAY_UNLOCK(relay);
+		bufev_p->relay_out = NULL;
+		if (last)
+			bev_relay_free(relay);
+	}
+	if ((relay = bufev_p->relay_in)) {
+		RELAY_LOCK(relay);
+		relay->dst = NULL;
+		last = relay->src == NULL;
+		if (!last)
+			event_active(&relay->src->ev_read, EV_READ, 1);
+		RELAY_UNLOCK(relay);
+		bufev_p->relay_in = NULL;
+		if (last)
+			bev_relay_free(relay);
+	}
+}
+#endif
+
+int
+bufferevent_socket_relay(struct bufferevent *src, struct bufferevent *dst)
+{
+#ifdef USE_SPLICE_RELAY
+	struct bufferevent_private *src_p, *dst_p;
+	struct bufferevent_relay_ *relay = NULL;
+	int r = -1, sz;
+
+	if (!BEV_IS_SOCKET(src) || !BEV_IS_SOCKET(dst) || src == dst ||
+	    src->ev_base != dst->ev_base)
+		return -1;
+	src_p = BEV_UPCAST(src);
+	dst_p = BEV_UPCAST(dst);
+
+	/* Lock in a fixed order, in case someone sets up the other
+	 * direction at the same time. */
+	if (src < dst) {
+		BEV_LOCK(src);
+		BEV_LOCK(dst);
+	} else {
+		BEV_LOCK(dst);
+		BEV_LOCK(src);
+	}
+	if (src_p->relay_out || dst_p->relay_in ||
+	    src_p->sticky_events || dst_p->sticky_events ||
+	    event_get_fd(&src->ev_read) == EVUTIL_INVALID_SOCKET ||
+	    event_get_fd(&dst->ev_write) == EVUTIL_INVALID_SOCKET)
+		goto done;
+	if ((relay = mm_calloc(1, sizeof(*relay))) == NULL)
+		goto done;
+	if (pipe2(relay->pipe, O_NONBLOCK|O_CLOEXEC) < 0) {
+		event_warn("%s: pipe2", __func__);
+		mm_free(relay);
+		goto done;
+	}
+	if (src_p->lock || dst_p->lock) {
+		EVTHREAD_ALLOC_LOCK(relay->lock, 0);
+		if (!relay->lock) {
+			close(relay->pipe[0]);
+			close(relay->pipe[1]);
+			mm_free(relay);
+			goto done;
+		}
+	}
+	/* A bigger pipe means fewer trips through the loop; it's fine if
+	 * we can't have one. */
+	(void)fcntl(relay->pipe[1], F_SETPIPE_SZ, BEV_RELAY_PIPE_SIZE);
+	sz = fcntl(relay->pipe[1], F_GETPIPE_SZ);
+	relay->pipe_size = sz > 0 ? (size_t)sz : 65536;
+	relay->src = src;
+	relay->dst = dst;
+	src_p->relay_out = relay;
+	dst_p->relay_in = relay;
+
+	/* Whatever src has already read must go out first. */
+	evbuffer_add_buffer(dst->output, src->input);
+	r = 0;
+done:
+	BEV_UNLOCK(dst);
+	BEV_UNLOCK(src);
+	return r;
+#else
+	return -1;
+#endif
+}
+
 /*
  * Create a new buffered event object.
  *
@@ -567,12 +1181,42 @@ bufferevent_new(evutil_socket_t fd,
 static int
 be_socket_enable(struct bufferevent *bufev, short event)
 {
+	struct bufferevent_private *bufev_p = BEV_UPCAST(bufev);
+
+	if (bufev_p->sticky_events) {
+		if (bev_sticky_add(bufev) < 0)
+			return -1;
+		if (event & EV_READ) {
+			/* Only the timeout changes. */
+			if (bufferevent_add_event_(&bufev->ev_read,
+				&bufev->timeout_read) == -1)
+				return -1;
+			if (bufev_p->read_ready)
+				event_active(&bufev->ev_read, EV_READ, 1);
+		}
+		if ((event & EV_WRITE) && bufev_p->connecting) {
+			if (bufferevent_add_event_(&bufev->ev_write,
+				&bufev->timeout_write) == -1)
+				return -1;
+		} else if (event & EV_WRITE) {
+			bev_sticky_want_write(bufev);
+		}
+		return 0;
+	}
 	if (event & EV_READ &&
 	    bufferevent_add_event_(&bufev->ev_read, &bufev->timeout_read) == -1)
 			return -1;
-	if (event & EV_WRITE &&
-	    bufferevent_add_event_(&bufev->ev_write, &bufev->timeout_write) == -1)
+	if (event & EV_WRITE) {
+		if ((bufev_p->options & BEV_OPT_COALESCE_WRITES) &&
+		    !bufev_p->connecting && !bufev_p->relay_in) {
+			if (event_deferred_cb_schedule_(bufev->ev_base,
+				&bufev_p->deferred_flush))
+				bufferevent_incref_(bufev);
+		} else if (bufferevent_add_event_(&bufev->ev_write,
+			&bufev->timeout_write) == -1) {
 			return -1;
+		}
+	}
 	return 0;
 }
 
@@ -580,6 +1224,14 @@ static int
 be_socket_disable(struct bufferevent *bufev, short event)
 {
 	struct bufferevent_private *bufev_p = BEV_UPCAST(bufev);
+	if (bufev_p->sticky_events) {
+		/* Leave the events added, and only stop their timeouts. */
+		if (event & EV_READ)
+			event_remove_timer(&bufev->ev_read);
+		if ((event & EV_WRITE) && ! bufev_p->connecting)
+			event_remove_timer(&bufev->ev_write);
+		return 0;
+	}
 	if (event & EV_READ) {
 		if (event_del(&bufev->ev_read) == -1)
 			return -1;
@@ -601,12 +1253,55 @@ be_socket_destruct(struct bufferevent *bufev)
 
 	fd = event_get_fd(&bufev->ev_read);
 
+	/* Last chance to hear that the kernel is done with zero-copy sends
+	 * before we close the socket. */
+	evbuffer_reap_zerocopy(bufev->output);
 	if ((bufev_p->options & BEV_OPT_CLOSE_ON_FREE) && fd >= 0)
 		EVUTIL_CLOSESOCKET(fd);
 
 	evutil_getaddrinfo_cancel_async_(bufev_p->dns_request);
 }
 
+static void
+be_socket_unlink(struct bufferevent *bufev)
+{
+#ifdef USE_SPLICE_RELAY
+	bev_relay_unlink(BEV_UPCAST(bufev));
+#endif
+}
+
+static int
+be_socket_adj_timeouts(struct bufferevent *bufev)
+{
+	struct bufferevent_private *bufev_p = BEV_UPCAST(bufev);
+	int r = 0;
+
+	if (!bufev_p->sticky_events)
+		return bufferevent_generic_adj_existing_timeouts_(bufev);
+
+	/* Sticky events are always pending, so look at what we are actually
+	 * waiting for. */
+	if ((bufev->enabled & EV_READ) && !bufev_p->read_suspended &&
+	    event_pending(&bufev->ev_read, EV_READ, NULL) &&
+	    evutil_timerisset(&bufev->timeout_read)) {
+		if (event_add(&bufev->ev_read, &bufev->timeout_read) < 0)
+			r = -1;
+	} else {
+		event_remove_timer(&bufev->ev_read);
+	}
+	if (event_pending(&bufev->ev_write, EV_WRITE, NULL) &&
+	    evutil_timerisset(&bufev->timeout_write) &&
+	    (bufev_p->connecting ||
+		((bufev->enabled & EV_WRITE) && !bufev_p->write_suspended &&
+		    evbuffer_get_length(bufev->output)))) {
+		if (event_add(&bufev->ev_write, &bufev->timeout_write) < 0)
+			r = -1;
+	} else {
+		event_remove_timer(&bufev->ev_write);
+	}
+	return r;
+}
+
 static int
 be_socket_flush(struct bufferevent *bev, short iotype,
     enum bufferevent_flush_mode mode)
@@ -630,9 +1325,10 @@ be_socket_setfd(struct bufferevent *bufev, evutil_socket_t fd)
 	evbuffer_unfreeze(bufev->output, 1);
 
 	event_assign(&bufev->ev_read, bufev->ev_base, fd,
-	    EV_READ|EV_PERSIST|EV_FINALIZE, bufferevent_readcb, bufev);
+	    EV_READ|BEV_SOCKET_EV_FLAGS(bufev_p), bufferevent_readcb, bufev);
 	event_assign(&bufev->ev_write, bufev->ev_base, fd,
-	    EV_WRITE|EV_PERSIST|EV_FINALIZE, bufferevent_writecb, bufev);
+	    EV_WRITE|BEV_SOCKET_EV_FLAGS(bufev_p), bufferevent_writecb, bufev);
+	bufev_p->read_ready = bufev_p->write_ready = 0;
 
 	if (fd >= 0)
 		bufferevent_enable(bufev, bufev->enabled);
@@ -658,7 +1354,11 @@ bufferevent_priority_set(struct bufferevent *bufev, int priority)
 	if (event_priority_set(&bufev->ev_write, priority) == -1)
 		goto done;
 
-	event_deferred_cb_set_priority_(&bufev_p->deferred, priority);
+	event_deferred_cb_set_priority_(bufev->ev_base, &bufev_p->deferred,
+	    priority);
+	if (bufev_p->options & BEV_OPT_COALESCE_WRITES)
+		event_deferred_cb_set_priority_(bufev->ev_base,
+		    &bufev_p->deferred_flush, priority);
 
 	r = 0;
 done:
@@ -670,11 +1370,23 @@ done:
 int
 bufferevent_base_set(struct event_base *base, struct bufferevent *bufev)
 {
+	struct bufferevent_private *bufev_p = BEV_UPCAST(bufev);
 	int res = -1;
 
 	BEV_LOCK(bufev);
 	if (!BEV_IS_SOCKET(bufev))
 		goto done;
+	/* We free the bufferevent through whatever base it has then, which
+	 * must be able to take back memory from the base that made it. */
+	if (!event_base_obj_movable_(bufev->ev_base, base))
+		goto done;
+	/* As with events, callbacks waiting to run can't change bases. */
+	if (event_deferred_cb_is_scheduled_(bufev->ev_base,
+		&bufev_p->deferred) ||
+	    ((bufev_p->options & BEV_OPT_COALESCE_WRITES) &&
+		event_deferred_cb_is_scheduled_(bufev->ev_base,
+		    &bufev_p->deferred_flush)))
+		goto done;
 
 	bufev->ev_base = base;
 
@@ -683,6 +1395,16 @@ bufferevent_base_set(struct event_base *base, struct bufferevent *bufev)
 		goto done;
 
 	res = event_base_set(base, &bufev->ev_write);
+	if (res == -1)
+		goto done;
+
+	/* As event_base_set() does for the events, put the deferred
+	 * callbacks in the middle of the new base's priorities. */
+	event_deferred_cb_set_priority_(base, &bufev_p->deferred,
+	    event_base_get_npriorities(base) / 2);
+	if (bufev_p->options & BEV_OPT_COALESCE_WRITES)
+		event_deferred_cb_set_priority_(base, &bufev_p->deferred_flush,
+		    event_base_get_npriorities(base) / 2);
 done:
 	BEV_UNLOCK(bufev);
 	return res;
@@ -49,9 +49,18 @@ typedef void (*deferred_cb_fn)(struct event_callback *, void *);
 EVENT2_EXPORT_SYMBOL
 void event_deferred_cb_init_(struct event_callback *, ev_uint8_t, deferred_cb_fn, void *);
 /**
-   Change the priority of a non-pending event_callback.
+   Change the priority of an event_callback, which may be scheduled in
+   base.  Return 0 on success, or -1 if base has no such priority.
  */
-void event_deferred_cb_set_priority_(struct event_callback *, ev_uint8_t);
+EVENT2_EXPORT_SYMBOL
+int event_deferred_cb_set_priority_(struct event_base *,
+    struct event_callback *, ev_uint8_t);
+/**
+   Return true iff a struct event_callback is currently scheduled in an
+   event_base.
+ */
+int event_deferred_cb_is_scheduled_(struct event_base *,
+    struct event_callback *);
 /**
    Cancel a struct event_callback if it is currently scheduled in an event_base.
  */
@@ -65,6 +74,20 @@ void event_deferred_cb_cancel_(struct event_base *, struct event_callback *);
 EVENT2_EXPORT_SYMBOL
 int event_deferred_cb_schedule_(struct event_base *, struct event_callback *);
 
+/**
+   Tell the callback profiler that the callback now running in base is
+   about to call fn, so that the time should be charged to fn.  Has no
+   effect unless the profiler is running and we are in base's loop thread.
+
+   kind is one of the EVENT_PROFILE_KIND_* values.
+ */
+EVENT2_EXPORT_SYMBOL
+void event_base_profile_note_(struct event_base *base, void (*fn)(void),
+    int kind);
+/** As event_base_profile_note_(), but cast fn for the caller. */
+#define EVENT_PROFILE_NOTE_(base, fn, kind)				\
+	event_base_profile_note_((base), (void (*)(void))(fn), (kind))
+
 #ifdef __cplusplus
 }
 #endif
@@ -198,6 +198,7 @@ devpoll_dispatch(struct event_base *base, struct timeval *tv)
 	}
 
 	event_debug(("%s: devpoll_wait reports %d", __func__, res));
+	event_base_record_dispatch_events_(base, res);
 
 	for (i = 0; i < res; i++) {
 		int which = 0;
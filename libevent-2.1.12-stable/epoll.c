@@ -86,9 +86,14 @@
 struct epollop {
 	struct epoll_event *events;
 	int nevents;
+	/* Number of dispatches in a row that used less than a quarter of
+	 * events. */
+	int n_underused;
 	int epfd;
 #ifdef USING_TIMERFD
 	int timerfd;
+	/* True if timerfd may be armed. */
+	int timerfd_armed;
 #endif
 };
 
@@ -129,6 +134,11 @@ const struct eventop epollops = {
 #define INITIAL_NEVENT 32
 #define MAX_NEVENT 4096
 
+/* We double the size of the event array whenever a dispatch fills it, up to
+ * the base's max_dispatch_events (or MAX_NEVENT), and halve it again once
+ * this many dispatches in a row have used less than a quarter of it. */
+#define EPOLL_SHRINK_AFTER 64
+
 /* On Linux kernels at least up to 2.6.24.4, epoll can't handle timeout
  * values bigger than (LONG_MAX - 999ULL)/HZ.  HZ in the wild can be
  * as big as 1000, and LONG_MAX can be as small as (1<<31)-1, so the
@@ -166,13 +176,16 @@ epoll_init(struct event_base *base)
 	epollop->epfd = epfd;
 
 	/* Initialize fields */
-	epollop->events = mm_calloc(INITIAL_NEVENT, sizeof(struct epoll_event));
+	epollop->nevents = INITIAL_NEVENT;
+	if (base->max_dispatch_events &&
+	    base->max_dispatch_events < INITIAL_NEVENT)
+		epollop->nevents = base->max_dispatch_events;
+	epollop->events = mm_calloc(epollop->nevents, sizeof(struct epoll_event));
 	if (epollop->events == NULL) {
 		mm_free(epollop);
 		close(epfd);
 		return (NULL);
 	}
-	epollop->nevents = INITIAL_NEVENT;
 
 	if ((base->flags & EVENT_BASE_FLAG_EPOLL_USE_CHANGELIST) != 0 ||
 	    ((base->flags & EVENT_BASE_FLAG_IGNORE_ENV) == 0 &&
@@ -413,6 +426,48 @@ epoll_nochangelist_del(struct event_base *base, evutil_socket_t fd,
 	return epoll_apply_one_change(base, base->evbase, &ch);
 }
 
+/* Adapt the size of the event array to a dispatch that reported 'res'
+ * events. */
+static void
+epoll_resize_events(struct event_base *base, struct epollop *epollop, int res)
+{
+	int max_nevents = base->max_dispatch_events ?
+	    base->max_dispatch_events : MAX_NEVENT;
+	int new_nevents = epollop->nevents;
+	struct epoll_event *new_events;
+
+	if (res == epollop->nevents && epollop->nevents < max_nevents) {
+		/* We used all of the event space this time.  We should
+		   be ready for more events next time. */
+		new_nevents = epollop->nevents * 2;
+		if (new_nevents > max_nevents)
+			new_nevents = max_nevents;
+		epollop->n_underused = 0;
+	} else if (res < epollop->nevents / 4 &&
+	    epollop->nevents > INITIAL_NEVENT) {
+		if (++epollop->n_underused < EPOLL_SHRINK_AFTER)
+			return;
+		/* The burst is over; give back some memory, and some
+		 * cache. */
+		new_nevents = epollop->nevents / 2;
+		if (new_nevents < INITIAL_NEVENT)
+			new_nevents = INITIAL_NEVENT;
+		epollop->n_underused = 0;
+	} else {
+		epollop->n_underused = 0;
+		return;
+	}
+
+	if (new_nevents == epollop->nevents)
+		return;
+	new_events = mm_realloc(epollop->events,
+	    new_nevents * sizeof(struct epoll_event));
+	if (new_events) {
+		epollop->events = new_events;
+		epollop->nevents = new_nevents;
+	}
+}
+
 static int
 epoll_dispatch(struct event_base *base, struct timeval *tv)
 {
@@ -442,9 +497,16 @@ epoll_dispatch(struct event_base *base, struct timeval *tv)
 		/* TODO: we could avoid unnecessary syscalls here by only
 		   calling timerfd_settime when the top timeout changes, or
 		   when we're called with a different timeval.
+		   For now we only skip disarming a timer that isn't armed,
+		   which is what a busy-polling base does over and over.
 		*/
-		if (timerfd_settime(epollop->timerfd, 0, &is, NULL) < 0) {
-			event_warn("timerfd_settime");
+		if (is.it_value.tv_sec || is.it_value.tv_nsec ||
+		    epollop->timerfd_armed) {
+			if (timerfd_settime(epollop->timerfd, 0, &is, NULL) < 0) {
+				event_warn("timerfd_settime");
+			}
+			epollop->timerfd_armed =
+			    is.it_value.tv_sec || is.it_value.tv_nsec;
 		}
 	} else
 #endif
@@ -477,6 +539,7 @@ epoll_dispatch(struct event_base *base, struct timeval *tv)
 
 	event_debug(("%s: epoll_wait reports %d", __func__, res));
 	EVUTIL_ASSERT(res <= epollop->nevents);
+	event_base_record_dispatch_events_(base, res);
 
 	for (i = 0; i < res; i++) {
 		int what = events[i].events;
@@ -505,19 +568,7 @@ epoll_dispatch(struct event_base *base, struct timeval *tv)
 		evmap_io_active_(base, events[i].data.fd, ev | EV_ET);
 	}
 
-	if (res == epollop->nevents && epollop->nevents < MAX_NEVENT) {
-		/* We used all of the event space this time.  We should
-		   be ready for more events next time. */
-		int new_nevents = epollop->nevents * 2;
-		struct epoll_event *new_events;
-
-		new_events = mm_realloc(epollop->events,
-		    new_nevents * sizeof(struct epoll_event));
-		if (new_events) {
-			epollop->events = new_events;
-			epollop->nevents = new_nevents;
-		}
-	}
+	epoll_resize_events(base, epollop, res);
 
 	return (0);
 }
@@ -153,6 +153,64 @@ struct evbuffer {
 	/** The parent bufferevent object this evbuffer belongs to.
 	 * NULL if the evbuffer stands alone. */
 	struct bufferevent *parent;
+
+	/** The most evbuffer_read() will read at once. */
+	size_t max_read;
+	/** How much evbuffer_read() currently tries to read at once.  This
+	 * grows while reads keep filling it, up to max_read, and shrinks
+	 * again when they stop. */
+	size_t read_size;
+	/** Number of reads in a row that came up well short of read_size. */
+	unsigned n_short_reads;
+
+	/** State for MSG_ZEROCOPY sends, or NULL if they aren't enabled. */
+	struct evbuffer_zerocopy *zerocopy;
+
+	/** Number of multicast chains in other evbuffers that share memory
+	 * with chains in this one.  Each of them also holds a reference to
+	 * this buffer.  Protected by this buffer's lock. */
+	int n_multicast_refs;
+
+	/** If this buffer is in ring mode (see evbuffer_enable_ring()), its
+	 * only chain.  NULL otherwise. */
+	struct evbuffer_chain *ring;
+
+	/** The memory domain that this buffer's bytes are counted against,
+	 * or NULL.  See evbuffer_set_mem_domain(). */
+	struct evbuffer_mem_domain *mem_domain;
+	/** The value of total_len that mem_domain last heard about. */
+	size_t mem_counted;
+};
+
+/** A memory accounting domain: see evbuffer_mem_domain_new(). */
+struct evbuffer_mem_domain {
+	/** Lock for this structure.  It nests inside evbuffer and bufferevent
+	 * locks, so we only ever try-lock members while holding it, and never
+	 * suspend or unsuspend them while holding it. */
+	void *lock;
+	/** The base that runs our deferred callback. */
+	struct event_base *base;
+	/** Total bytes held in the buffers of this domain. */
+	size_t held;
+	/** Above this many bytes, the domain is over budget... */
+	size_t high;
+	/** ... and it stays over budget until held drops to this. */
+	size_t low;
+	/** True iff we are over budget. */
+	unsigned over : 1;
+	/** The last value of over that we told the pressure callback. */
+	unsigned reported_over : 1;
+	/** True iff some member bufferevent was locked when we tried to
+	 * suspend or unsuspend it, and needs another try. */
+	unsigned pending_members : 1;
+	/** Number of evbuffers counted against this domain. */
+	int n_buffers;
+	/** Bufferevents that stop reading while we are over budget. */
+	LIST_HEAD(evbuffer_mem_domain_members, bufferevent_private) members;
+	/** Runs the pressure callback and retries pending members. */
+	struct event_callback deferred;
+	evbuffer_mem_domain_cb cb;
+	void *cbarg;
 };
 
 #if EVENT__SIZEOF_OFF_T < EVENT__SIZEOF_SIZE_T
@@ -200,6 +258,10 @@ struct evbuffer_chain {
 #define EVBUFFER_DANGLING	0x0040
 	/** a chain that is a referenced copy of another chain */
 #define EVBUFFER_MULTICAST	0x0080
+	/** a chain whose buffer is a ring that is mapped twice in a row, so
+	 * that its data is contiguous wherever it starts.  A buffer in ring
+	 * mode has this one chain and no other. */
+#define EVBUFFER_RING		0x0100
 
 	/** number of references to this chain */
 	int refcnt;
@@ -274,6 +336,18 @@ struct evbuffer_multicast_parent {
 	struct evbuffer_chain *parent;
 };
 
+/** The mapping behind a ring chain.  Lives at the end of an evbuffer_chain
+ * with the EVBUFFER_RING flag set.  The chain's buffer always points into
+ * the first copy of the ring, its misalign is always 0, and its buffer_len
+ * is the size of the ring. */
+struct evbuffer_chain_ring {
+	/** Start of the mapping: 'size' bytes of memory, followed by the
+	 * same memory again. */
+	unsigned char *base;
+	/** Size of the ring; a multiple of the page size. */
+	size_t size;
+};
+
 #define EVBUFFER_CHAIN_SIZE sizeof(struct evbuffer_chain)
 /** Return a pointer to extra data allocated along with an evbuffer. */
 #define EVBUFFER_CHAIN_EXTRA(t, c) (t *)((struct evbuffer_chain *)(c) + 1)
@@ -308,6 +382,15 @@ void evbuffer_incref_and_lock_(struct evbuffer *buf);
 void evbuffer_chain_pin_(struct evbuffer_chain *chain, unsigned flag);
 /** Unpin a single buffer chain using a given flag. */
 void evbuffer_chain_unpin_(struct evbuffer_chain *chain, unsigned flag);
+
+/** Release the chains of any zero-copy sends on buf that the kernel has
+ * finished with.  Cheap if there are none outstanding.  Requires lock. */
+int evbuffer_reap_zerocopy_(struct evbuffer *buf);
+
+/** Free the global state used by evbuffers, including the memory of
+ * zero-copy sends left behind by freed buffers. */
+void evbuffer_free_globals_(void);
+
 /** As evbuffer_free, but requires that we hold a lock on the buffer, and
  * releases the lock before freeing it and the buffer. */
 void evbuffer_decref_and_unlock_(struct evbuffer *buffer);
@@ -326,6 +409,10 @@ int evbuffer_read_setup_vecs_(struct evbuffer *buf, ev_ssize_t howmuch,
     struct evbuffer_iovec *vecs, int n_vecs, struct evbuffer_chain ***chainp,
     int exact);
 
+/** Return the most that evbuffer_read(buf, fd, -1) would read right now.
+ * A read that returns less than this has emptied the socket. */
+size_t evbuffer_get_read_cap_(struct evbuffer *buf);
+
 /* Helper macro: copies an evbuffer_iovec in ei to a win32 WSABUF in i. */
 #define WSABUF_FROM_EVBUFFER_IOV(i,ei) do {		\
 		(i)->buf = (ei)->iov_base;		\
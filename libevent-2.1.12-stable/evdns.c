@@ -782,6 +782,7 @@ struct deferred_reply_callback {
 	u32 ttl;
 	u32 err;
 	evdns_callback_type user_callback;
+	struct event_base *event_base;
 	struct reply reply;
 };
 
@@ -791,6 +792,8 @@ reply_run_callback(struct event_callback *d, void *user_pointer)
 	struct deferred_reply_callback *cb =
 	    EVUTIL_UPCAST(d, struct deferred_reply_callback, deferred);
 
+	EVENT_PROFILE_NOTE_(cb->event_base, cb->user_callback,
+	    EVENT_PROFILE_KIND_EVDNS);
 	switch (cb->request_type) {
 	case TYPE_A:
 		if (cb->have_reply)
@@ -845,6 +848,7 @@ reply_schedule_callback(struct request *const req, u32 ttl, u32 err, struct repl
 
 	d->request_type = req->request_type;
 	d->user_callback = req->user_callback;
+	d->event_base = req->base->event_base;
 	d->ttl = ttl;
 	d->err = err;
 	if (reply) {
@@ -1299,6 +1303,8 @@ request_parse(u8 *packet, int length, struct evdns_server_port *port, struct soc
 		return -1;
 	}
 
+	EVENT_PROFILE_NOTE_(port->event_base, port->user_callback,
+	    EVENT_PROFILE_KIND_EVDNS);
 	port->user_callback(&(server_req->base), port->user_data);
 
 	return 0;
@@ -69,6 +69,9 @@
 /* Define to 1 if you have the `clock_gettime' function. */
 #cmakedefine EVENT__HAVE_CLOCK_GETTIME 1
 
+/* Define if libevent_compress is built */
+#cmakedefine EVENT__HAVE_COMPRESS 1
+
 /* Define to 1 if you have the declaration of `CTL_KERN'. */
 #define EVENT__HAVE_DECL_CTL_KERN @EVENT__HAVE_DECL_CTL_KERN@
 
@@ -93,6 +96,9 @@
 /* Define to 1 if you have the <dlfcn.h> header file. */
 #cmakedefine EVENT__HAVE_DLFCN_H 1
 
+/* Define to 1 if you have the `dladdr' function. */
+#cmakedefine EVENT__HAVE_DLADDR 1
+
 /* Define if your system supports the epoll system calls */
 #cmakedefine EVENT__HAVE_EPOLL 1
 
@@ -102,6 +108,12 @@
 /* Define to 1 if you have the `epoll_ctl' function. */
 #cmakedefine EVENT__HAVE_EPOLL_CTL 1
 
+/* Define if your system supports the io_uring system calls */
+#cmakedefine EVENT__HAVE_IO_URING 1
+
+/* Define if your system can report MSG_ZEROCOPY send completions */
+#cmakedefine EVENT__HAVE_MSG_ZEROCOPY 1
+
 /* Define to 1 if you have the `eventfd' function. */
 #cmakedefine EVENT__HAVE_EVENTFD 1
 
@@ -184,6 +196,9 @@
 /* Define to 1 if you have the <memory.h> header file. */
 #cmakedefine EVENT__HAVE_MEMORY_H 1
 
+/* Define to 1 if you have the `memfd_create' function. */
+#cmakedefine EVENT__HAVE_MEMFD_CREATE 1
+
 /* Define to 1 if you have the `mmap' function. */
 #cmakedefine EVENT__HAVE_MMAP 1
 
@@ -443,6 +458,9 @@
 /* Define if kqueue works correctly with pipes */
 #cmakedefine EVENT__HAVE_WORKING_KQUEUE 1
 
+/* Define if the Zstandard library is available */
+#cmakedefine EVENT__HAVE_ZSTD 1
+
 #ifdef __USE_UNUSED_DEFINITIONS__
 /* Define to necessary symbol if this constant uses a non-standard name on your system. */
 /* XXX: Hello, this isn't even used, nor is it defined anywhere... - Ellzey */
@@ -38,6 +38,9 @@ extern "C" {
 #include <sys/queue.h>
 #include "event2/event_struct.h"
 #include "minheap-internal.h"
+#include "timerwheel-internal.h"
+#include "mpsc-internal.h"
+#include "slab-internal.h"
 #include "evsignal-internal.h"
 #include "mm-internal.h"
 #include "defer-internal.h"
@@ -141,16 +144,24 @@ struct eventop {
 struct event_map_entry;
 HT_HEAD(event_io_map, event_map_entry);
 #else
-#define event_io_map event_signal_map
+/* Used to map fds to a list of events when EVMAP_USE_HT is not defined.
+   Unlike event_signal_map, the per-fd entries are stored inline, so that
+   looking up an fd doesn't need to chase a pointer.
+*/
+struct event_io_map {
+	/* An array of nentries slots, each 'stride' bytes long, holding a
+	 * struct evmap_io followed by the backend's fdinfo. */
+	char *entries;
+	/* The number of slots available in entries */
+	int nentries;
+	/* The size of each slot in bytes; 0 until the array is allocated. */
+	int stride;
+};
 #endif
 
-/* Used to map signal numbers to a list of events.  If EVMAP_USE_HT is not
-   defined, this structure is also used as event_io_map, which maps fds to a
-   list of events.
-*/
+/* Used to map signal numbers to a list of events. */
 struct event_signal_map {
-	/* An array of evmap_io * or of evmap_signal *; empty entries are
-	 * set to NULL. */
+	/* An array of evmap_signal *; empty entries are set to NULL. */
 	void **entries;
 	/* The number of entries available in entries */
 	int nentries;
@@ -205,6 +216,20 @@ struct event_once {
 	void *arg;
 };
 
+/** How many runs of activations per active queue get a timestamp of their
+ * own; once they are used up, later callbacks join the newest run. */
+#define EVENT_ACTIVE_MARKS 64
+
+/** For one active queue, the callbacks at which runs of activations start,
+ * oldest first, and when each run was made active.  A run lasts until the
+ * next mark; callbacks queued before the first mark have no time. */
+struct event_active_marks {
+	struct event_callback *evcb[EVENT_ACTIVE_MARKS];
+	ev_uint32_t time[EVENT_ACTIVE_MARKS];
+	int first;
+	int n;
+};
+
 struct event_base {
 	/** Function pointers and other data to describe this event_base's
 	 * backend. 函数指针和其他数据，用于描述此事件库的后端。 */
@@ -286,6 +311,9 @@ struct event_base {
 
 	/** Priority queue of events with timeouts. */
 	struct min_heap timeheap;
+	/** Timing wheel of events with timeouts; used instead of timeheap
+	 * if EVENT_BASE_FLAG_TIMER_WHEEL is set. */
+	struct timer_wheel timewheel;
 
 	/** Stored timeval: used to avoid calling gettimeofday/clock_gettime
 	 * too often. */
@@ -326,6 +354,38 @@ struct event_base {
 	int max_dispatch_callbacks;
 	int limit_callbacks_after_prio;
 
+	/** How long to poll without blocking before we block in dispatch;
+	 * zero if we never spin. */
+	struct timeval busy_poll_budget;
+
+	/** Largest number of ready events a backend should report per
+	 * dispatch; 0 for the backend's default. */
+	int max_dispatch_events;
+
+	/** Counters reported by event_base_get_stats(). */
+	struct event_base_stats stats;
+	/** True if we collect the timing fields of 'stats'. */
+	int stats_timing;
+	/** While stats_timing is set, one per active queue: when the
+	 * callbacks waiting there were made active.  NULL otherwise. */
+	struct event_active_marks *active_marks;
+
+	/** Table for the callback profiler, or NULL if it was never
+	 * started. */
+	struct event_profile *profile;
+	/** True while the callback profiler is running. */
+	int profiling;
+	/** The function that the running callback's time is being charged
+	 * to; event_base_profile_note_() moves it to another one. */
+	void (*profile_note_fn)(void);
+	/** The kind that goes with profile_note_fn. */
+	int profile_note_kind;
+	/** True once event_base_profile_note_() has been called during the
+	 * running callback. */
+	int profile_noted;
+	/** When the time now charged to profile_note_fn began. */
+	ev_uint64_t profile_note_start;
+
 	/* Notify main thread to wake up break, etc. */
 	/** True if the base already has a pending notify, and we don't need
 	 * to add any more. */
@@ -339,6 +399,16 @@ struct event_base {
 	/** A function used to wake up the main thread from another thread. */
 	int (*th_notify_fn)(struct event_base *base);
 
+	/** Callbacks handed to us with event_base_post(), newest first.
+	 * Not protected by th_base_lock. */
+	struct mpsc_queue posted;
+	/** Internal callback that runs everything in 'posted'. */
+	struct event_callback posted_cb;
+
+	/** Freelists for event_base_obj_calloc_(); only used if
+	 * EVENT_BASE_FLAG_SLAB_ALLOC is set.  Protected by th_base_lock. */
+	struct event_slab slab;
+
 	/** Saved seed for weak random number generator. Some backends use
 	 * this to produce fairness among sockets. Protected by th_base_lock. */
 	struct evutil_weakrand_state weakrand_seed;
@@ -363,10 +433,16 @@ struct event_config {
 	struct timeval max_dispatch_interval;
 	int max_dispatch_callbacks;
 	int limit_callbacks_after_prio;
+	struct timeval busy_poll_budget;
+	int max_dispatch_events;
 	enum event_method_feature require_features;
 	enum event_base_config_flag flags;
 };
 
+/** Internal: record in base's statistics that the backend reported 'n'
+ * ready events from a single dispatch. */
+void event_base_record_dispatch_events_(struct event_base *base, int n);
+
 /* Internal use only: Functions that might be missing from <sys/queue.h> */
 #ifndef LIST_END
 #define LIST_END(head)			NULL
@@ -55,12 +55,18 @@
 #ifdef EVENT__HAVE_FCNTL_H
 #include <fcntl.h>
 #endif
+#ifdef EVENT__HAVE_DLADDR
+#include <dlfcn.h>
+#endif
 
 #include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/buffer_compat.h"
 #include "event2/event_struct.h"
 #include "event2/event_compat.h"
 #include "event-internal.h"
 #include "defer-internal.h"
+#include "evbuffer-internal.h"
 #include "evthread-internal.h"
 #include "event2/thread.h"
 #include "event2/util.h"
@@ -86,6 +92,9 @@ extern const struct eventop selectops;
 #ifdef EVENT__HAVE_POLL
 extern const struct eventop pollops;
 #endif
+#ifdef EVENT__HAVE_IO_URING
+extern const struct eventop iouringops;
+#endif
 #ifdef EVENT__HAVE_EPOLL
 extern const struct eventop epollops;
 #endif
@@ -110,6 +119,9 @@ static const struct eventop *eventops[] = {
 #ifdef EVENT__HAVE_EPOLL
 	&epollops,
 #endif
+#ifdef EVENT__HAVE_IO_URING
+	&iouringops,
+#endif
 #ifdef EVENT__HAVE_DEVPOLL
 	&devpollops,
 #endif
@@ -137,6 +149,7 @@ static void *event_self_cbarg_ptr_ = NULL;
 /* Prototypes */
 static void	event_queue_insert_active(struct event_base *, struct event_callback *);
 static void	event_queue_insert_active_later(struct event_base *, struct event_callback *);
+static ev_uint32_t event_active_time(struct event_base *, struct event_callback *);
 static void	event_queue_insert_timeout(struct event_base *, struct event *);
 static void	event_queue_insert_inserted(struct event_base *, struct event *);
 static void	event_queue_remove_active(struct event_base *, struct event_callback *);
@@ -156,6 +169,9 @@ static void	event_queue_reinsert_timeout(struct event_base *,struct event *, int
 static int	event_haveevents(struct event_base *);
 
 static int	event_process_active(struct event_base *);
+static int	event_base_busy_poll(struct event_base *, struct timeval **);
+static void	event_base_run_posted_(struct event_callback *, void *);
+static void	event_base_schedule_posted_(struct event_base *);
 
 static int	timeout_next(struct event_base *, struct timeval **);
 static void	timeout_process(struct event_base *);
@@ -400,6 +416,11 @@ static void event_debug_assert_socket_nonblocking_(evutil_socket_t fd) { (void)f
 #define EVENT_BASE_ASSERT_LOCKED(base)		\
 	EVLOCK_ASSERT_LOCKED((base)->th_base_lock)
 
+/* True iff 'base' keeps its non-common timeouts in the timing wheel rather
+ * than in the min-heap. */
+#define EVBASE_USES_TIMER_WHEEL(base)		\
+	((base)->flags & EVENT_BASE_FLAG_TIMER_WHEEL)
+
 /* How often (in seconds) do we check for changes in wall clock time relative
  * to monotonic time?  Set this to -1 for 'never.' */
 #define CLOCK_SYNC_INTERVAL 5
@@ -653,6 +674,24 @@ event_base_new_with_config(const struct event_config *cfg)
 	evmap_signal_initmap_(&base->sigmap);
 	event_changelist_init_(&base->changelist);
 
+	mpsc_ctor_(&base->posted);
+	event_slab_init_(&base->slab);
+	event_deferred_cb_init_(&base->posted_cb, 0,
+	    event_base_run_posted_, base);
+
+	if (should_check_environment &&
+	    evutil_getenv_("EVENT_TIMER_WHEEL") != NULL)
+		base->flags |= EVENT_BASE_FLAG_TIMER_WHEEL;
+	if (base->flags & EVENT_BASE_FLAG_TIMER_WHEEL) {
+		struct timeval now;
+		gettime(base, &now);
+		if (timer_wheel_ctor_(&base->timewheel, &now) < 0) {
+			event_warn("%s: calloc", __func__);
+			event_base_free(base);
+			return NULL;
+		}
+	}
+
 	base->evbase = NULL;
 
 	if (cfg) {
@@ -672,6 +711,10 @@ event_base_new_with_config(const struct event_config *cfg)
 	if (base->max_dispatch_callbacks == INT_MAX &&
 	    base->max_dispatch_time.tv_sec == -1)
 		base->limit_callbacks_after_prio = INT_MAX;
+	if (cfg) {
+		base->busy_poll_budget = cfg->busy_poll_budget;
+		base->max_dispatch_events = cfg->max_dispatch_events;
+	}
 
 	for (i = 0; eventops[i] && !base->evbase; i++) {
 		if (cfg != NULL) {
@@ -798,7 +841,7 @@ event_base_cancel_single_callback_(struct event_base *base,
 			struct event *ev = event_callback_to_event(evcb);
 			ev->ev_evcallback.evcb_cb_union.evcb_evfinalize(ev, ev->ev_arg);
 			if (evcb->evcb_closure == EV_CLOSURE_EVENT_FINALIZE_FREE)
-				mm_free(ev);
+				event_base_obj_free_(base, ev);
 			break;
 		}
 		case EV_CLOSURE_CB_FINALIZE:
@@ -875,6 +918,10 @@ event_base_free_(struct event_base *base, int run_finalizers)
 		event_del(ev);
 		++n_deleted;
 	}
+	while ((ev = timer_wheel_any_(&base->timewheel)) != NULL) {
+		event_del(ev);
+		++n_deleted;
+	}
 	for (i = 0; i < base->n_common_timeouts; ++i) {
 		struct common_timeout_list *ctl =
 		    base->common_timeout_queues[i];
@@ -915,10 +962,15 @@ event_base_free_(struct event_base *base, int run_finalizers)
 		event_debug(("%s: %d events were still set in base",
 			__func__, n_deleted));
 
+	/* Nobody is going to run these from a loop any more; run them now
+	 * so that their arguments don't leak. */
+	while (!mpsc_empty_(&base->posted))
+		event_base_run_posted_(&base->posted_cb, base);
+
 	while (LIST_FIRST(&base->once_events)) {
 		struct event_once *eonce = LIST_FIRST(&base->once_events);
 		LIST_REMOVE(eonce, next_once);
-		mm_free(eonce);
+		event_base_obj_free_(base, eonce);
 	}
 
 	if (base->evsel != NULL && base->evsel->dealloc != NULL)
@@ -929,12 +981,19 @@ event_base_free_(struct event_base *base, int run_finalizers)
 
 	EVUTIL_ASSERT(min_heap_empty_(&base->timeheap));
 	min_heap_dtor_(&base->timeheap);
+	EVUTIL_ASSERT(timer_wheel_empty_(&base->timewheel));
+	timer_wheel_dtor_(&base->timewheel);
 
 	mm_free(base->activequeues);
+	if (base->active_marks)
+		mm_free(base->active_marks);
 
 	evmap_io_clear_(&base->io);
 	evmap_signal_clear_(&base->sigmap);
 	event_changelist_freemem_(&base->changelist);
+	event_slab_clear_(&base->slab);
+	if (base->profile)
+		mm_free(base->profile);
 
 	EVTHREAD_FREE_LOCK(base->th_base_lock, 0);
 	EVTHREAD_FREE_COND(base->current_event_cond);
@@ -1230,6 +1289,29 @@ event_config_set_max_dispatch_interval(struct event_config *cfg,
 	return (0);
 }
 
+int
+event_config_set_busy_poll(struct event_config *cfg,
+    const struct timeval *budget)
+{
+	if (budget && (budget->tv_sec < 0 || budget->tv_usec < 0 ||
+		budget->tv_usec >= 1000000))
+		return (-1);
+	if (budget)
+		cfg->busy_poll_budget = *budget;
+	else
+		evutil_timerclear(&cfg->busy_poll_budget);
+	return (0);
+}
+
+int
+event_config_set_max_dispatch_events(struct event_config *cfg, int max_events)
+{
+	if (max_events < 0)
+		return (-1);
+	cfg->max_dispatch_events = max_events;
+	return (0);
+}
+
 int
 event_priority_init(int npriorities)
 {
@@ -1269,6 +1351,13 @@ event_base_priority_init(struct event_base *base, int npriorities)
 		TAILQ_INIT(&base->activequeues[i]);
 	}
 
+	if (base->active_marks) {
+		/* Without these we just stop measuring queue delay. */
+		mm_free(base->active_marks);
+		base->active_marks = mm_calloc(npriorities,
+		    sizeof(struct event_active_marks));
+	}
+
 ok:
 	r = 0;
 err:
@@ -1341,6 +1430,318 @@ event_base_get_max_events(struct event_base *base, unsigned int type, int clear)
 	return r;
 }
 
+/* Add 'value' to the log2-bucketed histogram 'hist', laid out as described
+ * for EVENT_BASE_STATS_NBUCKETS. */
+static inline void
+event_stats_histogram_add(ev_uint64_t *hist, ev_uint64_t value)
+{
+	int bucket = 0;
+
+	while (value && bucket < EVENT_BASE_STATS_NBUCKETS - 1) {
+		value >>= 1;
+		++bucket;
+	}
+	++hist[bucket];
+}
+
+void
+event_base_record_dispatch_events_(struct event_base *base, int n)
+{
+	event_stats_histogram_add(base->stats.dispatch_events,
+	    n > 0 ? (ev_uint64_t)n : 0);
+}
+
+int
+event_base_set_stats_timing(struct event_base *base, int enable)
+{
+	if (!base)
+		return (-1);
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (enable && !base->active_marks) {
+		base->active_marks = mm_calloc(base->nactivequeues,
+		    sizeof(struct event_active_marks));
+		if (!base->active_marks) {
+			EVBASE_RELEASE_LOCK(base, th_base_lock);
+			return (-1);
+		}
+	} else if (!enable && base->active_marks) {
+		mm_free(base->active_marks);
+		base->active_marks = NULL;
+	}
+	base->stats_timing = enable != 0;
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	return (0);
+}
+
+int
+event_base_get_stats(struct event_base *base, struct event_base_stats *stats,
+    int clear)
+{
+	if (!base || !stats)
+		return (-1);
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	*stats = base->stats;
+	if (clear)
+		memset(&base->stats, 0, sizeof(base->stats));
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	return (0);
+}
+
+/* The callback profiler keeps an open-addressing hash table, keyed on
+ * callback function and kind.  It is never resized, so that recording a
+ * callback never allocates; once it is 3/4 full, new callbacks are just
+ * counted as dropped. */
+#define EVENT_PROFILE_NSLOTS 1024
+#define EVENT_PROFILE_MAX_USED (EVENT_PROFILE_NSLOTS / 4 * 3)
+
+struct event_profile {
+	int n_used;
+	ev_uint64_t dropped;
+	struct event_profile_entry slots[EVENT_PROFILE_NSLOTS];
+};
+
+static const char *event_profile_kind_names[] = {
+	"event", "deferred", "finalize", "bufferevent", "evhttp", "evdns"
+};
+
+static inline unsigned
+event_profile_hash(void (*fn)(void), int kind)
+{
+	ev_uintptr_t p = (ev_uintptr_t)fn;
+	return (unsigned)(((p >> 3) ^ (p >> 17) ^ (ev_uintptr_t)kind) *
+	    2654435761u) & (EVENT_PROFILE_NSLOTS - 1);
+}
+
+static int
+event_profile_kind_of(const struct event_callback *evcb)
+{
+	switch (evcb->evcb_closure) {
+	case EV_CLOSURE_CB_SELF:
+		return EVENT_PROFILE_KIND_DEFERRED;
+	case EV_CLOSURE_CB_FINALIZE:
+	case EV_CLOSURE_EVENT_FINALIZE:
+	case EV_CLOSURE_EVENT_FINALIZE_FREE:
+		return EVENT_PROFILE_KIND_FINALIZE;
+	default:
+		return EVENT_PROFILE_KIND_EVENT;
+	}
+}
+
+/* Charge nsec nanoseconds to fn.  Requires th_base_lock. */
+static void
+event_profile_record(struct event_profile *prof, void (*fn)(void), int kind,
+    ev_uint64_t nsec)
+{
+	unsigned i = event_profile_hash(fn, kind);
+	struct event_profile_entry *e;
+
+	for (;;) {
+		e = &prof->slots[i];
+		if (e->callback == fn && e->kind == kind)
+			break;
+		if (e->callback == NULL) {
+			if (prof->n_used >= EVENT_PROFILE_MAX_USED) {
+				++prof->dropped;
+				return;
+			}
+			++prof->n_used;
+			e->callback = fn;
+			e->kind = kind;
+			break;
+		}
+		i = (i + 1) & (EVENT_PROFILE_NSLOTS - 1);
+	}
+
+	++e->calls;
+	e->total_nsec += nsec;
+	if (nsec > e->max_nsec)
+		e->max_nsec = nsec;
+}
+
+int
+event_base_profile_start(struct event_base *base)
+{
+	int r = 0;
+
+	if (!base)
+		return (-1);
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (base->profile == NULL)
+		base->profile = mm_calloc(1, sizeof(struct event_profile));
+	else
+		memset(base->profile, 0, sizeof(struct event_profile));
+	if (base->profile == NULL) {
+		event_warn("%s: calloc", __func__);
+		r = -1;
+	} else {
+		base->profiling = 1;
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	return (r);
+}
+
+int
+event_base_profile_stop(struct event_base *base)
+{
+	if (!base)
+		return (-1);
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	base->profiling = 0;
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	return (0);
+}
+
+void
+event_base_profile_note_(struct event_base *base, void (*fn)(void), int kind)
+{
+	/* Only the loop thread reads or writes the note, so we don't need
+	 * the lock; a stale read of 'profiling' costs at most one sample. */
+	ev_uint64_t now;
+
+	if (!base || !base->profiling || !EVBASE_IN_THREAD(base) ||
+	    base->current_event == NULL || base->profile_note_fn == NULL)
+		return;
+
+	/* A callback such as a bufferevent's deferred one may run several
+	 * user callbacks: each gets the time from its note to the next.
+	 * Whatever came before the first note goes to the first one. */
+	now = evutil_monotonic_nsec_();
+	if (base->profile_noted) {
+		EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+		if (base->profiling)
+			event_profile_record(base->profile,
+			    base->profile_note_fn, base->profile_note_kind,
+			    now - base->profile_note_start);
+		EVBASE_RELEASE_LOCK(base, th_base_lock);
+		base->profile_note_start = now;
+	}
+	base->profile_noted = 1;
+	base->profile_note_fn = fn;
+	base->profile_note_kind = kind;
+}
+
+static int
+compare_profile_entries(const void *a_, const void *b_)
+{
+	const struct event_profile_entry *a = a_, *b = b_;
+
+	if (a->total_nsec != b->total_nsec)
+		return a->total_nsec < b->total_nsec ? 1 : -1;
+	return a->calls < b->calls ? 1 : a->calls > b->calls ? -1 : 0;
+}
+
+/* Return a sorted copy of every entry in base's profile, and store their
+ * number in *n_out, and the number of dropped callbacks in *dropped_out.
+ * Returns NULL, with *n_out set to 0, if there is nothing to return. */
+static struct event_profile_entry *
+event_profile_snapshot(struct event_base *base, int *n_out,
+    ev_uint64_t *dropped_out)
+{
+	struct event_profile_entry *entries = NULL;
+	int i, n = 0;
+
+	*dropped_out = 0;
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (base->profile && base->profile->n_used) {
+		entries = mm_calloc(base->profile->n_used,
+		    sizeof(struct event_profile_entry));
+		if (entries) {
+			for (i = 0; i < EVENT_PROFILE_NSLOTS; ++i) {
+				if (base->profile->slots[i].callback)
+					entries[n++] = base->profile->slots[i];
+			}
+		}
+		*dropped_out = base->profile->dropped;
+	}
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	if (entries)
+		qsort(entries, n, sizeof(struct event_profile_entry),
+		    compare_profile_entries);
+	*n_out = n;
+	return entries;
+}
+
+int
+event_base_profile_get_top(struct event_base *base,
+    struct event_profile_entry *entries, int n)
+{
+	struct event_profile_entry *all;
+	ev_uint64_t dropped;
+	int n_all;
+
+	if (!base || n < 0 || (n > 0 && !entries))
+		return (-1);
+
+	all = event_profile_snapshot(base, &n_all, &dropped);
+	if (n > n_all)
+		n = n_all;
+	if (n)
+		memcpy(entries, all, n * sizeof(struct event_profile_entry));
+	if (all)
+		mm_free(all);
+
+	return (n);
+}
+
+int
+event_base_profile_dump(struct event_base *base, FILE *output, int n)
+{
+	struct event_profile_entry *all;
+	ev_uint64_t dropped;
+	int i, n_all;
+
+	if (!base || !output || n < 0)
+		return (-1);
+
+	all = event_profile_snapshot(base, &n_all, &dropped);
+	if (n > n_all)
+		n = n_all;
+
+	fprintf(output, "%-11s %10s %12s %10s %10s  %s\n", "kind", "calls",
+	    "total_usec", "avg_usec", "max_usec", "callback");
+	for (i = 0; i < n; ++i) {
+		const struct event_profile_entry *e = &all[i];
+		void *addr = (void *)e->callback;
+#ifdef EVENT__HAVE_DLADDR
+		Dl_info info;
+#endif
+
+		fprintf(output, "%-11s %10lu %12.1f %10.1f %10.1f  ",
+		    event_profile_kind_names[e->kind],
+		    (unsigned long)e->calls, e->total_nsec / 1000.0,
+		    e->total_nsec / 1000.0 / e->calls, e->max_nsec / 1000.0);
+#ifdef EVENT__HAVE_DLADDR
+		if (dladdr(addr, &info) && info.dli_sname) {
+			if (info.dli_saddr == addr)
+				fprintf(output, "%s\n", info.dli_sname);
+			else
+				fprintf(output, "%s+0x%lx\n", info.dli_sname,
+				    (unsigned long)((char *)addr -
+					(char *)info.dli_saddr));
+			continue;
+		}
+#endif
+		fprintf(output, "%p\n", addr);
+	}
+	if (dropped)
+		fprintf(output, "(%lu calls to other callbacks not counted: "
+		    "table full)\n", (unsigned long)dropped);
+
+	if (all)
+		mm_free(all);
+
+	return (0);
+}
+
 /* Returns true iff we're currently watching any events. */
 static int
 event_haveevents(struct event_base *base)
@@ -1642,6 +2043,12 @@ event_process_active_single_queue(struct event_base *base,
 
 	for (evcb = TAILQ_FIRST(activeq); evcb; evcb = TAILQ_FIRST(activeq)) {
 		struct event *ev=NULL;
+		ev_uint64_t started = 0;
+		ev_uint32_t active_time = 0;
+		void (*prof_fn)(void) = NULL;
+		int prof_kind = 0;
+		if (base->active_marks)
+			active_time = event_active_time(base, evcb);
 		if (evcb->evcb_flags & EVLIST_INIT) {
 			ev = event_callback_to_event(evcb);
 
@@ -1666,6 +2073,27 @@ event_process_active_single_queue(struct event_base *base,
 		if (!(evcb->evcb_flags & EVLIST_INTERNAL))
 			++count;
 
+		++base->stats.callbacks_run[
+		    evcb->evcb_pri < EVENT_BASE_STATS_NPRIORITIES ?
+		    evcb->evcb_pri : EVENT_BASE_STATS_NPRIORITIES - 1];
+		if (base->profiling) {
+			/* Take these now: the callback may free evcb. */
+			prof_fn = (void (*)(void))
+			    evcb->evcb_cb_union.evcb_callback;
+			prof_kind = event_profile_kind_of(evcb);
+		}
+		if (base->stats_timing || prof_fn) {
+			started = evutil_monotonic_nsec_();
+			if (active_time)
+				event_stats_histogram_add(
+				    base->stats.queue_delay_nsec,
+				    (ev_uint32_t)((ev_uint32_t)started -
+					active_time));
+		}
+		base->profile_note_fn = prof_fn;
+		base->profile_note_kind = prof_kind;
+		base->profile_noted = 0;
+		base->profile_note_start = started;
 
 		base->current_event = evcb;
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
@@ -1709,7 +2137,7 @@ event_process_active_single_queue(struct event_base *base,
 			event_debug_note_teardown_(ev);
 			evcb_evfinalize(ev, ev->ev_arg);
 			if (evcb_closure == EV_CLOSURE_EVENT_FINALIZE_FREE)
-				mm_free(ev);
+				event_base_obj_free_(base, ev);
 		}
 		break;
 		case EV_CLOSURE_CB_FINALIZE: {
@@ -1725,6 +2153,18 @@ event_process_active_single_queue(struct event_base *base,
 		}
 
 		EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+		if (started) {
+			ev_uint64_t now = evutil_monotonic_nsec_();
+			if (base->stats_timing)
+				event_stats_histogram_add(
+				    base->stats.callback_nsec, now - started);
+			if (base->profile_note_fn && base->profiling)
+				event_profile_record(base->profile,
+				    base->profile_note_fn,
+				    base->profile_note_kind,
+				    now - base->profile_note_start);
+		}
+		base->profile_note_fn = NULL;
 		base->current_event = NULL;
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
 		if (base->current_event_waiters) {
@@ -1966,6 +2406,10 @@ event_base_loop(struct event_base *base, int flags)
 			break;
 		}
 
+		++base->stats.loop_iterations;
+
+		event_base_schedule_posted_(base);
+
 		tv_p = &tv;
 		if (!N_ACTIVE_CALLBACKS(base) && !(flags & EVLOOP_NONBLOCK)) {
 			timeout_next(base, &tv_p);
@@ -1989,7 +2433,19 @@ event_base_loop(struct event_base *base, int flags)
 
 		clear_time_cache(base);
 
-		res = evsel->dispatch(base, tv_p);
+		res = 0;
+		if (evutil_timerisset(&base->busy_poll_budget) &&
+		    (tv_p == NULL || evutil_timerisset(tv_p)))
+			res = event_base_busy_poll(base, &tv_p);
+		if (res == 0) {
+			ev_uint64_t started = 0;
+			if (base->stats_timing)
+				started = evutil_monotonic_nsec_();
+			res = evsel->dispatch(base, tv_p);
+			if (started)
+				base->stats.dispatch_nsec +=
+				    evutil_monotonic_nsec_() - started;
+		}
 
 		if (res == -1) {
 			event_debug(("%s: dispatch returned unsuccessfully.",
@@ -2002,6 +2458,8 @@ event_base_loop(struct event_base *base, int flags)
 
 		timeout_process(base);
 
+		event_base_schedule_posted_(base);
+
 		if (N_ACTIVE_CALLBACKS(base)) {
 			int n = event_process_active(base);
 			if ((flags & EVLOOP_ONCE)
@@ -2022,6 +2480,52 @@ done:
 	return (retval);
 }
 
+/* Helper for event_base_loop: poll the backend without blocking until
+ * something becomes active or base->busy_poll_budget runs out, but never
+ * past the timeout in *tv_p.  Returns -1 if dispatch failed, 1 if the spin
+ * found work, and 0 if it didn't; in that case *tv_p is reduced by the time
+ * spent spinning, so that the caller can block for the remainder. */
+static int
+event_base_busy_poll(struct event_base *base, struct timeval **tv_p)
+{
+	const struct eventop *evsel = base->evsel;
+	struct timeval zero, start, now, deadline, limit;
+
+	evutil_timerclear(&zero);
+	if (evutil_gettime_monotonic_(&base->monotonic_timer, &start) < 0)
+		return (0);
+	evutil_timeradd(&start, &base->busy_poll_budget, &deadline);
+	if (*tv_p) {
+		evutil_timeradd(&start, *tv_p, &limit);
+		if (evutil_timercmp(&limit, &deadline, <))
+			deadline = limit;
+	}
+
+	do {
+		if (evsel->dispatch(base, &zero) == -1)
+			return (-1);
+		/* A pending notify means another thread changed something we
+		 * care about, like the next timeout; go back and look. */
+		if (N_ACTIVE_CALLBACKS(base) || base->is_notify_pending ||
+		    base->event_break || base->event_gotterm) {
+			++base->stats.busy_poll_hits;
+			return (1);
+		}
+		evutil_gettime_monotonic_(&base->monotonic_timer, &now);
+	} while (evutil_timercmp(&now, &deadline, <));
+
+	++base->stats.busy_poll_misses;
+	if (*tv_p) {
+		struct timeval spent;
+		evutil_timersub(&now, &start, &spent);
+		if (evutil_timercmp(*tv_p, &spent, >))
+			evutil_timersub(*tv_p, &spent, *tv_p);
+		else
+			evutil_timerclear(*tv_p);
+	}
+	return (0);
+}
+
 /* One-time callback to implement event_base_once: invokes the user callback,
  * then deletes the allocated storage */
 static void
@@ -2034,7 +2538,7 @@ event_once_cb(evutil_socket_t fd, short events, void *arg)
 	LIST_REMOVE(eonce, next_once);
 	EVBASE_RELEASE_LOCK(eonce->ev.ev_base, th_base_lock);
 	event_debug_unassign(&eonce->ev);
-	mm_free(eonce);
+	event_base_obj_free_(eonce->ev.ev_base, eonce);
 }
 
 /* not threadsafe, event scheduled once. */
@@ -2064,7 +2568,7 @@ event_base_once(struct event_base *base, evutil_socket_t fd, short events,
 	if (events & (EV_SIGNAL|EV_PERSIST))
 		return (-1);
 
-	if ((eonce = mm_calloc(1, sizeof(struct event_once))) == NULL)
+	if ((eonce = event_base_obj_calloc_(base, sizeof(struct event_once))) == NULL)
 		return (-1);
 
 	eonce->cb = callback;
@@ -2086,7 +2590,7 @@ event_base_once(struct event_base *base, evutil_socket_t fd, short events,
 		event_assign(&eonce->ev, base, fd, events, event_once_cb, eonce);
 	} else {
 		/* Bad event combination */
-		mm_free(eonce);
+		event_base_obj_free_(base, eonce);
 		return (-1);
 	}
 
@@ -2098,7 +2602,8 @@ event_base_once(struct event_base *base, evutil_socket_t fd, short events,
 			res = event_add_nolock_(&eonce->ev, tv, 0);
 
 		if (res != 0) {
-			mm_free(eonce);
+			EVBASE_RELEASE_LOCK(base, th_base_lock);
+			event_base_obj_free_(base, eonce);
 			return (res);
 		} else {
 			LIST_INSERT_HEAD(&base->once_events, eonce, next_once);
@@ -2109,6 +2614,76 @@ event_base_once(struct event_base *base, evutil_socket_t fd, short events,
 	return (0);
 }
 
+struct event_post {
+	struct mpsc_node node;
+	void (*cb)(void *);
+	void *arg;
+};
+
+int
+event_base_post(struct event_base *base, void (*cb)(void *), void *arg)
+{
+	struct event_post *post;
+	int was_empty;
+
+	if (base == NULL || cb == NULL)
+		return (-1);
+
+	if ((post = mm_malloc(sizeof(struct event_post))) == NULL)
+		return (-1);
+	post->cb = cb;
+	post->arg = arg;
+
+#ifdef MPSC_NEEDS_LOCK_
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+#endif
+	was_empty = mpsc_push_(&base->posted, &post->node);
+#ifdef MPSC_NEEDS_LOCK_
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+#endif
+
+	/* Only the post that makes the queue non-empty needs to wake up the
+	 * loop, and only if nobody else has done so already: everything
+	 * queued behind it is picked up by the same wakeup. */
+	if (was_empty && base->th_notify_fn != NULL &&
+	    !MPSC_XCHG_INT_(&base->is_notify_pending, 1))
+		base->th_notify_fn(base);
+
+	return (0);
+}
+
+/* Called from the loop with the lock held: make sure that anything which
+ * has been posted will get run in this iteration. */
+static void
+event_base_schedule_posted_(struct event_base *base)
+{
+	EVENT_BASE_ASSERT_LOCKED(base);
+	if (!mpsc_empty_(&base->posted))
+		event_callback_activate_nolock_(base, &base->posted_cb);
+}
+
+static void
+event_base_run_posted_(struct event_callback *evcb, void *arg)
+{
+	struct event_base *base = arg;
+	struct mpsc_node *node;
+
+#ifdef MPSC_NEEDS_LOCK_
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+#endif
+	node = mpsc_take_all_(&base->posted);
+#ifdef MPSC_NEEDS_LOCK_
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+#endif
+
+	while (node) {
+		struct event_post *post = (struct event_post *)node;
+		node = node->next;
+		post->cb(post->arg);
+		mm_free(post);
+	}
+}
+
 int
 event_assign(struct event *ev, struct event_base *base, evutil_socket_t fd, short events, void (*callback)(evutil_socket_t, short, void *), void *arg)
 {
@@ -2166,6 +2741,10 @@ event_base_set(struct event_base *base, struct event *ev)
 	/* Only innocent events may be assigned to a different base */
 	if (ev->ev_flags != EVLIST_INIT)
 		return (-1);
+	/* An event from event_new() must be freed on the base it was
+	 * allocated from; we can't tell whether ev is one. */
+	if (!event_base_obj_movable_(ev->ev_base, base))
+		return (-1);
 
 	event_debug_assert_is_setup_(ev);
 
@@ -2208,11 +2787,13 @@ struct event *
 event_new(struct event_base *base, evutil_socket_t fd, short events, void (*cb)(evutil_socket_t, short, void *), void *arg)
 {
 	struct event *ev;
-	ev = mm_malloc(sizeof(struct event));
+	if (base == NULL)
+		base = current_base;
+	ev = event_base_obj_calloc_(base, sizeof(struct event));
 	if (ev == NULL)
 		return (NULL);
 	if (event_assign(ev, base, fd, events, cb, arg) < 0) {
-		mm_free(ev);
+		event_base_obj_free_(base, ev);
 		return (NULL);
 	}
 
@@ -2229,8 +2810,46 @@ event_free(struct event *ev)
 	/* make sure that this event won't be coming back to haunt us. */
 	event_del(ev);
 	event_debug_note_teardown_(ev);
-	mm_free(ev);
+	event_base_obj_free_(ev->ev_base, ev);
+
+}
 
+void *
+event_base_obj_calloc_(struct event_base *base, size_t size)
+{
+	void *ptr;
+
+	if (base == NULL || !(base->flags & EVENT_BASE_FLAG_SLAB_ALLOC))
+		return mm_calloc(1, size);
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	ptr = event_slab_alloc_(&base->slab, size);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return ptr;
+}
+
+void
+event_base_obj_free_(struct event_base *base, void *ptr)
+{
+	if (ptr == NULL)
+		return;
+	if (base == NULL || !(base->flags & EVENT_BASE_FLAG_SLAB_ALLOC)) {
+		mm_free(ptr);
+		return;
+	}
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	event_slab_free_(ptr);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+}
+
+int
+event_base_obj_movable_(struct event_base *from, struct event_base *to)
+{
+	if (from == to)
+		return 1;
+	return !(from && (from->flags & EVENT_BASE_FLAG_SLAB_ALLOC)) &&
+	    !(to && (to->flags & EVENT_BASE_FLAG_SLAB_ALLOC));
 }
 
 void
@@ -2543,9 +3162,9 @@ evthread_notify_base(struct event_base *base)
 	EVENT_BASE_ASSERT_LOCKED(base);
 	if (!base->th_notify_fn)
 		return -1;
-	if (base->is_notify_pending)
+	/* event_base_post() sets this flag without holding the lock. */
+	if (MPSC_XCHG_INT_(&base->is_notify_pending, 1))
 		return 0;
-	base->is_notify_pending = 1;
 	return base->th_notify_fn(base);
 }
 
@@ -2625,7 +3244,8 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 	 * prepare for timeout insertion further below, if we get a
 	 * failure on any step, we should not change any state.
 	 */
-	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT)) {
+	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT) &&
+	    !EVBASE_USES_TIMER_WHEEL(base)) {
 		if (min_heap_reserve_(&base->timeheap,
 			1 + min_heap_size_(&base->timeheap)) == -1)
 			return (-1);  /* ENOMEM == errno */
@@ -2740,6 +3360,11 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 			if (ev == TAILQ_FIRST(&ctl->events)) {
 				common_timeout_schedule(ctl, &now, ev);
 			}
+		} else if (EVBASE_USES_TIMER_WHEEL(base)) {
+			/* The wheel can't cheaply tell us whether this is
+			 * now the earliest timeout, so always wake up the
+			 * main thread and let it recompute its wait. */
+			notify = 1;
 		} else {
 			struct event* top = NULL;
 			/* See if the earliest timeout is now earlier than it
@@ -3105,10 +3730,41 @@ event_deferred_cb_init_(struct event_callback *cb, ev_uint8_t priority, deferred
 	cb->evcb_closure = EV_CLOSURE_CB_SELF;
 }
 
-void
-event_deferred_cb_set_priority_(struct event_callback *cb, ev_uint8_t priority)
+int
+event_deferred_cb_set_priority_(struct event_base *base,
+    struct event_callback *cb, ev_uint8_t priority)
 {
-	cb->evcb_pri = priority;
+	int r = -1;
+	if (!base)
+		base = current_base;
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	if (priority >= base->nactivequeues)
+		goto done;
+	if (cb->evcb_flags & EVLIST_ACTIVE) {
+		/* The queue it is on depends on its priority. */
+		event_queue_remove_active(base, cb);
+		cb->evcb_pri = priority;
+		event_queue_insert_active(base, cb);
+	} else {
+		cb->evcb_pri = priority;
+	}
+	r = 0;
+done:
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return r;
+}
+
+int
+event_deferred_cb_is_scheduled_(struct event_base *base,
+    struct event_callback *cb)
+{
+	int r;
+	if (!base)
+		base = current_base;
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	r = (cb->evcb_flags & (EVLIST_ACTIVE|EVLIST_ACTIVE_LATER)) != 0;
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return r;
 }
 
 void
@@ -3144,16 +3800,25 @@ timeout_next(struct event_base *base, struct timeval **tv_p)
 {
 	/* Caller must hold th_base_lock */
 	struct timeval now;
-	struct event *ev;
+	struct timeval next;
+	struct event *ev = NULL;
 	struct timeval *tv = *tv_p;
 	int res = 0;
 
-	ev = min_heap_top_(&base->timeheap);
+	if (EVBASE_USES_TIMER_WHEEL(base)) {
+		if (timer_wheel_next_timeout_(&base->timewheel, &next) < 0) {
+			*tv_p = NULL;
+			goto out;
+		}
+	} else {
+		ev = min_heap_top_(&base->timeheap);
 
-	if (ev == NULL) {
-		/* if no time-based events are active wait for I/O */
-		*tv_p = NULL;
-		goto out;
+		if (ev == NULL) {
+			/* if no time-based events are active wait for I/O */
+			*tv_p = NULL;
+			goto out;
+		}
+		next = ev->ev_timeout;
 	}
 
 	if (gettime(base, &now) == -1) {
@@ -3161,12 +3826,12 @@ timeout_next(struct event_base *base, struct timeval **tv_p)
 		goto out;
 	}
 
-	if (evutil_timercmp(&ev->ev_timeout, &now, <=)) {
+	if (evutil_timercmp(&next, &now, <=)) {
 		evutil_timerclear(tv);
 		goto out;
 	}
 
-	evutil_timersub(&ev->ev_timeout, &now, tv);
+	evutil_timersub(&next, &now, tv);
 
 	EVUTIL_ASSERT(tv->tv_sec >= 0);
 	EVUTIL_ASSERT(tv->tv_usec >= 0);
@@ -3184,6 +3849,23 @@ timeout_process(struct event_base *base)
 	struct timeval now;
 	struct event *ev;
 
+	if (EVBASE_USES_TIMER_WHEEL(base)) {
+		if (timer_wheel_empty_(&base->timewheel))
+			return;
+
+		gettime(base, &now);
+		timer_wheel_advance_(&base->timewheel, &now);
+
+		while ((ev = timer_wheel_expired_(&base->timewheel))) {
+			event_del_nolock_(ev, EVENT_DEL_NOBLOCK);
+
+			event_debug(("timeout_process: event: %p, call %p",
+				 ev, ev->ev_callback));
+			event_active_nolock_(ev, EV_TIMEOUT, 1);
+		}
+		return;
+	}
+
 	if (min_heap_empty_(&base->timeheap)) {
 		return;
 	}
@@ -3232,6 +3914,72 @@ event_queue_remove_inserted(struct event_base *base, struct event *ev)
 	DECR_EVENT_COUNT(base, ev->ev_flags);
 	ev->ev_flags &= ~EVLIST_INSERTED;
 }
+/* Note that evcb, just appended to its active queue, was made active at
+ * 'now' (never 0).  Callbacks made active within a microsecond of the
+ * newest run join it rather than taking a mark of their own. */
+static void
+event_active_mark(struct event_base *base, struct event_callback *evcb,
+    ev_uint32_t now)
+{
+	struct event_active_marks *m = &base->active_marks[evcb->evcb_pri];
+	int i;
+
+	if (m->n) {
+		i = (m->first + m->n - 1) % EVENT_ACTIVE_MARKS;
+		if (m->n == EVENT_ACTIVE_MARKS || now - m->time[i] < 1000)
+			return;
+	}
+	i = (m->first + m->n) % EVENT_ACTIVE_MARKS;
+	m->evcb[i] = evcb;
+	m->time[i] = now;
+	++m->n;
+}
+
+/* Return when evcb, at the head of its active queue, was made active, or 0
+ * if it was queued before we started keeping track. */
+static ev_uint32_t
+event_active_time(struct event_base *base, struct event_callback *evcb)
+{
+	struct event_active_marks *m = &base->active_marks[evcb->evcb_pri];
+
+	if (m->n && m->evcb[m->first] == evcb)
+		return m->time[m->first];
+	return 0;
+}
+
+/* evcb is about to leave its active queue.  If a run starts at it, the
+ * run now starts at the callback after it, unless that one starts a run
+ * of its own or there is none. */
+static void
+event_active_unmark(struct event_base *base, struct event_callback *evcb)
+{
+	struct event_active_marks *m = &base->active_marks[evcb->evcb_pri];
+	struct event_callback *next = TAILQ_NEXT(evcb, evcb_active_next);
+	int i, j, k;
+
+	for (i = 0; i < m->n; ++i) {
+		j = (m->first + i) % EVENT_ACTIVE_MARKS;
+		if (m->evcb[j] != evcb)
+			continue;
+		k = (j + 1) % EVENT_ACTIVE_MARKS;
+		if (next && !(i + 1 < m->n && m->evcb[k] == next)) {
+			m->evcb[j] = next;
+		} else if (i == 0) {
+			m->first = k;
+			--m->n;
+		} else {
+			for (; i + 1 < m->n; ++i) {
+				j = (m->first + i) % EVENT_ACTIVE_MARKS;
+				k = (j + 1) % EVENT_ACTIVE_MARKS;
+				m->evcb[j] = m->evcb[k];
+				m->time[j] = m->time[k];
+			}
+			--m->n;
+		}
+		return;
+	}
+}
+
 static void
 event_queue_remove_active(struct event_base *base, struct event_callback *evcb)
 {
@@ -3245,6 +3993,8 @@ event_queue_remove_active(struct event_base *base, struct event_callback *evcb)
 	evcb->evcb_flags &= ~EVLIST_ACTIVE;
 	base->event_count_active--;
 
+	if (base->active_marks)
+		event_active_unmark(base, evcb);
 	TAILQ_REMOVE(&base->activequeues[evcb->evcb_pri],
 	    evcb, evcb_active_next);
 }
@@ -3280,6 +4030,8 @@ event_queue_remove_timeout(struct event_base *base, struct event *ev)
 		    get_common_timeout_list(base, &ev->ev_timeout);
 		TAILQ_REMOVE(&ctl->events, ev,
 		    ev_timeout_pos.ev_next_with_common_timeout);
+	} else if (EVBASE_USES_TIMER_WHEEL(base)) {
+		timer_wheel_erase_(&base->timewheel, ev);
 	} else {
 		min_heap_erase_(&base->timeheap, ev);
 	}
@@ -3309,15 +4061,26 @@ event_queue_reinsert_timeout(struct event_base *base, struct event *ev,
 		ctl = base->common_timeout_queues[old_timeout_idx];
 		TAILQ_REMOVE(&ctl->events, ev,
 		    ev_timeout_pos.ev_next_with_common_timeout);
-		min_heap_push_(&base->timeheap, ev);
+		if (EVBASE_USES_TIMER_WHEEL(base))
+			timer_wheel_push_(&base->timewheel, ev);
+		else
+			min_heap_push_(&base->timeheap, ev);
 		break;
 	case 1: /* Wasn't common; has become common. */
-		min_heap_erase_(&base->timeheap, ev);
+		if (EVBASE_USES_TIMER_WHEEL(base))
+			timer_wheel_erase_(&base->timewheel, ev);
+		else
+			min_heap_erase_(&base->timeheap, ev);
 		ctl = get_common_timeout_list(base, &ev->ev_timeout);
 		insert_common_timeout_inorder(ctl, ev);
 		break;
 	case 0: /* was in heap; is still on heap. */
-		min_heap_adjust_(&base->timeheap, ev);
+		if (EVBASE_USES_TIMER_WHEEL(base)) {
+			timer_wheel_erase_(&base->timewheel, ev);
+			timer_wheel_push_(&base->timewheel, ev);
+		} else {
+			min_heap_adjust_(&base->timeheap, ev);
+		}
 		break;
 	default:
 		EVUTIL_ASSERT(0); /* unreachable */
@@ -3392,6 +4155,9 @@ event_queue_insert_active(struct event_base *base, struct event_callback *evcb)
 	EVUTIL_ASSERT(evcb->evcb_pri < base->nactivequeues);
 	TAILQ_INSERT_TAIL(&base->activequeues[evcb->evcb_pri],
 	    evcb, evcb_active_next);
+	if (base->active_marks)
+		event_active_mark(base, evcb,
+		    (ev_uint32_t)evutil_monotonic_nsec_() | 1);
 }
 
 static void
@@ -3430,6 +4196,8 @@ event_queue_insert_timeout(struct event_base *base, struct event *ev)
 		struct common_timeout_list *ctl =
 		    get_common_timeout_list(base, &ev->ev_timeout);
 		insert_common_timeout_inorder(ctl, ev);
+	} else if (EVBASE_USES_TIMER_WHEEL(base)) {
+		timer_wheel_push_(&base->timewheel, ev);
 	} else {
 		min_heap_push_(&base->timeheap, ev);
 	}
@@ -3439,13 +4207,18 @@ static void
 event_queue_make_later_events_active(struct event_base *base)
 {
 	struct event_callback *evcb;
+	ev_uint32_t now = 0;
 	EVENT_BASE_ASSERT_LOCKED(base);
 
+	if (base->active_marks && !TAILQ_EMPTY(&base->active_later_queue))
+		now = (ev_uint32_t)evutil_monotonic_nsec_() | 1;
 	while ((evcb = TAILQ_FIRST(&base->active_later_queue))) {
 		TAILQ_REMOVE(&base->active_later_queue, evcb, evcb_active_next);
 		evcb->evcb_flags = (evcb->evcb_flags & ~EVLIST_ACTIVE_LATER) | EVLIST_ACTIVE;
 		EVUTIL_ASSERT(evcb->evcb_pri < base->nactivequeues);
 		TAILQ_INSERT_TAIL(&base->activequeues[evcb->evcb_pri], evcb, evcb_active_next);
+		if (now)
+			event_active_mark(base, evcb, now);
 		base->n_deferreds_queued += (evcb->evcb_closure == EV_CLOSURE_CB_SELF);
 	}
 }
@@ -3475,6 +4248,84 @@ event_get_method(void)
 	return (current_base->evsel->name);
 }
 
+/* Thread cache support.
+ *
+ * Each thread keeps its own list of the caches it has put memory in, so
+ * that a thread only ever touches its own caches: when it exits, and when
+ * it calls event_set_mem_functions() or libevent_global_shutdown().
+ */
+#if defined(EVENT__DISABLE_THREAD_SUPPORT)
+#define THREAD_CACHES_STORAGE static
+#elif defined(_MSC_VER)
+#define THREAD_CACHES_STORAGE static __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__) || defined(__SUNPRO_C)
+#define THREAD_CACHES_STORAGE static __thread
+#endif
+
+#ifdef THREAD_CACHES_STORAGE
+struct event_thread_caches {
+	/** The caches this thread has put memory in. */
+	struct event_thread_cache_ *head;
+	/** 1 once we will hear about this thread exiting; -1 once it has
+	 * begun to exit, after which no cache may be used. */
+	int exit_hooked;
+};
+THREAD_CACHES_STORAGE struct event_thread_caches thread_caches;
+
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+static void
+event_thread_caches_thread_exit(void *arg)
+{
+	struct event_thread_cache_ *cache;
+
+	thread_caches.exit_hooked = -1;
+	while ((cache = thread_caches.head) != NULL) {
+		thread_caches.head = cache->next;
+		cache->listed = 0;
+		cache->empty(cache);
+	}
+}
+#endif
+#endif
+
+int
+event_thread_cache_usable_(struct event_thread_cache_ *cache,
+    void (*empty)(struct event_thread_cache_ *))
+{
+#ifdef THREAD_CACHES_STORAGE
+	if (cache->listed)
+		return 1;
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+	if (thread_caches.exit_hooked == 0 &&
+	    evthread_at_thread_exit_(event_thread_caches_thread_exit,
+		NULL) == 0)
+		thread_caches.exit_hooked = 1;
+	if (thread_caches.exit_hooked <= 0)
+		return 0;
+#endif
+	cache->empty = empty;
+	cache->next = thread_caches.head;
+	thread_caches.head = cache;
+	cache->listed = 1;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Empty the calling thread's caches.  They stay on its list, to be emptied
+ * again when it exits. */
+static void
+event_thread_caches_empty(void)
+{
+#ifdef THREAD_CACHES_STORAGE
+	struct event_thread_cache_ *cache;
+
+	for (cache = thread_caches.head; cache; cache = cache->next)
+		cache->empty(cache);
+#endif
+}
+
 #ifndef EVENT__DISABLE_MM_REPLACEMENT
 static void *(*mm_malloc_fn_)(size_t sz) = NULL;
 static void *(*mm_realloc_fn_)(void *p, size_t sz) = NULL;
@@ -3572,6 +4423,9 @@ event_set_mem_functions(void *(*malloc_fn)(size_t sz),
 			void *(*realloc_fn)(void *ptr, size_t sz),
 			void (*free_fn)(void *ptr))
 {
+	/* Cached memory belongs to the old allocator.  No other thread
+	 * should be using Libevent yet, so ours is the only cache. */
+	event_thread_caches_empty();
 	mm_malloc_fn_ = malloc_fn;
 	mm_realloc_fn_ = realloc_fn;
 	mm_free_fn_ = free_fn;
@@ -3591,7 +4445,10 @@ evthread_notify_drain_eventfd(evutil_socket_t fd, short what, void *arg)
 		event_sock_warn(fd, "Error reading from eventfd");
 	}
 	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
-	base->is_notify_pending = 0;
+	MPSC_STORE_INT_(&base->is_notify_pending, 0);
+	/* Anything posted before we cleared the flag did not wake us up, so
+	 * pick it up now. */
+	event_base_schedule_posted_(base);
 	EVBASE_RELEASE_LOCK(base, th_base_lock);
 }
 #endif
@@ -3610,7 +4467,10 @@ evthread_notify_drain_default(evutil_socket_t fd, short what, void *arg)
 #endif
 
 	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
-	base->is_notify_pending = 0;
+	MPSC_STORE_INT_(&base->is_notify_pending, 0);
+	/* Anything posted before we cleared the flag did not wake us up, so
+	 * pick it up now. */
+	event_base_schedule_posted_(base);
 	EVBASE_RELEASE_LOCK(base, th_base_lock);
 }
 
@@ -3700,6 +4560,16 @@ event_base_foreach_event_nolock_(struct event_base *base,
 			return r;
 	}
 
+	/* ... or in the timing wheel. */
+	if (EVBASE_USES_TIMER_WHEEL(base)) {
+		TIMER_WHEEL_FOREACH(ev, &base->timewheel, i) {
+			if (ev->ev_flags & EVLIST_INSERTED)
+				continue;
+			if ((r = fn(base, ev, arg)))
+				return r;
+		}
+	}
+
 	/* Now for the events in one of the timeout queues.
 	 * the min-heap. */
 	for (i = 0; i < base->n_common_timeouts; ++i) {
@@ -3844,6 +4714,13 @@ event_base_active_by_fd(struct event_base *base, evutil_socket_t fd, short event
 			}
 		}
 
+		if (EVBASE_USES_TIMER_WHEEL(base)) {
+			TIMER_WHEEL_FOREACH(ev, &base->timewheel, i) {
+				if (ev->ev_fd == fd)
+					event_active_nolock_(ev, EV_TIMEOUT, 1);
+			}
+		}
+
 		for (i = 0; i < base->n_common_timeouts; ++i) {
 			struct common_timeout_list *ctl = base->common_timeout_queues[i];
 			TAILQ_FOREACH(ev, &ctl->events,
@@ -3920,11 +4797,18 @@ event_free_evutil_globals(void)
 	evutil_free_globals_();
 }
 
+static void
+event_free_evbuffer_globals(void)
+{
+	evbuffer_free_globals_();
+}
+
 static void
 event_free_globals(void)
 {
 	event_free_debug_globals();
 	event_free_evsig_globals();
+	event_free_evbuffer_globals();
 	event_free_evutil_globals();
 }
 
@@ -3933,6 +4817,7 @@ libevent_global_shutdown(void)
 {
 	event_disable_debug_mode();
 	event_free_globals();
+	event_thread_caches_empty();
 }
 
 #ifndef EVENT__DISABLE_THREAD_SUPPORT
@@ -3944,6 +4829,8 @@ event_global_setup_locks_(const int enable_locks)
 #endif
 	if (evsig_global_setup_locks_(enable_locks) < 0)
 		return -1;
+	if (evbuffer_global_setup_locks_(enable_locks) < 0)
+		return -1;
 	if (evutil_global_setup_locks_(enable_locks) < 0)
 		return -1;
 	if (evutil_secure_rng_global_setup_locks_(enable_locks) < 0)
@@ -3980,6 +4867,23 @@ event_base_assert_ok_nolock_(struct event_base *base)
 		EVUTIL_ASSERT(ev->ev_timeout_pos.min_heap_idx == i);
 	}
 
+	/* Check the timing wheel */
+	if (EVBASE_USES_TIMER_WHEEL(base)) {
+		struct event *ev, **prev;
+		unsigned n = 0;
+		for (i = 0; i <= TIMER_WHEEL_NSLOTS; ++i) {
+			prev = &base->timewheel.slots[i];
+			for (ev = *prev; ev; ev = TIMER_WHEEL_NEXT_(ev)) {
+				EVUTIL_ASSERT(ev->ev_flags & EVLIST_TIMEOUT);
+				EVUTIL_ASSERT(!is_common_timeout(&ev->ev_timeout, base));
+				EVUTIL_ASSERT(TIMER_WHEEL_PREV_(ev) == prev);
+				prev = &TIMER_WHEEL_NEXT_(ev);
+				++n;
+			}
+		}
+		EVUTIL_ASSERT(n == timer_wheel_size_(&base->timewheel));
+	}
+
 	/* Check that the common timeouts are fine */
 	for (i = 0; i < base->n_common_timeouts; ++i) {
 		struct common_timeout_list *ctl = base->common_timeout_queues[i];
@@ -61,6 +61,9 @@ struct evmap_io {
 	ev_uint16_t nread;
 	ev_uint16_t nwrite;
 	ev_uint16_t nclose;
+	/* True once the entry has been constructed.  Only used by the flat
+	 * fd table, where every slot exists whether it is in use or not. */
+	ev_uint8_t in_use;
 };
 
 /* An entry for an evmap_signal list: notes all the events that want to know
@@ -71,10 +74,11 @@ struct evmap_signal {
 
 /* On some platforms, fds start at 0 and increment by 1 as they are
    allocated, and old numbers get used.  For these platforms, we
-   implement io maps just like signal maps: as an array of pointers to
-   struct evmap_io.  But on other platforms (windows), sockets are not
-   0-indexed, not necessarily consecutive, and not necessarily reused.
-   There, we use a hashtable to implement evmap_io.
+   implement io maps as a flat array indexed by fd, where each slot holds
+   a struct evmap_io followed by the backend's fdinfo.  But on other
+   platforms (windows), sockets are not 0-indexed, not necessarily
+   consecutive, and not necessarily reused.  There, we use a hashtable to
+   implement evmap_io.
 */
 #ifdef EVMAP_USE_HT
 struct event_map_entry {
@@ -178,22 +182,101 @@ void evmap_io_clear_(struct event_io_map *ctx)
 		(x) = (struct type *)((map)->entries[slot]);		\
 	} while (0)
 
-/* If we aren't using hashtables, then define the IO_SLOT macros and functions
-   as thin aliases over the SIGNAL_SLOT versions. */
+/* If we aren't using hashtables, then the IO_SLOT macros index straight
+   into the flat fd table.  A slot that has never been constructed reads as
+   NULL, just like a missing entry in a signal map. */
 #ifndef EVMAP_USE_HT
-#define GET_IO_SLOT(x,map,slot,type) GET_SIGNAL_SLOT(x,map,slot,type)
-#define GET_IO_SLOT_AND_CTOR(x,map,slot,type,ctor,fdinfo_len)	\
-	GET_SIGNAL_SLOT_AND_CTOR(x,map,slot,type,ctor,fdinfo_len)
+#define IO_SLOT_PTR_(map, slot)						\
+	((struct evmap_io *)((map)->entries + (size_t)(slot) * (map)->stride))
+#define GET_IO_SLOT(x, map, slot, type)					\
+	do {								\
+		(x) = IO_SLOT_PTR_(map, slot);				\
+		if (!(x)->in_use)					\
+			(x) = NULL;					\
+	} while (0)
+#define GET_IO_SLOT_AND_CTOR(x, map, slot, type, ctor, fdinfo_len)	\
+	do {								\
+		(x) = IO_SLOT_PTR_(map, slot);				\
+		if (!(x)->in_use) {					\
+			(ctor)(x);					\
+			(x)->in_use = 1;				\
+		}							\
+	} while (0)
 #define FDINFO_OFFSET sizeof(struct evmap_io)
 void
 evmap_io_initmap_(struct event_io_map* ctx)
 {
-	evmap_signal_initmap_(ctx);
+	ctx->entries = NULL;
+	ctx->nentries = 0;
+	ctx->stride = 0;
 }
 void
 evmap_io_clear_(struct event_io_map* ctx)
 {
-	evmap_signal_clear_(ctx);
+	if (ctx->entries != NULL)
+		mm_free(ctx->entries);
+	evmap_io_initmap_(ctx);
+}
+
+/** Expand the fd table 'map' until it is big enough to store a value in
+	'slot', with room for fdinfo_len bytes of fdinfo in each slot.
+
+	The slots move when we do this, so we have to fix up the pointer that
+	the first event on each fd keeps back to the list head in its slot.
+ */
+static int
+evmap_io_make_space(struct event_io_map *map, int slot, size_t fdinfo_len)
+{
+	size_t stride = (sizeof(struct evmap_io) + fdinfo_len + 7) & ~(size_t)7;
+	int nentries = map->nentries, old_nentries = map->nentries, i;
+	char *tmp;
+
+	if (stride < (size_t)map->stride)
+		stride = map->stride;
+	if (slot < nentries && stride == (size_t)map->stride)
+		return (0);
+
+	if (slot > INT_MAX / 2 || stride > INT_MAX)
+		return (-1);
+	if (!nentries)
+		nentries = 32;
+	while (nentries <= slot)
+		nentries <<= 1;
+	if ((size_t)nentries > EV_SIZE_MAX / stride)
+		return (-1);
+
+	if (stride == (size_t)map->stride) {
+		tmp = mm_realloc(map->entries, nentries * stride);
+		if (tmp == NULL)
+			return (-1);
+		memset(tmp + old_nentries * stride, 0,
+		    (nentries - old_nentries) * stride);
+	} else {
+		/* The backend wants more fdinfo than we have room for: this
+		 * can only happen before the backend is set up, or right
+		 * after it changes in event_reinit(). */
+		tmp = mm_calloc(nentries, stride);
+		if (tmp == NULL)
+			return (-1);
+		for (i = 0; i < old_nentries; ++i)
+			memcpy(tmp + i * stride, map->entries + i * map->stride,
+			    map->stride);
+		if (map->entries)
+			mm_free(map->entries);
+	}
+
+	map->entries = tmp;
+	map->nentries = nentries;
+	map->stride = (int)stride;
+
+	for (i = 0; i < old_nentries; ++i) {
+		struct evmap_io *ctx = IO_SLOT_PTR_(map, i);
+		struct event *ev = LIST_FIRST(&ctx->events);
+		if (ev)
+			ev->ev_io_next.le_prev = &LIST_FIRST(&ctx->events);
+	}
+
+	return (0);
 }
 #endif
 
@@ -285,10 +368,8 @@ evmap_io_add_(struct event_base *base, evutil_socket_t fd, struct event *ev)
 		return 0;
 
 #ifndef EVMAP_USE_HT
-	if (fd >= io->nentries) {
-		if (evmap_make_space(io, fd, sizeof(struct evmap_io *)) == -1)
-			return (-1);
-	}
+	if (evmap_io_make_space(io, fd, evsel->fdinfo_len) == -1)
+		return (-1);
 #endif
 	GET_IO_SLOT_AND_CTOR(ctx, io, fd, evmap_io, evmap_io_init,
 						 evsel->fdinfo_len);
@@ -370,6 +451,7 @@ evmap_io_del_(struct event_base *base, evutil_socket_t fd, struct event *ev)
 #endif
 
 	GET_IO_SLOT(ctx, io, fd, evmap_io);
+	EVUTIL_ASSERT(ctx != NULL);
 
 	nread = ctx->nread;
 	nwrite = ctx->nwrite;
@@ -557,7 +639,8 @@ evmap_io_foreach_fd(struct event_base *base,
 		fd = (*mapent)->fd;
 #else
 	for (fd = 0; fd < iomap->nentries; ++fd) {
-		struct evmap_io *ctx = iomap->entries[fd];
+		struct evmap_io *ctx;
+		GET_IO_SLOT(ctx, iomap, fd, evmap_io);
 		if (!ctx)
 			continue;
 #endif
@@ -321,6 +321,7 @@ evport_dispatch(struct event_base *base, struct timeval *tv)
 	}
 
 	event_debug(("%s: port_getn reports %d events", __func__, nevents));
+	event_base_record_dispatch_events_(base, nevents);
 
 	for (i = 0; i < nevents; ++i) {
 		port_event_t *pevt = &pevtlist[i];
@@ -386,6 +386,7 @@ void *evthread_setup_global_lock_(void *lock_, unsigned locktype,
 
 int event_global_setup_locks_(const int enable_locks);
 int evsig_global_setup_locks_(const int enable_locks);
+int evbuffer_global_setup_locks_(const int enable_locks);
 int evutil_global_setup_locks_(const int enable_locks);
 int evutil_secure_rng_global_setup_locks_(const int enable_locks);
 
@@ -397,6 +398,16 @@ struct evthread_condition_callbacks *evthread_get_condition_callbacks(void);
 /** Disable locking for internal usage (like global shutdown) */
 void evthreadimpl_disable_lock_debugging_(void);
 
+/** Arrange for cb(arg) to be called when the calling thread exits.  Returns
+ * 0 on success, and -1 if the threading library we were set up with gives
+ * us no way to find out about thread exit. */
+int evthread_at_thread_exit_(void (*cb)(void *), void *arg);
+/** Set the function that evthread_at_thread_exit_() uses; called by
+ * evthread_use_pthreads(). */
+EVENT2_EXPORT_SYMBOL
+void evthread_set_thread_exit_fn_(
+	int (*exit_fn)(void (*cb)(void *), void *arg));
+
 #endif
 
 #ifdef __cplusplus
@@ -56,6 +56,7 @@ GLOBAL struct evthread_lock_callbacks evthread_lock_fns_ = {
 	0, 0, NULL, NULL, NULL, NULL
 };
 GLOBAL unsigned long (*evthread_id_fn_)(void) = NULL;
+static int (*evthread_thread_exit_fn_)(void (*)(void *), void *) = NULL;
 GLOBAL struct evthread_condition_callbacks evthread_cond_fns_ = {
 	0, NULL, NULL, NULL, NULL
 };
@@ -74,6 +75,20 @@ evthread_set_id_callback(unsigned long (*id_fn)(void))
 	evthread_id_fn_ = id_fn;
 }
 
+void
+evthread_set_thread_exit_fn_(int (*exit_fn)(void (*cb)(void *), void *arg))
+{
+	evthread_thread_exit_fn_ = exit_fn;
+}
+
+int
+evthread_at_thread_exit_(void (*cb)(void *), void *arg)
+{
+	if (!evthread_thread_exit_fn_)
+		return -1;
+	return evthread_thread_exit_fn_(cb, arg);
+}
+
 struct evthread_lock_callbacks *evthread_get_lock_callbacks()
 {
 	return evthread_lock_debugging_enabled_
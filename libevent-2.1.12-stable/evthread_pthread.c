@@ -41,6 +41,16 @@ struct event_base;
 
 static pthread_mutexattr_t attr_recursive;
 
+/* Callbacks to run when a thread exits, kept as a list per thread under
+ * thread_exit_key. */
+struct evthread_posix_exit_cb {
+	void (*cb)(void *);
+	void *arg;
+	struct evthread_posix_exit_cb *next;
+};
+static pthread_key_t thread_exit_key;
+static int thread_exit_key_created = 0;
+
 static void *
 evthread_posix_lock_alloc(unsigned locktype)
 {
@@ -160,6 +170,34 @@ evthread_posix_cond_wait(void *cond_, void *lock_, const struct timeval *tv)
 	}
 }
 
+static void
+evthread_posix_run_exit_cbs(void *ent_)
+{
+	struct evthread_posix_exit_cb *ent = ent_, *next;
+	for (; ent; ent = next) {
+		next = ent->next;
+		ent->cb(ent->arg);
+		mm_free(ent);
+	}
+}
+
+static int
+evthread_posix_at_thread_exit(void (*cb)(void *), void *arg)
+{
+	struct evthread_posix_exit_cb *ent =
+	    mm_malloc(sizeof(struct evthread_posix_exit_cb));
+	if (!ent)
+		return -1;
+	ent->cb = cb;
+	ent->arg = arg;
+	ent->next = pthread_getspecific(thread_exit_key);
+	if (pthread_setspecific(thread_exit_key, ent)) {
+		mm_free(ent);
+		return -1;
+	}
+	return 0;
+}
+
 int
 evthread_use_pthreads(void)
 {
@@ -187,5 +225,10 @@ evthread_use_pthreads(void)
 	evthread_set_lock_callbacks(&cbs);
 	evthread_set_condition_callbacks(&cond_cbs);
 	evthread_set_id_callback(evthread_posix_get_id);
+	if (!thread_exit_key_created &&
+	    !pthread_key_create(&thread_exit_key, evthread_posix_run_exit_cbs))
+		thread_exit_key_created = 1;
+	if (thread_exit_key_created)
+		evthread_set_thread_exit_fn_(evthread_posix_at_thread_exit);
 	return 0;
 }
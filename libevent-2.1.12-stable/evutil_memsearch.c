@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "util-internal.h"
+
+/* Byte-search kernels for the evbuffer search functions.
+ *
+ * evutil_memchr2_() looks for the first of two bytes (say, CR or LF), and
+ * evutil_memmem_() looks for a pattern of two or more bytes.  Both work on
+ * one contiguous range; buffer.c takes care of matches that cross from one
+ * chain into the next.
+ *
+ * On x86 with GCC or clang we build SSE2 and AVX2 versions and pick one the
+ * first time we are called, based on what the CPU supports.  The pattern
+ * search compares the first and last bytes of the pattern against a whole
+ * vector of candidate positions at once, and only calls memcmp() at
+ * positions where both match; this keeps it fast when the first byte of the
+ * pattern is common in the data, which is where memchr() plus memcmp() does
+ * worst.  The EVENT_MEMSEARCH environment variable ("scalar", "sse2" or
+ * "avx2") overrides the choice.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define MEMSEARCH_X86
+#include <immintrin.h>
+#endif
+
+typedef const char *(*memchr2_fn)(const char *, size_t, int, int);
+typedef const char *(*memmem_fn)(const char *, size_t, const char *, size_t);
+
+static const char *
+memchr2_scalar(const char *s, size_t len, int c1, int c2)
+{
+#define CHUNK_SZ 128
+	/* Lots of benchmarking found this approach to be faster in practice
+	 * than doing two memchrs over the whole buffer, doin a memchr on each
+	 * char of the buffer, or trying to emulate memchr by hand. */
+	const char *s_end = s + len, *p1, *p2;
+	while (s < s_end) {
+		size_t chunk = (s + CHUNK_SZ < s_end) ? CHUNK_SZ : (s_end - s);
+		p1 = memchr(s, c1, chunk);
+		p2 = memchr(s, c2, chunk);
+		if (p1) {
+			if (p2 && p2 < p1)
+				return p2;
+			return p1;
+		} else if (p2) {
+			return p2;
+		}
+		s += CHUNK_SZ;
+	}
+	return NULL;
+#undef CHUNK_SZ
+}
+
+static const char *
+memmem_scalar(const char *s, size_t len, const char *pat, size_t patlen)
+{
+	const char *last = s + len - patlen;
+
+	if (len < patlen)
+		return NULL;
+	while (s <= last) {
+		s = memchr(s, pat[0], last - s + 1);
+		if (s == NULL)
+			return NULL;
+		if (!memcmp(s + 1, pat + 1, patlen - 1))
+			return s;
+		++s;
+	}
+	return NULL;
+}
+
+#ifdef MEMSEARCH_X86
+__attribute__((target("sse2")))
+static const char *
+memchr2_sse2(const char *s, size_t len, int c1, int c2)
+{
+	const __m128i v1 = _mm_set1_epi8((char)c1);
+	const __m128i v2 = _mm_set1_epi8((char)c2);
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + i));
+		unsigned m = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(b, v1), _mm_cmpeq_epi8(b, v2)));
+		if (m)
+			return s + i + __builtin_ctz(m);
+	}
+	return memchr2_scalar(s + i, len - i, c1, c2);
+}
+
+__attribute__((target("sse2")))
+static const char *
+memmem_sse2(const char *s, size_t len, const char *pat, size_t patlen)
+{
+	const __m128i first = _mm_set1_epi8(pat[0]);
+	const __m128i last = _mm_set1_epi8(pat[patlen - 1]);
+	size_t i;
+
+	if (len < patlen)
+		return NULL;
+	for (i = 0; i + patlen - 1 + 16 <= len; i += 16) {
+		__m128i bf = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i bl = _mm_loadu_si128(
+			(const __m128i *)(s + i + patlen - 1));
+		unsigned m = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+		while (m) {
+			unsigned bit = __builtin_ctz(m);
+			if (!memcmp(s + i + bit + 1, pat + 1, patlen - 2))
+				return s + i + bit;
+			m &= m - 1;
+		}
+	}
+	return memmem_scalar(s + i, len - i, pat, patlen);
+}
+
+__attribute__((target("avx2")))
+static const char *
+memchr2_avx2(const char *s, size_t len, int c1, int c2)
+{
+	const __m256i v1 = _mm256_set1_epi8((char)c1);
+	const __m256i v2 = _mm256_set1_epi8((char)c2);
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i b = _mm256_loadu_si256((const __m256i *)(s + i));
+		unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(b, v1), _mm256_cmpeq_epi8(b, v2)));
+		if (m)
+			return s + i + __builtin_ctz(m);
+	}
+	return memchr2_sse2(s + i, len - i, c1, c2);
+}
+
+__attribute__((target("avx2")))
+static const char *
+memmem_avx2(const char *s, size_t len, const char *pat, size_t patlen)
+{
+	const __m256i first = _mm256_set1_epi8(pat[0]);
+	const __m256i last = _mm256_set1_epi8(pat[patlen - 1]);
+	size_t i;
+
+	if (len < patlen)
+		return NULL;
+	for (i = 0; i + patlen - 1 + 32 <= len; i += 32) {
+		__m256i bf = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i bl = _mm256_loadu_si256(
+			(const __m256i *)(s + i + patlen - 1));
+		unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(bf, first),
+			_mm256_cmpeq_epi8(bl, last)));
+		while (m) {
+			unsigned bit = __builtin_ctz(m);
+			if (!memcmp(s + i + bit + 1, pat + 1, patlen - 2))
+				return s + i + bit;
+			m &= m - 1;
+		}
+	}
+	return memmem_sse2(s + i, len - i, pat, patlen);
+}
+#endif
+
+struct memsearch_impl {
+	const char *name;
+	memchr2_fn memchr2;
+	memmem_fn memmem;
+};
+
+/* Best first. */
+static const struct memsearch_impl memsearch_impls[] = {
+#ifdef MEMSEARCH_X86
+	{ "avx2", memchr2_avx2, memmem_avx2 },
+	{ "sse2", memchr2_sse2, memmem_sse2 },
+#endif
+	{ "scalar", memchr2_scalar, memmem_scalar },
+	{ NULL, NULL, NULL }
+};
+
+static const struct memsearch_impl *memsearch_impl = NULL;
+
+static int
+memsearch_impl_supported(const struct memsearch_impl *impl)
+{
+#ifdef MEMSEARCH_X86
+	__builtin_cpu_init();
+	if (!strcmp(impl->name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+#if defined(__i386__) && !defined(__SSE2__)
+	if (!strcmp(impl->name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+#endif
+#endif
+	return 1;
+}
+
+int
+evutil_memsearch_select_(const char *name)
+{
+	const struct memsearch_impl *impl;
+
+	for (impl = memsearch_impls; impl->name; ++impl) {
+		if (name && strcmp(name, impl->name))
+			continue;
+		if (!memsearch_impl_supported(impl)) {
+			if (name)
+				return -1;
+			continue;
+		}
+		/* Several threads may get here at once; they will all pick
+		 * the same thing. */
+		memsearch_impl = impl;
+		return 0;
+	}
+	return -1;
+}
+
+static void
+memsearch_resolve(void)
+{
+	if (evutil_memsearch_select_(evutil_getenv_("EVENT_MEMSEARCH")) < 0)
+		evutil_memsearch_select_(NULL);
+}
+
+const char *
+evutil_memsearch_get_impl_(void)
+{
+	if (memsearch_impl == NULL)
+		memsearch_resolve();
+	return memsearch_impl->name;
+}
+
+const char *
+evutil_memchr2_(const char *s, size_t len, int c1, int c2)
+{
+	if (EVUTIL_UNLIKELY(memsearch_impl == NULL))
+		memsearch_resolve();
+	return memsearch_impl->memchr2(s, len, c1, c2);
+}
+
+const char *
+evutil_memmem_(const char *s, size_t len, const char *pat, size_t patlen)
+{
+	if (EVUTIL_UNLIKELY(memsearch_impl == NULL))
+		memsearch_resolve();
+	if (patlen < 2)
+		return patlen ? memchr(s, pat[0], len) : s;
+	return memsearch_impl->memmem(s, len, pat, patlen);
+}
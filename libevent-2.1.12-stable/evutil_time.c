@@ -619,3 +619,47 @@ evutil_gettime_monotonic_(struct evutil_monotonic_timer *base,
 
 }
 #endif
+
+/* =====
+   A cheap, precise, monotonic nanosecond clock for measuring short
+   intervals, such as how long a callback ran.  Unlike the timers above it
+   never uses a coarse clock, and it is not ratcheted: callers only ever
+   subtract two readings from it.
+ */
+ev_uint64_t
+evutil_monotonic_nsec_(void)
+{
+#if defined(HAVE_POSIX_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+	return (ev_uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#elif defined(HAVE_MACH_MONOTONIC)
+	static struct mach_timebase_info tb;
+
+	if (tb.denom == 0)
+		mach_timebase_info(&tb);
+	return mach_absolute_time() * tb.numer / tb.denom;
+#elif defined(HAVE_WIN32_MONOTONIC)
+	static ev_uint64_t freq;
+	LARGE_INTEGER counter;
+	ev_uint64_t c;
+
+	if (freq == 0) {
+		LARGE_INTEGER f;
+		if (!QueryPerformanceFrequency(&f) || f.QuadPart <= 0)
+			return GetTickCount() * (ev_uint64_t)1000000;
+		freq = f.QuadPart;
+	}
+	QueryPerformanceCounter(&counter);
+	c = counter.QuadPart;
+	return (c / freq) * 1000000000 + (c % freq) * 1000000000 / freq;
+#else
+	struct timeval tv;
+
+	if (evutil_gettimeofday(&tv, NULL) < 0)
+		return 0;
+	return (ev_uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
@@ -175,6 +175,11 @@ fake_getnameinfo(const struct sockaddr *sa, size_t salen, char *host,
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #endif
 
+/* Tell the callback profiler that the time spent from here on belongs to
+ * the user's callback cb. */
+#define EVHTTP_PROFILE_NOTE(base, cb)					\
+	EVENT_PROFILE_NOTE_((base), (cb), EVENT_PROFILE_KIND_EVHTTP)
+
 extern int debug;
 
 static evutil_socket_t create_bind_socket_nonblock(struct evutil_addrinfo *, int reuse);
@@ -394,14 +399,78 @@ evhttp_send_continue_done(struct evhttp_connection *evcon, void *arg)
 	bufferevent_disable(evcon->bufev, EV_WRITE);
 }
 
+/** Helper: write n, which must not be negative, in decimal at p, and return
+ * the number of bytes written: at most 10. */
+static size_t
+evhttp_format_int(char *p, int n)
+{
+	char digits[10];
+	unsigned u = n < 0 ? 0 : (unsigned)n;
+	size_t len = 0, i;
+
+	do {
+		digits[len++] = (char)('0' + u % 10);
+		u /= 10;
+	} while (u);
+	for (i = 0; i < len; ++i)
+		p[i] = digits[len - 1 - i];
+	return len;
+}
+
+/** Longest version that evhttp_format_version() writes. */
+#define EVHTTP_VERSION_MAX 26
+
+/** Helper: write "HTTP/major.minor" at p, and return its length. */
+static size_t
+evhttp_format_version(char *p, struct evhttp_request *req)
+{
+	size_t len = 5;
+
+	memcpy(p, "HTTP/", 5);
+	len += evhttp_format_int(p + len, req->major);
+	p[len++] = '.';
+	len += evhttp_format_int(p + len, req->minor);
+	return len;
+}
+
+/** Helper: append the line "a b c\r\n" to buf with a single commit, so that
+ * the buffer's callbacks hear about the line once, as a whole. */
+static int
+evhttp_add_start_line(struct evbuffer *buf, const char *a, size_t a_len,
+    const char *b, size_t b_len, const char *c, size_t c_len)
+{
+	struct evbuffer_iovec v;
+	size_t len = a_len + b_len + c_len + 4;
+	char *p;
+
+	if (evbuffer_reserve_space(buf, len, &v, 1) != 1)
+		return -1;
+	p = v.iov_base;
+	memcpy(p, a, a_len);
+	p += a_len;
+	*p++ = ' ';
+	memcpy(p, b, b_len);
+	p += b_len;
+	*p++ = ' ';
+	memcpy(p, c, c_len);
+	p += c_len;
+	memcpy(p, "\r\n", 2);
+	v.iov_len = len;
+	return evbuffer_commit_space(buf, &v, 1);
+}
+
 static void
 evhttp_send_continue(struct evhttp_connection *evcon,
 			struct evhttp_request *req)
 {
+	struct evbuffer *output = bufferevent_get_output(evcon->bufev);
+	char line[EVHTTP_VERSION_MAX + 17];
+	size_t len;
+
 	bufferevent_enable(evcon->bufev, EV_WRITE);
-	evbuffer_add_printf(bufferevent_get_output(evcon->bufev),
-			"HTTP/%d.%d 100 Continue\r\n\r\n",
-			req->major, req->minor);
+	len = evhttp_format_version(line, req);
+	memcpy(line + len, " 100 Continue\r\n\r\n", 17);
+	evbuffer_add(output, line, len + 17);
 	evcon->cb = evhttp_send_continue_done;
 	evcon->cb_arg = NULL;
 	bufferevent_setcb(evcon->bufev,
@@ -438,7 +507,10 @@ static void
 evhttp_make_header_request(struct evhttp_connection *evcon,
     struct evhttp_request *req)
 {
+	struct evbuffer *output = bufferevent_get_output(evcon->bufev);
 	const char *method;
+	char version[EVHTTP_VERSION_MAX];
+	size_t version_len;
 
 	evhttp_remove_header(req->output_headers, "Proxy-Connection");
 
@@ -447,9 +519,9 @@ evhttp_make_header_request(struct evhttp_connection *evcon,
 		method = "NULL";
 	}
 
-	evbuffer_add_printf(bufferevent_get_output(evcon->bufev),
-	    "%s %s HTTP/%d.%d\r\n",
-	    method, req->uri, req->major, req->minor);
+	version_len = evhttp_format_version(version, req);
+	evhttp_add_start_line(output, method, strlen(method),
+	    req->uri, strlen(req->uri), version, version_len);
 
 	/* Add the content length on a post or put request if missing */
 	if ((req->type == EVHTTP_REQ_POST || req->type == EVHTTP_REQ_PUT) &&
@@ -531,11 +603,15 @@ static void
 evhttp_make_header_response(struct evhttp_connection *evcon,
     struct evhttp_request *req)
 {
+	struct evbuffer *output = bufferevent_get_output(evcon->bufev);
 	int is_keepalive = evhttp_is_connection_keepalive(req->input_headers);
-	evbuffer_add_printf(bufferevent_get_output(evcon->bufev),
-	    "HTTP/%d.%d %d %s\r\n",
-	    req->major, req->minor, req->response_code,
-	    req->response_code_line);
+	char version[EVHTTP_VERSION_MAX], code[10];
+	size_t version_len, code_len;
+
+	version_len = evhttp_format_version(version, req);
+	code_len = evhttp_format_int(code, req->response_code);
+	evhttp_add_start_line(output, version, version_len, code, code_len,
+	    req->response_code_line, strlen(req->response_code_line));
 
 	if (req->major == 1) {
 		if (req->minor >= 1)
@@ -619,8 +695,9 @@ evhttp_make_header(struct evhttp_connection *evcon, struct evhttp_request *req)
 	}
 
 	TAILQ_FOREACH(header, req->output_headers, next) {
-		evbuffer_add_printf(output, "%s: %s\r\n",
-		    header->key, header->value);
+		evbuffer_add_header_line(output,
+		    header->key, strlen(header->key),
+		    header->value, strlen(header->value));
 	}
 	evbuffer_add(output, "\r\n", 2);
 
@@ -704,6 +781,7 @@ evhttp_connection_incoming_fail(struct evhttp_request *req,
 		 * the callback needs to send a reply, once the reply has
 		 * been send, the connection should get freed.
 		 */
+		EVHTTP_PROFILE_NOTE(req->evcon->base, req->cb);
 		(*req->cb)(req, req->cb_arg);
 	}
 
@@ -740,6 +818,7 @@ evhttp_connection_fail_(struct evhttp_connection *evcon,
 	void *cb_arg;
 	void (*error_cb)(enum evhttp_request_error, void *);
 	void *error_cb_arg;
+	struct event_base *base = evcon->base;
 	EVUTIL_ASSERT(req != NULL);
 
 	bufferevent_disable(evcon->bufev, EV_READ|EV_WRITE);
@@ -795,10 +874,14 @@ evhttp_connection_fail_(struct evhttp_connection *evcon,
 	EVUTIL_SET_SOCKET_ERROR(errsave);
 
 	/* inform the user */
-	if (error_cb != NULL)
+	if (error_cb != NULL) {
+		EVHTTP_PROFILE_NOTE(base, error_cb);
 		error_cb(error, error_cb_arg);
-	if (cb != NULL)
+	}
+	if (cb != NULL) {
+		EVHTTP_PROFILE_NOTE(base, cb);
 		(*cb)(NULL, cb_arg);
+	}
 }
 
 /* Bufferevent callback: invoked when any data has been written from an
@@ -809,8 +892,10 @@ evhttp_write_cb(struct bufferevent *bufev, void *arg)
 	struct evhttp_connection *evcon = arg;
 
 	/* Activate our call back */
-	if (evcon->cb != NULL)
+	if (evcon->cb != NULL) {
+		EVHTTP_PROFILE_NOTE(evcon->base, evcon->cb);
 		(*evcon->cb)(evcon, evcon->cb_arg);
+	}
 }
 
 /**
@@ -870,6 +955,7 @@ evhttp_connection_done(struct evhttp_connection *evcon)
 	}
 
 	/* notify the user of the request */
+	EVHTTP_PROFILE_NOTE(evcon->base, req->cb);
 	(*req->cb)(req, req->cb_arg);
 
 	/* if this was an outgoing request, we own and it's done. so free it. */
@@ -2907,8 +2993,8 @@ evhttp_send_reply_chunk_with_cb(struct evhttp_request *req, struct evbuffer *dat
 	if (!evhttp_response_needs_body(req))
 		return;
 	if (req->chunked) {
-		evbuffer_add_printf(output, "%x\r\n",
-				    (unsigned)evbuffer_get_length(databuf));
+		evbuffer_add_hex(output, evbuffer_get_length(databuf));
+		evbuffer_add(output, "\r\n", 2);
 	}
 	evbuffer_add_buffer(output, databuf);
 	if (req->chunked) {
@@ -3144,7 +3230,12 @@ evhttp_uriencode(const char *uri, ev_ssize_t len, int space_as_plus)
 		} else if (*p == ' ' && space_as_plus) {
 			evbuffer_add(buf, "+", 1);
 		} else {
-			evbuffer_add_printf(buf, "%%%02X", (unsigned char)(*p));
+			static const char hex[] = "0123456789ABCDEF";
+			char esc[3];
+			esc[0] = '%';
+			esc[1] = hex[((unsigned char)*p) >> 4];
+			esc[2] = hex[((unsigned char)*p) & 0xf];
+			evbuffer_add(buf, esc, 3);
 		}
 	}
 
@@ -3492,12 +3583,14 @@ evhttp_handle_request(struct evhttp_request *req, void *arg)
 	}
 
 	if ((cb = evhttp_dispatch_callback(&http->callbacks, req)) != NULL) {
+		EVHTTP_PROFILE_NOTE(http->base, cb->cb);
 		(*cb->cb)(req, cb->cbarg);
 		return;
 	}
 
 	/* Generic call back */
 	if (http->gencb) {
+		EVHTTP_PROFILE_NOTE(http->base, http->gencb);
 		(*http->gencb)(req, http->gencbarg);
 		return;
 	} else {
@@ -4966,11 +5059,15 @@ evhttp_uri_join(struct evhttp_uri *uri, char *buf, size_t limit)
 	}
 	if (uri->host) {
 		evbuffer_add(tmp, "//", 2);
-		if (uri->userinfo)
-			evbuffer_add_printf(tmp,"%s@", uri->userinfo);
+		if (uri->userinfo) {
+			URI_ADD_(userinfo);
+			evbuffer_add(tmp, "@", 1);
+		}
 		URI_ADD_(host);
-		if (uri->port >= 0)
-			evbuffer_add_printf(tmp,":%d", uri->port);
+		if (uri->port >= 0) {
+			evbuffer_add(tmp, ":", 1);
+			evbuffer_add_int(tmp, uri->port);
+		}
 
 		if (uri->path && uri->path[0] != '/' && uri->path[0] != '\0')
 			goto err;
@@ -221,6 +221,134 @@ void evbuffer_lock(struct evbuffer *buf);
 EVENT2_EXPORT_SYMBOL
 void evbuffer_unlock(struct evbuffer *buf);
 
+/**
+   Switch an empty evbuffer to a fixed-size ring of memory that is mapped
+   twice in a row, so that everything in the buffer is always contiguous.
+
+   Parsers that call evbuffer_pullup() on every message never have to wait
+   for data to be copied together: evbuffer_pullup() and
+   evbuffer_get_contiguous_space() always see the whole buffer, and
+   evbuffer_peek() returns a single extent.
+
+   The buffer never grows past its size.  evbuffer_add(),
+   evbuffer_prepend(), evbuffer_expand() and evbuffer_reserve_space() fail
+   when the data would not fit, and evbuffer_read() reads no more than
+   fits, and fails with ENOBUFS when the ring is full.  When a bufferevent
+   reads into a ring, give it a read high-water mark no larger than the
+   ring.  evbuffer_add_buffer() and evbuffer_remove_buffer() copy data into
+   and out of a ring instead of moving chains, evbuffer_add_reference()
+   copies the data and calls the cleanup function right away, and
+   evbuffer_add_file_segment(), evbuffer_add_buffer_reference() and
+   evbuffer_prepend_buffer() fail.
+
+   This is only available where memfd_create() exists.
+
+   @param buf an empty evbuffer
+   @param size the size of the ring; it is rounded up to a whole number of
+     pages.
+   @return 0 on success, -1 if buf is not empty, is already a ring, or
+     the system doesn't support it.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_enable_ring(struct evbuffer *buf, size_t size);
+
+/**
+  A memory accounting domain for evbuffers.
+
+  A domain adds up the bytes held in every evbuffer attached to it with
+  evbuffer_set_mem_domain() or bufferevent_set_mem_domain().  When the
+  total goes above the domain's high-water mark, the domain is over
+  budget: every bufferevent attached to it stops reading, and the
+  pressure callback (if any) is told.  Once the total drops back to the
+  low-water mark, reading resumes and the callback is told again.
+
+  All of the bufferevents stop reading, however little each one holds:
+  any read adds to the total.  They go on writing, which is how the total
+  comes back down.  Evbuffers attached on their own are only counted.
+
+  This gives one limit for a whole process (or event base), however many
+  connections it has, where per-bufferevent watermarks only limit each
+  connection on its own.
+
+  @see evbuffer_mem_domain_new()
+ */
+struct evbuffer_mem_domain;
+struct event_base;
+
+/**
+  A callback invoked when a memory domain goes over or back under budget.
+
+  It runs from the domain's event base, without any locks held.
+
+  @param domain the domain
+  @param over_budget 1 if the domain just went over budget, 0 if it just
+    went back under
+  @param held the number of bytes held in the domain at the time
+  @param arg the argument passed to evbuffer_mem_domain_setcb()
+ */
+typedef void (*evbuffer_mem_domain_cb)(struct evbuffer_mem_domain *domain,
+    int over_budget, size_t held, void *arg);
+
+/**
+  Create a new memory accounting domain.
+
+  @param base the event base that runs the domain's pressure callback
+  @param high the domain goes over budget when it holds more than this
+    many bytes
+  @param low the domain goes back under budget when it holds this many
+    bytes or fewer; must be no greater than high
+  @return the new domain, or NULL on error
+  @see evbuffer_mem_domain_free(), evbuffer_set_mem_domain(),
+    bufferevent_set_mem_domain()
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_mem_domain *evbuffer_mem_domain_new(struct event_base *base,
+    size_t high, size_t low);
+
+/**
+  Free a memory accounting domain.
+
+  No evbuffer or bufferevent may still be attached to it.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_mem_domain_free(struct evbuffer_mem_domain *domain);
+
+/**
+  Set the callback invoked when a memory domain goes over or back under
+  budget.
+
+  @param domain the domain
+  @param cb the callback, or NULL to remove it
+  @param arg an argument for the callback
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_mem_domain_setcb(struct evbuffer_mem_domain *domain,
+    evbuffer_mem_domain_cb cb, void *arg);
+
+/**
+  Return the number of bytes held in the buffers of a memory domain.
+ */
+EVENT2_EXPORT_SYMBOL
+size_t evbuffer_mem_domain_get_held(struct evbuffer_mem_domain *domain);
+
+/**
+  Count the bytes held in an evbuffer against a memory domain.
+
+  An evbuffer belongs to at most one domain; attaching it to a new one
+  detaches it from the old.  Freeing the buffer detaches it as well.
+
+  The buffer only counts toward the domain's total: nothing stops adding
+  to it when the domain is over budget.  To make the domain stop reading
+  on a bufferevent, use bufferevent_set_mem_domain().
+
+  @param buf the evbuffer
+  @param domain the domain, or NULL to detach the buffer from its domain
+  @return 0 on success, -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_set_mem_domain(struct evbuffer *buf,
+    struct evbuffer_mem_domain *domain);
+
 
 /** If this flag is set, then we will not use evbuffer_peek(),
  * evbuffer_remove(), evbuffer_remove_buffer(), and so on to read bytes
@@ -454,11 +582,37 @@ ev_ssize_t evbuffer_copyout_from(struct evbuffer *buf, const struct evbuffer_ptr
   @param dst the destination evbuffer to store the result into 要存储结果到的目标事件缓冲区
   @param datlen the maximum numbers of bytes to transfer 要传输的最大字节数
   @return the number of bytes read 已读取的字节数
+  @see evbuffer_remove_buffer_reference()
  */
 EVENT2_EXPORT_SYMBOL
 int evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
     size_t datlen);
 
+/**
+  Like evbuffer_remove_buffer(), but share a large piece left over at the
+  end with dst instead of copying it.
+
+  evbuffer_remove_buffer() moves whole chains and copies the rest of the
+  last chain it reads from.  This function instead gives dst a reference
+  to that piece, the same way evbuffer_add_buffer_reference() does, so
+  src stays allocated until dst is done with it.  Data added to either
+  buffer afterwards never overwrites the shared bytes.
+
+  Since dst may then keep src alive after everything else is done with it,
+  src must stand on its own: it must not belong to a bufferevent, use
+  deferred callbacks, or use a lock that it does not own.
+
+  @param src the evbuffer to be read from
+  @param dst the destination evbuffer to store the result into
+  @param datlen the maximum numbers of bytes to transfer
+  @return the number of bytes read, or -1 if src can't be shared or an
+     error occurred
+  @see evbuffer_remove_buffer()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_remove_buffer_reference(struct evbuffer *src,
+    struct evbuffer *dst, size_t datlen);
+
 /** Used to tell evbuffer_readln what kind of line-ending to look for.
  *  用来告诉 evbuffer_readln 要找什么样的行结尾。
  */
@@ -517,7 +671,8 @@ char *evbuffer_readln(struct evbuffer *buffer, size_t *n_read_out,
 
   @param outbuf the output buffer 输出缓冲区
   @param inbuf the input buffer 输入缓冲区
-  @return 0 if successful, or -1 if an error occurred
+  @return 0 if successful, or -1 if an error occurred, including when
+     inbuf holds a reference to memory in outbuf
 
   @see evbuffer_remove_buffer()
  */
@@ -787,6 +942,65 @@ int evbuffer_add_vprintf(struct evbuffer *buf, const char *fmt, va_list ap)
 #endif
 ;
 
+/**
+  Append a signed integer in decimal to the end of an evbuffer.
+
+  This does the same as evbuffer_add_printf(buf, "%lld", n), but writes
+  the digits straight into the buffer instead of going through
+  vsnprintf().
+
+  @param buf the evbuffer that will be appended to
+  @param n the number to append
+  @return The number of bytes added if successful, or -1 if an error
+    occurred.
+  @see evbuffer_add_uint(), evbuffer_add_hex()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_int(struct evbuffer *buf, ev_int64_t n);
+
+/**
+  Append an unsigned integer in decimal to the end of an evbuffer.
+
+  @param buf the evbuffer that will be appended to
+  @param n the number to append
+  @return The number of bytes added if successful, or -1 if an error
+    occurred.
+  @see evbuffer_add_int(), evbuffer_add_hex()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_uint(struct evbuffer *buf, ev_uint64_t n);
+
+/**
+  Append an unsigned integer in lowercase hexadecimal, with no prefix or
+  padding, to the end of an evbuffer, as with "%llx".
+
+  @param buf the evbuffer that will be appended to
+  @param n the number to append
+  @return The number of bytes added if successful, or -1 if an error
+    occurred.
+  @see evbuffer_add_int(), evbuffer_add_uint()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_hex(struct evbuffer *buf, ev_uint64_t n);
+
+/**
+  Append a "key: value" line, ended with CRLF, to the end of an evbuffer.
+
+  This is how HTTP and similar protocols write their headers.  Neither
+  the key nor the value is checked or escaped.
+
+  @param buf the evbuffer that will be appended to
+  @param key the key
+  @param key_len the length of key
+  @param value the value
+  @param value_len the length of value
+  @return The number of bytes added if successful, or -1 if an error
+    occurred.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_header_line(struct evbuffer *buf, const char *key,
+    size_t key_len, const char *value, size_t value_len);
+
 
 /**
   Remove a specified number of bytes data from the beginning of an evbuffer.
@@ -833,6 +1047,72 @@ EVENT2_EXPORT_SYMBOL
 int evbuffer_write_atmost(struct evbuffer *buffer, evutil_socket_t fd,
 						  ev_ssize_t howmuch);
 
+/** The default size above which a chain is sent with MSG_ZEROCOPY. */
+#define EVBUFFER_ZEROCOPY_THRESHOLD_DEFAULT 16384
+
+/**
+  Let evbuffer_write_atmost() send large chains to a socket without copying
+  them into the kernel.
+
+  Once this is enabled, whenever the first chain in the buffer holds at
+  least threshold bytes, evbuffer_write_atmost() on fd sends it, together
+  with any large chains right after it, using MSG_ZEROCOPY.  The bytes are
+  drained from the buffer as usual, but the buffer keeps a reference to
+  their memory (so that, for example, an evbuffer_add_reference() cleanup
+  function doesn't run yet) until the kernel reports that it is done with
+  them.  Smaller chains are written with writev() as before.
+
+  Completions are read from the socket's error queue by later calls to
+  evbuffer_write_atmost() and evbuffer_reap_zerocopy(); a socket-based
+  bufferevent reaps them whenever its socket is readable or writable.  No
+  one else should read that error queue.
+
+  Zero-copy only pays off for large writes: the completion costs about as
+  much as copying a few kilobytes, and over loopback the kernel copies
+  anyway.
+
+  This is only available on Linux 4.14 and later.
+
+  @param buf the evbuffer to configure
+  @param fd a connected TCP socket that buf will be written to
+  @param threshold the smallest chain to send without copying, or 0 for
+	EVBUFFER_ZEROCOPY_THRESHOLD_DEFAULT
+  @return 0 on success, -1 if the system or socket doesn't support it.
+  @see evbuffer_reap_zerocopy(), bufferevent_socket_enable_zerocopy()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_enable_zerocopy(struct evbuffer *buf, evutil_socket_t fd,
+    size_t threshold);
+
+/**
+  Release the memory of any zero-copy sends the kernel has finished with.
+
+  If buf is freed, or moved to another socket, while sends are still
+  outstanding, Libevent keeps their memory until the kernel is done with
+  it.  It checks whenever zero-copy is enabled on an evbuffer, or one
+  that uses zero-copy is freed, but only hears back while the socket is
+  open: once it is closed, the memory is kept until
+  libevent_global_shutdown().  To get it back promptly, keep
+  calling this until evbuffer_get_zerocopy_pending() returns 0 before
+  freeing the buffer or closing the socket.  A later evbuffer that enables
+  zero-copy on the same socket takes over the sends left behind.
+
+  @param buf an evbuffer with zero-copy sends enabled
+  @return the number of completions read, or -1 on error.
+  @see evbuffer_enable_zerocopy()
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_reap_zerocopy(struct evbuffer *buf);
+
+/**
+  Return the number of bytes sent with MSG_ZEROCOPY whose memory the kernel
+  might still be using.
+
+  @see evbuffer_enable_zerocopy()
+ */
+EVENT2_EXPORT_SYMBOL
+size_t evbuffer_get_zerocopy_pending(struct evbuffer *buf);
+
 /**
   Read from a file descriptor and store the result in an evbuffer.
   从文件描述符中读取，并将结果存储在事件缓冲区中。
@@ -848,6 +1128,35 @@ int evbuffer_write_atmost(struct evbuffer *buffer, evutil_socket_t fd,
 EVENT2_EXPORT_SYMBOL
 int evbuffer_read(struct evbuffer *buffer, evutil_socket_t fd, int howmuch);
 
+/** The default for the largest single read done by evbuffer_read(). */
+#define EVBUFFER_MAX_READ_DEFAULT 65536
+
+/**
+  Set the largest amount of data evbuffer_read() will read at once.
+
+  evbuffer_read() starts out reading 4096 bytes at a time.  As long as each
+  read comes back full, it doubles the amount it asks for, up to this
+  limit; when reads keep coming back mostly empty, it halves it again.  Bulk
+  transfers thus need fewer system calls, while interactive connections do
+  not tie up large chains.  Setting a limit of 4096 or less turns this off
+  and makes every read ask for exactly that much.
+
+  @param buf the evbuffer to configure
+  @param max the largest read in bytes, or 0 for EVBUFFER_MAX_READ_DEFAULT
+  @return 0 on success, -1 if max is too large.
+  @see evbuffer_get_max_read(), bufferevent_set_max_single_read()
+*/
+EVENT2_EXPORT_SYMBOL
+int evbuffer_set_max_read(struct evbuffer *buf, size_t max);
+
+/**
+  Return the largest amount of data evbuffer_read() will read at once.
+
+  @see evbuffer_set_max_read()
+*/
+EVENT2_EXPORT_SYMBOL
+size_t evbuffer_get_max_read(struct evbuffer *buf);
+
 /**
    Search for a string within an evbuffer.
    在ev缓冲区中搜索字符串。
@@ -1223,6 +1532,54 @@ int evbuffer_defer_callbacks(struct evbuffer *buffer, struct event_base *base);
 EVENT2_EXPORT_SYMBOL
 size_t evbuffer_add_iovec(struct evbuffer * buffer, struct evbuffer_iovec * vec, int n_vec);
 
+/**
+  Set the limits on the per-thread cache of evbuffer chain memory.
+
+  When an evbuffer frees a chain of its own memory, Libevent keeps it in a
+  cache belonging to the current thread (sorted by size into power-of-two
+  classes) instead of returning it to the allocator, and hands it out again
+  the next time an evbuffer on that thread needs a chain of the same size.
+  This makes the common pattern of reading, processing and draining data of
+  similar sizes run without calling malloc() or free() at all.
+
+  Chains whose allocation is larger than max_chain_size are never cached,
+  and a thread's cache never holds more than max_bytes; setting either to 0
+  disables the cache.  The defaults are 65536 and 262144 bytes.  The limits
+  are shared by all threads, so set them before other threads start using
+  evbuffers.
+
+  The cache only exists on platforms where Libevent can use compiler-provided
+  thread-local storage, or when it is built without thread support.  With
+  thread support, a thread only caches chains once evthread_use_pthreads()
+  has been called, so that its cache can be emptied when the thread exits.
+  libevent_global_shutdown() and event_set_mem_functions() only empty the
+  cache of the thread that calls them; every other thread's cache is emptied
+  when that thread exits.
+
+  @param max_chain_size the largest chain allocation to cache, in bytes; at
+     most 128 times the minimum chain size (128 KB on 64-bit platforms)
+  @param max_bytes the most memory each thread's cache may hold
+  @return 0 on success, -1 if max_chain_size is too large.
+  @see evbuffer_chain_cache_trim()
+*/
+EVENT2_EXPORT_SYMBOL
+int evbuffer_set_chain_cache_limits(size_t max_chain_size, size_t max_bytes);
+
+/**
+  Release memory from the calling thread's evbuffer chain cache.
+
+  Frees cached chains, largest first, until the calling thread's cache
+  holds no more than max_bytes.  Caches are emptied anyway when their
+  thread exits, and by libevent_global_shutdown() and
+  event_set_mem_functions().
+
+  @param max_bytes how much memory the cache may keep
+  @return the number of bytes released
+  @see evbuffer_set_chain_cache_limits()
+*/
+EVENT2_EXPORT_SYMBOL
+size_t evbuffer_chain_cache_trim(size_t max_bytes);
+
 #ifdef __cplusplus
 }
 #endif
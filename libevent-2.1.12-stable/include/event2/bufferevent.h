@@ -185,7 +185,28 @@ enum bufferevent_options {
 	* bufferevent.  This option currently requires that
 	* BEV_OPT_DEFER_CALLBACKS also be set; a future version of Libevent
 	* might remove the requirement. 如果设置，则在缓冲器上没有锁的情况下执行回调。此选项当前要求同时设置 BEV_OPT_DEFER_CALLBACKS ； Libevent 的未来版本可能会删除该要求。 */
-	BEV_OPT_UNLOCK_CALLBACKS = (1<<3)
+	BEV_OPT_UNLOCK_CALLBACKS = (1<<3),
+
+	/** If set on a socket bufferevent, data added to the output buffer
+	 * is not written when the socket next becomes writable, but by one
+	 * write at the end of the current batch of callbacks.  Everything
+	 * the callbacks wrote goes out in that single call, without first
+	 * waiting for the backend to report the socket writable.  Only if
+	 * the socket cannot take it all does the bufferevent wait for it to
+	 * become writable as usual.  Other bufferevent types ignore this
+	 * flag. */
+	BEV_OPT_COALESCE_WRITES = (1<<4),
+
+	/** If set on a socket bufferevent, its read and write events are
+	 * added once, as edge-triggered (EV_ET), and stay added for as long
+	 * as it has a socket.  Disabling, suspending, and finishing a write
+	 * no longer delete them, so the backend doesn't have to be told
+	 * about every change.  Instead, the bufferevent remembers when the
+	 * socket became ready, and acts on it once it wants to read or write
+	 * again.  No other events may be added for the same socket unless
+	 * they are edge-triggered too.  Ignored if the backend doesn't
+	 * support EV_ET, and by other bufferevent types. */
+	BEV_OPT_STICKY_EVENTS = (1<<5)
 };
 
 /**
@@ -278,6 +299,71 @@ int bufferevent_socket_connect_hostname(struct bufferevent *,
 EVENT2_EXPORT_SYMBOL
 int bufferevent_socket_get_dns_error(struct bufferevent *bev);
 
+/**
+   Send large writes on a socket-based bufferevent without copying them.
+
+   This calls evbuffer_enable_zerocopy() on the bufferevent's output buffer
+   and socket.  The bufferevent reads the kernel's completion notices
+   whenever its socket becomes readable or writable, so the memory of
+   sent chains may be held a little longer than usual.  If you change the
+   socket with bufferevent_setfd(), call this again.
+
+   Memory the kernel may still be reading is never reused.  If the
+   bufferevent is freed while evbuffer_get_zerocopy_pending() on its output
+   is nonzero, what it can't reap before closing the socket stays allocated
+   until libevent_global_shutdown().  So before freeing a bufferevent that
+   has written with zero-copy, wait for its output to drain and for
+   evbuffer_get_zerocopy_pending() to reach 0.
+
+   @param bev a socket-based bufferevent that already has a socket
+   @param threshold the smallest chain to send without copying, or 0 for
+	EVBUFFER_ZEROCOPY_THRESHOLD_DEFAULT
+   @return 0 on success, -1 if zero-copy sends aren't available.
+   @see evbuffer_enable_zerocopy()
+*/
+EVENT2_EXPORT_SYMBOL
+int bufferevent_socket_enable_zerocopy(struct bufferevent *bev,
+    size_t threshold);
+
+/**
+   Forward everything that arrives on one socket-based bufferevent straight
+   out of another one's socket, without copying it into user space.
+
+   Once this is set up, data read on src is moved with splice() into a
+   kernel pipe, and from there to dst's socket.  It never shows up in src's
+   input buffer, so src's read callback is not invoked; anything already in
+   that buffer is moved to dst's output buffer and sent first.  To relay
+   both ways, call this twice with the arguments swapped.
+
+   The relay honors the usual flow controls.  src's read rate limit and
+   dst's write rate limit apply, and src's read high-water mark caps how
+   many bytes may wait in the pipe.  While dst can't keep up, src stops
+   reading.  Both bufferevents must stay enabled: src for EV_READ and dst
+   for EV_WRITE.
+
+   When src reaches EOF, the relay first passes on whatever is still in
+   the pipe.  It then shuts down the sending side of dst's socket and
+   reports BEV_EVENT_READING|BEV_EVENT_EOF to src's event callback.  dst
+   keeps reading, so the other direction can finish.
+
+   The relay ends when either bufferevent is freed.  If src goes first,
+   dst still sends whatever is left in the pipe.  If dst goes first, src
+   goes back to reading into its input buffer; if there were bytes left in
+   the pipe, they are lost, and src's event callback gets
+   BEV_EVENT_READING|BEV_EVENT_ERROR.  Don't change either one's socket
+   while it is in use.  src and dst must belong to the same event_base.
+
+   This is only available on Linux.
+
+   @param src the bufferevent whose socket to read from
+   @param dst the bufferevent whose socket to write to
+   @return 0 on success, -1 if either bufferevent is not socket-based or
+     has no socket yet, if src is already relayed, if dst is already the
+     target of a relay, or if splice() is not available.
+*/
+EVENT2_EXPORT_SYMBOL
+int bufferevent_socket_relay(struct bufferevent *src, struct bufferevent *dst);
+
 /**
   Assign a bufferevent to a specific event_base.
   将缓冲程序分配给特定的event_base。
@@ -288,7 +374,9 @@ int bufferevent_socket_get_dns_error(struct bufferevent *bev);
   @param base an event_base returned by event_init() 由event_init（）返回的 event_base
   @param bufev a bufferevent struct returned by bufferevent_new()
      or bufferevent_socket_new() 由bufferevent_new（）或bufferevent_socket_new（）返回的 bufferevent 结构
-  @return 0 if successful, or -1 if an error occurred
+  @return 0 if successful, or -1 if an error occurred, including when base
+     differs from the current one and either of them was created with
+     EVENT_BASE_FLAG_SLAB_ALLOC
   @see bufferevent_new()
  */
 EVENT2_EXPORT_SYMBOL
@@ -831,6 +919,33 @@ int bufferevent_pair_new(struct event_base *base, int options,
 EVENT2_EXPORT_SYMBOL
 struct bufferevent *bufferevent_pair_get_partner(struct bufferevent *bev);
 
+/**
+   Allocate a pair of linked bufferevents whose ends belong to different
+   event bases, for passing data between threads.
+
+   pair[0] is associated with base0 and pair[1] with base1.  Each end must
+   only be used, and freed, from the thread that runs its own event base.
+   Data written to one end is handed to the other without copying and
+   without taking a lock; the other end's base is woken up at most once
+   for everything written before it gets around to reading.  When one end
+   is freed, the other gets BEV_EVENT_EOF once it has read everything that
+   was sent to it.
+
+   If the two bases run in different threads, threading support must be
+   enabled (e.g. with evthread_use_pthreads()) before they are created.
+
+   bufferevent_pair_get_partner() returns NULL for these bufferevents.
+
+   @param base0 The event base for pair[0]
+   @param base1 The event base for pair[1]
+   @param options A set of options for the two bufferevents
+   @param pair A pointer to an array to hold the two new bufferevent objects.
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_pair_new_cross(struct event_base *base0,
+    struct event_base *base1, int options, struct bufferevent *pair[2]);
+
 /**
    Abstract type used to configure rate-limiting on a bufferevent or a group
    of bufferevents.
@@ -982,10 +1097,30 @@ int bufferevent_add_to_rate_limit_group(struct bufferevent *bev,
 EVENT2_EXPORT_SYMBOL
 int bufferevent_remove_from_rate_limit_group(struct bufferevent *bev);
 
+struct evbuffer_mem_domain;
+
+/**
+   Count the input and output buffers of 'bev' against the memory domain
+   'domain', and make 'bev' stop reading while 'domain' is over budget.
+   If 'domain' is NULL, remove 'bev' from its current domain.
+
+   A bufferevent may belong to no more than one memory domain at a time.
+   The bufferevent leaves its domain when it is freed.
+
+   Return 0 on success and -1 on failure.
+
+   @see evbuffer_mem_domain_new()
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_set_mem_domain(struct bufferevent *bev,
+    struct evbuffer_mem_domain *domain);
+
 /**
    Set the size limit for single read operation.
 
-   Set to 0 for a reasonable default.
+   Set to 0 for a reasonable default (EVBUFFER_MAX_READ_DEFAULT).  Within
+   this limit, reads on a socket-based bufferevent grow and shrink with the
+   traffic; see evbuffer_set_max_read().
 
    Return 0 on success and -1 on failure.
  */
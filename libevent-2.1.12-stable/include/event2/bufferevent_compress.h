@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVENT2_BUFFEREVENT_COMPRESS_H_INCLUDED_
+#define EVENT2_BUFFEREVENT_COMPRESS_H_INCLUDED_
+
+/** @file event2/bufferevent_compress.h
+
+    Compressing bufferevents.
+
+    A compressing bufferevent is a filtering bufferevent that compresses
+    everything written to it before passing it to the underlying
+    bufferevent, and decompresses everything it reads from the underlying
+    bufferevent.  Data goes straight from the chains of one buffer into
+    space reserved in the other, without being copied in between.
+
+    These functions are in the libevent_compress library, which is only
+    built if Libevent finds zlib.
+ */
+#include <event2/visibility.h>
+#include <event2/event-config.h>
+#include <event2/bufferevent.h>
+#include <event2/util.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Stream formats for bufferevent_compress_new(). */
+enum bufferevent_compress_format {
+	/** Deflate with a zlib header and trailer (RFC 1950). */
+	BEV_COMPRESS_ZLIB = 0,
+	/** Deflate with a gzip header and trailer (RFC 1952). */
+	BEV_COMPRESS_GZIP = 1,
+	/** Zstandard.  Only available if Libevent was built with libzstd. */
+	BEV_COMPRESS_ZSTD = 2
+};
+
+/** When a compressing bufferevent flushes its compressor.  Until it does,
+    the other side may not be able to decompress all of the data written
+    so far; every flush costs a little in compression ratio. */
+enum bufferevent_compress_flush {
+	/** Flush after compressing the data from each write. */
+	BEV_COMPRESS_FLUSH_WRITE = 0,
+	/** Flush once at least flush_bytes bytes have been compressed since
+	    the last flush. */
+	BEV_COMPRESS_FLUSH_BYTES = 1,
+	/** Flush once per event loop iteration in which data was written,
+	    after the callbacks that wrote it have run. */
+	BEV_COMPRESS_FLUSH_LOOP = 2
+};
+
+/**
+   Create a new bufferevent that compresses the data written to it and
+   decompresses the data read from it, over an existing bufferevent.
+
+   Compressor and decompressor state is taken from, and given back to, a
+   small per-thread pool, so that creating and freeing compressing
+   bufferevents does not set up a new compressor every time.  With thread
+   support, a thread only pools once evthread_use_pthreads() has been
+   called; its pool is freed when it exits.  libevent_global_shutdown()
+   only frees the pool of the thread that calls it.
+
+   bufferevent_flush() with BEV_FLUSH flushes the compressor no matter what
+   the flush policy is; BEV_FINISHED ends the stream, and whatever is
+   written afterwards starts a new one.  Several streams in a row are
+   decompressed as one.
+
+   @param underlying the bufferevent that carries the compressed data.
+   @param format the stream format.
+   @param level the compression level, or -1 for the format's default.
+   @param flush when to flush the compressor.
+   @param flush_bytes the number of bytes for BEV_COMPRESS_FLUSH_BYTES;
+      ignored otherwise.
+   @param options a set of bufferevent_options to modify the behavior of
+      the new bufferevent, as for bufferevent_filter_new().
+   @return a new bufferevent on success, or NULL if the format or level is
+      not supported or on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+struct bufferevent *
+bufferevent_compress_new(struct bufferevent *underlying,
+    enum bufferevent_compress_format format, int level,
+    enum bufferevent_compress_flush flush, size_t flush_bytes, int options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT2_BUFFEREVENT_COMPRESS_H_INCLUDED_ */
@@ -133,6 +133,38 @@ int bufferevent_ssl_renegotiate(struct bufferevent *bev);
 EVENT2_EXPORT_SYMBOL
 unsigned long bufferevent_get_openssl_error(struct bufferevent *bev);
 
+/**
+   Ask OpenSSL to hand record encryption and decryption to the kernel
+   (kTLS) once the handshake is done.
+
+   This sets SSL_OP_ENABLE_KTLS on the SSL object, so it has to be called
+   before the handshake completes, and it only works for bufferevents made
+   with bufferevent_openssl_socket_new().  Setting SSL_OP_ENABLE_KTLS on the
+   SSL_CTX does the same for every connection.
+
+   If the kernel takes over encryption, the bufferevent writes its output
+   buffer straight to the socket, and file segments added to the output
+   buffer after the handshake are sent with sendfile().  If the kernel has
+   no TLS support, or does not support the negotiated cipher, OpenSSL keeps
+   doing the work and nothing changes; use bufferevent_openssl_get_ktls()
+   to find out which happened.
+
+   @param bev an SSL bufferevent.
+   @param enable 1 to ask for kTLS, 0 not to.
+   @return 0 on success, or -1 if this bufferevent cannot use kTLS or
+     Libevent was built against an OpenSSL without kTLS support.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_openssl_set_ktls(struct bufferevent *bev, int enable);
+
+/**
+   Return which directions of an SSL bufferevent the kernel encrypts or
+   decrypts: a combination of EV_WRITE and EV_READ, or 0 if OpenSSL does
+   all the work (including before the handshake is done).
+ */
+EVENT2_EXPORT_SYMBOL
+short bufferevent_openssl_get_ktls(struct bufferevent *bev);
+
 #endif
 
 #ifdef __cplusplus
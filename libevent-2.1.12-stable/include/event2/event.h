@@ -47,14 +47,16 @@
 
 
   Currently, Libevent supports /dev/poll, kqueue(2), select(2), poll(2),
-  epoll(4), and evports. The internal event mechanism is completely
+  epoll(4), io_uring(7), and evports. The internal event mechanism is completely
   independent of the exposed event API, and a simple update of Libevent can
   provide new functionality without having to redesign the applications. As a
   result, Libevent allows for portable application development and provides
   the most scalable event notification mechanism available on an operating
   system.  Libevent can also be used for multithreaded programs.  Libevent
-  should compile on Linux, *BSD, Mac OS X, Solaris and, Windows.
-  目前，Libevent支持/dev/poll、kqueue（2）、select（2）和poll（2），epoll（4）以及evports。
+  should compile on Linux, *BSD, Mac OS X, Solaris and, Windows.  On Linux,
+  epoll(4) remains the default; io_uring(7) is picked only when epoll is
+  avoided, e.g. with event_config_avoid_method(cfg, "epoll") or EVENT_NOEPOLL.
+  目前，Libevent支持/dev/poll、kqueue（2）、select（2）和poll（2），epoll（4），io_uring（7）以及evports。
   内部事件机制完全独立于公开事件API，Libevent的简单更新可以提供新的功能，而无需重新设计应用程序。
   因此，Libevent允许便携式应用程序开发，并提供了操作系统上可用的最可扩展的事件通知机制。
   Libevent也可用于多线程程序。Libevent应该在Linux、*BSD、Mac OS X、Solaris和Windows上编译。
@@ -534,6 +536,184 @@ int event_base_get_num_events(struct event_base *, unsigned int);
 EVENT2_EXPORT_SYMBOL
 int event_base_get_max_events(struct event_base *, unsigned int, int);
 
+/**
+  Number of buckets in each histogram in struct event_base_stats.
+
+  Bucket 0 counts zeros; bucket i (for i > 0) counts values in the range
+  [2^(i-1), 2^i).  The last bucket also counts everything larger.  For the
+  histograms of times, which are in nanoseconds, that is about 1 second.
+ */
+#define EVENT_BASE_STATS_NBUCKETS 32
+
+/**
+  Number of priorities that struct event_base_stats counts callbacks for
+  separately.  Callbacks of any lower priority (larger number) are counted
+  together with the last one.
+ */
+#define EVENT_BASE_STATS_NPRIORITIES 16
+
+/**
+  Counters describing the work an event_base has done.
+
+  The counters are always kept.  The timing fields cost two clock reads
+  per callback, and are only collected while enabled with
+  event_base_set_stats_timing().
+
+  @see event_base_get_stats()
+ */
+struct event_base_stats {
+	/** Iterations of the event loop. */
+	ev_uint64_t loop_iterations;
+	/** Callbacks run, including Libevent's internal ones, indexed by
+	 * priority. */
+	ev_uint64_t callbacks_run[EVENT_BASE_STATS_NPRIORITIES];
+	/** Busy-poll spins that found something to do before their budget
+	 * ran out. */
+	ev_uint64_t busy_poll_hits;
+	/** Busy-poll spins that used up their budget, after which the base
+	 * blocked. */
+	ev_uint64_t busy_poll_misses;
+	/** Histogram of the number of ready events reported by each call to
+	 * the backend's dispatch function. */
+	ev_uint64_t dispatch_events[EVENT_BASE_STATS_NBUCKETS];
+
+	/** Timing only: total nanoseconds spent in the backend's dispatch
+	 * function, waiting for events. */
+	ev_uint64_t dispatch_nsec;
+	/** Timing only: histogram of how long each callback ran, in
+	 * nanoseconds. */
+	ev_uint64_t callback_nsec[EVENT_BASE_STATS_NBUCKETS];
+	/** Timing only: histogram of how long each callback waited between
+	 * being made active and being run, in nanoseconds.  Callbacks made
+	 * active within a microsecond of each other are timed from the
+	 * first of them.  Waits longer than about 4 seconds are not measured
+	 * correctly. */
+	ev_uint64_t queue_delay_nsec[EVENT_BASE_STATS_NBUCKETS];
+};
+
+/**
+  Get a snapshot of the statistics collected by an event_base.
+
+  @param eb the event_base structure returned by event_base_new()
+  @param stats a structure to fill in with the current counters
+  @param clear if nonzero, reset the counters after reading them
+  @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_get_stats(struct event_base *eb,
+    struct event_base_stats *stats, int clear);
+
+/**
+  Turn collection of the timing fields of struct event_base_stats on or
+  off.  This may be done at any time, from any thread, including while
+  the loop is running; it is off when a base is created.
+
+  @param eb the event_base structure returned by event_base_new()
+  @param enable nonzero to collect timing statistics, zero to stop
+  @return 0 on success, -1 on failure.
+  @see event_base_get_stats()
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_set_stats_timing(struct event_base *eb, int enable);
+
+/**
+   @name Callback profiler kinds
+
+   What kind of callback an event_profile_entry describes.
+   @{
+*/
+/** A callback passed to event_new(), event_assign() or event_base_once() */
+#define EVENT_PROFILE_KIND_EVENT	0
+/** One of Libevent's deferred callbacks, or one passed to event_base_post() */
+#define EVENT_PROFILE_KIND_DEFERRED	1
+/** A finalizer passed to event_finalize() or event_free_finalize() */
+#define EVENT_PROFILE_KIND_FINALIZE	2
+/** A read, write or event callback of a bufferevent */
+#define EVENT_PROFILE_KIND_BUFFEREVENT	3
+/** A request or connection callback of evhttp */
+#define EVENT_PROFILE_KIND_EVHTTP	4
+/** A resolver or server callback of evdns */
+#define EVENT_PROFILE_KIND_EVDNS	5
+/**@}*/
+
+/**
+  The cost of one callback function, as measured by the profiler.
+
+  @see event_base_profile_get_top()
+ */
+struct event_profile_entry {
+	/** The callback function.  Cast it back to the right type before
+	 * comparing it against anything. */
+	void (*callback)(void);
+	/** One of the EVENT_PROFILE_KIND_* values. */
+	int kind;
+	/** How many times the callback ran. */
+	ev_uint64_t calls;
+	/** Total nanoseconds spent in the callback. */
+	ev_uint64_t total_nsec;
+	/** Nanoseconds spent in the slowest single call. */
+	ev_uint64_t max_nsec;
+};
+
+/**
+  Start profiling the callbacks run by an event_base, discarding the
+  results of any earlier profile.
+
+  While the profiler runs, the base times every callback it runs, and adds
+  the time to a table keyed by callback function and kind.  When a
+  bufferevent, evhttp or evdns callback runs a user callback, the time is
+  charged to the user callback instead of to Libevent's internal one; when
+  it runs several, each is charged from its start until the next one's.
+
+  The profiler costs two clock reads and a small hash table update per
+  callback, so it may be left on for a few seconds on a busy server to
+  find out which callback is stalling the loop.  The table holds a fixed
+  number of distinct callbacks; any beyond that are not counted.
+
+  @param eb the event_base structure returned by event_base_new()
+  @return 0 on success, -1 on failure.
+  @see event_base_profile_stop(), event_base_profile_get_top()
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_profile_start(struct event_base *eb);
+
+/**
+  Stop profiling the callbacks run by an event_base.  The results
+  collected so far stay available to event_base_profile_get_top() until
+  the profiler is started again.
+
+  @param eb the event_base structure returned by event_base_new()
+  @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_profile_stop(struct event_base *eb);
+
+/**
+  Get the most expensive callbacks seen by the profiler.
+
+  This may be called while the profiler is running, from any thread.
+
+  @param eb the event_base structure returned by event_base_new()
+  @param entries an array to fill in, in order of decreasing total_nsec
+  @param n the number of elements in entries
+  @return the number of entries filled in, or -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_profile_get_top(struct event_base *eb,
+    struct event_profile_entry *entries, int n);
+
+/**
+  Write the n most expensive callbacks seen by the profiler to a file,
+  one per line.  Callbacks are named with dladdr() where it is available.
+
+  @param eb the event_base structure returned by event_base_new()
+  @param output a stdio file to write to
+  @param n the largest number of callbacks to write
+  @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_profile_dump(struct event_base *eb, FILE *output, int n);
+
 /**
    Allocates a new event configuration object.
    分配新的事件配置对象。
@@ -675,7 +855,34 @@ enum event_base_config_flag {
 	    present.
        通常，Libevent使用我们拥有的最快的单调计时器来实现其时间和超时代码。然而，如果设置了此标志，我们将使用效率较低但更精确的计时器，假设存在计时器。
 	 */
-	EVENT_BASE_FLAG_PRECISE_TIMER = 0x20
+	EVENT_BASE_FLAG_PRECISE_TIMER = 0x20,
+
+	/** Keep events with timeouts in a hierarchical timing wheel instead
+	    of a binary min-heap.  Adding and removing a timeout becomes O(1)
+	    instead of O(log n), which pays off when very many timeouts are
+	    pending and are added and removed frequently, as with idle
+	    connection timeouts.  Timeouts are still never run early, but
+	    timeouts on the same millisecond may run in a different order.
+
+	    This flag can also be activated by setting the EVENT_TIMER_WHEEL
+	    environment variable.
+	 */
+	EVENT_BASE_FLAG_TIMER_WHEEL = 0x40,
+
+	/** Allocate the small fixed-size objects that belong to this base
+	    (events from event_new(), event_base_once() records and
+	    bufferevents) from per-base slabs instead of calling malloc for
+	    each one.  Freed objects are kept on per-size freelists for
+	    reuse, and the memory goes back to the system only when the base
+	    is freed; so every such object must be freed before the base.
+	    event_base_set() and bufferevent_base_set() refuse to move an
+	    event or a bufferevent into or out of such a base.
+
+	    The freelists are protected by the base's own lock, so there is
+	    no contention on a global allocator lock, and none at all when
+	    the base was created with EVENT_BASE_FLAG_NOLOCK.
+	 */
+	EVENT_BASE_FLAG_SLAB_ALLOC = 0x80
 };
 
 /**
@@ -779,6 +986,57 @@ int event_config_set_max_dispatch_interval(struct event_config *cfg,
     const struct timeval *max_interval, int max_callbacks,
     int min_priority);
 
+/**
+ * Make the event base spin before it blocks waiting for events.
+ *
+ * By default, when there is nothing to do, the event loop asks the backend
+ * to block until an event or the next timeout arrives.  Waking up from that
+ * sleep costs a context switch, which shows up as tail latency in
+ * latency-critical programs.  With a busy-poll budget set, the loop first
+ * polls the backend without blocking, over and over, for up to 'budget'
+ * before it falls back to a blocking wait for the remaining timeout.
+ * Wakeups from other threads and events activated by them end the spin
+ * too.
+ *
+ * This trades CPU time for latency: a thread running a busy-polling base
+ * will use a whole CPU while it spins.  The spin never runs past the next
+ * timeout.  Use event_base_get_stats() to see how often a spin found work
+ * (busy_poll_hits) and how often it used up its budget (busy_poll_misses).
+ *
+ * @param cfg The event_base configuration object.
+ * @param budget How long to spin before blocking, or NULL (or a zero
+ *     timeval) to never spin.
+ * @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_config_set_busy_poll(struct event_config *cfg,
+    const struct timeval *budget);
+
+/**
+ * Limit how many ready events the backend hands to the event base each time
+ * it checks for events.
+ *
+ * Backends that collect ready events into an array (currently epoll and
+ * io_uring) size that array to fit the observed readiness, growing it when
+ * a check fills it and shrinking it again when load drops, up to this
+ * maximum.  Events beyond the limit stay queued in the kernel and are
+ * reported by the next check, after timeouts and active callbacks have had
+ * a chance to run.  A large limit lets a burst of readiness be handled in
+ * few loop iterations; a small one keeps the loop responsive to timers and
+ * high-priority events during such a burst.
+ *
+ * The number of events reported by each check is recorded in the
+ * dispatch_events histogram of event_base_get_stats().
+ *
+ * @param cfg The event_base configuration object.
+ * @param max_events The largest number of events to take from the backend
+ *     per check, or 0 to use the backend's default (4096 for epoll).
+ * @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_config_set_max_dispatch_events(struct event_config *cfg,
+    int max_events);
+
 /**
   Initialize the event API.   初始化事件API。
 
@@ -916,7 +1174,9 @@ void event_enable_debug_logging(ev_uint32_t which);
 
   @param eb the event base
   @param ev the event
-  @return 0 on success, -1 on failure.
+  @return 0 on success, -1 on failure, including when the event's base and
+    eb differ and either of them was created with
+    EVENT_BASE_FLAG_SLAB_ALLOC.
  */
 EVENT2_EXPORT_SYMBOL
 int event_base_set(struct event_base *, struct event *);
@@ -1414,6 +1674,34 @@ int event_free_finalize(unsigned, struct event *, event_finalize_callback_fn);
 EVENT2_EXPORT_SYMBOL
 int event_base_once(struct event_base *, evutil_socket_t, short, event_callback_fn, void *, const struct timeval *);
 
+/**
+  Run a callback from the loop of an event_base, posted from any thread.
+
+  event_base_post() is the cheap way for other threads to hand work to the
+  thread that runs an event_base.  Unlike event_base_once() or
+  event_active(), it never takes the base's lock: the callback is pushed
+  onto a lock-free queue, and the loop thread runs everything that has
+  been queued in one batch on its next iteration, in the order in which
+  it was posted.  Only the post that finds the queue empty wakes up the
+  loop, so a burst of posts costs at most one wakeup.
+
+  Posted callbacks run at priority 0.  Callbacks that are still queued
+  when the base is freed are run from event_base_free().
+
+  To post from a thread other than the one running the loop, threading
+  must have been set up (see evthread_use_pthreads()) before the base was
+  created, or the base must have been made notifiable with
+  evthread_make_base_notifiable().
+
+  @param base the event_base whose loop should run the callback
+  @param cb the function to call
+  @param arg an argument to be passed to cb
+  @return 0 if successful, or -1 if an error occurred
+  @see event_base_once()
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_post(struct event_base *base, void (*cb)(void *), void *arg);
+
 /**
   Add an event to the set of pending events.
   将事件添加到待处理事件集中。
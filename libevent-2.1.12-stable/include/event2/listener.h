@@ -122,6 +122,19 @@ typedef void (*evconnlistener_errorcb)(struct evconnlistener *, void *);
  * This socket option also supported by Windows.   Windows也支持此套接字选项。
  */
 #define LEV_OPT_BIND_IPV6ONLY		(1u<<8)
+/** Flag: For a listener group, indicates that each new connection should
+ * go to the listener whose index is the number of the CPU that received
+ * it, modulo the size of the group.
+ *
+ * This attaches an SO_ATTACH_REUSEPORT_CBPF program to the group's
+ * sockets.  It works best when the thread running the event_base of
+ * listener i is pinned to CPU i, so that a connection is accepted and
+ * handled on the CPU where its packets arrive.
+ *
+ * This is only available on Linux 4.5+, and only used by
+ * evconnlistener_group_new_bind().
+ */
+#define LEV_OPT_REUSEPORT_STEER_BY_CPU	(1u<<9)
 
 /**
    Allocate a new evconnlistener object to listen for incoming TCP connections
@@ -206,6 +219,75 @@ EVENT2_EXPORT_SYMBOL
 void evconnlistener_set_error_cb(struct evconnlistener *lev,
     evconnlistener_errorcb errorcb);
 
+/**
+   A set of evconnlisteners, one per event_base, that all listen on the
+   same address with SO_REUSEPORT.
+
+   The kernel spreads incoming connections across the listeners' sockets,
+   so each event_base (typically one per worker thread) accepts its own
+   connections, without a single acceptor thread handing sockets to the
+   others.
+ */
+struct evconnlistener_group;
+
+/**
+   Allocate a group of listeners on a given address, one for each of
+   n_bases event_bases.
+
+   Each listener gets its own socket, bound to sa with SO_REUSEPORT, and
+   runs cb in the thread of its own event_base.  If sa has a port of 0,
+   every socket is bound to the port the kernel picked for the first.
+
+   The group owns its sockets: LEV_OPT_REUSEABLE_PORT and
+   LEV_OPT_CLOSE_ON_FREE are always set.  Add
+   LEV_OPT_REUSEPORT_STEER_BY_CPU to choose the listener by receiving CPU
+   instead of by connection hash; if that is not supported, the group
+   is not created.
+
+   This needs SO_REUSEPORT load balancing, as found on Linux 3.9+.
+
+   @param bases An array of event bases, one per listener.
+   @param n_bases The number of elements in bases.
+   @param cb A callback to be invoked when a new connection arrives.
+   @param ptr A user-supplied pointer to give to the callback.
+   @param flags Any number of LEV_OPT_* flags
+   @param backlog Passed to each listen() call.  Set to -1 for a
+      reasonable default.
+   @param sa The address to listen for connections on.
+   @param socklen The length of the address.
+   @return a new listener group, or NULL on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evconnlistener_group *evconnlistener_group_new_bind(
+    struct event_base **bases, int n_bases,
+    evconnlistener_cb cb, void *ptr, unsigned flags, int backlog,
+    const struct sockaddr *sa, int socklen);
+/**
+   Disable and deallocate every listener in a group, and the group.
+ */
+EVENT2_EXPORT_SYMBOL
+void evconnlistener_group_free(struct evconnlistener_group *group);
+/**
+   Re-enable every listener in a group.
+ */
+EVENT2_EXPORT_SYMBOL
+int evconnlistener_group_enable(struct evconnlistener_group *group);
+/**
+   Stop listening for connections on every listener in a group.
+ */
+EVENT2_EXPORT_SYMBOL
+int evconnlistener_group_disable(struct evconnlistener_group *group);
+
+/** Return the number of listeners in a group. */
+EVENT2_EXPORT_SYMBOL
+int evconnlistener_group_get_size(struct evconnlistener_group *group);
+
+/** Return the i'th listener in a group, which uses the i'th event_base
+    passed to evconnlistener_group_new_bind(); or NULL if there is none. */
+EVENT2_EXPORT_SYMBOL
+struct evconnlistener *evconnlistener_group_get_listener(
+    struct evconnlistener_group *group, int i);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,626 @@
+/*
+ * Copyright 2000-2007 Niels Provos <provos@citi.umich.edu>
+ * Copyright 2007-2012 Niels Provos, Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef EVENT__HAVE_IO_URING
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "event-internal.h"
+#include "evsignal-internal.h"
+#include "event2/thread.h"
+#include "evthread-internal.h"
+#include "log-internal.h"
+#include "evmap-internal.h"
+#include "changelist-internal.h"
+#include "mm-internal.h"
+
+/*
+  This backend uses io_uring (Linux 5.13 and later) for readiness
+  notification.  Every fd we care about has a single poll request in
+  flight in the ring; all the adds and deletes that pile up in the
+  changelist between two calls to iouring_dispatch() are written into the
+  submission queue and handed to the kernel by the same io_uring_enter()
+  that waits for completions, so changing interest costs no syscalls of
+  its own.
+
+  Edge-triggered events use multishot polls, which stay armed and report
+  every new wakeup.  Level-triggered events use one-shot polls that we
+  re-arm on the next dispatch after they fire; since a fresh poll request
+  checks the fd's current state, data left unread by a callback is
+  reported again, just as with epoll.
+ */
+
+/* Kernel features we can't do without: EXT_ARG lets us pass a timeout to
+ * io_uring_enter(), NODROP keeps completions from being lost when the
+ * completion queue overflows, and RSRC_TAGS arrived in the same release
+ * as multishot polls, which the kernel doesn't otherwise advertise. */
+#define IOURING_REQUIRED_FEATURES \
+	(IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG| \
+	 IORING_FEAT_RSRC_TAGS)
+
+#define IOURING_SQ_ENTRIES 256
+#define IOURING_CQ_ENTRIES 4096
+
+/* A poll request is identified by its fd in the low 32 bits of user_data
+ * and the fd's generation in the high 32 bits.  Completions for cancelled
+ * requests, and for the cancellations themselves, are thus recognizable. */
+#define IOURING_UDATA(fd, gen) \
+	(((ev_uint64_t)(gen) << 32) | (ev_uint32_t)(fd))
+#define IOURING_UDATA_FD(ud) ((int)((ud) & 0xffffffffu))
+#define IOURING_UDATA_GEN(ud) ((ev_uint32_t)((ud) >> 32))
+/* No valid fd has all of its low 32 bits set. */
+#define IOURING_UDATA_IGNORE (~(ev_uint64_t)0)
+
+#define IOURING_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define IOURING_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* Per-fd state: what we are polling for, and which poll request is the
+ * current one. */
+struct iouring_fd {
+	ev_uint32_t gen;
+	ev_uint8_t events;
+	ev_uint8_t flags;
+};
+
+/* A poll request for this fd is in flight. */
+#define IOURING_FD_ARMED 0x01
+/* The fd's events are edge-triggered; use a multishot poll. */
+#define IOURING_FD_ET 0x02
+/* The fd is on the list of polls to re-arm at the next dispatch. */
+#define IOURING_FD_REARM 0x04
+/* The poll request in flight, if any, is not for the current events. */
+#define IOURING_FD_STALE 0x08
+
+struct iouringop {
+	int ring_fd;
+
+	/* The shared ring mapping and the array of submission entries. */
+	void *ring;
+	size_t ring_sz;
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+
+	/* Submission queue. */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	/* Tail including entries we haven't published to the kernel yet. */
+	unsigned sq_local_tail;
+
+	/* Completion queue. */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Per-fd state, indexed by fd. */
+	struct iouring_fd *fds;
+	int nfds;
+
+	/* Fds whose one-shot poll fired and must be re-armed, or whose
+	 * change we couldn't queue for want of submission entries. */
+	int *rearm;
+	int n_rearm;
+	int rearm_size;
+};
+
+static void *iouring_init(struct event_base *);
+static int iouring_dispatch(struct event_base *, struct timeval *);
+static void iouring_dealloc(struct event_base *);
+
+const struct eventop iouringops = {
+	"io_uring",
+	iouring_init,
+	event_changelist_add_,
+	event_changelist_del_,
+	iouring_dispatch,
+	iouring_dealloc,
+	1, /* need reinit */
+	EV_FEATURE_ET|EV_FEATURE_O1|EV_FEATURE_EARLY_CLOSE,
+	EVENT_CHANGELIST_FDINFO_SIZE
+};
+
+static int
+iouring_enter(struct iouringop *iop, unsigned min_complete, unsigned flags,
+    const void *arg, size_t argsz)
+{
+	unsigned to_submit;
+
+	IOURING_STORE_RELEASE(iop->sq_tail, iop->sq_local_tail);
+	to_submit = iop->sq_local_tail - IOURING_LOAD_ACQUIRE(iop->sq_head);
+
+	return (int)syscall(__NR_io_uring_enter, iop->ring_fd, to_submit,
+	    min_complete, flags, arg, argsz);
+}
+
+static void
+iouring_free(struct iouringop *iop)
+{
+	if (iop->sqes && iop->sqes != MAP_FAILED)
+		munmap(iop->sqes, iop->sqes_sz);
+	if (iop->ring && iop->ring != MAP_FAILED)
+		munmap(iop->ring, iop->ring_sz);
+	if (iop->ring_fd >= 0)
+		close(iop->ring_fd);
+	if (iop->fds)
+		mm_free(iop->fds);
+	if (iop->rearm)
+		mm_free(iop->rearm);
+
+	memset(iop, 0, sizeof(struct iouringop));
+	mm_free(iop);
+}
+
+static void *
+iouring_init(struct event_base *base)
+{
+	struct iouringop *iop;
+	struct io_uring_params p;
+	unsigned *sq_array;
+	unsigned i;
+	char *ring;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_CLAMP;
+	p.cq_entries = IOURING_CQ_ENTRIES;
+	fd = (int)syscall(__NR_io_uring_setup, IOURING_SQ_ENTRIES, &p);
+	if (fd < 0) {
+		/* ENOSYS means an old kernel; EPERM means io_uring is turned
+		 * off by sysctl or a seccomp filter.  Either way we quietly
+		 * let the next backend have a go. */
+		if (errno != ENOSYS && errno != EPERM && errno != EINVAL)
+			event_warn("io_uring_setup");
+		return (NULL);
+	}
+	if ((p.features & IOURING_REQUIRED_FEATURES) !=
+	    IOURING_REQUIRED_FEATURES) {
+		event_debug(("%s: kernel io_uring lacks features %x; "
+			"not using it", __func__,
+			IOURING_REQUIRED_FEATURES & ~p.features));
+		close(fd);
+		return (NULL);
+	}
+
+	if (!(iop = mm_calloc(1, sizeof(struct iouringop)))) {
+		close(fd);
+		return (NULL);
+	}
+	iop->ring_fd = fd;
+
+	/* With IORING_FEAT_SINGLE_MMAP both queues live in one mapping. */
+	iop->ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) >
+	    iop->ring_sz)
+		iop->ring_sz = p.cq_off.cqes +
+		    p.cq_entries * sizeof(struct io_uring_cqe);
+	iop->ring = mmap(NULL, iop->ring_sz, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (iop->ring == MAP_FAILED) {
+		event_warn("%s: mmap", __func__);
+		goto err;
+	}
+	iop->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	iop->sqes = mmap(NULL, iop->sqes_sz, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (iop->sqes == MAP_FAILED) {
+		event_warn("%s: mmap", __func__);
+		goto err;
+	}
+
+	ring = iop->ring;
+	iop->sq_head = (unsigned *)(ring + p.sq_off.head);
+	iop->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+	iop->sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask);
+	iop->sq_entries = *(unsigned *)(ring + p.sq_off.ring_entries);
+	iop->sq_local_tail = *iop->sq_tail;
+	iop->cq_head = (unsigned *)(ring + p.cq_off.head);
+	iop->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+	iop->cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+	iop->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	/* We always fill submission entries in ring order, so the index
+	 * array never needs to change. */
+	sq_array = (unsigned *)(ring + p.sq_off.array);
+	for (i = 0; i < iop->sq_entries; ++i)
+		sq_array[i] = i;
+
+	evsig_init_(base);
+
+	return (iop);
+err:
+	iouring_free(iop);
+	return (NULL);
+}
+
+/* Return the next free submission entry, cleared.  If the submission
+ * queue is full, hand what is in it to the kernel first. */
+static struct io_uring_sqe *
+iouring_get_sqe(struct iouringop *iop)
+{
+	struct io_uring_sqe *sqe;
+
+	if (iop->sq_local_tail - IOURING_LOAD_ACQUIRE(iop->sq_head) >=
+	    iop->sq_entries) {
+		/* Submitting consumes the whole queue unless the kernel
+		 * refuses; if it does, report that rather than retry. */
+		if (iouring_enter(iop, 0, 0, NULL, 0) < 0) {
+			event_warn("%s: io_uring_enter", __func__);
+			return (NULL);
+		}
+		if (iop->sq_local_tail - IOURING_LOAD_ACQUIRE(iop->sq_head) >=
+		    iop->sq_entries) {
+			event_warnx("%s: submission queue is full", __func__);
+			return (NULL);
+		}
+	}
+
+	sqe = &iop->sqes[iop->sq_local_tail & iop->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	++iop->sq_local_tail;
+	return (sqe);
+}
+
+static ev_uint32_t
+iouring_poll_mask(short events)
+{
+	ev_uint32_t mask = 0;
+
+	if (events & EV_READ)
+		mask |= POLLIN;
+	if (events & EV_WRITE)
+		mask |= POLLOUT;
+	if (events & EV_CLOSED)
+		mask |= POLLRDHUP;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	/* The kernel reads poll32_events half-word swapped on big-endian
+	 * machines. */
+	mask = (mask << 16) | (mask >> 16);
+#endif
+	return (mask);
+}
+
+static int
+iouring_queue_poll(struct iouringop *iop, int fd)
+{
+	struct iouring_fd *f = &iop->fds[fd];
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = iouring_get_sqe(iop)))
+		return (-1);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = iouring_poll_mask(f->events);
+	if (f->flags & IOURING_FD_ET)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = IOURING_UDATA(fd, ++f->gen);
+	f->flags |= IOURING_FD_ARMED;
+
+	return (0);
+}
+
+static int
+iouring_queue_cancel(struct iouringop *iop, int fd)
+{
+	struct iouring_fd *f = &iop->fds[fd];
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = iouring_get_sqe(iop)))
+		return (-1);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = IOURING_UDATA(fd, f->gen);
+	sqe->user_data = IOURING_UDATA_IGNORE;
+	/* Whatever the old request still reports is now stale. */
+	++f->gen;
+	f->flags &= ~IOURING_FD_ARMED;
+
+	return (0);
+}
+
+static int
+iouring_grow_fds(struct iouringop *iop, int fd)
+{
+	struct iouring_fd *new_fds;
+	int new_nfds = iop->nfds ? iop->nfds : 64;
+
+	while (new_nfds <= fd)
+		new_nfds <<= 1;
+
+	new_fds = mm_realloc(iop->fds, new_nfds * sizeof(struct iouring_fd));
+	if (new_fds == NULL)
+		return (-1);
+	memset(new_fds + iop->nfds, 0,
+	    (new_nfds - iop->nfds) * sizeof(struct iouring_fd));
+
+	iop->fds = new_fds;
+	iop->nfds = new_nfds;
+	return (0);
+}
+
+static int
+iouring_queue_rearm(struct iouringop *iop, int fd)
+{
+	struct iouring_fd *f = &iop->fds[fd];
+
+	if (f->flags & IOURING_FD_REARM)
+		return (0);
+
+	if (iop->n_rearm == iop->rearm_size) {
+		int new_size = iop->rearm_size ? iop->rearm_size * 2 : 64;
+		int *new_rearm = mm_realloc(iop->rearm, new_size * sizeof(int));
+		if (new_rearm == NULL) {
+			event_warn("%s: realloc", __func__);
+			return (-1);
+		}
+		iop->rearm = new_rearm;
+		iop->rearm_size = new_size;
+	}
+	iop->rearm[iop->n_rearm++] = fd;
+	f->flags |= IOURING_FD_REARM;
+	return (0);
+}
+
+/* Bring the fd's poll request in line with its events: cancel a stale
+ * request, and queue a new one if there is anything to poll for.  If the
+ * submission queue has no room, put the fd on the re-arm list so that we
+ * try again on the next dispatch, once the kernel has taken what is
+ * queued.  Return -1 only if we can't do that either. */
+static int
+iouring_sync_fd(struct iouringop *iop, int fd)
+{
+	struct iouring_fd *f = &iop->fds[fd];
+
+	if ((f->flags & (IOURING_FD_STALE|IOURING_FD_ARMED)) ==
+	    (IOURING_FD_STALE|IOURING_FD_ARMED) &&
+	    iouring_queue_cancel(iop, fd) < 0)
+		return iouring_queue_rearm(iop, fd);
+	f->flags &= ~IOURING_FD_STALE;
+	if (f->events && !(f->flags & IOURING_FD_ARMED) &&
+	    iouring_queue_poll(iop, fd) < 0)
+		return iouring_queue_rearm(iop, fd);
+	return (0);
+}
+
+static int
+iouring_apply_one_change(struct iouringop *iop, const struct event_change *ch)
+{
+	struct iouring_fd *f;
+	short events = ch->old_events & (EV_READ|EV_WRITE|EV_CLOSED);
+	ev_uint8_t all = ch->read_change|ch->write_change|ch->close_change;
+
+	if (ch->read_change & EV_CHANGE_ADD)
+		events |= EV_READ;
+	else if (ch->read_change & EV_CHANGE_DEL)
+		events &= ~EV_READ;
+	if (ch->write_change & EV_CHANGE_ADD)
+		events |= EV_WRITE;
+	else if (ch->write_change & EV_CHANGE_DEL)
+		events &= ~EV_WRITE;
+	if (ch->close_change & EV_CHANGE_ADD)
+		events |= EV_CLOSED;
+	else if (ch->close_change & EV_CHANGE_DEL)
+		events &= ~EV_CLOSED;
+
+	if (ch->fd >= iop->nfds && iouring_grow_fds(iop, ch->fd) < 0)
+		return (-1);
+	f = &iop->fds[ch->fd];
+
+	/* An add always gets a fresh poll request, even if nothing seems to
+	 * have changed: the fd might have been closed and reopened since
+	 * the old request was made, and that request is still watching the
+	 * old file. */
+	if (!(all & EV_CHANGE_ADD) && events == f->events)
+		return (0);
+
+	f->events = events;
+	if (all & EV_CHANGE_ET)
+		f->flags |= IOURING_FD_ET;
+	else
+		f->flags &= ~IOURING_FD_ET;
+	f->flags |= IOURING_FD_STALE;
+
+	return iouring_sync_fd(iop, ch->fd);
+}
+
+static int
+iouring_apply_changes(struct event_base *base)
+{
+	struct event_changelist *changelist = &base->changelist;
+	struct iouringop *iop = base->evbase;
+	int r = 0;
+	int i, n;
+
+	/* Fds that still can't be armed go back on the list; they never
+	 * land past the entry we are looking at. */
+	n = iop->n_rearm;
+	iop->n_rearm = 0;
+	for (i = 0; i < n; ++i) {
+		int fd = iop->rearm[i];
+
+		iop->fds[fd].flags &= ~IOURING_FD_REARM;
+		if (iouring_sync_fd(iop, fd) < 0)
+			r = -1;
+	}
+
+	for (i = 0; i < changelist->n_changes; ++i) {
+		if (iouring_apply_one_change(iop, &changelist->changes[i]) < 0) {
+			event_warnx("%s: couldn't queue change for fd %d",
+			    __func__, changelist->changes[i].fd);
+			r = -1;
+		}
+	}
+
+	return (r);
+}
+
+static void
+iouring_process_completions(struct event_base *base)
+{
+	struct iouringop *iop = base->evbase;
+	unsigned head = *iop->cq_head;
+	unsigned tail = IOURING_LOAD_ACQUIRE(iop->cq_tail);
+	int max = base->max_dispatch_events ? base->max_dispatch_events : INT_MAX;
+	int n = 0;
+
+	/* Whatever is beyond 'max' stays in the completion queue for the
+	 * next dispatch. */
+	for (; head != tail && n < max; ++head) {
+		const struct io_uring_cqe *cqe = &iop->cqes[head & iop->cq_mask];
+		struct iouring_fd *f;
+		int fd, what;
+		short ev = 0;
+
+		if (cqe->user_data == IOURING_UDATA_IGNORE)
+			continue;
+		fd = IOURING_UDATA_FD(cqe->user_data);
+		if (fd >= iop->nfds)
+			continue;
+		f = &iop->fds[fd];
+		if (IOURING_UDATA_GEN(cqe->user_data) != f->gen)
+			continue;
+
+		if (!(cqe->flags & IORING_CQE_F_MORE)) {
+			/* The request is done: a one-shot poll fired, or the
+			 * kernel gave up on a multishot one. */
+			f->flags &= ~IOURING_FD_ARMED;
+			if (cqe->res >= 0)
+				iouring_queue_rearm(iop, fd);
+		}
+
+		if (cqe->res < 0) {
+			/* Most likely the fd was closed under us. */
+			event_debug(("%s: poll on fd %d failed: %s", __func__,
+				fd, strerror(-cqe->res)));
+			continue;
+		}
+
+		what = cqe->res;
+		if (what & POLLERR) {
+			ev = EV_READ | EV_WRITE;
+		} else if ((what & POLLHUP) && !(what & POLLRDHUP)) {
+			ev = EV_READ | EV_WRITE;
+		} else {
+			if (what & POLLIN)
+				ev |= EV_READ;
+			if (what & POLLOUT)
+				ev |= EV_WRITE;
+			if (what & POLLRDHUP)
+				ev |= EV_CLOSED;
+		}
+
+		if (!ev)
+			continue;
+
+		evmap_io_active_(base, fd, ev | EV_ET);
+		++n;
+	}
+
+	IOURING_STORE_RELEASE(iop->cq_head, head);
+	event_debug(("%s: io_uring reports %d", __func__, n));
+	event_base_record_dispatch_events_(base, n);
+}
+
+static int
+iouring_dispatch(struct event_base *base, struct timeval *tv)
+{
+	struct iouringop *iop = base->evbase;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned wait_nr = 1;
+	int res;
+
+	memset(&arg, 0, sizeof(arg));
+	if (tv != NULL) {
+		ts.tv_sec = tv->tv_sec;
+		ts.tv_nsec = tv->tv_usec * 1000;
+		arg.ts = (ev_uint64_t)(uintptr_t)&ts;
+		if (tv->tv_sec == 0 && tv->tv_usec == 0)
+			wait_nr = 0;
+	}
+
+	if (iouring_apply_changes(base) < 0) {
+		event_changelist_remove_all_(&base->changelist, base);
+		return (-1);
+	}
+	event_changelist_remove_all_(&base->changelist, base);
+	/* Don't sleep while some fd is waiting for its poll to be queued:
+	 * it couldn't wake us up. */
+	if (iop->n_rearm)
+		wait_nr = 0;
+
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	/* Submit every queued change and wait, all in one go.  If the kernel
+	 * stops short of submitting everything, it returns without waiting
+	 * and the rest goes out on the next call. */
+	res = iouring_enter(iop, wait_nr,
+	    IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+
+	if (res == -1 && errno != EINTR && errno != ETIME &&
+	    errno != EAGAIN && errno != EBUSY) {
+		event_warn("io_uring_enter");
+		return (-1);
+	}
+
+	iouring_process_completions(base);
+
+	return (0);
+}
+
+static void
+iouring_dealloc(struct event_base *base)
+{
+	struct iouringop *iop = base->evbase;
+
+	evsig_dealloc_(base);
+	iouring_free(iop);
+}
+
+#endif /* EVENT__HAVE_IO_URING */
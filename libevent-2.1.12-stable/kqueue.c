@@ -330,6 +330,7 @@ kq_dispatch(struct event_base *base, struct timeval *tv)
 	}
 
 	event_debug(("%s: kevent reports %d", __func__, res));
+	event_base_record_dispatch_events_(base, res);
 
 	for (i = 0; i < res; i++) {
 		int which = 0;
@@ -405,7 +406,7 @@ kq_dispatch(struct event_base *base, struct timeval *tv)
 			which |= EV_SIGNAL;
 #ifdef EVFILT_USER
 		} else if (events[i].filter == EVFILT_USER) {
-			base->is_notify_pending = 0;
+			MPSC_STORE_INT_(&base->is_notify_pending, 0);
 #endif
 		}
 
@@ -40,6 +40,7 @@
 #include <mswsock.h>
 #endif
 #include <errno.h>
+#include <string.h>
 #ifdef EVENT__HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
@@ -49,6 +50,9 @@
 #ifdef EVENT__HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 #include "event2/listener.h"
 #include "event2/util.h"
@@ -90,6 +94,11 @@ struct evconnlistener_event {
 	struct event listener;
 };
 
+struct evconnlistener_group {
+	int n_listeners;
+	struct evconnlistener **listeners;
+};
+
 #ifdef _WIN32
 struct evconnlistener_iocp {
 	struct evconnlistener base;
@@ -207,26 +216,22 @@ evconnlistener_new(struct event_base *base,
 	return &lev->base;
 }
 
-struct evconnlistener *
-evconnlistener_new_bind(struct event_base *base, evconnlistener_cb cb,
-    void *ptr, unsigned flags, int backlog, const struct sockaddr *sa,
-    int socklen)
+/* Create a nonblocking stream socket with the options in 'flags', and bind
+ * it to sa if sa is set.  Return the socket, or -1 on failure. */
+static evutil_socket_t
+listener_bind_socket(unsigned flags, const struct sockaddr *sa, int socklen)
 {
-	struct evconnlistener *listener;
 	evutil_socket_t fd;
 	int on = 1;
 	int family = sa ? sa->sa_family : AF_UNSPEC;
 	int socktype = SOCK_STREAM | EVUTIL_SOCK_NONBLOCK;
 
-	if (backlog == 0)
-		return NULL;
-
 	if (flags & LEV_OPT_CLOSE_ON_EXEC)
 		socktype |= EVUTIL_SOCK_CLOEXEC;
 
 	fd = evutil_socket_(family, socktype, 0);
 	if (fd == -1)
-		return NULL;
+		return -1;
 
 	if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void*)&on, sizeof(on))<0)
 		goto err;
@@ -256,16 +261,189 @@ evconnlistener_new_bind(struct event_base *base, evconnlistener_cb cb,
 			goto err;
 	}
 
+	return fd;
+err:
+	evutil_closesocket(fd);
+	return -1;
+}
+
+struct evconnlistener *
+evconnlistener_new_bind(struct event_base *base, evconnlistener_cb cb,
+    void *ptr, unsigned flags, int backlog, const struct sockaddr *sa,
+    int socklen)
+{
+	struct evconnlistener *listener;
+	evutil_socket_t fd;
+
+	if (backlog == 0)
+		return NULL;
+
+	fd = listener_bind_socket(flags, sa, socklen);
+	if (fd == -1)
+		return NULL;
+
 	listener = evconnlistener_new(base, cb, ptr, flags, backlog, fd);
-	if (!listener)
-		goto err;
+	if (!listener) {
+		evutil_closesocket(fd);
+		return NULL;
+	}
 
 	return listener;
+}
+
+/* Make the kernel hand each new connection in fd's SO_REUSEPORT group to
+ * the socket whose index in the group is the number of the receiving CPU,
+ * modulo n. */
+static int
+listener_attach_cpu_steering(evutil_socket_t fd, int n)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_filter code[] = {
+		/* A = the current CPU */
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		/* A = A % n */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (ev_uint32_t)n },
+		/* return A */
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+	    (void *)&prog, (ev_socklen_t)sizeof(prog));
+#else
+	event_warnx("%s: steering connections by CPU is not supported "
+	    "on this platform", __func__);
+	return -1;
+#endif
+}
+
+struct evconnlistener_group *
+evconnlistener_group_new_bind(struct event_base **bases, int n_bases,
+    evconnlistener_cb cb, void *ptr, unsigned flags, int backlog,
+    const struct sockaddr *sa, int socklen)
+{
+	struct evconnlistener_group *group;
+	struct sockaddr_storage ss;
+	ev_socklen_t sslen = sizeof(ss);
+	unsigned lflags;
+	int i;
+
+	if (!bases || n_bases < 1 || !sa || socklen < 0 ||
+	    socklen > (int)sizeof(ss) || backlog == 0)
+		return NULL;
+
+	group = mm_calloc(1, sizeof(struct evconnlistener_group));
+	if (!group)
+		return NULL;
+	group->listeners = mm_calloc(n_bases, sizeof(struct evconnlistener *));
+	if (!group->listeners) {
+		mm_free(group);
+		return NULL;
+	}
+
+	/* Every socket we open belongs to us, and only the last step may
+	 * enable the listeners: until the steering program is attached, the
+	 * kernel would spread connections by hash. */
+	lflags = flags | LEV_OPT_REUSEABLE_PORT | LEV_OPT_CLOSE_ON_FREE |
+	    LEV_OPT_DISABLED;
+	memcpy(&ss, sa, socklen);
+	sslen = (ev_socklen_t)socklen;
+
+	for (i = 0; i < n_bases; ++i) {
+		evutil_socket_t fd;
+
+		fd = listener_bind_socket(lflags,
+		    (struct sockaddr *)&ss, (int)sslen);
+		if (fd == -1)
+			goto err;
+		/* If the caller let the kernel pick a port, the rest of the
+		 * sockets have to bind to the one it picked. */
+		if (i == 0) {
+			sslen = sizeof(ss);
+			if (getsockname(fd, (struct sockaddr *)&ss,
+				&sslen) < 0) {
+				evutil_closesocket(fd);
+				goto err;
+			}
+		}
+		group->listeners[i] = evconnlistener_new(bases[i], cb, ptr,
+		    lflags, backlog, fd);
+		if (!group->listeners[i]) {
+			evutil_closesocket(fd);
+			goto err;
+		}
+		++group->n_listeners;
+	}
+
+	if ((flags & LEV_OPT_REUSEPORT_STEER_BY_CPU) &&
+	    listener_attach_cpu_steering(
+		    evconnlistener_get_fd(group->listeners[0]), n_bases) < 0) {
+		event_sock_warn(evconnlistener_get_fd(group->listeners[0]),
+		    "%s: couldn't attach SO_ATTACH_REUSEPORT_CBPF program",
+		    __func__);
+		goto err;
+	}
+
+	if (!(flags & LEV_OPT_DISABLED))
+		evconnlistener_group_enable(group);
+
+	return group;
 err:
-	evutil_closesocket(fd);
+	evconnlistener_group_free(group);
 	return NULL;
 }
 
+void
+evconnlistener_group_free(struct evconnlistener_group *group)
+{
+	int i;
+
+	for (i = 0; i < group->n_listeners; ++i)
+		evconnlistener_free(group->listeners[i]);
+	mm_free(group->listeners);
+	mm_free(group);
+}
+
+int
+evconnlistener_group_enable(struct evconnlistener_group *group)
+{
+	int i, r = 0;
+
+	for (i = 0; i < group->n_listeners; ++i) {
+		if (evconnlistener_enable(group->listeners[i]) < 0)
+			r = -1;
+	}
+	return r;
+}
+
+int
+evconnlistener_group_disable(struct evconnlistener_group *group)
+{
+	int i, r = 0;
+
+	for (i = 0; i < group->n_listeners; ++i) {
+		if (evconnlistener_disable(group->listeners[i]) < 0)
+			r = -1;
+	}
+	return r;
+}
+
+int
+evconnlistener_group_get_size(struct evconnlistener_group *group)
+{
+	return group->n_listeners;
+}
+
+struct evconnlistener *
+evconnlistener_group_get_listener(struct evconnlistener_group *group, int i)
+{
+	if (i < 0 || i >= group->n_listeners)
+		return NULL;
+	return group->listeners[i];
+}
+
 void
 evconnlistener_free(struct evconnlistener *lev)
 {
@@ -85,6 +85,41 @@ void event_mm_free_(void *p);
 #define mm_free(p) free(p)
 #endif
 
+struct event_base;
+/** Allocate a zeroed object of the given size that belongs to base: from
+ * the base's slabs if it was created with EVENT_BASE_FLAG_SLAB_ALLOC, and
+ * with mm_calloc() otherwise.  Free it with event_base_obj_free_() on the
+ * same base. */
+EVENT2_EXPORT_SYMBOL
+void *event_base_obj_calloc_(struct event_base *base, size_t size);
+EVENT2_EXPORT_SYMBOL
+void event_base_obj_free_(struct event_base *base, void *ptr);
+/** Return true iff an object from event_base_obj_calloc_() on 'from' may be
+ * freed with event_base_obj_free_() on 'to', as when it moves to another
+ * base: that is, unless either base keeps such objects in slabs. */
+EVENT2_EXPORT_SYMBOL
+int event_base_obj_movable_(struct event_base *from, struct event_base *to);
+
+/** A cache of memory that belongs to one thread, such as the evbuffer chain
+ * cache: it lives in thread-local storage, or is the only one of its kind
+ * when Libevent is built without thread support.  Zero it before use. */
+struct event_thread_cache_ {
+	/** Frees everything in the cache. */
+	void (*empty)(struct event_thread_cache_ *cache);
+	/** True if the cache is on its thread's list of caches. */
+	int listed;
+	struct event_thread_cache_ *next;
+};
+/** Return true iff the calling thread may keep memory in cache, which
+ * belongs to it.  Once this has returned true, empty(cache) is called from
+ * the same thread when it exits, or when it calls event_set_mem_functions()
+ * or libevent_global_shutdown(); no other thread ever empties it.  With
+ * thread support, this needs a threading library that can tell us about
+ * thread exit, as evthread_use_pthreads() sets up. */
+EVENT2_EXPORT_SYMBOL
+int event_thread_cache_usable_(struct event_thread_cache_ *cache,
+    void (*empty)(struct event_thread_cache_ *));
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef MPSC_INTERNAL_H_INCLUDED_
+#define MPSC_INTERNAL_H_INCLUDED_
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#undef WIN32_LEAN_AND_MEAN
+#endif
+
+/* A multi-producer, single-consumer queue.
+ *
+ * Producers push onto an intrusive stack with a compare-and-swap on its
+ * head; the consumer takes the whole stack with one exchange and reverses
+ * it, so that items come out in the order in which they were pushed.  Any
+ * number of threads may call mpsc_push_() at once; only one thread at a
+ * time may call mpsc_take_all_().
+ *
+ * On compilers where we do not know how to do atomic operations,
+ * MPSC_NEEDS_LOCK_ is defined, and callers must serialize every operation
+ * on the queue themselves.
+ */
+
+struct mpsc_node {
+	struct mpsc_node *next;
+};
+
+struct mpsc_queue {
+	struct mpsc_node *head;
+};
+
+#if defined(__GNUC__) && defined(__ATOMIC_SEQ_CST)
+#define MPSC_LOAD_(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define MPSC_STORE_(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define MPSC_XCHG_(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define MPSC_CAS_(p, expp, v)						\
+	__atomic_compare_exchange_n((p), (expp), (v), 1,		\
+	    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+#define MPSC_XCHG_INT_(p, v) MPSC_XCHG_(p, v)
+#define MPSC_STORE_INT_(p, v) MPSC_STORE_(p, v)
+#elif defined(_MSC_VER)
+#define MPSC_LOAD_(p) InterlockedCompareExchangePointer((PVOID*)(p), NULL, NULL)
+#define MPSC_STORE_(p, v) ((void)InterlockedExchangePointer((PVOID*)(p), (v)))
+#define MPSC_XCHG_(p, v) InterlockedExchangePointer((PVOID*)(p), (v))
+#define MPSC_CAS_(p, expp, v) mpsc_cas_msvc_((PVOID*)(p), (PVOID*)(expp), (v))
+#define MPSC_XCHG_INT_(p, v) InterlockedExchange((LONG*)(p), (v))
+#define MPSC_STORE_INT_(p, v) ((void)InterlockedExchange((LONG*)(p), (v)))
+static inline int
+mpsc_cas_msvc_(PVOID *p, PVOID *expp, PVOID v)
+{
+	PVOID old = InterlockedCompareExchangePointer(p, v, *expp);
+	if (old == *expp)
+		return 1;
+	*expp = old;
+	return 0;
+}
+#else
+#define MPSC_NEEDS_LOCK_
+#define MPSC_LOAD_(p) (*(p))
+#define MPSC_STORE_(p, v) (*(p) = (v))
+#define MPSC_XCHG_(p, v) mpsc_xchg_nolock_((void **)(p), (v))
+#define MPSC_CAS_(p, expp, v) (*(p) = (v), 1)
+#define MPSC_XCHG_INT_(p, v) mpsc_xchg_int_nolock_((p), (v))
+#define MPSC_STORE_INT_(p, v) (*(p) = (v))
+static inline void *
+mpsc_xchg_nolock_(void **p, void *v)
+{
+	void *old = *p;
+	*p = v;
+	return old;
+}
+static inline int
+mpsc_xchg_int_nolock_(int *p, int v)
+{
+	int old = *p;
+	*p = v;
+	return old;
+}
+#endif
+
+static inline void
+mpsc_ctor_(struct mpsc_queue *q)
+{
+	q->head = NULL;
+}
+
+static inline int
+mpsc_empty_(struct mpsc_queue *q)
+{
+	return MPSC_LOAD_(&q->head) == NULL;
+}
+
+/** Add n to q.  Return true if q was empty before, so that the caller
+ * knows it may have to wake up the consumer. */
+static inline int
+mpsc_push_(struct mpsc_queue *q, struct mpsc_node *n)
+{
+	struct mpsc_node *head = MPSC_LOAD_(&q->head);
+	do {
+		n->next = head;
+	} while (!MPSC_CAS_(&q->head, &head, n));
+	return n->next == NULL;
+}
+
+/** Remove every node from q, and return them oldest-first as a list linked
+ * through their next pointers. */
+static inline struct mpsc_node *
+mpsc_take_all_(struct mpsc_queue *q)
+{
+	struct mpsc_node *n, *next, *prev = NULL;
+
+	n = (struct mpsc_node *)MPSC_XCHG_(&q->head, NULL);
+	while (n) {
+		next = n->next;
+		n->next = prev;
+		prev = n;
+		n = next;
+	}
+	return prev;
+}
+
+#endif /* MPSC_INTERNAL_H_INCLUDED_ */
@@ -193,6 +193,7 @@ poll_dispatch(struct event_base *base, struct timeval *tv)
 	}
 
 	event_debug(("%s: poll reports %d", __func__, res));
+	event_base_record_dispatch_events_(base, res);
 
 	if (res == 0 || nfds == 0)
 		return (0);
@@ -41,6 +41,7 @@ static struct sockaddr_storage listen_on_addr;
 static struct sockaddr_storage connect_to_addr;
 static int connect_to_addrlen;
 static int use_wrapper = 1;
+static int use_relay = 0;
 
 static SSL_CTX *ssl_ctx = NULL;
 
@@ -144,11 +145,53 @@ eventcb(struct bufferevent *bev, short what, void *ctx)
 	}
 }
 
+/* With -R, each connection is a pair of bufferevents relaying to each other
+ * in the kernel.  We close both once both directions have seen EOF, or as
+ * soon as either side fails. */
+struct relay_conn {
+	struct bufferevent *bev[2];
+	int n_eof;
+};
+
+static void
+relay_conn_free(struct relay_conn *c)
+{
+	bufferevent_free(c->bev[0]);
+	bufferevent_free(c->bev[1]);
+	free(c);
+}
+
+static void
+relay_eventcb(struct bufferevent *bev, short what, void *ctx)
+{
+	struct relay_conn *c = ctx;
+
+	if (what & BEV_EVENT_CONNECTED) {
+		/* The outgoing side has a socket now. */
+		if (bufferevent_socket_relay(c->bev[0], c->bev[1]) < 0 ||
+		    bufferevent_socket_relay(c->bev[1], c->bev[0]) < 0) {
+			fprintf(stderr, "Couldn't set up relay\n");
+			relay_conn_free(c);
+			return;
+		}
+		bufferevent_enable(c->bev[0], EV_READ|EV_WRITE);
+	} else if (what & BEV_EVENT_ERROR) {
+		if (errno)
+			perror("connection error");
+		relay_conn_free(c);
+	} else if (what & BEV_EVENT_EOF) {
+		/* The relay has already passed the EOF on. */
+		if (++c->n_eof == 2)
+			relay_conn_free(c);
+	}
+}
+
 static void
 syntax(void)
 {
 	fputs("Syntax:\n", stderr);
-	fputs("   le-proxy [-s] [-W] <listen-on-addr> <connect-to-addr>\n", stderr);
+	fputs("   le-proxy [-s] [-W] [-R] <listen-on-addr> <connect-to-addr>\n", stderr);
+	fputs("   -R relays with splice() instead of copying through evbuffers\n", stderr);
 	fputs("Example:\n", stderr);
 	fputs("   le-proxy 127.0.0.1:8888 1.2.3.4:80\n", stderr);
 
@@ -165,6 +208,28 @@ accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
 	b_in = bufferevent_socket_new(base, fd,
 	    BEV_OPT_CLOSE_ON_FREE|BEV_OPT_DEFER_CALLBACKS);
 
+	if (use_relay) {
+		struct relay_conn *c = calloc(1, sizeof(*c));
+		b_out = bufferevent_socket_new(base, -1,
+		    BEV_OPT_CLOSE_ON_FREE|BEV_OPT_DEFER_CALLBACKS);
+		assert(c && b_in && b_out);
+		c->bev[0] = b_in;
+		c->bev[1] = b_out;
+		bufferevent_setcb(b_in, NULL, NULL, relay_eventcb, c);
+		bufferevent_setcb(b_out, NULL, NULL, relay_eventcb, c);
+		if (bufferevent_socket_connect(b_out,
+			(struct sockaddr*)&connect_to_addr,
+			connect_to_addrlen) < 0) {
+			perror("bufferevent_socket_connect");
+			relay_conn_free(c);
+			return;
+		}
+		/* The client waits until we are connected and can relay
+		 * what it sends. */
+		bufferevent_enable(b_out, EV_READ|EV_WRITE);
+		return;
+	}
+
 	if (!ssl_ctx || use_wrapper)
 		b_out = bufferevent_socket_new(base, -1,
 		    BEV_OPT_CLOSE_ON_FREE|BEV_OPT_DEFER_CALLBACKS);
@@ -231,13 +296,15 @@ main(int argc, char **argv)
 			use_ssl = 1;
 		} else if (!strcmp(argv[i], "-W")) {
 			use_wrapper = 0;
+		} else if (!strcmp(argv[i], "-R")) {
+			use_relay = 1;
 		} else if (argv[i][0] == '-') {
 			syntax();
 		} else
 			break;
 	}
 
-	if (i+2 != argc)
+	if (i+2 != argc || (use_relay && use_ssl))
 		syntax();
 
 	memset(&listen_on_addr, 0, sizeof(listen_on_addr));
@@ -186,6 +186,7 @@ select_dispatch(struct event_base *base, struct timeval *tv)
 	}
 
 	event_debug(("%s: select reports %d", __func__, res));
+	event_base_record_dispatch_events_(base, res);
 
 	check_selectop(sop);
 	i = evutil_weakrand_range_(&base->weakrand_seed, nfds);
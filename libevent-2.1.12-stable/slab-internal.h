@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SLAB_INTERNAL_H_INCLUDED_
+#define SLAB_INTERNAL_H_INCLUDED_
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+#include "mm-internal.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* A simple slab allocator for small fixed-size objects.
+ *
+ * Objects are rounded up to one of EVENT_SLAB_NCLASSES size classes, each
+ * EVENT_SLAB_GRANULE bytes apart.  Each class carves objects out of chunks
+ * of about EVENT_SLAB_CHUNK_SIZE bytes and keeps freed objects on a LIFO
+ * freelist, so that the most recently freed (and most likely cached)
+ * object is handed out first.  Chunks are only given back when the whole
+ * allocator is cleared.
+ *
+ * Every object is preceded by an EVENT_SLAB_HEADER byte header that holds
+ * its size class while it is allocated, so that event_slab_free_() does
+ * not need to be told the size.  Requests too large for any class go
+ * straight to mm_malloc(), with a NULL class in the header.
+ *
+ * None of this is thread-safe: callers must hold whatever lock protects
+ * the allocator.
+ */
+
+#define EVENT_SLAB_HEADER 16
+#define EVENT_SLAB_GRANULE 64
+#define EVENT_SLAB_NCLASSES 16
+#define EVENT_SLAB_CHUNK_SIZE 16384
+
+struct event_slab_chunk {
+	struct event_slab_chunk *next;
+};
+
+struct event_slab_class {
+	/** Size of each object, header included. */
+	size_t size;
+	/** Free objects, linked through their headers. */
+	void *freelist;
+	/** Every chunk we have allocated for this class. */
+	struct event_slab_chunk *chunks;
+};
+
+struct event_slab {
+	struct event_slab_class classes[EVENT_SLAB_NCLASSES];
+};
+
+#define EVENT_SLAB_LINK_(hdr) (*(void **)(hdr))
+
+static inline void
+event_slab_init_(struct event_slab *s)
+{
+	int i;
+	for (i = 0; i < EVENT_SLAB_NCLASSES; ++i) {
+		s->classes[i].size = (size_t)(i + 1) * EVENT_SLAB_GRANULE;
+		s->classes[i].freelist = NULL;
+		s->classes[i].chunks = NULL;
+	}
+}
+
+static inline void
+event_slab_clear_(struct event_slab *s)
+{
+	int i;
+	for (i = 0; i < EVENT_SLAB_NCLASSES; ++i) {
+		struct event_slab_chunk *chunk, *next;
+		for (chunk = s->classes[i].chunks; chunk; chunk = next) {
+			next = chunk->next;
+			mm_free(chunk);
+		}
+		s->classes[i].freelist = NULL;
+		s->classes[i].chunks = NULL;
+	}
+}
+
+static inline int
+event_slab_grow_(struct event_slab_class *c)
+{
+	struct event_slab_chunk *chunk;
+	size_t n = EVENT_SLAB_CHUNK_SIZE / c->size, i;
+	char *p;
+
+	if (n < 8)
+		n = 8;
+	chunk = mm_malloc(EVENT_SLAB_HEADER + n * c->size);
+	if (chunk == NULL)
+		return -1;
+	chunk->next = c->chunks;
+	c->chunks = chunk;
+
+	/* Push them in reverse, so that they get handed out in address
+	 * order. */
+	p = (char *)chunk + EVENT_SLAB_HEADER + n * c->size;
+	for (i = 0; i < n; ++i) {
+		p -= c->size;
+		EVENT_SLAB_LINK_(p) = c->freelist;
+		c->freelist = p;
+	}
+	return 0;
+}
+
+/** Return a zeroed object of at least size bytes, or NULL. */
+static inline void *
+event_slab_alloc_(struct event_slab *s, size_t size)
+{
+	size_t idx = (size + EVENT_SLAB_HEADER - 1) / EVENT_SLAB_GRANULE;
+	struct event_slab_class *c;
+	char *hdr;
+
+	if (idx >= EVENT_SLAB_NCLASSES) {
+		hdr = mm_calloc(1, size + EVENT_SLAB_HEADER);
+		if (hdr == NULL)
+			return NULL;
+		EVENT_SLAB_LINK_(hdr) = NULL;
+		return hdr + EVENT_SLAB_HEADER;
+	}
+
+	c = &s->classes[idx];
+	if (c->freelist == NULL && event_slab_grow_(c) < 0)
+		return NULL;
+	hdr = c->freelist;
+	c->freelist = EVENT_SLAB_LINK_(hdr);
+	memset(hdr, 0, c->size);
+	EVENT_SLAB_LINK_(hdr) = c;
+	return hdr + EVENT_SLAB_HEADER;
+}
+
+/** Give back an object that came from event_slab_alloc_(). */
+static inline void
+event_slab_free_(void *ptr)
+{
+	char *hdr = (char *)ptr - EVENT_SLAB_HEADER;
+	struct event_slab_class *c = EVENT_SLAB_LINK_(hdr);
+
+	if (c == NULL) {
+		mm_free(hdr);
+		return;
+	}
+	EVENT_SLAB_LINK_(hdr) = c->freelist;
+	c->freelist = hdr;
+}
+
+#endif /* SLAB_INTERNAL_H_INCLUDED_ */
@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark measures how many loopback connections per second a
+ * server can accept with 1 to N worker threads, each running its own
+ * event_base.
+ *
+ * In "group" mode every worker accepts on its own SO_REUSEPORT socket
+ * from an evconnlistener_group.  In "central" mode one acceptor thread
+ * owns a single listener and hands each new socket to the next worker
+ * with event_base_post(), the way servers usually did it before.  With
+ * -s, the group steers connections by CPU, and worker i is pinned to
+ * CPU i.
+ *
+ * A few client threads connect and close as fast as they can.  They
+ * close with SO_LINGER set to zero, so that no TIME_WAIT sockets use up
+ * the loopback port range.
+ */
+
+#define MODE_GROUP 0
+#define MODE_CENTRAL 1
+
+struct worker {
+	pthread_t thread;
+	struct event_base *base;
+	long accepted;
+	int index;
+};
+
+static struct worker *workers;
+static int n_workers;
+static int next_worker;
+static int steer;
+static volatile int stop;
+static struct sockaddr_storage server_addr;
+static ev_socklen_t server_addrlen;
+
+static void
+pin_to_cpu(int cpu)
+{
+#if defined(__linux__) && defined(CPU_SET)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+
+	if (steer)
+		pin_to_cpu(w->index);
+	event_base_loop(w->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	return NULL;
+}
+
+static void
+group_accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *sa, int socklen, void *arg)
+{
+	struct event_base *base = evconnlistener_get_base(listener);
+	int i;
+
+	for (i = 0; i < n_workers; ++i) {
+		if (workers[i].base == base) {
+			++workers[i].accepted;
+			break;
+		}
+	}
+	evutil_closesocket(fd);
+}
+
+struct handoff {
+	struct worker *worker;
+	evutil_socket_t fd;
+};
+
+static void
+worker_take_cb(void *arg)
+{
+	struct handoff *h = arg;
+
+	++h->worker->accepted;
+	evutil_closesocket(h->fd);
+	free(h);
+}
+
+static void
+central_accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *sa, int socklen, void *arg)
+{
+	struct handoff *h = malloc(sizeof(struct handoff));
+
+	if (h == NULL) {
+		evutil_closesocket(fd);
+		return;
+	}
+	h->worker = &workers[next_worker];
+	h->fd = fd;
+	if (++next_worker == n_workers)
+		next_worker = 0;
+	if (event_base_post(h->worker->base, worker_take_cb, h) < 0) {
+		evutil_closesocket(fd);
+		free(h);
+	}
+}
+
+static void *
+central_main(void *arg)
+{
+	event_base_dispatch(arg);
+	return NULL;
+}
+
+static void *
+client_main(void *arg)
+{
+	struct linger lin;
+
+	lin.l_onoff = 1;
+	lin.l_linger = 0;
+	while (!stop) {
+		evutil_socket_t fd = socket(server_addr.ss_family,
+		    SOCK_STREAM, 0);
+		if (fd < 0) {
+			perror("socket");
+			exit(1);
+		}
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&lin,
+		    sizeof(lin));
+		if (connect(fd, (struct sockaddr *)&server_addr,
+			server_addrlen) < 0) {
+			/* The accept queue is full; try again. */
+			evutil_closesocket(fd);
+			continue;
+		}
+		evutil_closesocket(fd);
+	}
+	return NULL;
+}
+
+static void
+run(int mode, int n, int n_clients, int seconds)
+{
+	struct sockaddr_in sin;
+	struct evconnlistener_group *group = NULL;
+	struct evconnlistener *central = NULL;
+	struct event_base *central_base = NULL;
+	pthread_t central_thread;
+	struct event_base **bases;
+	pthread_t *clients;
+	long total = 0;
+	int i;
+
+	n_workers = n;
+	next_worker = 0;
+	stop = 0;
+	workers = calloc(n, sizeof(struct worker));
+	bases = calloc(n, sizeof(struct event_base *));
+	clients = calloc(n_clients, sizeof(pthread_t));
+	if (!workers || !bases || !clients) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < n; ++i) {
+		workers[i].index = i;
+		workers[i].base = bases[i] = event_base_new();
+		if (!bases[i]) {
+			fprintf(stderr, "Couldn't create event base\n");
+			exit(1);
+		}
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+	sin.sin_port = 0;
+
+	if (mode == MODE_GROUP) {
+		group = evconnlistener_group_new_bind(bases, n,
+		    group_accept_cb, NULL,
+		    steer ? LEV_OPT_REUSEPORT_STEER_BY_CPU : 0, 1024,
+		    (struct sockaddr *)&sin, sizeof(sin));
+		if (!group) {
+			fprintf(stderr, "Couldn't create listener group\n");
+			exit(1);
+		}
+		server_addrlen = sizeof(server_addr);
+		getsockname(evconnlistener_get_fd(
+			evconnlistener_group_get_listener(group, 0)),
+		    (struct sockaddr *)&server_addr, &server_addrlen);
+	} else {
+		central_base = event_base_new();
+		central = evconnlistener_new_bind(central_base,
+		    central_accept_cb, NULL,
+		    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE, 1024,
+		    (struct sockaddr *)&sin, sizeof(sin));
+		if (!central) {
+			fprintf(stderr, "Couldn't create listener\n");
+			exit(1);
+		}
+		server_addrlen = sizeof(server_addr);
+		getsockname(evconnlistener_get_fd(central),
+		    (struct sockaddr *)&server_addr, &server_addrlen);
+		pthread_create(&central_thread, NULL, central_main,
+		    central_base);
+	}
+
+	for (i = 0; i < n; ++i)
+		pthread_create(&workers[i].thread, NULL, worker_main,
+		    &workers[i]);
+	for (i = 0; i < n_clients; ++i)
+		pthread_create(&clients[i], NULL, client_main, NULL);
+
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < n_clients; ++i)
+		pthread_join(clients[i], NULL);
+
+	if (central) {
+		event_base_loopbreak(central_base);
+		pthread_join(central_thread, NULL);
+	}
+	for (i = 0; i < n; ++i) {
+		event_base_loopbreak(bases[i]);
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].accepted;
+	}
+
+	fprintf(stdout, "%-7s %2d workers: %8ld accepts/sec  (",
+	    mode == MODE_GROUP ? (steer ? "steered" : "group") : "central",
+	    n, total / seconds);
+	for (i = 0; i < n; ++i)
+		fprintf(stdout, "%s%ld", i ? " " : "",
+		    workers[i].accepted / seconds);
+	fprintf(stdout, ")\n");
+
+	if (group)
+		evconnlistener_group_free(group);
+	if (central) {
+		evconnlistener_free(central);
+		event_base_free(central_base);
+	}
+	for (i = 0; i < n; ++i)
+		event_base_free(bases[i]);
+	free(bases);
+	free(clients);
+	free(workers);
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_workers = 4, n_clients = 4, seconds = 2;
+	int c, n;
+
+	while ((c = getopt(argc, argv, "w:c:t:s")) != -1) {
+		switch (c) {
+		case 'w':
+			max_workers = atoi(optarg);
+			break;
+		case 'c':
+			n_clients = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 's':
+			steer = 1;
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (max_workers < 1 || n_clients < 1 || seconds < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	if (evthread_use_pthreads() < 0) {
+		fprintf(stderr, "Couldn't set up threading\n");
+		exit(1);
+	}
+
+	for (n = 1; n <= max_workers; n *= 2) {
+		run(MODE_CENTRAL, n, n_clients, seconds);
+		run(MODE_GROUP, n, n_clients, seconds);
+	}
+
+	exit(0);
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/bufferevent.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark simulates connection churn against one event_base: for
+ * every connection it creates a bufferevent and an idle timer, schedules
+ * a one-shot callback with event_base_once(), and then tears all of it
+ * down again some connections later.  It counts the calls that reach
+ * malloc() per connection, and the time taken, with and without
+ * EVENT_BASE_FLAG_SLAB_ALLOC.
+ */
+
+struct conn {
+	struct bufferevent *bev;
+	struct event *timer;
+};
+
+static long n_mallocs;
+
+#ifndef EVENT__DISABLE_MM_REPLACEMENT
+static void *
+count_malloc(size_t sz)
+{
+	++n_mallocs;
+	return malloc(sz);
+}
+
+static void *
+count_realloc(void *p, size_t sz)
+{
+	if (p == NULL)
+		++n_mallocs;
+	return realloc(p, sz);
+}
+#endif
+
+static void
+timer_cb(evutil_socket_t fd, short what, void *arg)
+{
+}
+
+static void
+once_cb(evutil_socket_t fd, short what, void *arg)
+{
+}
+
+static void
+conn_open(struct event_base *base, struct conn *c)
+{
+	struct timeval tv = { 60, 0 };
+
+	c->bev = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
+	c->timer = evtimer_new(base, timer_cb, c);
+	if (c->bev == NULL || c->timer == NULL) {
+		fprintf(stderr, "Couldn't allocate connection\n");
+		exit(1);
+	}
+	evtimer_add(c->timer, &tv);
+	event_base_once(base, -1, EV_TIMEOUT, once_cb, c, NULL);
+}
+
+static void
+conn_close(struct conn *c)
+{
+	event_free(c->timer);
+	bufferevent_free(c->bev);
+}
+
+static int
+run_once(int num_conns, int window, int use_slab)
+{
+	struct event_config *cfg;
+	struct event_base *base;
+	struct conn *conns;
+	struct timeval ts, te;
+	long mallocs, usec;
+	int i;
+
+	cfg = event_config_new();
+	if (cfg == NULL)
+		return -1;
+	if (use_slab)
+		event_config_set_flag(cfg, EVENT_BASE_FLAG_SLAB_ALLOC);
+	base = event_base_new_with_config(cfg);
+	event_config_free(cfg);
+	if (base == NULL)
+		return -1;
+
+	conns = calloc(window, sizeof(struct conn));
+	if (conns == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	/* Warm up: fill the window of live connections. */
+	for (i = 0; i < window; i++)
+		conn_open(base, &conns[i]);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+
+	mallocs = n_mallocs;
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < num_conns; i++) {
+		struct conn *c = &conns[i % window];
+		conn_close(c);
+		conn_open(base, c);
+		if (i % 64 == 63)
+			event_base_loop(base, EVLOOP_NONBLOCK);
+	}
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	mallocs = n_mallocs - mallocs;
+
+	fprintf(stdout, "%-6s %8d conns (%d live): %6.2f mallocs/conn  "
+	    "%7.1f nsec/conn\n", use_slab ? "slab" : "malloc",
+	    num_conns, window, (double)mallocs / num_conns,
+	    usec * 1000.0 / num_conns);
+
+	for (i = 0; i < window; i++)
+		conn_close(&conns[i]);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	free(conns);
+	event_base_free(base);
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int num_conns = 200000, window = 1000, num_runs = 3;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "n:w:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_conns = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_conns < 1 || window < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+#ifndef EVENT__DISABLE_MM_REPLACEMENT
+	event_set_mem_functions(count_malloc, count_realloc, free);
+#else
+	fprintf(stderr, "Built without memory function replacement; "
+	    "malloc counts will read as zero\n");
+#endif
+
+	for (i = 0; i < num_runs; i++) {
+		if (run_once(num_conns, window, 0) < 0 ||
+		    run_once(num_conns, window, 1) < 0) {
+			fprintf(stderr, "Couldn't create event base\n");
+			exit(1);
+		}
+	}
+
+	exit(0);
+}
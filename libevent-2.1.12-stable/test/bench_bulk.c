@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/listener.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark pushes a bulk transfer through a loopback TCP connection
+ * between two bufferevents on one event_base, and reports the throughput
+ * and the number of reads the receiving side needed.  It compares reads
+ * fixed at 4096 bytes, which is what evbuffer_read() always did before,
+ * against the adaptive read sizing it does now.  With -z, it also runs
+ * with the sender using MSG_ZEROCOPY.  Over loopback the kernel still
+ * copies in the end, so this mostly shows what the completion handling
+ * costs; the savings only show up on a real NIC.
+ */
+
+#define CHUNK_SIZE (256*1024)
+
+static char chunk[CHUNK_SIZE];
+static size_t total_bytes = (size_t)1 << 30;
+static size_t sent, received;
+static long n_reads;
+static int fixed_reads;
+static int use_zerocopy;
+static struct event_base *base;
+static struct bufferevent *receiver;
+
+static void
+sender_writecb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *out = bufferevent_get_output(bev);
+
+	while (sent < total_bytes &&
+	    evbuffer_get_length(out) < CHUNK_SIZE) {
+		size_t n = total_bytes - sent;
+		if (n > CHUNK_SIZE)
+			n = CHUNK_SIZE;
+		evbuffer_add_reference(out, chunk, n, NULL, NULL);
+		sent += n;
+	}
+}
+
+static void
+receiver_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *in = bufferevent_get_input(bev);
+
+	++n_reads;
+	received += evbuffer_get_length(in);
+	evbuffer_drain(in, evbuffer_get_length(in));
+	if (received >= total_bytes)
+		event_base_loopbreak(base);
+}
+
+static void
+eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	if (what & (BEV_EVENT_EOF|BEV_EVENT_ERROR)) {
+		fprintf(stderr, "Connection closed early\n");
+		exit(1);
+	}
+}
+
+static void
+accept_cb(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *sa, int socklen, void *arg)
+{
+	receiver = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
+	if (receiver == NULL) {
+		fprintf(stderr, "Couldn't create bufferevent\n");
+		exit(1);
+	}
+	if (fixed_reads)
+		evbuffer_set_max_read(bufferevent_get_input(receiver), 4096);
+	bufferevent_setcb(receiver, receiver_readcb, NULL, eventcb, NULL);
+	bufferevent_enable(receiver, EV_READ);
+}
+
+static void
+run_once(void)
+{
+	struct evconnlistener *listener;
+	struct bufferevent *sender;
+	struct sockaddr_in sin;
+	struct sockaddr_storage ss;
+	ev_socklen_t slen = sizeof(ss);
+	struct timeval ts, te;
+	double usec;
+
+	base = event_base_new();
+	if (base == NULL) {
+		fprintf(stderr, "Couldn't create event base\n");
+		exit(1);
+	}
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+	listener = evconnlistener_new_bind(base, accept_cb, NULL,
+	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE, -1,
+	    (struct sockaddr *)&sin, sizeof(sin));
+	if (listener == NULL ||
+	    getsockname(evconnlistener_get_fd(listener),
+		(struct sockaddr *)&ss, &slen) < 0) {
+		fprintf(stderr, "Couldn't listen on loopback\n");
+		exit(1);
+	}
+
+	sender = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
+	if (sender == NULL ||
+	    bufferevent_socket_connect(sender, (struct sockaddr *)&ss,
+		(int)slen) < 0) {
+		fprintf(stderr, "Couldn't connect\n");
+		exit(1);
+	}
+	/* Let the sender write in large batches, so that how much arrives
+	 * at once is up to the receiver. */
+	bufferevent_set_max_single_write(sender, CHUNK_SIZE);
+	if (use_zerocopy && bufferevent_socket_enable_zerocopy(sender, 0) < 0) {
+		fprintf(stderr, "Zero-copy sends are not available\n");
+		exit(1);
+	}
+	bufferevent_setcb(sender, NULL, sender_writecb, eventcb, NULL);
+	bufferevent_enable(sender, EV_WRITE);
+
+	sent = received = 0;
+	n_reads = 0;
+	evutil_gettimeofday(&ts, NULL);
+	sender_writecb(sender, NULL);
+	event_base_dispatch(base);
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1e6 + te.tv_usec;
+
+	fprintf(stdout, "%-8s %6lu MB: %8.1f MB/s  %8ld reads  "
+	    "%8.0f bytes/read\n",
+	    use_zerocopy ? "zerocopy" : fixed_reads ? "fixed" : "adaptive",
+	    (unsigned long)(received >> 20),
+	    usec ? (received / 1048576.0) / (usec / 1e6) : 0.0,
+	    n_reads, n_reads ? (double)received / n_reads : 0.0);
+
+	bufferevent_free(sender);
+	if (receiver)
+		bufferevent_free(receiver);
+	receiver = NULL;
+	evconnlistener_free(listener);
+	event_base_free(base);
+}
+
+int
+main(int argc, char **argv)
+{
+	int num_runs = 3, try_zerocopy = 0;
+	int i, c;
+
+#ifdef _WIN32
+	WSADATA wsa_data;
+	WSAStartup(0x0202, &wsa_data);
+#endif
+
+	while ((c = getopt(argc, argv, "m:r:z")) != -1) {
+		switch (c) {
+		case 'm':
+			total_bytes = (size_t)atoi(optarg) << 20;
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		case 'z':
+			try_zerocopy = 1;
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (total_bytes < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+	memset(chunk, 'x', sizeof(chunk));
+
+	for (i = 0; i < num_runs; i++) {
+		fixed_reads = 1;
+		run_once();
+		fixed_reads = 0;
+		run_once();
+		if (try_zerocopy) {
+			use_zerocopy = 1;
+			run_once();
+			use_zerocopy = 0;
+		}
+	}
+
+	exit(0);
+}
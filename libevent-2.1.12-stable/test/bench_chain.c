@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark runs the add/drain cycle that a proxy goes through for
+ * every read: some data is appended to an input evbuffer, moved over to an
+ * output evbuffer, and drained once it has been "written".  It counts the
+ * calls that reach malloc() per cycle, and the time taken, with the evbuffer
+ * chain cache turned off and on.
+ */
+
+static long n_mallocs;
+
+#ifndef EVENT__DISABLE_MM_REPLACEMENT
+static void *
+count_malloc(size_t sz)
+{
+	++n_mallocs;
+	return malloc(sz);
+}
+
+static void *
+count_realloc(void *p, size_t sz)
+{
+	if (p == NULL)
+		++n_mallocs;
+	return realloc(p, sz);
+}
+#endif
+
+static void
+run_once(int num_cycles, int size, int use_cache)
+{
+	struct evbuffer *in, *out;
+	struct timeval ts, te;
+	long mallocs, usec;
+	char *data;
+	int i;
+
+	if (use_cache)
+		evbuffer_set_chain_cache_limits(65536, 262144);
+	else
+		evbuffer_set_chain_cache_limits(0, 0);
+
+	data = malloc(size);
+	in = evbuffer_new();
+	out = evbuffer_new();
+	if (data == NULL || in == NULL || out == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(data, 'x', size);
+
+	mallocs = n_mallocs;
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < num_cycles; i++) {
+		/* Vary the size a little, the way reads do. */
+		int n = size - (i & 255);
+		if (n < 1)
+			n = 1;
+		evbuffer_add(in, data, n);
+		evbuffer_add_buffer(out, in);
+		evbuffer_drain(out, n);
+	}
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	mallocs = n_mallocs - mallocs;
+
+	fprintf(stdout, "%-8s %8d cycles of %5d bytes: %6.3f mallocs/cycle  "
+	    "%7.1f nsec/cycle\n", use_cache ? "cache" : "no-cache",
+	    num_cycles, size, (double)mallocs / num_cycles,
+	    usec * 1000.0 / num_cycles);
+
+	evbuffer_free(in);
+	evbuffer_free(out);
+	free(data);
+}
+
+int
+main(int argc, char **argv)
+{
+	int num_cycles = 1000000, size = 4096, num_runs = 3;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "n:s:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_cycles = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_cycles < 1 || size < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+#ifndef EVENT__DISABLE_MM_REPLACEMENT
+	event_set_mem_functions(count_malloc, count_realloc, free);
+#else
+	fprintf(stderr, "Built without memory function replacement; "
+	    "malloc counts will read as zero\n");
+#endif
+
+	for (i = 0; i < num_runs; i++) {
+		run_once(num_cycles, size, 0);
+		run_once(num_cycles, size, 1);
+	}
+
+	exit(0);
+}
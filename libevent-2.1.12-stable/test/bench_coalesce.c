@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(__linux__) && defined(EVENT__HAVE_EPOLL)
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define COUNT_SYSCALLS
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark answers pipelined requests the way a small HTTP server
+ * does: each request is answered with a status line, headers and a body,
+ * written with three bufferevent_write() calls.  Every client connection
+ * sends a batch of requests, waits for all the responses, and sends the
+ * next batch.  It compares plain socket bufferevents against ones created
+ * with BEV_OPT_COALESCE_WRITES.
+ *
+ * On Linux, it counts the epoll_ctl() and writev() calls Libevent makes,
+ * by defining those functions itself.  It avoids the io_uring backend so
+ * that there are epoll_ctl() calls to count.
+ */
+
+#ifdef COUNT_SYSCALLS
+static unsigned long n_epoll_ctl, n_writev;
+
+int
+epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	++n_epoll_ctl;
+	return (int)syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+
+ssize_t
+writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	++n_writev;
+	return syscall(SYS_writev, fd, iov, iovcnt);
+}
+#endif
+
+#define REQUEST "GET / HTTP/1.1\r\n"
+#define REQUEST_LEN (sizeof(REQUEST) - 1)
+#define STATUS "HTTP/1.1 200 OK\r\n"
+#define HEADERS "Content-Type: text/plain\r\nContent-Length: 13\r\n\r\n"
+#define BODY "Hello, world!"
+#define RESPONSE_LEN \
+	(sizeof(STATUS) - 1 + sizeof(HEADERS) - 1 + sizeof(BODY) - 1)
+
+struct client {
+	evutil_socket_t fd;
+	struct event *ev;
+	size_t pending;
+};
+
+static int pipeline = 8;
+static long responses_left;
+static char request_batch[REQUEST_LEN * 256];
+
+static void
+server_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	while (evbuffer_get_length(input) >= REQUEST_LEN) {
+		evbuffer_drain(input, REQUEST_LEN);
+		bufferevent_write(bev, STATUS, sizeof(STATUS) - 1);
+		bufferevent_write(bev, HEADERS, sizeof(HEADERS) - 1);
+		bufferevent_write(bev, BODY, sizeof(BODY) - 1);
+	}
+}
+
+static void
+client_send_batch(struct client *c)
+{
+	if (send(c->fd, request_batch, REQUEST_LEN * pipeline, 0) !=
+	    (ev_ssize_t)(REQUEST_LEN * pipeline)) {
+		perror("send");
+		exit(1);
+	}
+	c->pending = RESPONSE_LEN * pipeline;
+}
+
+static void
+client_readcb(evutil_socket_t fd, short what, void *arg)
+{
+	struct client *c = arg;
+	char buf[16384];
+	ev_ssize_t n;
+
+	n = recv(fd, buf, sizeof(buf), 0);
+	if (n <= 0) {
+		perror("recv");
+		exit(1);
+	}
+	c->pending -= n;
+	if (c->pending)
+		return;
+	responses_left -= pipeline;
+	if (responses_left > 0)
+		client_send_batch(c);
+	else
+		event_base_loopbreak(event_get_base(c->ev));
+}
+
+static void
+run_once(int n_conns, long n_responses, int coalesce)
+{
+	struct event_config *cfg;
+	struct event_base *base;
+	struct bufferevent **bevs;
+	struct client *clients;
+	struct timeval ts, te;
+	long usec;
+	int i;
+#ifdef COUNT_SYSCALLS
+	unsigned long epoll_ctl_start, writev_start;
+#endif
+
+	cfg = event_config_new();
+	event_config_avoid_method(cfg, "io_uring");
+	base = event_base_new_with_config(cfg);
+	event_config_free(cfg);
+	bevs = calloc(n_conns, sizeof(*bevs));
+	clients = calloc(n_conns, sizeof(*clients));
+	if (!base || !bevs || !clients) {
+		perror("setup");
+		exit(1);
+	}
+
+	for (i = 0; i < n_conns; ++i) {
+		evutil_socket_t pair[2];
+		if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+			perror("socketpair");
+			exit(1);
+		}
+		evutil_make_socket_nonblocking(pair[0]);
+		evutil_make_socket_nonblocking(pair[1]);
+		bevs[i] = bufferevent_socket_new(base, pair[0],
+		    BEV_OPT_CLOSE_ON_FREE |
+		    (coalesce ? BEV_OPT_COALESCE_WRITES : 0));
+		bufferevent_setcb(bevs[i], server_readcb, NULL, NULL, NULL);
+		bufferevent_enable(bevs[i], EV_READ|EV_WRITE);
+		clients[i].fd = pair[1];
+		clients[i].ev = event_new(base, pair[1], EV_READ|EV_PERSIST,
+		    client_readcb, &clients[i]);
+		event_add(clients[i].ev, NULL);
+	}
+	/* Let the bufferevents settle before we start counting. */
+	event_base_loop(base, EVLOOP_NONBLOCK);
+
+	responses_left = n_responses;
+#ifdef COUNT_SYSCALLS
+	epoll_ctl_start = n_epoll_ctl;
+	writev_start = n_writev;
+#endif
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < n_conns; ++i)
+		client_send_batch(&clients[i]);
+	event_base_dispatch(base);
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	if (usec == 0)
+		usec = 1;
+
+	n_responses -= responses_left;
+	fprintf(stdout, "%-8s %s: %8.1f nsec/response",
+	    coalesce ? "coalesce" : "plain", event_base_get_method(base),
+	    usec * 1000.0 / n_responses);
+#ifdef COUNT_SYSCALLS
+	fprintf(stdout, "  %5.3f epoll_ctl/response  %5.3f writev/response",
+	    (double)(n_epoll_ctl - epoll_ctl_start) / n_responses,
+	    (double)(n_writev - writev_start) / n_responses);
+#endif
+	fprintf(stdout, "\n");
+
+	for (i = 0; i < n_conns; ++i) {
+		bufferevent_free(bevs[i]);
+		event_free(clients[i].ev);
+		evutil_closesocket(clients[i].fd);
+	}
+	free(bevs);
+	free(clients);
+	event_base_free(base);
+}
+
+int
+main(int argc, char **argv)
+{
+	int n_conns = 100, num_runs = 3;
+	long n_responses = 1000000;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "c:n:p:r:")) != -1) {
+		switch (c) {
+		case 'c':
+			n_conns = atoi(optarg);
+			break;
+		case 'n':
+			n_responses = atol(optarg);
+			break;
+		case 'p':
+			pipeline = atoi(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (n_conns < 1 || n_responses < 1 || pipeline < 1 ||
+	    pipeline > 256) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+	for (i = 0; i < pipeline; ++i)
+		memcpy(request_batch + i * REQUEST_LEN, REQUEST, REQUEST_LEN);
+
+	for (i = 0; i < num_runs; i++) {
+		run_once(n_conns, n_responses, 0);
+		run_once(n_conns, n_responses, 1);
+	}
+
+	exit(0);
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef EVENT__HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <zlib.h>
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/bufferevent_compress.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark pushes data through a compressing bufferevent and a
+ * decompressing one over a bufferevent pair, one "connection" after
+ * another, and reports the CPU time spent per gigabyte of uncompressed
+ * data.  It compares bufferevent_compress_new() against the zlib filter
+ * from test/regress_zlib.c, which hands zlib one chain at a time, reserves
+ * 4096 bytes of output per call, and sets up a new z_stream for every
+ * connection.  Both flush after every write.
+ */
+
+static size_t received;
+
+/* The zlib filter from test/regress_zlib.c, flushing on every write. */
+static enum bufferevent_filter_result
+sample_filter(struct evbuffer *src, struct evbuffer *dst, int deflating,
+    enum bufferevent_flush_mode state, z_streamp p)
+{
+	struct evbuffer_iovec v_in[1];
+	struct evbuffer_iovec v_out[1];
+	int nread, nwrite;
+	int res, n;
+
+	do {
+		n = evbuffer_peek(src, -1, NULL, v_in, 1);
+		if (n) {
+			p->avail_in = v_in[0].iov_len;
+			p->next_in = (unsigned char *)v_in[0].iov_base;
+		} else {
+			p->avail_in = 0;
+			p->next_in = 0;
+			v_in[0].iov_len = 0;
+		}
+
+		evbuffer_reserve_space(dst, 4096, v_out, 1);
+		p->next_out = (unsigned char *)v_out[0].iov_base;
+		p->avail_out = v_out[0].iov_len;
+
+		if (deflating)
+			res = deflate(p, state == BEV_FINISHED ?
+			    Z_FINISH : Z_SYNC_FLUSH);
+		else
+			res = inflate(p, Z_NO_FLUSH);
+
+		nread = v_in[0].iov_len - p->avail_in;
+		nwrite = v_out[0].iov_len - p->avail_out;
+
+		evbuffer_drain(src, nread);
+		v_out[0].iov_len = nwrite;
+		evbuffer_commit_space(dst, v_out, 1);
+
+		if (res == Z_BUF_ERROR) {
+			if (nwrite == 0)
+				return BEV_NEED_MORE;
+		} else if (res != Z_OK && res != Z_STREAM_END) {
+			return BEV_ERROR;
+		}
+		if (!nwrite && !nread)
+			return BEV_NEED_MORE;
+	} while (evbuffer_get_length(src) > 0 || p->avail_out == 0);
+
+	return BEV_OK;
+}
+
+static enum bufferevent_filter_result
+sample_output_filter(struct evbuffer *src, struct evbuffer *dst,
+    ev_ssize_t lim, enum bufferevent_flush_mode state, void *ctx)
+{
+	return sample_filter(src, dst, 1, state, ctx);
+}
+
+static enum bufferevent_filter_result
+sample_input_filter(struct evbuffer *src, struct evbuffer *dst,
+    ev_ssize_t lim, enum bufferevent_flush_mode state, void *ctx)
+{
+	return sample_filter(src, dst, 0, state, ctx);
+}
+
+static void
+sample_deflate_free(void *ctx)
+{
+	deflateEnd(ctx);
+	free(ctx);
+}
+
+static void
+sample_inflate_free(void *ctx)
+{
+	inflateEnd(ctx);
+	free(ctx);
+}
+
+static void
+readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	received += evbuffer_get_length(input);
+	evbuffer_drain(input, evbuffer_get_length(input));
+}
+
+static double
+cpu_seconds(void)
+{
+#ifdef EVENT__HAVE_SYS_RESOURCE_H
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static void
+open_pair(struct event_base *base, int builtin, int level,
+    struct bufferevent **out, struct bufferevent **in)
+{
+	struct bufferevent *pair[2];
+
+	if (bufferevent_pair_new(base, 0, pair) < 0) {
+		perror("bufferevent_pair_new");
+		exit(1);
+	}
+	if (builtin) {
+		*out = bufferevent_compress_new(pair[0], BEV_COMPRESS_ZLIB,
+		    level, BEV_COMPRESS_FLUSH_WRITE, 0,
+		    BEV_OPT_CLOSE_ON_FREE);
+		*in = bufferevent_compress_new(pair[1], BEV_COMPRESS_ZLIB,
+		    level, BEV_COMPRESS_FLUSH_WRITE, 0,
+		    BEV_OPT_CLOSE_ON_FREE);
+	} else {
+		z_streamp zo = calloc(1, sizeof(*zo));
+		z_streamp zi = calloc(1, sizeof(*zi));
+
+		if (!zo || !zi || deflateInit(zo, level) != Z_OK ||
+		    inflateInit(zi) != Z_OK) {
+			fprintf(stderr, "zlib setup failed\n");
+			exit(1);
+		}
+		*out = bufferevent_filter_new(pair[0], NULL,
+		    sample_output_filter, BEV_OPT_CLOSE_ON_FREE,
+		    sample_deflate_free, zo);
+		*in = bufferevent_filter_new(pair[1], sample_input_filter,
+		    NULL, BEV_OPT_CLOSE_ON_FREE, sample_inflate_free, zi);
+	}
+	if (!*out || !*in) {
+		fprintf(stderr, "Couldn't set up the filters\n");
+		exit(1);
+	}
+	bufferevent_setcb(*in, readcb, NULL, NULL, NULL);
+	bufferevent_enable(*in, EV_READ);
+}
+
+static void
+run_once(const unsigned char *data, size_t total, size_t per_conn,
+    size_t write_size, int level, int builtin)
+{
+	struct event_base *base;
+	double start, used;
+	size_t sent = 0;
+
+	if (!(base = event_base_new())) {
+		perror("event_base_new");
+		exit(1);
+	}
+
+	received = 0;
+	start = cpu_seconds();
+	while (sent < total) {
+		struct bufferevent *out, *in;
+		size_t conn = 0;
+
+		open_pair(base, builtin, level, &out, &in);
+		while (conn < per_conn) {
+			size_t n = write_size;
+			if (n > per_conn - conn)
+				n = per_conn - conn;
+			bufferevent_write(out, data + conn, n);
+			conn += n;
+		}
+		bufferevent_flush(out, EV_WRITE, BEV_FINISHED);
+		sent += conn;
+		while (received < sent)
+			if (event_base_loop(base, EVLOOP_NONBLOCK) < 0)
+				break;
+		if (received != sent) {
+			fprintf(stderr, "Lost data: sent %lu, received %lu\n",
+			    (unsigned long)sent, (unsigned long)received);
+			exit(1);
+		}
+		bufferevent_free(out);
+		bufferevent_free(in);
+	}
+	used = cpu_seconds() - start;
+
+	fprintf(stdout, "%-7s %6lu-byte writes: %6.3f CPU sec/GB\n",
+	    builtin ? "builtin" : "sample", (unsigned long)write_size,
+	    used * (1 << 30) / (double)sent);
+
+	event_base_free(base);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t total = 256 << 20, per_conn = 1 << 20;
+	size_t sizes[] = { 1024, 16384, 65536 };
+	int level = 1, num_runs = 3;
+	unsigned char *data;
+	size_t i;
+	int c, r;
+
+	while ((c = getopt(argc, argv, "c:l:n:r:")) != -1) {
+		switch (c) {
+		case 'c':
+			per_conn = atol(optarg);
+			break;
+		case 'l':
+			level = atoi(optarg);
+			break;
+		case 'n':
+			total = atol(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (per_conn < 1 || total < 1 || level < 0 || level > 9) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	/* Something that compresses about as well as HTTP traffic. */
+	if (!(data = malloc(per_conn))) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < per_conn; ++i) {
+		static const char words[] =
+		    "GET /index.html HTTP/1.1 Host: example.com "
+		    "Content-Length: 1234 Accept-Encoding: gzip ";
+		if (i % 7)
+			data[i] = words[(i * 31 + i / 64) % (sizeof(words) - 1)];
+		else
+			data[i] = (unsigned char)(i >> 3);
+	}
+
+	for (r = 0; r < num_runs; r++) {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			run_once(data, total, per_conn, sizes[i], level, 0);
+			run_once(data, total, per_conn, sizes[i], level, 1);
+		}
+	}
+
+	free(data);
+	exit(0);
+}
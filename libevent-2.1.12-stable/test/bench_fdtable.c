@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#include <sys/resource.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark measures what it costs to go from a ready fd to its
+ * callback when a base watches a great many fds.  It opens a large number
+ * of socketpairs, adds a read event on every fd in random order, and then
+ * repeatedly marks a random subset of the fds ready with
+ * event_base_active_by_fd() and runs the loop once.
+ *
+ * That takes the same path through the event map as a backend reporting
+ * readiness, but without the system calls, so the time per callback is
+ * mostly spent on cache misses in the fd table and in the events.
+ */
+
+static long fired;
+
+static void
+read_cb(evutil_socket_t fd, short which, void *arg)
+{
+	++fired;
+}
+
+static void
+shuffle(evutil_socket_t *fds, int n)
+{
+	int i;
+
+	for (i = n - 1; i > 0; --i) {
+		int j = rand() % (i + 1);
+		evutil_socket_t tmp = fds[i];
+		fds[i] = fds[j];
+		fds[j] = tmp;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct event_base *base;
+	struct event **events;
+	evutil_socket_t *fds;
+	struct timeval ts, te;
+	int num_fds = 100000, num_active = 1000, num_rounds = 1000;
+	int i, j, c;
+	long usec;
+#ifndef _WIN32
+	struct rlimit rl;
+#endif
+
+	while ((c = getopt(argc, argv, "n:a:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_fds = atoi(optarg);
+			break;
+		case 'a':
+			num_active = atoi(optarg);
+			break;
+		case 'r':
+			num_rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_fds < 2 || num_active < 1 || num_rounds < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+#ifndef _WIN32
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		if (rl.rlim_cur < (rlim_t)num_fds + 50) {
+			rl.rlim_cur = (rlim_t)num_fds + 50;
+			if (rl.rlim_max != RLIM_INFINITY &&
+			    rl.rlim_cur > rl.rlim_max)
+				rl.rlim_cur = rl.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &rl);
+			getrlimit(RLIMIT_NOFILE, &rl);
+		}
+		if (rl.rlim_cur < (rlim_t)num_fds + 50) {
+			num_fds = (int)rl.rlim_cur - 50;
+			fprintf(stderr, "Limited to %d fds by RLIMIT_NOFILE\n",
+			    num_fds);
+		}
+	}
+#endif
+	num_fds &= ~1;
+
+	fds = calloc(num_fds, sizeof(evutil_socket_t));
+	events = calloc(num_fds, sizeof(struct event *));
+	if (fds == NULL || events == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < num_fds; i += 2) {
+		if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i]) == -1) {
+			perror("socketpair");
+			exit(1);
+		}
+	}
+
+	base = event_base_new();
+	if (base == NULL) {
+		fprintf(stderr, "Couldn't create event base\n");
+		exit(1);
+	}
+
+	/* Add the events in random order, the way a server accumulates
+	 * connections, so that neither the events nor anything else the
+	 * base allocates per fd ends up laid out in fd order. */
+	srand(1);
+	shuffle(fds, num_fds);
+	for (i = 0; i < num_fds; ++i) {
+		events[i] = event_new(base, fds[i], EV_READ|EV_PERSIST,
+		    read_cb, NULL);
+		if (events[i] == NULL || event_add(events[i], NULL) < 0) {
+			fprintf(stderr, "Couldn't add event\n");
+			exit(1);
+		}
+	}
+
+	/* Warm up. */
+	for (i = 0; i < num_fds; ++i)
+		event_base_active_by_fd(base, fds[i], EV_READ);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+
+	fired = 0;
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < num_rounds; ++i) {
+		for (j = 0; j < num_active; ++j)
+			event_base_active_by_fd(base,
+			    fds[rand() % num_fds], EV_READ);
+		event_base_loop(base, EVLOOP_NONBLOCK);
+	}
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+
+	fprintf(stdout, "%s: %d fds, %ld callbacks in %ld usec, "
+	    "%.1f nsec/callback\n", event_base_get_method(base), num_fds,
+	    fired, usec, fired ? usec * 1000.0 / fired : 0.0);
+
+	for (i = 0; i < num_fds; ++i) {
+		event_free(events[i]);
+		evutil_closesocket(fds[i]);
+	}
+	free(events);
+	free(fds);
+	event_base_free(base);
+
+	exit(0);
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark forwards framed messages the way a message router does:
+ * data arrives in an input evbuffer in large reads, each frame is moved to
+ * an output evbuffer with evbuffer_remove_buffer_reference(), and the
+ * output is drained once it has been "written".  It compares that against
+ * copying every frame into the output, which is what
+ * evbuffer_remove_buffer() does for frames that do not end on a chain
+ * boundary.  Reads are simulated by filling space from
+ * evbuffer_reserve_space(), which costs the same for both.
+ */
+
+static void
+read_into(struct evbuffer *in, int read_size)
+{
+	struct evbuffer_iovec v;
+
+	if (evbuffer_reserve_space(in, read_size, &v, 1) != 1) {
+		perror("evbuffer_reserve_space");
+		exit(1);
+	}
+	/* Touch the memory, the way the kernel would. */
+	memset(v.iov_base, 'x', read_size);
+	v.iov_len = read_size;
+	evbuffer_commit_space(in, &v, 1);
+}
+
+/* Move one frame from 'in' to 'out' with a single copy. */
+static void
+copy_frame(struct evbuffer *in, struct evbuffer *out, int frame_size)
+{
+	struct evbuffer_iovec v[8];
+	int frame_size_orig = frame_size;
+	int i, n;
+
+	n = evbuffer_peek(in, frame_size, NULL, v, 8);
+	for (i = 0; i < n && frame_size > 0; i++) {
+		size_t len = v[i].iov_len;
+		if (len > (size_t)frame_size)
+			len = frame_size;
+		evbuffer_add(out, v[i].iov_base, len);
+		frame_size -= (int)len;
+	}
+	evbuffer_drain(in, frame_size_orig);
+}
+
+static void
+run_once(long total, int frame_size, int read_size, int share)
+{
+	struct evbuffer *in, *out;
+	struct timeval ts, te;
+	long forwarded = 0, frames = 0, usec;
+
+	in = evbuffer_new();
+	out = evbuffer_new();
+	if (in == NULL || out == NULL) {
+		perror("evbuffer_new");
+		exit(1);
+	}
+
+	evutil_gettimeofday(&ts, NULL);
+	while (forwarded < total) {
+		read_into(in, read_size);
+		while (evbuffer_get_length(in) >= (size_t)frame_size) {
+			if (share) {
+				evbuffer_remove_buffer_reference(in, out,
+				    frame_size);
+			} else {
+				copy_frame(in, out, frame_size);
+			}
+			forwarded += frame_size;
+			++frames;
+		}
+		evbuffer_drain(out, evbuffer_get_length(out));
+	}
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	if (usec == 0)
+		usec = 1;
+
+	fprintf(stdout, "%-5s %6d-byte frames: %8.1f nsec/frame  %8.1f MB/s\n",
+	    share ? "share" : "copy", frame_size, usec * 1000.0 / frames,
+	    (double)forwarded / usec);
+
+	evbuffer_free(in);
+	evbuffer_free(out);
+}
+
+int
+main(int argc, char **argv)
+{
+	int min_size = 1024, max_size = 65536, read_size = 65536;
+	int num_runs = 3;
+	long total = 1L << 30;
+	int i, c, size;
+
+	while ((c = getopt(argc, argv, "m:M:n:R:r:")) != -1) {
+		switch (c) {
+		case 'm':
+			min_size = atoi(optarg);
+			break;
+		case 'M':
+			max_size = atoi(optarg);
+			break;
+		case 'n':
+			total = atol(optarg);
+			break;
+		case 'R':
+			read_size = atoi(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (min_size < 1 || max_size < min_size || read_size < 1 ||
+	    total < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_runs; i++) {
+		/* Frame sizes just off a power of two, so that frames do
+		 * not line up with the reads. */
+		for (size = min_size; size <= max_size; size *= 2) {
+			run_once(total, size - 3, read_size, 0);
+			run_once(total, size - 3, read_size, 1);
+		}
+	}
+
+	exit(0);
+}
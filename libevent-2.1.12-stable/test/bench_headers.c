@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark serializes a typical HTTP response head, followed by the
+ * size line of one chunk, into an evbuffer and then drains it, the way an
+ * HTTP server does for every reply.  It compares evbuffer_add_printf()
+ * against evbuffer_add_int(), evbuffer_add_hex() and
+ * evbuffer_add_header_line().
+ */
+
+static const char *headers[][2] = {
+	{ "Content-Type", "text/html; charset=ISO-8859-1" },
+	{ "Date", "Fri, 16 Oct 2026 12:00:00 GMT" },
+	{ "Server", "libevent" },
+	{ "Cache-Control", "no-cache, no-store, must-revalidate" },
+	{ "Connection", "keep-alive" },
+	{ "Transfer-Encoding", "chunked" },
+	{ "X-Request-Id", "4f2c6a1e-3b7d-4d2a-9c1e-7a5b3d9e8f01" },
+	{ "Vary", "Accept-Encoding" },
+};
+#define N_HEADERS (sizeof(headers) / sizeof(headers[0]))
+
+static size_t header_lens[N_HEADERS][2];
+
+static void
+write_printf(struct evbuffer *out, int code, size_t chunk)
+{
+	size_t i;
+
+	evbuffer_add_printf(out, "HTTP/%d.%d %d %s\r\n", 1, 1, code, "OK");
+	for (i = 0; i < N_HEADERS; ++i)
+		evbuffer_add_printf(out, "%s: %s\r\n",
+		    headers[i][0], headers[i][1]);
+	evbuffer_add(out, "\r\n", 2);
+	evbuffer_add_printf(out, "%x\r\n", (unsigned)chunk);
+}
+
+static void
+write_fast(struct evbuffer *out, int code, size_t chunk)
+{
+	size_t i;
+
+	evbuffer_add(out, "HTTP/", 5);
+	evbuffer_add_int(out, 1);
+	evbuffer_add(out, ".", 1);
+	evbuffer_add_int(out, 1);
+	evbuffer_add(out, " ", 1);
+	evbuffer_add_int(out, code);
+	evbuffer_add(out, " OK\r\n", 5);
+	for (i = 0; i < N_HEADERS; ++i)
+		evbuffer_add_header_line(out,
+		    headers[i][0], header_lens[i][0],
+		    headers[i][1], header_lens[i][1]);
+	evbuffer_add(out, "\r\n", 2);
+	evbuffer_add_hex(out, chunk);
+	evbuffer_add(out, "\r\n", 2);
+}
+
+static void
+run_once(long iterations, int fast)
+{
+	struct evbuffer *out;
+	struct timeval ts, te;
+	long i, usec;
+	size_t bytes = 0;
+
+	if ((out = evbuffer_new()) == NULL) {
+		perror("evbuffer_new");
+		exit(1);
+	}
+
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < iterations; ++i) {
+		if (fast)
+			write_fast(out, 200, 4096 + (i & 0xfff));
+		else
+			write_printf(out, 200, 4096 + (i & 0xfff));
+		bytes += evbuffer_get_length(out);
+		evbuffer_drain(out, evbuffer_get_length(out));
+	}
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	if (usec == 0)
+		usec = 1;
+
+	fprintf(stdout, "%-6s %4d-byte heads: %8.1f nsec/head  %8.1f MB/s\n",
+	    fast ? "fast" : "printf", (int)(bytes / iterations),
+	    usec * 1000.0 / iterations, (double)bytes / usec);
+
+	evbuffer_free(out);
+}
+
+int
+main(int argc, char **argv)
+{
+	long iterations = 1000000;
+	int num_runs = 3;
+	int i, c;
+	size_t j;
+
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = atol(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (iterations < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	for (j = 0; j < N_HEADERS; ++j) {
+		header_lens[j][0] = strlen(headers[j][0]);
+		header_lens[j][1] = strlen(headers[j][1]);
+	}
+
+	for (i = 0; i < num_runs; i++) {
+		run_once(iterations, 0);
+		run_once(iterations, 1);
+	}
+
+	exit(0);
+}
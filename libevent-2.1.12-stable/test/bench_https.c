@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef EVENT__HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/bufferevent_ssl.h>
+#include <event2/http.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark serves a static file over HTTPS on the loopback interface
+ * and fetches it back with keep-alive requests, all in one process, and
+ * reports throughput and the CPU time spent per gigabyte.  It compares
+ * OpenSSL doing the encryption against kernel TLS, asked for with
+ * bufferevent_openssl_set_ktls() on both ends.  With kTLS the server adds
+ * the file to connections the kernel encrypts for as a sendfile() segment.
+ *
+ * If the kernel has no TLS support ("modprobe tls" on Linux), or does not
+ * support the negotiated cipher, the kTLS runs fall back to OpenSSL and
+ * say so.
+ */
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+struct client {
+	struct bufferevent *bev;
+	/* Body bytes still to come, or -1 while reading the headers. */
+	ev_ssize_t body_left;
+};
+
+static SSL_CTX *server_ctx, *client_ctx;
+static struct evbuffer_file_segment *seg;
+static size_t file_size;
+static long requests_left, responses_left;
+static short server_ktls;
+
+static SSL *
+new_ssl(SSL_CTX *ctx)
+{
+	SSL *ssl = SSL_new(ctx);
+
+	if (!ssl) {
+		fprintf(stderr, "SSL_new failed\n");
+		exit(1);
+	}
+	return ssl;
+}
+
+static void
+server_cb(struct evhttp_request *req, void *arg)
+{
+	struct evbuffer *reply = evhttp_request_get_output_buffer(req);
+	struct bufferevent *bev = evhttp_connection_get_bufferevent(
+		evhttp_request_get_connection(req));
+
+	/* Let the file go out with sendfile() if the kernel encrypts. */
+	server_ktls = bufferevent_openssl_get_ktls(bev);
+	if (server_ktls & EV_WRITE)
+		evbuffer_set_flags(reply, EVBUFFER_FLAG_DRAINS_TO_FD);
+	if (evbuffer_add_file_segment(reply, seg, 0, -1) < 0) {
+		evhttp_send_error(req, HTTP_INTERNAL, NULL);
+		return;
+	}
+	evhttp_send_reply(req, HTTP_OK, "OK", NULL);
+}
+
+static struct bufferevent *
+server_bevcb(struct event_base *base, void *arg)
+{
+	struct bufferevent *bev;
+
+	bev = bufferevent_openssl_socket_new(base, -1, new_ssl(server_ctx),
+	    BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+	if (bev && *(int *)arg)
+		bufferevent_openssl_set_ktls(bev, 1);
+	return bev;
+}
+
+static void
+client_send(struct client *c)
+{
+	if (requests_left <= 0)
+		return;
+	--requests_left;
+	c->body_left = -1;
+	bufferevent_write(c->bev, REQUEST, sizeof(REQUEST) - 1);
+}
+
+static void
+client_readcb(struct bufferevent *bev, void *arg)
+{
+	struct client *c = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	while (evbuffer_get_length(input)) {
+		size_t n;
+
+		if (c->body_left < 0) {
+			struct evbuffer_ptr p =
+			    evbuffer_search(input, "\r\n\r\n", 4, NULL);
+			if (p.pos < 0)
+				return;
+			evbuffer_drain(input, p.pos + 4);
+			c->body_left = file_size;
+		}
+		n = evbuffer_get_length(input);
+		if (n > (size_t)c->body_left)
+			n = c->body_left;
+		evbuffer_drain(input, n);
+		c->body_left -= n;
+		if (c->body_left)
+			return;
+		if (--responses_left == 0) {
+			event_base_loopbreak(bufferevent_get_base(bev));
+			return;
+		}
+		client_send(c);
+	}
+}
+
+static void
+client_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	if (what & (BEV_EVENT_ERROR|BEV_EVENT_EOF)) {
+		fprintf(stderr, "Client connection failed: %s\n",
+		    ERR_reason_error_string(bufferevent_get_openssl_error(bev)));
+		exit(1);
+	}
+}
+
+/* Run n requests, spread over all the clients. */
+static void
+run_requests(struct event_base *base, struct client *clients, int n_conns,
+    long n)
+{
+	int i;
+
+	requests_left = responses_left = n;
+	for (i = 0; i < n_conns; ++i)
+		client_send(&clients[i]);
+	event_base_dispatch(base);
+}
+
+static double
+cpu_seconds(void)
+{
+#ifdef EVENT__HAVE_SYS_RESOURCE_H
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static void
+run_once(int n_conns, long n_requests, int ktls)
+{
+	struct event_base *base;
+	struct evhttp *http;
+	struct evhttp_bound_socket *sock;
+	struct client *clients;
+	struct sockaddr_storage ss;
+	ev_socklen_t socklen = sizeof(ss);
+	struct timeval ts, te;
+	double cpu, bytes;
+	long usec;
+	int i;
+
+	base = event_base_new();
+	http = base ? evhttp_new(base) : NULL;
+	clients = calloc(n_conns, sizeof(*clients));
+	if (!http || !clients) {
+		perror("setup");
+		exit(1);
+	}
+	evhttp_set_gencb(http, server_cb, NULL);
+	evhttp_set_bevcb(http, server_bevcb, &ktls);
+	sock = evhttp_bind_socket_with_handle(http, "127.0.0.1", 0);
+	if (!sock || getsockname(evhttp_bound_socket_get_fd(sock),
+		(struct sockaddr *)&ss, &socklen) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	for (i = 0; i < n_conns; ++i) {
+		struct bufferevent *bev;
+
+		bev = bufferevent_openssl_socket_new(base, -1,
+		    new_ssl(client_ctx), BUFFEREVENT_SSL_CONNECTING,
+		    BEV_OPT_CLOSE_ON_FREE);
+		if (!bev) {
+			fprintf(stderr, "bufferevent_openssl_socket_new failed\n");
+			exit(1);
+		}
+		if (ktls)
+			bufferevent_openssl_set_ktls(bev, 1);
+		clients[i].bev = bev;
+		bufferevent_setcb(bev, client_readcb, NULL, client_eventcb,
+		    &clients[i]);
+		bufferevent_enable(bev, EV_READ|EV_WRITE);
+		if (bufferevent_socket_connect(bev, (struct sockaddr *)&ss,
+			socklen) < 0) {
+			perror("connect");
+			exit(1);
+		}
+	}
+	/* One request per connection first, so that every handshake is
+	 * done before we start counting. */
+	server_ktls = 0;
+	run_requests(base, clients, n_conns, n_conns);
+
+	cpu = cpu_seconds();
+	evutil_gettimeofday(&ts, NULL);
+	run_requests(base, clients, n_conns, n_requests);
+	evutil_gettimeofday(&te, NULL);
+	cpu = cpu_seconds() - cpu;
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	if (usec == 0)
+		usec = 1;
+	bytes = (double)n_requests * file_size;
+
+	fprintf(stdout, "%-7s %8lu-byte file: %8.1f MB/s  %6.3f CPU sec/GB"
+	    "  (kTLS: server %s%s)\n",
+	    ktls ? "ktls" : "openssl", (unsigned long)file_size,
+	    bytes / usec, cpu * (1 << 30) / bytes,
+	    (server_ktls & EV_WRITE) ? "tx " : "",
+	    (server_ktls & EV_READ) ? "rx" : (server_ktls ? "" : "off"));
+
+	for (i = 0; i < n_conns; ++i)
+		bufferevent_free(clients[i].bev);
+	free(clients);
+	evhttp_free(http);
+	event_base_free(base);
+}
+
+/* A throwaway self-signed certificate for "localhost". */
+static void
+setup_ssl(void)
+{
+	EVP_PKEY *key = NULL;
+	EVP_PKEY_CTX *kctx;
+	X509 *x509;
+	X509_NAME *name;
+
+	kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 ||
+	    EVP_PKEY_keygen(kctx, &key) <= 0) {
+		fprintf(stderr, "Couldn't generate a key\n");
+		exit(1);
+	}
+	EVP_PKEY_CTX_free(kctx);
+
+	x509 = X509_new();
+	name = X509_NAME_new();
+	if (!x509 || !name) {
+		fprintf(stderr, "X509_new failed\n");
+		exit(1);
+	}
+	X509_set_version(x509, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), (long)time(NULL));
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+	    (unsigned char *)"localhost", -1, -1, 0);
+	X509_set_subject_name(x509, name);
+	X509_set_issuer_name(x509, name);
+	X509_NAME_free(name);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+	X509_set_pubkey(x509, key);
+	if (!X509_sign(x509, key, EVP_sha256())) {
+		fprintf(stderr, "X509_sign failed\n");
+		exit(1);
+	}
+
+	server_ctx = SSL_CTX_new(TLS_server_method());
+	client_ctx = SSL_CTX_new(TLS_client_method());
+	if (!server_ctx || !client_ctx ||
+	    !SSL_CTX_use_certificate(server_ctx, x509) ||
+	    !SSL_CTX_use_PrivateKey(server_ctx, key)) {
+		fprintf(stderr, "SSL_CTX setup failed\n");
+		exit(1);
+	}
+	X509_free(x509);
+	EVP_PKEY_free(key);
+}
+
+int
+main(int argc, char **argv)
+{
+	int n_conns = 4, num_runs = 3;
+	long n_requests = 1000;
+	size_t size = 1 << 20, i;
+	char *tmpl, *data;
+	evutil_socket_t fd;
+	int r, c;
+
+	while ((c = getopt(argc, argv, "c:n:r:s:")) != -1) {
+		switch (c) {
+		case 'c':
+			n_conns = atoi(optarg);
+			break;
+		case 'n':
+			n_requests = atol(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		case 's':
+			size = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (n_conns < 1 || n_requests < 1 || size < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	setup_ssl();
+
+	/* The file we serve. */
+	tmpl = strdup("/tmp/bench_https_XXXXXX");
+	data = malloc(size);
+	if (!tmpl || !data || (fd = mkstemp(tmpl)) < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	unlink(tmpl);
+	free(tmpl);
+	for (i = 0; i < size; ++i)
+		data[i] = (char)(i * 131 + (i >> 12));
+	if (write(fd, data, size) != (ev_ssize_t)size) {
+		perror("write");
+		exit(1);
+	}
+	free(data);
+	file_size = size;
+	if (!(seg = evbuffer_file_segment_new(fd, 0, size,
+		    EVBUF_FS_CLOSE_ON_FREE))) {
+		fprintf(stderr, "evbuffer_file_segment_new failed\n");
+		exit(1);
+	}
+
+	for (r = 0; r < num_runs; r++) {
+		run_once(n_conns, n_requests, 0);
+		run_once(n_conns, n_requests, 1);
+	}
+
+	evbuffer_file_segment_free(seg);
+	SSL_CTX_free(server_ctx);
+	SSL_CTX_free(client_ctx);
+	exit(0);
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark pushes data from a producer thread to a consumer thread
+ * through a pair of bufferevents, the way an I/O thread hands requests to
+ * a worker.  The consumer runs an event_base and drains what it reads.
+ *
+ * "locked" is what one had to do before: a bufferevent_pair_new() pair
+ * with BEV_OPT_THREADSAFE on the consumer's base, which the producer
+ * writes to from its own thread, waiting whenever more than 1 MB is
+ * queued.  "cross" is bufferevent_pair_new_cross(), with the producer
+ * running its own event_base and writing from its write callback.
+ */
+
+static size_t chunk_size = 16384;
+static size_t total = 256 << 20;
+static size_t received;
+static char *chunk;
+
+static void
+consumer_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	received += evbuffer_get_length(input);
+	evbuffer_drain(input, evbuffer_get_length(input));
+	if (received >= total)
+		event_base_loopbreak(bufferevent_get_base(bev));
+}
+
+static void *
+locked_producer(void *arg)
+{
+	struct bufferevent **pair = arg;
+	size_t sent = 0;
+
+	while (sent < total) {
+		while (evbuffer_get_length(bufferevent_get_input(pair[1])) >
+		    (1 << 20))
+			sched_yield();
+		bufferevent_write(pair[0], chunk, chunk_size);
+		sent += chunk_size;
+	}
+	return NULL;
+}
+
+static size_t cross_sent;
+
+static void
+cross_writecb(struct bufferevent *bev, void *arg)
+{
+	if (cross_sent >= total) {
+		event_base_loopbreak(bufferevent_get_base(bev));
+		return;
+	}
+	bufferevent_write(bev, chunk, chunk_size);
+	cross_sent += chunk_size;
+}
+
+static void *
+cross_producer(void *arg)
+{
+	struct bufferevent *bev = arg;
+	struct event_base *base = bufferevent_get_base(bev);
+
+	cross_writecb(bev, NULL);
+	event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+	return NULL;
+}
+
+static void
+run_once(int cross)
+{
+	struct event_base *base, *producer_base = NULL;
+	struct bufferevent *pair[2];
+	pthread_t thread;
+	struct timeval ts, te;
+	long usec;
+
+	base = event_base_new();
+	if (cross) {
+		producer_base = event_base_new();
+		if (!base || !producer_base ||
+		    bufferevent_pair_new_cross(producer_base, base, 0,
+			pair) < 0) {
+			fprintf(stderr, "setup failed\n");
+			exit(1);
+		}
+	} else if (!base ||
+	    bufferevent_pair_new(base, BEV_OPT_THREADSAFE, pair) < 0) {
+		fprintf(stderr, "setup failed\n");
+		exit(1);
+	}
+	bufferevent_setcb(pair[1], consumer_readcb, NULL, NULL, NULL);
+	bufferevent_enable(pair[1], EV_READ);
+	if (cross)
+		bufferevent_setcb(pair[0], NULL, cross_writecb, NULL, NULL);
+	received = cross_sent = 0;
+
+	evutil_gettimeofday(&ts, NULL);
+	pthread_create(&thread, NULL, cross ? cross_producer : locked_producer,
+	    cross ? (void *)pair[0] : (void *)pair);
+	event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+	evutil_gettimeofday(&te, NULL);
+	pthread_join(thread, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	if (usec == 0)
+		usec = 1;
+
+	fprintf(stdout, "%-6s %6lu-byte writes: %8.1f MB/s\n",
+	    cross ? "cross" : "locked", (unsigned long)chunk_size,
+	    (double)received / usec);
+
+	/* Each end goes away on its own base. */
+	bufferevent_free(pair[0]);
+	bufferevent_free(pair[1]);
+	if (producer_base)
+		event_base_free(producer_base);
+	event_base_free(base);
+}
+
+int
+main(int argc, char **argv)
+{
+	int num_runs = 3;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "c:n:r:")) != -1) {
+		switch (c) {
+		case 'c':
+			chunk_size = atol(optarg);
+			break;
+		case 'n':
+			total = atol(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (chunk_size < 1 || total < chunk_size) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+	if (evthread_use_pthreads() < 0 || !(chunk = calloc(1, chunk_size))) {
+		fprintf(stderr, "setup failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_runs; i++) {
+		run_once(0);
+		run_once(1);
+	}
+
+	free(chunk);
+	exit(0);
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark measures how fast other threads can hand callbacks to
+ * the thread running an event_base.  It compares event_base_post() with
+ * the usual way of doing it before, event_base_once() with an immediate
+ * timeout, which takes the base lock and allocates an event per call.
+ *
+ * The throughput test has a number of producer threads post as fast as
+ * they can.  The latency test has one producer post a timestamp every
+ * 50 usec, and the loop thread measures how long each one took to arrive.
+ */
+
+#define MODE_POST 0
+#define MODE_ONCE 1
+
+static struct event_base *base;
+static int mode;
+static int num_producers = 4;
+static int num_messages = 200000;
+static int num_latency = 20000;
+
+static long received;
+static long expected;
+
+static long *latencies;
+static int n_latencies;
+
+static long
+now_usec(void)
+{
+	struct timeval tv;
+
+	evutil_gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+static void
+count_cb(void *arg)
+{
+	if (++received == expected)
+		event_base_loopbreak(base);
+}
+
+static void
+latency_cb(void *arg)
+{
+	long *sent = arg;
+
+	latencies[n_latencies++] = now_usec() - *sent;
+	free(sent);
+	if (++received == expected)
+		event_base_loopbreak(base);
+}
+
+struct once_wrap {
+	void (*cb)(void *);
+	void *arg;
+};
+
+static void
+once_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct once_wrap *wrap = arg;
+
+	wrap->cb(wrap->arg);
+	free(wrap);
+}
+
+static void
+submit(void (*cb)(void *), void *arg)
+{
+	if (mode == MODE_POST) {
+		if (event_base_post(base, cb, arg) < 0) {
+			fprintf(stderr, "event_base_post failed\n");
+			exit(1);
+		}
+	} else {
+		/* event_base_once() passes a single pointer along, so wrap
+		 * the callback and its argument. */
+		struct once_wrap *wrap = malloc(sizeof(struct once_wrap));
+		if (wrap == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		wrap->cb = cb;
+		wrap->arg = arg;
+		if (event_base_once(base, -1, EV_TIMEOUT, once_cb,
+			wrap, NULL) < 0) {
+			fprintf(stderr, "event_base_once failed\n");
+			exit(1);
+		}
+	}
+}
+
+static void *
+throughput_producer(void *arg)
+{
+	int i, n = *(int *)arg;
+
+	for (i = 0; i < n; i++)
+		submit(count_cb, NULL);
+	return NULL;
+}
+
+static void *
+latency_producer(void *arg)
+{
+	int i;
+
+	for (i = 0; i < num_latency; i++) {
+		long *sent = malloc(sizeof(long));
+		if (sent == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		*sent = now_usec();
+		submit(latency_cb, sent);
+		usleep(50);
+	}
+	return NULL;
+}
+
+static int
+cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void
+run_throughput(void)
+{
+	pthread_t *threads;
+	int i, per_thread = num_messages / num_producers;
+	long start, usec;
+
+	threads = calloc(num_producers, sizeof(pthread_t));
+	if (threads == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	received = 0;
+	expected = (long)per_thread * num_producers;
+
+	start = now_usec();
+	for (i = 0; i < num_producers; i++)
+		pthread_create(&threads[i], NULL, throughput_producer,
+		    &per_thread);
+	event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+	usec = now_usec() - start;
+	for (i = 0; i < num_producers; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	fprintf(stdout, "%-4s throughput: %d threads, %ld callbacks in "
+	    "%ld usec, %.0f/sec\n", mode == MODE_POST ? "post" : "once",
+	    num_producers, expected, usec,
+	    usec ? expected * 1e6 / usec : 0.0);
+}
+
+static void
+run_latency(void)
+{
+	pthread_t thread;
+	double sum = 0;
+	int i;
+
+	latencies = calloc(num_latency, sizeof(long));
+	if (latencies == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	n_latencies = 0;
+	received = 0;
+	expected = num_latency;
+
+	pthread_create(&thread, NULL, latency_producer, NULL);
+	event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+	pthread_join(thread, NULL);
+
+	for (i = 0; i < n_latencies; i++)
+		sum += latencies[i];
+	qsort(latencies, n_latencies, sizeof(long), cmp_long);
+	fprintf(stdout, "%-4s latency: avg %.1f  p50 %ld  p99 %ld  "
+	    "max %ld usec\n", mode == MODE_POST ? "post" : "once",
+	    sum / n_latencies, latencies[n_latencies / 2],
+	    latencies[n_latencies * 99 / 100], latencies[n_latencies - 1]);
+	free(latencies);
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "t:n:l:")) != -1) {
+		switch (c) {
+		case 't':
+			num_producers = atoi(optarg);
+			break;
+		case 'n':
+			num_messages = atoi(optarg);
+			break;
+		case 'l':
+			num_latency = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (num_producers < 1 || num_messages < num_producers ||
+	    num_latency < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	if (evthread_use_pthreads() < 0) {
+		fprintf(stderr, "Couldn't set up threading\n");
+		exit(1);
+	}
+
+	for (mode = MODE_POST; mode <= MODE_ONCE; mode++) {
+		base = event_base_new();
+		if (base == NULL) {
+			fprintf(stderr, "Couldn't create event base\n");
+			exit(1);
+		}
+		run_throughput();
+		run_latency();
+		event_base_free(base);
+	}
+
+	exit(0);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark parses a stream of small length-prefixed messages the way
+ * a protocol parser does: data arrives in reads that do not line up with
+ * the messages, and each message is made contiguous with evbuffer_pullup()
+ * and then drained.  It compares an ordinary evbuffer, where a message that
+ * straddles two chains has to be copied together, with one in ring mode
+ * (see evbuffer_enable_ring()), where it never does.
+ */
+
+#define MSG_MIN 16
+#define MSG_MAX 512
+
+/* Build a stream of messages: a two-byte big-endian length, then that many
+ * bytes of payload. */
+static unsigned char *
+make_stream(size_t len)
+{
+	unsigned char *stream = malloc(len + MSG_MAX + 2);
+	size_t pos = 0;
+	unsigned seed = 1;
+
+	if (stream == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	while (pos < len) {
+		unsigned n;
+		seed = seed * 1103515245 + 12345;
+		n = MSG_MIN + (seed >> 16) % (MSG_MAX - MSG_MIN + 1);
+		stream[pos] = (unsigned char)(n >> 8);
+		stream[pos + 1] = (unsigned char)n;
+		memset(stream + pos + 2, (int)(seed >> 24), n);
+		pos += 2 + n;
+	}
+	return stream;
+}
+
+static void
+run_once(const unsigned char *stream, size_t stream_len, int read_size,
+    size_t ring_size)
+{
+	struct evbuffer *buf;
+	struct evbuffer_iovec v;
+	struct timeval ts, te;
+	size_t pos = 0;
+	long msgs = 0, usec;
+	unsigned sum = 0;
+
+	buf = evbuffer_new();
+	if (buf == NULL) {
+		perror("evbuffer_new");
+		exit(1);
+	}
+	if (ring_size && evbuffer_enable_ring(buf, ring_size) < 0) {
+		fprintf(stderr, "Ring buffers are not supported here\n");
+		exit(1);
+	}
+
+	evutil_gettimeofday(&ts, NULL);
+	while (pos < stream_len) {
+		size_t n = read_size;
+		unsigned char *p;
+
+		if (n > stream_len - pos)
+			n = stream_len - pos;
+		if (evbuffer_reserve_space(buf, n, &v, 1) != 1) {
+			fprintf(stderr, "evbuffer_reserve_space failed\n");
+			exit(1);
+		}
+		memcpy(v.iov_base, stream + pos, n);
+		v.iov_len = n;
+		evbuffer_commit_space(buf, &v, 1);
+		pos += n;
+
+		for (;;) {
+			size_t len = evbuffer_get_length(buf), msg_len;
+			if (len < 2)
+				break;
+			p = evbuffer_pullup(buf, 2);
+			msg_len = 2 + ((p[0] << 8) | p[1]);
+			if (len < msg_len)
+				break;
+			p = evbuffer_pullup(buf, msg_len);
+			sum += p[msg_len - 1];
+			evbuffer_drain(buf, msg_len);
+			++msgs;
+		}
+	}
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	if (usec == 0)
+		usec = 1;
+
+	fprintf(stdout, "%-6s %5d-byte reads: %6.1f nsec/message  "
+	    "%7.1f MB/s  (%u)\n", ring_size ? "ring" : "chains", read_size,
+	    usec * 1000.0 / msgs, (double)stream_len / usec, sum & 0xff);
+
+	evbuffer_free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	int read_size = 4096, num_runs = 3;
+	size_t stream_len = 64 << 20, ring_size = 65536;
+	unsigned char *stream;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "n:R:s:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			stream_len = (size_t)atol(optarg);
+			break;
+		case 'R':
+			read_size = atoi(optarg);
+			break;
+		case 's':
+			ring_size = (size_t)atol(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (read_size < 1 || stream_len < 1 ||
+	    ring_size < (size_t)read_size + MSG_MAX + 2) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	stream = make_stream(stream_len);
+	for (i = 0; i < num_runs; i++) {
+		run_once(stream, stream_len, read_size, 0);
+		run_once(stream, stream_len, read_size, ring_size);
+	}
+	free(stream);
+
+	exit(0);
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include "event2/event-config.h"
+#include "../util-internal.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark times the evbuffer search functions over buffers of 1 KB
+ * to 1 MB that are split into many small chains, once for each search
+ * implementation this machine supports.  The buffers hold HTTP-style
+ * header lines, and every search has to scan the whole buffer:
+ *
+ *   crlfcrlf  evbuffer_search() for the blank line ending a header block
+ *   boundary  evbuffer_search() for a multipart boundary, whose first byte
+ *             is common in the data
+ *   eol_any   evbuffer_search_eol(EVBUFFER_EOL_ANY) over a line without
+ *             a line ending
+ *   readln    evbuffer_readln(EVBUFFER_EOL_CRLF) on every line, the way
+ *             the HTTP parser reads headers
+ */
+
+static const char *impls[] = { "scalar", "sse2", "avx2", NULL };
+static const size_t sizes[] = { 1024, 16384, 262144, 1048576, 0 };
+static int chain_size = 256;
+static long total_bytes = 256L << 20;
+
+static char *
+make_headers(size_t size)
+{
+	char *p = malloc(size), *cp = p;
+	int n = 0;
+
+	if (p == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	while (cp + 64 <= p + size) {
+		cp += sprintf(cp, "X-Header-%05d: -----dddddddddddddddddd-----"
+		    "ddddd\r\n", n++ % 100000);
+	}
+	memset(cp, 'x', p + size - cp);
+	return p;
+}
+
+static struct evbuffer *
+make_buffer(const char *data, size_t size)
+{
+	struct evbuffer *buf = evbuffer_new();
+	size_t off;
+
+	if (buf == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (off = 0; off < size; off += chain_size) {
+		size_t n = size - off < (size_t)chain_size ?
+		    size - off : (size_t)chain_size;
+		/* Each reference gets a chain of its own. */
+		evbuffer_add_reference(buf, data + off, n, NULL, NULL);
+	}
+	return buf;
+}
+
+static double
+elapsed_nsec(struct timeval *ts)
+{
+	struct timeval te;
+
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, ts, &te);
+	return te.tv_sec * 1e9 + te.tv_usec * 1e3;
+}
+
+static void
+report(const char *impl, const char *what, size_t size, long iters,
+    double nsec)
+{
+	fprintf(stdout, "%-6s %-9s %8lu bytes: %9.1f usec/search  "
+	    "%7.2f GB/s\n", impl, what, (unsigned long)size,
+	    nsec / iters / 1e3, (double)size * iters / nsec);
+}
+
+static void
+run(const char *impl, size_t size)
+{
+	char *data = make_headers(size);
+	struct evbuffer *buf = make_buffer(data, size);
+	struct evbuffer_ptr p;
+	struct timeval ts;
+	long iters = total_bytes / (long)size, i;
+	size_t eol_len;
+
+	if (iters < 1)
+		iters = 1;
+
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < iters; ++i) {
+		p = evbuffer_search(buf, "\r\n\r\n", 4, NULL);
+		if (p.pos != -1)
+			exit(1);
+	}
+	report(impl, "crlfcrlf", size, iters, elapsed_nsec(&ts));
+
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < iters; ++i) {
+		p = evbuffer_search(buf, "-----ddddd\r\n--", 14, NULL);
+		if (p.pos != -1)
+			exit(1);
+	}
+	report(impl, "boundary", size, iters, elapsed_nsec(&ts));
+
+	evbuffer_free(buf);
+	memset(data, 'x', size);
+	buf = make_buffer(data, size);
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < iters; ++i) {
+		p = evbuffer_search_eol(buf, NULL, &eol_len, EVBUFFER_EOL_ANY);
+		if (p.pos != -1)
+			exit(1);
+	}
+	report(impl, "eol_any", size, iters, elapsed_nsec(&ts));
+	evbuffer_free(buf);
+
+	free(data);
+	data = make_headers(size);
+	iters = iters / 4 + 1;
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < iters; ++i) {
+		char *line;
+		buf = make_buffer(data, size);
+		while ((line = evbuffer_readln(buf, NULL, EVBUFFER_EOL_CRLF)))
+			free(line);
+		evbuffer_free(buf);
+	}
+	report(impl, "readln", size, iters, elapsed_nsec(&ts));
+
+	free(data);
+}
+
+int
+main(int argc, char **argv)
+{
+	int i, j, c;
+
+	while ((c = getopt(argc, argv, "c:m:")) != -1) {
+		switch (c) {
+		case 'c':
+			chain_size = atoi(optarg);
+			break;
+		case 'm':
+			total_bytes = atol(optarg) << 20;
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (chain_size < 1 || total_bytes < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	for (i = 0; impls[i]; ++i) {
+		if (evutil_memsearch_select_(impls[i]) < 0) {
+			fprintf(stdout, "%s: not supported here\n", impls[i]);
+			continue;
+		}
+		for (j = 0; sizes[j]; ++j)
+			run(impls[i], sizes[j]);
+	}
+
+	exit(0);
+}
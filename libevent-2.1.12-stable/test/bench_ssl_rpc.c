@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef EVENT__HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/bufferevent_ssl.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark runs a small-message RPC exchange over one TLS connection
+ * on a socketpair, client and server in the same process, and reports the
+ * calls per second and the CPU time spent per call.  The client keeps a
+ * number of fixed-size requests in flight and the server answers each one
+ * with a response of the same size.  Both sides add every message to the
+ * output buffer with evbuffer_add_reference(), as a zero-copy RPC layer
+ * would, so each message is a chain of its own.
+ */
+
+static SSL_CTX *server_ctx, *client_ctx;
+static char *payload;
+static size_t msg_size;
+static long requests_left, responses_left;
+
+static SSL *
+new_ssl(SSL_CTX *ctx)
+{
+	SSL *ssl = SSL_new(ctx);
+
+	if (!ssl) {
+		fprintf(stderr, "SSL_new failed\n");
+		exit(1);
+	}
+	return ssl;
+}
+
+static void
+send_msg(struct bufferevent *bev)
+{
+	evbuffer_add_reference(bufferevent_get_output(bev), payload, msg_size,
+	    NULL, NULL);
+}
+
+static void
+server_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	while (evbuffer_get_length(input) >= msg_size) {
+		evbuffer_drain(input, msg_size);
+		send_msg(bev);
+	}
+}
+
+static void
+client_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	while (evbuffer_get_length(input) >= msg_size) {
+		evbuffer_drain(input, msg_size);
+		if (--responses_left == 0) {
+			event_base_loopbreak(bufferevent_get_base(bev));
+			return;
+		}
+		if (requests_left > 0) {
+			--requests_left;
+			send_msg(bev);
+		}
+	}
+}
+
+static void
+eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	if (what & (BEV_EVENT_ERROR|BEV_EVENT_EOF)) {
+		fprintf(stderr, "Connection failed: %s\n",
+		    ERR_reason_error_string(bufferevent_get_openssl_error(bev)));
+		exit(1);
+	}
+}
+
+/* Run n calls with up to depth of them outstanding at once. */
+static void
+run_calls(struct event_base *base, struct bufferevent *client, int depth,
+    long n)
+{
+	int i;
+
+	requests_left = responses_left = n;
+	for (i = 0; i < depth && requests_left > 0; ++i) {
+		--requests_left;
+		send_msg(client);
+	}
+	event_base_dispatch(base);
+}
+
+static double
+cpu_seconds(void)
+{
+#ifdef EVENT__HAVE_SYS_RESOURCE_H
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static void
+run_once(size_t size, int depth, long n_calls)
+{
+	struct event_base *base;
+	struct bufferevent *client, *server;
+	evutil_socket_t pair[2];
+	struct timeval ts, te;
+	double cpu;
+	long usec;
+
+	if (!(base = event_base_new())) {
+		perror("event_base_new");
+		exit(1);
+	}
+	if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+
+	client = bufferevent_openssl_socket_new(base, pair[0],
+	    new_ssl(client_ctx), BUFFEREVENT_SSL_CONNECTING,
+	    BEV_OPT_CLOSE_ON_FREE);
+	server = bufferevent_openssl_socket_new(base, pair[1],
+	    new_ssl(server_ctx), BUFFEREVENT_SSL_ACCEPTING,
+	    BEV_OPT_CLOSE_ON_FREE);
+	if (!client || !server) {
+		fprintf(stderr, "bufferevent_openssl_socket_new failed\n");
+		exit(1);
+	}
+	bufferevent_setcb(client, client_readcb, NULL, eventcb, NULL);
+	bufferevent_setcb(server, server_readcb, NULL, eventcb, NULL);
+	bufferevent_enable(client, EV_READ|EV_WRITE);
+	bufferevent_enable(server, EV_READ|EV_WRITE);
+
+	msg_size = size;
+	/* One call first, so that the handshake is done before we start
+	 * counting. */
+	run_calls(base, client, 1, 1);
+
+	cpu = cpu_seconds();
+	evutil_gettimeofday(&ts, NULL);
+	run_calls(base, client, depth, n_calls);
+	evutil_gettimeofday(&te, NULL);
+	cpu = cpu_seconds() - cpu;
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	if (usec == 0)
+		usec = 1;
+
+	fprintf(stdout, "%6lu-byte calls, %3d in flight: %9.0f calls/s"
+	    "  %7.2f CPU usec/call\n",
+	    (unsigned long)size, depth, n_calls * 1e6 / usec,
+	    cpu * 1e6 / n_calls);
+
+	bufferevent_free(client);
+	bufferevent_free(server);
+	event_base_free(base);
+}
+
+/* A throwaway self-signed certificate for "localhost". */
+static void
+setup_ssl(void)
+{
+	EVP_PKEY *key = NULL;
+	EVP_PKEY_CTX *kctx;
+	X509 *x509;
+	X509_NAME *name;
+
+	kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 ||
+	    EVP_PKEY_keygen(kctx, &key) <= 0) {
+		fprintf(stderr, "Couldn't generate a key\n");
+		exit(1);
+	}
+	EVP_PKEY_CTX_free(kctx);
+
+	x509 = X509_new();
+	name = X509_NAME_new();
+	if (!x509 || !name) {
+		fprintf(stderr, "X509_new failed\n");
+		exit(1);
+	}
+	X509_set_version(x509, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), (long)time(NULL));
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+	    (unsigned char *)"localhost", -1, -1, 0);
+	X509_set_subject_name(x509, name);
+	X509_set_issuer_name(x509, name);
+	X509_NAME_free(name);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+	X509_set_pubkey(x509, key);
+	if (!X509_sign(x509, key, EVP_sha256())) {
+		fprintf(stderr, "X509_sign failed\n");
+		exit(1);
+	}
+
+	server_ctx = SSL_CTX_new(TLS_server_method());
+	client_ctx = SSL_CTX_new(TLS_client_method());
+	if (!server_ctx || !client_ctx ||
+	    !SSL_CTX_use_certificate(server_ctx, x509) ||
+	    !SSL_CTX_use_PrivateKey(server_ctx, key)) {
+		fprintf(stderr, "SSL_CTX setup failed\n");
+		exit(1);
+	}
+	X509_free(x509);
+	EVP_PKEY_free(key);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t sizes[] = { 64, 512, 4096 };
+	int depths[] = { 1, 16, 128 };
+	long n_calls = 100000;
+	int num_runs = 1;
+	size_t i, j;
+	int r, c;
+
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			n_calls = atol(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (n_calls < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	setup_ssl();
+	if (!(payload = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]))) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]; ++i)
+		payload[i] = (char)(i * 131);
+
+	for (r = 0; r < num_runs; r++) {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			for (j = 0; j < sizeof(depths) / sizeof(depths[0]); j++)
+				run_once(sizes[i], depths[j], n_calls);
+	}
+
+	SSL_CTX_free(server_ctx);
+	SSL_CTX_free(client_ctx);
+	free(payload);
+	exit(0);
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <windows.h>
+#include <getopt.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(__linux__) && defined(EVENT__HAVE_EPOLL)
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#define COUNT_SYSCALLS
+#endif
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/http.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark runs keep-alive HTTP requests against an evhttp server.
+ * Every client connection sends a request, waits for the response, and
+ * sends the next one on the same connection.  evhttp turns reading and
+ * writing on and off around each request, which costs an epoll_ctl() call
+ * every time with plain socket bufferevents.  It compares those against
+ * bufferevents created with BEV_OPT_STICKY_EVENTS.
+ *
+ * On Linux, it counts the epoll_ctl() calls Libevent makes, by defining
+ * that function itself.  It avoids the io_uring backend so that there are
+ * epoll_ctl() calls to count.
+ */
+
+#ifdef COUNT_SYSCALLS
+static unsigned long n_epoll_ctl;
+
+int
+epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	++n_epoll_ctl;
+	return (int)syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+#endif
+
+#define REQUEST "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+#define REQUEST_LEN (sizeof(REQUEST) - 1)
+#define BODY "Hello, world!"
+#define BODY_LEN (sizeof(BODY) - 1)
+
+struct client {
+	evutil_socket_t fd;
+	struct event *ev;
+	struct evbuffer *buf;
+};
+
+static long requests_left, responses_left;
+
+static void
+server_cb(struct evhttp_request *req, void *arg)
+{
+	evbuffer_add(evhttp_request_get_output_buffer(req), BODY, BODY_LEN);
+	evhttp_send_reply(req, HTTP_OK, "OK", NULL);
+}
+
+static struct bufferevent *
+server_bevcb(struct event_base *base, void *arg)
+{
+	return bufferevent_socket_new(base, -1,
+	    BEV_OPT_CLOSE_ON_FREE | *(int *)arg);
+}
+
+static void
+client_send(struct client *c)
+{
+	if (requests_left <= 0)
+		return;
+	--requests_left;
+	if (send(c->fd, REQUEST, REQUEST_LEN, 0) != (ev_ssize_t)REQUEST_LEN) {
+		perror("send");
+		exit(1);
+	}
+}
+
+static void
+client_readcb(evutil_socket_t fd, short what, void *arg)
+{
+	struct client *c = arg;
+	struct evbuffer_ptr p;
+
+	if (evbuffer_read(c->buf, fd, -1) <= 0) {
+		perror("recv");
+		exit(1);
+	}
+	p = evbuffer_search(c->buf, "\r\n\r\n", 4, NULL);
+	if (p.pos < 0 ||
+	    evbuffer_get_length(c->buf) < p.pos + 4 + BODY_LEN)
+		return;
+	evbuffer_drain(c->buf, evbuffer_get_length(c->buf));
+	if (--responses_left == 0)
+		event_base_loopbreak(event_get_base(c->ev));
+	else
+		client_send(c);
+}
+
+/* Run n requests, spread over all the clients. */
+static void
+run_requests(struct event_base *base, struct client *clients, int n_conns,
+    long n)
+{
+	int i;
+
+	requests_left = responses_left = n;
+	for (i = 0; i < n_conns; ++i)
+		client_send(&clients[i]);
+	event_base_dispatch(base);
+}
+
+static void
+run_once(int n_conns, long n_requests, int sticky)
+{
+	struct event_config *cfg;
+	struct event_base *base;
+	struct evhttp *http;
+	struct evhttp_bound_socket *sock;
+	struct client *clients;
+	struct sockaddr_storage ss;
+	ev_socklen_t socklen = sizeof(ss);
+	struct timeval ts, te;
+	int options = sticky ? BEV_OPT_STICKY_EVENTS : 0;
+	long usec;
+	int i;
+#ifdef COUNT_SYSCALLS
+	unsigned long epoll_ctl_start;
+#endif
+
+	cfg = event_config_new();
+	event_config_avoid_method(cfg, "io_uring");
+	base = event_base_new_with_config(cfg);
+	event_config_free(cfg);
+	http = base ? evhttp_new(base) : NULL;
+	clients = calloc(n_conns, sizeof(*clients));
+	if (!http || !clients) {
+		perror("setup");
+		exit(1);
+	}
+	evhttp_set_gencb(http, server_cb, NULL);
+	evhttp_set_bevcb(http, server_bevcb, &options);
+	sock = evhttp_bind_socket_with_handle(http, "127.0.0.1", 0);
+	if (!sock || getsockname(evhttp_bound_socket_get_fd(sock),
+		(struct sockaddr *)&ss, &socklen) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	for (i = 0; i < n_conns; ++i) {
+		clients[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (clients[i].fd == EVUTIL_INVALID_SOCKET ||
+		    connect(clients[i].fd, (struct sockaddr *)&ss,
+			socklen) < 0) {
+			perror("connect");
+			exit(1);
+		}
+		evutil_make_socket_nonblocking(clients[i].fd);
+		clients[i].buf = evbuffer_new();
+		clients[i].ev = event_new(base, clients[i].fd,
+		    EV_READ|EV_PERSIST, client_readcb, &clients[i]);
+		event_add(clients[i].ev, NULL);
+	}
+	/* One request per connection first, so that every connection has
+	 * been accepted before we start counting. */
+	run_requests(base, clients, n_conns, n_conns);
+
+#ifdef COUNT_SYSCALLS
+	epoll_ctl_start = n_epoll_ctl;
+#endif
+	evutil_gettimeofday(&ts, NULL);
+	run_requests(base, clients, n_conns, n_requests);
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, &ts, &te);
+	usec = te.tv_sec * 1000000L + te.tv_usec;
+	if (usec == 0)
+		usec = 1;
+
+	fprintf(stdout, "%-6s %s: %8.1f nsec/request",
+	    sticky ? "sticky" : "plain", event_base_get_method(base),
+	    usec * 1000.0 / n_requests);
+#ifdef COUNT_SYSCALLS
+	fprintf(stdout, "  %5.3f epoll_ctl/request",
+	    (double)(n_epoll_ctl - epoll_ctl_start) / n_requests);
+#endif
+	fprintf(stdout, "\n");
+
+	for (i = 0; i < n_conns; ++i) {
+		event_free(clients[i].ev);
+		evbuffer_free(clients[i].buf);
+		evutil_closesocket(clients[i].fd);
+	}
+	free(clients);
+	evhttp_free(http);
+	event_base_free(base);
+}
+
+int
+main(int argc, char **argv)
+{
+	int n_conns = 50, num_runs = 3;
+	long n_requests = 200000;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "c:n:r:")) != -1) {
+		switch (c) {
+		case 'c':
+			n_conns = atoi(optarg);
+			break;
+		case 'n':
+			n_requests = atol(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+	if (n_conns < 1 || n_requests < 1) {
+		fprintf(stderr, "Bad arguments\n");
+		exit(1);
+	}
+
+	for (i = 0; i < num_runs; i++) {
+		run_once(n_conns, n_requests, 0);
+		run_once(n_conns, n_requests, 1);
+	}
+
+	exit(0);
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "event2/event-config.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <getopt.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+/*
+ * This benchmark compares the binary heap against the timing wheel
+ * (EVENT_BASE_FLAG_TIMER_WHEEL) as the store for pending timeouts.  It
+ * adds a large number of idle-connection style timers spread over a
+ * minute, starting ten seconds out, re-arms every one of them (what a server does whenever a
+ * connection sees traffic), lets a short burst of them expire through
+ * the event loop and finally deletes the rest.
+ */
+
+static int fired;
+
+static void
+timer_cb(evutil_socket_t fd, short which, void *arg)
+{
+	fired++;
+}
+
+static long
+elapsed_usec(const struct timeval *ts)
+{
+	struct timeval te;
+
+	evutil_gettimeofday(&te, NULL);
+	evutil_timersub(&te, ts, &te);
+	return te.tv_sec * 1000000L + te.tv_usec;
+}
+
+static void
+random_timeout(struct timeval *tv, int max_msec)
+{
+	int msec = 1 + rand() % max_msec;
+
+	tv->tv_sec = msec / 1000;
+	tv->tv_usec = (msec % 1000) * 1000 + rand() % 1000;
+}
+
+static int
+run_once(int num_timers, int num_fire, int use_wheel)
+{
+	struct event_config *cfg;
+	struct event_base *base;
+	struct event **events;
+	struct timeval ts, tv;
+	long t_add, t_readd, t_fire, t_del;
+	int i;
+
+	cfg = event_config_new();
+	if (cfg == NULL)
+		return -1;
+	if (use_wheel)
+		event_config_set_flag(cfg, EVENT_BASE_FLAG_TIMER_WHEEL);
+	base = event_base_new_with_config(cfg);
+	event_config_free(cfg);
+	if (base == NULL)
+		return -1;
+
+	events = calloc(num_timers, sizeof(struct event *));
+	if (events == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < num_timers; i++) {
+		events[i] = evtimer_new(base, timer_cb, NULL);
+		if (events[i] == NULL) {
+			perror("evtimer_new");
+			exit(1);
+		}
+	}
+
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < num_timers; i++) {
+		random_timeout(&tv, 60 * 1000);
+		tv.tv_sec += 10;
+		evtimer_add(events[i], &tv);
+	}
+	t_add = elapsed_usec(&ts);
+
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < num_timers; i++) {
+		random_timeout(&tv, 60 * 1000);
+		tv.tv_sec += 10;
+		evtimer_add(events[i], &tv);
+	}
+	t_readd = elapsed_usec(&ts);
+
+	/* Pull a few of them in to the next 50 msec and let them fire. */
+	if (num_fire > num_timers)
+		num_fire = num_timers;
+	fired = 0;
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < num_fire; i++) {
+		random_timeout(&tv, 50);
+		evtimer_add(events[i], &tv);
+	}
+	while (fired < num_fire)
+		event_base_loop(base, EVLOOP_ONCE);
+	t_fire = elapsed_usec(&ts);
+
+	evutil_gettimeofday(&ts, NULL);
+	for (i = 0; i < num_timers; i++)
+		evtimer_del(events[i]);
+	t_del = elapsed_usec(&ts);
+
+	fprintf(stdout, "%-5s %8d timers: add %8ld  readd %8ld  "
+	    "fire(%d) %8ld  del %8ld usec\n",
+	    use_wheel ? "wheel" : "heap", num_timers,
+	    t_add, t_readd, num_fire, t_fire, t_del);
+
+	for (i = 0; i < num_timers; i++)
+		event_free(events[i]);
+	free(events);
+	event_base_free(base);
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int default_sizes[] = { 10000, 100000, 1000000 };
+	int num_timers = 0, num_fire = 1000, num_runs = 3;
+	int i, j, c;
+
+	while ((c = getopt(argc, argv, "n:f:r:")) != -1) {
+		switch (c) {
+		case 'n':
+			num_timers = atoi(optarg);
+			break;
+		case 'f':
+			num_fire = atoi(optarg);
+			break;
+		case 'r':
+			num_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Illegal argument \"%c\"\n", c);
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < 3; i++) {
+		int n = num_timers ? num_timers : default_sizes[i];
+		for (j = 0; j < num_runs; j++) {
+			if (run_once(n, num_fire, 0) < 0 ||
+			    run_once(n, num_fire, 1) < 0) {
+				fprintf(stderr, "Couldn't create event base\n");
+				exit(1);
+			}
+		}
+		if (num_timers)
+			break;
+	}
+
+	exit(0);
+}
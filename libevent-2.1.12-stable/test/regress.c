@@ -62,6 +62,7 @@
 #include "event2/tag.h"
 #include "event2/buffer.h"
 #include "event2/buffer_compat.h"
+#include "event2/bufferevent.h"
 #include "event2/util.h"
 #include "event-internal.h"
 #include "evthread-internal.h"
@@ -3343,6 +3344,520 @@ end:
 		event_config_free(cfg);
 }
 
+static void
+busy_poll_write_cb(evutil_socket_t fd, short what, void *arg)
+{
+	evutil_socket_t *pair = arg;
+	tt_int_op(send(pair[0], "x", 1, 0), ==, 1);
+end:
+	;
+}
+
+static void
+busy_poll_read_cb(evutil_socket_t fd, short what, void *arg)
+{
+	int *called = arg;
+	char buf;
+	tt_int_op(recv(fd, &buf, 1, 0), ==, 1);
+	++*called;
+end:
+	;
+}
+
+static void
+test_busy_poll(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_config *cfg = NULL;
+	struct event_base *base = NULL;
+	struct event *ev_read = NULL, *ev_write = NULL;
+	struct event_base_stats stats;
+	struct timeval budget = { 1, 0 }, delay = { 0, 20*1000 };
+	int called = 0;
+
+	cfg = event_config_new();
+	tt_assert(cfg);
+	if (strstr(data->setup_data, "precise"))
+		event_config_set_flag(cfg, EVENT_BASE_FLAG_PRECISE_TIMER);
+	tt_int_op(event_config_set_busy_poll(cfg, &budget), ==, 0);
+	base = event_base_new_with_config(cfg);
+	tt_assert(base);
+
+	ev_read = event_new(base, data->pair[1], EV_READ, busy_poll_read_cb,
+	    &called);
+	ev_write = evtimer_new(base, busy_poll_write_cb, data->pair);
+	tt_assert(ev_read);
+	tt_assert(ev_write);
+	event_add(ev_read, NULL);
+	evtimer_add(ev_write, &delay);
+
+	/* The first spin is cut short by the timer and counts as a miss;
+	 * after the timer has written, the next spin finds the read. */
+	event_base_dispatch(base);
+	tt_int_op(called, ==, 1);
+
+	tt_int_op(event_base_get_stats(base, &stats, 1), ==, 0);
+	tt_assert(stats.busy_poll_misses >= 1);
+	tt_assert(stats.busy_poll_hits >= 1);
+	tt_int_op(event_base_get_stats(base, &stats, 0), ==, 0);
+	tt_assert(stats.busy_poll_hits == 0);
+	tt_assert(stats.busy_poll_misses == 0);
+
+end:
+	if (ev_read)
+		event_free(ev_read);
+	if (ev_write)
+		event_free(ev_write);
+	if (base)
+		event_base_free(base);
+	if (cfg)
+		event_config_free(cfg);
+}
+
+#define N_DISPATCH_PAIRS 32
+#define MAX_DISPATCH_EVENTS 4
+
+static void
+test_max_dispatch_events(void *arg)
+{
+	struct event_config *cfg = NULL;
+	struct event_base *base = NULL;
+	struct event *evs[N_DISPATCH_PAIRS];
+	evutil_socket_t pairs[N_DISPATCH_PAIRS][2];
+	struct event_base_stats stats;
+	const char *method;
+	ev_uint64_t n_dispatches = 0;
+	int called = 0, limited, i;
+
+	memset(evs, 0, sizeof(evs));
+	for (i = 0; i < N_DISPATCH_PAIRS; ++i)
+		pairs[i][0] = pairs[i][1] = EVUTIL_INVALID_SOCKET;
+
+	cfg = event_config_new();
+	tt_assert(cfg);
+	tt_int_op(event_config_set_max_dispatch_events(cfg, -1), ==, -1);
+	tt_int_op(event_config_set_max_dispatch_events(cfg,
+		MAX_DISPATCH_EVENTS), ==, 0);
+	base = event_base_new_with_config(cfg);
+	tt_assert(base);
+	method = event_base_get_method(base);
+	limited = !strcmp(method, "epoll") || !strcmp(method, "io_uring") ||
+	    !strcmp(method, "epoll (with changelist)");
+
+	for (i = 0; i < N_DISPATCH_PAIRS; ++i) {
+		tt_int_op(evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i]),
+		    ==, 0);
+		evs[i] = event_new(base, pairs[i][1], EV_READ,
+		    busy_poll_read_cb, &called);
+		tt_assert(evs[i]);
+		event_add(evs[i], NULL);
+		tt_int_op(send(pairs[i][0], "x", 1, 0), ==, 1);
+	}
+
+	/* Only MAX_DISPATCH_EVENTS of them may be reported at once. */
+	event_base_loop(base, EVLOOP_ONCE);
+	if (limited)
+		tt_int_op(called, <=, MAX_DISPATCH_EVENTS);
+	while (called < N_DISPATCH_PAIRS)
+		event_base_loop(base, EVLOOP_ONCE);
+
+	tt_int_op(event_base_get_stats(base, &stats, 0), ==, 0);
+	for (i = 0; i < EVENT_BASE_STATS_NBUCKETS; ++i) {
+		n_dispatches += stats.dispatch_events[i];
+		/* Bucket 3 holds [4,8). */
+		if (limited && i > 3)
+			tt_assert(stats.dispatch_events[i] == 0);
+	}
+	tt_assert(n_dispatches >= 1);
+	if (limited)
+		tt_assert(n_dispatches >= N_DISPATCH_PAIRS / MAX_DISPATCH_EVENTS);
+
+end:
+	for (i = 0; i < N_DISPATCH_PAIRS; ++i) {
+		if (evs[i])
+			event_free(evs[i]);
+		if (pairs[i][0] != EVUTIL_INVALID_SOCKET)
+			evutil_closesocket(pairs[i][0]);
+		if (pairs[i][1] != EVUTIL_INVALID_SOCKET)
+			evutil_closesocket(pairs[i][1]);
+	}
+	if (base)
+		event_base_free(base);
+	if (cfg)
+		event_config_free(cfg);
+}
+
+static void
+stats_sleep_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct timeval tv = { 0, 2000 };
+	evutil_usleep_(&tv);
+	++*(int *)arg;
+}
+
+static ev_uint64_t
+stats_histogram_sum(const ev_uint64_t *hist, int from)
+{
+	ev_uint64_t n = 0;
+	int i;
+	for (i = from; i < EVENT_BASE_STATS_NBUCKETS; ++i)
+		n += hist[i];
+	return n;
+}
+
+static void
+test_stats(void *arg)
+{
+	struct event_base *base = NULL;
+	struct event *timer = NULL, *ev = NULL, *evs[3] = { NULL, NULL, NULL };
+	struct event_base_stats stats;
+	struct timeval tv = { 0, 10000 };
+	int called = 0, i;
+
+	base = event_base_new();
+	tt_assert(base);
+	tt_int_op(event_base_priority_init(base, 2), ==, 0);
+	tt_int_op(event_base_set_stats_timing(NULL, 1), ==, -1);
+	tt_int_op(event_base_get_stats(base, NULL, 0), ==, -1);
+
+	timer = evtimer_new(base, stats_sleep_cb, &called);
+	ev = event_new(base, -1, 0, stats_sleep_cb, &called);
+	tt_assert(timer && ev);
+	event_priority_set(timer, 0);
+	event_priority_set(ev, 1);
+
+	tt_int_op(event_base_set_stats_timing(base, 1), ==, 0);
+	evtimer_add(timer, &tv);
+	event_active(ev, EV_READ, 1);
+	event_base_dispatch(base);
+	tt_int_op(called, ==, 2);
+
+	tt_int_op(event_base_get_stats(base, &stats, 1), ==, 0);
+	tt_assert(stats.loop_iterations >= 2);
+	tt_assert(stats.callbacks_run[0] >= 1);
+	tt_assert(stats.callbacks_run[1] >= 1);
+	/* We were waiting for the timer for most of 10 msec. */
+	tt_assert(stats.dispatch_nsec >= 5000000);
+	/* Both callbacks took at least 2 msec: bucket 21 starts at 2^20. */
+	tt_assert(stats_histogram_sum(stats.callback_nsec, 21) >= 2);
+	tt_assert(stats_histogram_sum(stats.queue_delay_nsec, 0) >= 2);
+
+	tt_int_op(event_base_get_stats(base, &stats, 0), ==, 0);
+	tt_assert(stats.loop_iterations == 0);
+	tt_assert(stats_histogram_sum(stats.callback_nsec, 0) == 0);
+
+	/* Made active together: when the first is deleted, the others are
+	 * still timed from when they were made active. */
+	for (i = 0; i < 3; ++i) {
+		evs[i] = event_new(base, -1, 0, stats_sleep_cb, &called);
+		tt_assert(evs[i]);
+		event_active(evs[i], EV_READ, 1);
+	}
+	event_del(evs[0]);
+	event_base_dispatch(base);
+	tt_int_op(called, ==, 4);
+	tt_int_op(event_base_get_stats(base, &stats, 1), ==, 0);
+	tt_assert(stats_histogram_sum(stats.queue_delay_nsec, 0) == 2);
+	/* The last one waited for the 2 msec the second one slept. */
+	tt_assert(stats_histogram_sum(stats.queue_delay_nsec, 21) == 1);
+
+	/* With timing off, only the counters move. */
+	tt_int_op(event_base_set_stats_timing(base, 0), ==, 0);
+	evtimer_add(timer, &tv);
+	event_base_dispatch(base);
+	tt_int_op(called, ==, 5);
+	tt_int_op(event_base_get_stats(base, &stats, 0), ==, 0);
+	tt_assert(stats.loop_iterations >= 1);
+	tt_assert(stats.callbacks_run[0] >= 1);
+	tt_assert(stats.dispatch_nsec == 0);
+	tt_assert(stats_histogram_sum(stats.callback_nsec, 0) == 0);
+	tt_assert(stats_histogram_sum(stats.queue_delay_nsec, 0) == 0);
+
+end:
+	if (timer)
+		event_free(timer);
+	if (ev)
+		event_free(ev);
+	for (i = 0; i < 3; ++i)
+		if (evs[i])
+			event_free(evs[i]);
+	if (base)
+		event_base_free(base);
+}
+
+static void
+profile_fast_cb(evutil_socket_t fd, short what, void *arg)
+{
+	++*(int *)arg;
+}
+
+static void
+profile_bev_readcb(struct bufferevent *bev, void *arg)
+{
+	struct timeval tv = { 0, 2000 };
+	evbuffer_drain(bufferevent_get_input(bev), 1024);
+	evutil_usleep_(&tv);
+	++*(int *)arg;
+}
+
+static void
+profile_bev_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct timeval tv = { 0, 2000 };
+	evutil_usleep_(&tv);
+	++*(int *)arg;
+}
+
+static void
+test_profile(void *arg)
+{
+	struct event_base *base = NULL;
+	struct event *slow = NULL, *fast = NULL;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct event_profile_entry top[8];
+	FILE *f = NULL;
+	char line[256];
+	int called = 0, read_called = 0, i, n;
+
+	base = event_base_new();
+	tt_assert(base);
+	tt_int_op(event_base_profile_start(NULL), ==, -1);
+	tt_int_op(event_base_profile_get_top(base, top, 8), ==, 0);
+
+	slow = event_new(base, -1, 0, stats_sleep_cb, &called);
+	fast = event_new(base, -1, 0, profile_fast_cb, &called);
+	tt_assert(slow && fast);
+	tt_int_op(bufferevent_pair_new(base, BEV_OPT_DEFER_CALLBACKS, pair),
+	    ==, 0);
+	bufferevent_setcb(pair[1], profile_bev_readcb, NULL, NULL,
+	    &read_called);
+	bufferevent_enable(pair[1], EV_READ);
+
+	/* Nothing is counted before the profiler starts. */
+	event_active(slow, EV_READ, 1);
+	event_base_loop(base, EVLOOP_ONCE);
+	tt_int_op(called, ==, 1);
+
+	tt_int_op(event_base_profile_start(base), ==, 0);
+	for (i = 0; i < 3; ++i) {
+		event_active(slow, EV_READ, 1);
+		event_base_loop(base, EVLOOP_ONCE);
+	}
+	for (i = 0; i < 10; ++i) {
+		event_active(fast, EV_READ, 1);
+		event_base_loop(base, EVLOOP_ONCE);
+	}
+	bufferevent_write(pair[0], "x", 1);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(called, ==, 14);
+	tt_int_op(read_called, ==, 1);
+	tt_int_op(event_base_profile_stop(base), ==, 0);
+
+	/* Stopped: this call is not counted. */
+	event_active(slow, EV_READ, 1);
+	event_base_loop(base, EVLOOP_ONCE);
+
+	n = event_base_profile_get_top(base, top, 8);
+	tt_int_op(n, >=, 3);
+	/* The slow callback ran for at least 6 msec in all. */
+	tt_assert(top[0].callback == (void (*)(void))stats_sleep_cb);
+	tt_int_op(top[0].kind, ==, EVENT_PROFILE_KIND_EVENT);
+	tt_assert(top[0].calls == 3);
+	tt_assert(top[0].total_nsec >= 6000000);
+	tt_assert(top[0].max_nsec >= 2000000);
+	tt_assert(top[0].max_nsec <= top[0].total_nsec);
+	for (i = 1; i < n; ++i)
+		tt_assert(top[i].total_nsec <= top[i-1].total_nsec);
+
+	/* The bufferevent's deferred callback is charged to its readcb. */
+	tt_assert(top[1].callback == (void (*)(void))profile_bev_readcb);
+	tt_int_op(top[1].kind, ==, EVENT_PROFILE_KIND_BUFFEREVENT);
+	tt_assert(top[1].calls == 1);
+
+	for (i = 0; i < n; ++i) {
+		if (top[i].callback == (void (*)(void))profile_fast_cb)
+			break;
+	}
+	tt_int_op(i, <, n);
+	tt_assert(top[i].calls == 10);
+
+	tt_int_op(event_base_profile_get_top(base, top, 1), ==, 1);
+	tt_assert(top[0].callback == (void (*)(void))stats_sleep_cb);
+
+	f = tmpfile();
+	tt_assert(f);
+	tt_int_op(event_base_profile_dump(base, f, 2), ==, 0);
+	rewind(f);
+	for (n = 0; fgets(line, sizeof(line), f); ++n) {
+		if (n == 1) {
+			tt_assert(!strncmp(line, "event ", 6));
+		} else if (n == 2) {
+			tt_assert(!strncmp(line, "bufferevent ", 12));
+		}
+	}
+	tt_int_op(n, ==, 3);
+
+	/* Restarting throws the old results away. */
+	tt_int_op(event_base_profile_start(base), ==, 0);
+	tt_int_op(event_base_profile_get_top(base, top, 8), ==, 0);
+
+	/* One deferred run that calls both the readcb and the eventcb
+	 * charges each of them for its own time. */
+	bufferevent_setcb(pair[1], profile_bev_readcb, NULL,
+	    profile_bev_eventcb, &read_called);
+	bufferevent_write(pair[0], "x", 1);
+	bufferevent_trigger_event(pair[1], BEV_EVENT_EOF,
+	    BEV_TRIG_DEFER_CALLBACKS);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	tt_int_op(read_called, ==, 3);
+	n = event_base_profile_get_top(base, top, 8);
+	tt_int_op(n, ==, 2);
+	for (i = 0; i < n; ++i) {
+		tt_assert(top[i].callback ==
+		    (void (*)(void))profile_bev_readcb ||
+		    top[i].callback == (void (*)(void))profile_bev_eventcb);
+		tt_assert(top[i].calls == 1);
+		tt_assert(top[i].total_nsec >= 2000000);
+	}
+	tt_assert(top[0].callback != top[1].callback);
+
+end:
+	if (f)
+		fclose(f);
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (pair[1])
+		bufferevent_free(pair[1]);
+	if (slow)
+		event_free(slow);
+	if (fast)
+		event_free(fast);
+	if (base)
+		event_base_free(base);
+}
+
+#define N_SLAB_EVENTS 1000
+
+static void
+slab_count_cb(evutil_socket_t fd, short what, void *arg)
+{
+	++*(int *)arg;
+}
+
+static void
+slab_finalize_cb(struct event *ev, void *arg)
+{
+	++*(int *)arg;
+}
+
+static void
+test_slab_alloc(void *arg)
+{
+	struct event_config *cfg = NULL;
+	struct event_base *base = NULL, *base2 = NULL;
+	struct event **evs = NULL;
+	struct event *ev = NULL, *ev2;
+	struct bufferevent *bev = NULL, *bev2;
+	struct timeval tv = { 10, 0 };
+	int called = 0, i;
+
+	cfg = event_config_new();
+	tt_assert(cfg);
+	event_config_set_flag(cfg, EVENT_BASE_FLAG_SLAB_ALLOC);
+	base = event_base_new_with_config(cfg);
+	tt_assert(base);
+
+	/* A freed event is handed out again right away. */
+	ev = event_new(base, -1, 0, slab_count_cb, &called);
+	tt_assert(ev);
+	event_free(ev);
+	ev2 = event_new(base, -1, 0, slab_count_cb, &called);
+	tt_ptr_op(ev2, ==, ev);
+	ev = ev2;
+
+	/* Plenty of them at once, spanning several chunks. */
+	evs = calloc(N_SLAB_EVENTS, sizeof(struct event *));
+	tt_assert(evs);
+	for (i = 0; i < N_SLAB_EVENTS; ++i) {
+		evs[i] = evtimer_new(base, slab_count_cb, &called);
+		tt_assert(evs[i]);
+		tt_assert(evs[i] != ev);
+		evtimer_add(evs[i], &tv);
+	}
+	for (i = 1; i < N_SLAB_EVENTS; ++i)
+		tt_assert(evs[i] != evs[i - 1]);
+	for (i = 0; i < N_SLAB_EVENTS; ++i) {
+		event_free(evs[i]);
+		evs[i] = NULL;
+	}
+
+	for (i = 0; i < 100; ++i)
+		tt_int_op(event_base_once(base, -1, EV_TIMEOUT, slab_count_cb,
+			&called, NULL), ==, 0);
+	event_base_dispatch(base);
+	tt_int_op(called, ==, 100);
+
+	/* The finalizer gets the event's own argument. */
+	event_free_finalize(0, ev, slab_finalize_cb);
+	ev = NULL;
+	event_base_dispatch(base);
+	tt_int_op(called, ==, 101);
+
+	bev = bufferevent_socket_new(base, -1, 0);
+	tt_assert(bev);
+	bufferevent_free(bev);
+	event_base_loop(base, EVLOOP_NONBLOCK);
+	bev2 = bufferevent_socket_new(base, -1, 0);
+	tt_ptr_op(bev2, ==, bev);
+	bev = bev2;
+
+	/* A bufferevent can't move into or out of a slab base. */
+	base2 = event_base_new();
+	tt_assert(base2);
+	bev2 = bufferevent_socket_new(base2, -1, 0);
+	tt_assert(bev2);
+	tt_int_op(bufferevent_base_set(base, bev2), ==, -1);
+	tt_ptr_op(bufferevent_get_base(bev2), ==, base2);
+	bufferevent_free(bev2);
+	tt_int_op(bufferevent_base_set(base2, bev), ==, -1);
+	tt_ptr_op(bufferevent_get_base(bev), ==, base);
+	tt_int_op(bufferevent_base_set(base, bev), ==, 0);
+
+	/* Nor can an event. */
+	ev2 = event_new(base2, -1, 0, slab_count_cb, &called);
+	tt_assert(ev2);
+	tt_int_op(event_base_set(base, ev2), ==, -1);
+	tt_ptr_op(event_get_base(ev2), ==, base2);
+	event_free(ev2);
+	ev2 = event_new(base, -1, 0, slab_count_cb, &called);
+	tt_assert(ev2);
+	tt_int_op(event_base_set(base2, ev2), ==, -1);
+	tt_int_op(event_base_set(base, ev2), ==, 0);
+	event_free(ev2);
+
+	/* Left for event_base_free() to clean up. */
+	tt_int_op(event_base_once(base, -1, EV_TIMEOUT, slab_count_cb,
+		&called, &tv), ==, 0);
+
+end:
+	if (evs) {
+		for (i = 0; i < N_SLAB_EVENTS; ++i)
+			if (evs[i])
+				event_free(evs[i]);
+		free(evs);
+	}
+	if (ev)
+		event_free(ev);
+	if (bev)
+		bufferevent_free(bev);
+	if (base)
+		event_base_free(base);
+	if (base2)
+		event_base_free(base2);
+	if (cfg)
+		event_config_free(cfg);
+}
+
 static void
 tabf_cb(evutil_socket_t fd, short what, void *arg)
 {
@@ -3573,6 +4088,12 @@ struct testcase_t main_testcases[] = {
 	{ "gettimeofday_cached_reset", test_gettimeofday_cached, TT_FORK, &basic_setup, (void*)"sleep reset" },
 	{ "gettimeofday_cached_disabled", test_gettimeofday_cached, TT_FORK, &basic_setup, (void*)"sleep disable" },
 	{ "gettimeofday_cached_disabled_nosleep", test_gettimeofday_cached, TT_FORK, &basic_setup, (void*)"disable" },
+	{ "busy_poll", test_busy_poll, TT_FORK|TT_NEED_SOCKETPAIR, &basic_setup, (void*)"" },
+	{ "busy_poll_precise", test_busy_poll, TT_FORK|TT_NEED_SOCKETPAIR, &basic_setup, (void*)"precise" },
+	{ "max_dispatch_events", test_max_dispatch_events, TT_FORK, NULL, NULL },
+	{ "slab_alloc", test_slab_alloc, TT_FORK, NULL, NULL },
+	{ "stats", test_stats, TT_FORK, NULL, NULL },
+	{ "profile", test_profile, TT_FORK, NULL, NULL },
 
 	BASIC(active_by_fd, TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR),
 
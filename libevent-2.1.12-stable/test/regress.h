@@ -48,6 +48,7 @@ extern struct testcase_t dns_testcases[];
 extern struct testcase_t rpc_testcases[];
 extern struct testcase_t edgetriggered_testcases[];
 extern struct testcase_t minheap_testcases[];
+extern struct testcase_t timerwheel_testcases[];
 extern struct testcase_t iocp_testcases[];
 extern struct testcase_t ssl_testcases[];
 extern struct testcase_t listener_testcases[];
@@ -60,6 +61,7 @@ extern struct evutil_weakrand_state test_weakrand_state;
 
 void regress_threads(void *);
 void test_bufferevent_zlib(void *);
+void test_bufferevent_compress(void *);
 
 /* Helpers to wrap old testcases */
 extern evutil_socket_t pair[2];
@@ -2227,6 +2227,337 @@ end:
 		evbuffer_free(buf2);
 }
 
+static void
+test_evbuffer_remove_buffer_shared(void *ptr)
+{
+	struct basic_test_data *testdata = ptr;
+	struct evbuffer *src = NULL, *dst = NULL, *dst2 = NULL;
+	struct evbuffer_iovec v_src, v_dst;
+	char *data = NULL, *out = NULL;
+	const size_t len = 8192;
+	size_t i;
+
+	data = malloc(len);
+	out = malloc(len);
+	tt_assert(data && out);
+	for (i = 0; i < len; ++i)
+		data[i] = (char)(i * 7);
+
+	src = evbuffer_new();
+	dst = evbuffer_new();
+	dst2 = evbuffer_new();
+	tt_assert(src && dst && dst2);
+
+	tt_int_op(evbuffer_add(src, data, len), ==, 0);
+	tt_int_op(evbuffer_peek(src, -1, NULL, &v_src, 1), ==, 1);
+
+	/* A large partial chain is shared, not copied. */
+	tt_int_op(evbuffer_remove_buffer_reference(src, dst, 3000), ==, 3000);
+	tt_int_op(evbuffer_get_length(src), ==, len - 3000);
+	tt_int_op(evbuffer_get_length(dst), ==, 3000);
+	tt_int_op(evbuffer_peek(dst, -1, NULL, &v_dst, 1), ==, 1);
+	tt_ptr_op(v_dst.iov_base, ==, v_src.iov_base);
+	evbuffer_validate(src);
+	evbuffer_validate(dst);
+
+	/* Appending to either buffer must not touch the shared bytes. */
+	tt_int_op(evbuffer_add(dst, "abc", 3), ==, 0);
+	tt_int_op(evbuffer_add(src, "xyz", 3), ==, 0);
+	tt_int_op(evbuffer_prepend(src, "123", 3), ==, 0);
+	tt_int_op(evbuffer_get_length(dst), ==, 3003);
+	tt_int_op(evbuffer_remove(dst, out, 3003), ==, 3003);
+	tt_int_op(memcmp(out, data, 3000), ==, 0);
+	tt_int_op(memcmp(out + 3000, "abc", 3), ==, 0);
+	tt_int_op(evbuffer_drain(src, 3), ==, 0);
+
+	/* Sharing a shared chain refers back to the original memory. */
+	tt_int_op(evbuffer_remove_buffer_reference(src, dst, 2000), ==, 2000);
+	tt_int_op(evbuffer_remove_buffer_reference(dst, dst2, 1800), ==, 1800);
+	tt_int_op(evbuffer_peek(dst2, -1, NULL, &v_dst, 1), ==, 1);
+	tt_ptr_op(v_dst.iov_base, ==, (char *)v_src.iov_base + 3000);
+	evbuffer_validate(dst);
+	evbuffer_validate(dst2);
+
+	/* Nothing is shared into a buffer that others refer to. */
+	tt_int_op(evbuffer_remove_buffer_reference(dst2, src, 1700), ==, 1700);
+	evbuffer_validate(src);
+
+	/* The data outlives the buffer it came from. */
+	evbuffer_free(src);
+	src = NULL;
+	tt_int_op(evbuffer_remove(dst, out, 200), ==, 200);
+	tt_int_op(memcmp(out, data + 4800, 200), ==, 0);
+	tt_int_op(evbuffer_remove(dst2, out, 100), ==, 100);
+	tt_int_op(memcmp(out, data + 4700, 100), ==, 0);
+
+	/* Small pieces are still copied. */
+	src = evbuffer_new();
+	tt_assert(src);
+	tt_int_op(evbuffer_add(src, data, len), ==, 0);
+	tt_int_op(evbuffer_peek(src, -1, NULL, &v_src, 1), ==, 1);
+	tt_int_op(evbuffer_remove_buffer_reference(src, dst, 100), ==, 100);
+	tt_int_op(evbuffer_get_length(dst), ==, 100);
+	tt_int_op(evbuffer_peek(dst, -1, NULL, &v_dst, 1), ==, 1);
+	tt_ptr_op(v_dst.iov_base, !=, v_src.iov_base);
+	tt_int_op(memcmp(v_dst.iov_base, data, 100), ==, 0);
+	evbuffer_free(dst);
+	dst = evbuffer_new();
+	tt_assert(dst);
+
+	/* evbuffer_remove_buffer() copies even large pieces. */
+	tt_int_op(evbuffer_remove_buffer(src, dst, 2000), ==, 2000);
+	tt_int_op(evbuffer_peek(dst, -1, NULL, &v_dst, 1), ==, 1);
+	tt_ptr_op(v_dst.iov_base, !=, (char *)v_src.iov_base + 100);
+
+	/* A buffer won't take back chains that refer to its own memory:
+	 * it would keep itself alive. */
+	tt_int_op(evbuffer_remove_buffer_reference(src, dst, 2000), ==, 2000);
+	tt_int_op(evbuffer_peek(dst, -1, NULL, NULL, 0), ==, 2);
+	tt_int_op(evbuffer_prepend_buffer(src, dst), ==, -1);
+	tt_int_op(evbuffer_add_buffer(src, dst), ==, -1);
+	tt_int_op(evbuffer_remove_buffer(dst, src, 4000), ==, -1);
+	tt_int_op(evbuffer_get_length(dst), ==, 4000);
+	tt_int_op(evbuffer_remove_buffer(dst, src, 2000), ==, 2000);
+	tt_int_op(evbuffer_get_length(src), ==, len - 2100);
+	evbuffer_validate(src);
+	evbuffer_validate(dst);
+
+	/* A buffer that others keep alive can't be shared from. */
+	tt_int_op(evbuffer_defer_callbacks(src, testdata->base), ==, 0);
+	tt_int_op(evbuffer_remove_buffer_reference(src, dst, 2000), ==, -1);
+	tt_int_op(evbuffer_get_length(src), ==, len - 2100);
+
+end:
+	if (src)
+		evbuffer_free(src);
+	if (dst)
+		evbuffer_free(dst);
+	if (dst2)
+		evbuffer_free(dst2);
+	if (data)
+		free(data);
+	if (out)
+		free(out);
+}
+
+static void
+test_evbuffer_ring(void *ptr)
+{
+	struct evbuffer *buf = NULL, *other = NULL;
+	struct evbuffer_iovec v[2];
+	evutil_socket_t pair[2] = { -1, -1 };
+	char data[4096], out[4096];
+	unsigned char *p;
+	size_t size, i;
+
+	for (i = 0; i < sizeof(data); ++i)
+		data[i] = (char)(i * 13);
+
+	buf = evbuffer_new();
+	other = evbuffer_new();
+	tt_assert(buf && other);
+	tt_int_op(evbuffer_add(buf, "x", 1), ==, 0);
+	/* Only an empty buffer can become a ring. */
+	tt_int_op(evbuffer_enable_ring(buf, 4096), ==, -1);
+	evbuffer_drain(buf, 1);
+#ifdef EVENT__HAVE_MEMFD_CREATE
+	tt_int_op(evbuffer_enable_ring(buf, 4096), ==, 0);
+#else
+	if (evbuffer_enable_ring(buf, 4096) < 0)
+		tt_skip();
+#endif
+	tt_int_op(evbuffer_enable_ring(buf, 4096), ==, -1);
+
+	/* Find out how big the ring is by filling it. */
+	tt_int_op(evbuffer_reserve_space(buf, 1, v, 1), ==, 1);
+	size = v[0].iov_len;
+	tt_assert(size >= 4096);
+	tt_int_op(evbuffer_get_contiguous_space(buf), ==, 0);
+
+	/* Push the data around the end of the ring a few times; it must
+	 * always come back as one piece. */
+	for (i = 0; i < 3 * size / 1000; ++i) {
+		tt_int_op(evbuffer_add(buf, data, 1000), ==, 0);
+		tt_int_op(evbuffer_add(buf, data + 1000, 1000), ==, 0);
+		evbuffer_validate(buf);
+		tt_int_op(evbuffer_get_contiguous_space(buf), ==, 2000);
+		tt_int_op(evbuffer_peek(buf, -1, NULL, v, 2), ==, 1);
+		p = evbuffer_pullup(buf, -1);
+		tt_ptr_op(p, ==, v[0].iov_base);
+		tt_int_op(memcmp(p, data, 2000), ==, 0);
+		tt_int_op(evbuffer_drain(buf, 1500), ==, 0);
+		tt_int_op(evbuffer_remove(buf, out, 500), ==, 500);
+		tt_int_op(memcmp(out, data + 1500, 500), ==, 0);
+		/* Leave a little behind, so that the data wraps. */
+		tt_int_op(evbuffer_add(buf, data, 7), ==, 0);
+		tt_int_op(evbuffer_drain(buf, 7), ==, 0);
+		tt_int_op(evbuffer_add(buf, data, 300), ==, 0);
+		tt_int_op(evbuffer_drain(buf, 100), ==, 0);
+		tt_int_op(evbuffer_remove(buf, out, 200), ==, 200);
+		tt_int_op(memcmp(out, data + 100, 200), ==, 0);
+	}
+
+	/* The ring doesn't grow. */
+	tt_int_op(evbuffer_add(buf, data, 100), ==, 0);
+	tt_int_op(evbuffer_drain(buf, 100), ==, 0);
+	for (i = 0; i < size / 1024; ++i)
+		tt_int_op(evbuffer_add(buf, data, 1024), ==, 0);
+	tt_int_op(evbuffer_get_length(buf), ==, size);
+	tt_int_op(evbuffer_add(buf, "x", 1), ==, -1);
+	tt_int_op(evbuffer_expand(buf, 1), ==, -1);
+	tt_int_op(evbuffer_reserve_space(buf, 1, v, 2), ==, -1);
+	tt_int_op(evbuffer_get_contiguous_space(buf), ==, size);
+	evbuffer_validate(buf);
+
+	/* Prepending runs backwards over the start of the ring. */
+	tt_int_op(evbuffer_drain(buf, size - 10), ==, 0);
+	tt_int_op(evbuffer_prepend(buf, "hello ", 6), ==, 0);
+	tt_int_op(evbuffer_get_contiguous_space(buf), ==, 16);
+	tt_int_op(memcmp(evbuffer_pullup(buf, -1), "hello ", 6), ==, 0);
+	tt_int_op(evbuffer_drain(buf, 16), ==, 0);
+	tt_int_op(evbuffer_prepend(buf, "abc", 3), ==, 0);
+	tt_int_op(evbuffer_prepend(buf, "xyz", 3), ==, 0);
+	tt_int_op(evbuffer_remove(buf, out, 6), ==, 6);
+	tt_int_op(memcmp(out, "xyzabc", 6), ==, 0);
+	tt_int_op(evbuffer_add_printf(buf, "%d-%s", 42, "ring"), ==, 7);
+	tt_int_op(evbuffer_remove(buf, out, 7), ==, 7);
+	tt_int_op(memcmp(out, "42-ring", 7), ==, 0);
+
+	/* Data is copied into and out of the ring. */
+	tt_int_op(evbuffer_add(other, data, 3000), ==, 0);
+	tt_int_op(evbuffer_add_buffer(buf, other), ==, 0);
+	tt_int_op(evbuffer_get_length(other), ==, 0);
+	tt_int_op(evbuffer_remove_buffer(buf, other, 1000), ==, 1000);
+	tt_int_op(evbuffer_add_buffer(other, buf), ==, 0);
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+	tt_int_op(evbuffer_get_length(other), ==, 3000);
+	tt_int_op(evbuffer_remove(other, out, 3000), ==, 3000);
+	tt_int_op(memcmp(out, data, 3000), ==, 0);
+	for (i = 0; i < size / 1024; ++i)
+		tt_int_op(evbuffer_add(other, data, 1024), ==, 0);
+	tt_int_op(evbuffer_add(buf, "x", 1), ==, 0);
+	tt_int_op(evbuffer_add_buffer(buf, other), ==, -1);
+	tt_int_op(evbuffer_remove_buffer(other, buf, size), ==, size - 1);
+	tt_int_op(evbuffer_add_buffer_reference(other, buf), ==, -1);
+	tt_int_op(evbuffer_prepend_buffer(buf, other), ==, -1);
+	tt_int_op(evbuffer_drain(buf, size), ==, 0);
+	evbuffer_drain(other, evbuffer_get_length(other));
+
+	ref_done_cb_called_count = 0;
+	tt_int_op(evbuffer_add_reference(buf, data, 10, ref_done_cb, NULL),
+	    ==, 0);
+	tt_int_op(ref_done_cb_called_count, ==, 1);
+	ref_done_cb_called_count = 0;
+	tt_int_op(evbuffer_remove(buf, out, 10), ==, 10);
+	tt_int_op(memcmp(out, data, 10), ==, 0);
+
+	/* Reading stops when the ring is full. */
+	tt_int_op(evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair), ==, 0);
+	evutil_make_socket_nonblocking(pair[0]);
+	for (i = 0; i < size / 1024 + 1; ++i)
+		tt_int_op(send(pair[1], data, 1024, 0), ==, 1024);
+	tt_int_op(evbuffer_add(buf, data, 10), ==, 0);
+	tt_int_op(evbuffer_drain(buf, 10), ==, 0);
+	while (evbuffer_get_length(buf) < size)
+		tt_int_op(evbuffer_read(buf, pair[0], -1), >, 0);
+	tt_int_op(evbuffer_read(buf, pair[0], -1), ==, -1);
+	tt_int_op(evbuffer_get_length(buf), ==, size);
+	tt_int_op(memcmp(evbuffer_pullup(buf, 1024), data, 1024), ==, 0);
+	evbuffer_validate(buf);
+
+end:
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+	if (buf)
+		evbuffer_free(buf);
+	if (other)
+		evbuffer_free(other);
+}
+
+static void
+test_evbuffer_add_int(void *ptr)
+{
+	struct evbuffer *buf = evbuffer_new();
+	char expect[128], *s = NULL;
+	ev_uint64_t u;
+	int i;
+
+	tt_assert(buf);
+	tt_int_op(evbuffer_add_int(buf, 0), ==, 1);
+	tt_int_op(evbuffer_add_int(buf, -7), ==, 2);
+	tt_int_op(evbuffer_add_int(buf, 1234567890), ==, 10);
+	tt_int_op(evbuffer_add_int(buf, EV_INT64_MIN), ==, 20);
+	tt_int_op(evbuffer_add_int(buf, EV_INT64_MAX), ==, 19);
+	tt_int_op(evbuffer_add_uint(buf, EV_UINT64_MAX), ==, 20);
+	evbuffer_add(buf, "\n", 1);
+	s = evbuffer_readln(buf, NULL, EVBUFFER_EOL_ANY);
+	tt_str_op(s, ==, "0-71234567890-9223372036854775808"
+	    "922337203685477580718446744073709551615");
+	free(s);
+	s = NULL;
+
+	/* Every length of decimal and hex number comes out like printf. */
+	for (i = 0, u = 1; i < 20; ++i, u *= 10) {
+		evbuffer_add_uint(buf, u - 1);
+		evbuffer_add(buf, " ", 1);
+		evbuffer_add_uint(buf, u);
+		evbuffer_add(buf, "\n", 1);
+		evutil_snprintf(expect, sizeof(expect), EV_U64_FMT " " EV_U64_FMT,
+		    EV_U64_ARG(u - 1), EV_U64_ARG(u));
+		s = evbuffer_readln(buf, NULL, EVBUFFER_EOL_LF);
+		tt_str_op(s, ==, expect);
+		free(s);
+		s = NULL;
+	}
+	for (i = 0; i < 64; ++i) {
+		u = (ev_uint64_t)1 << i;
+		tt_int_op(evbuffer_add_hex(buf, u), ==, i / 4 + 1);
+		evbuffer_add(buf, "\n", 1);
+		if (u >> 32)
+			evutil_snprintf(expect, sizeof(expect), "%lx%08lx",
+			    (unsigned long)(u >> 32),
+			    (unsigned long)(u & 0xffffffffU));
+		else
+			evutil_snprintf(expect, sizeof(expect), "%lx",
+			    (unsigned long)u);
+		s = evbuffer_readln(buf, NULL, EVBUFFER_EOL_LF);
+		tt_str_op(s, ==, expect);
+		free(s);
+		s = NULL;
+	}
+	tt_int_op(evbuffer_add_hex(buf, 0), ==, 1);
+	tt_int_op(evbuffer_add_hex(buf, 0xdeadbeefU), ==, 8);
+	tt_int_op(evbuffer_add_hex(buf, EV_UINT64_MAX), ==, 16);
+	evbuffer_add(buf, "\n", 1);
+	s = evbuffer_readln(buf, NULL, EVBUFFER_EOL_ANY);
+	tt_str_op(s, ==, "0deadbeefffffffffffffffff");
+	free(s);
+	s = NULL;
+
+	tt_int_op(evbuffer_add_header_line(buf, "Host", 4, "example.com", 11),
+	    ==, 19);
+	tt_int_op(evbuffer_add_header_line(buf, "X-Empty", 7, "", 0), ==, 11);
+	tt_int_op(evbuffer_get_length(buf), ==, 30);
+	tt_int_op(memcmp(evbuffer_pullup(buf, -1),
+		"Host: example.com\r\nX-Empty: \r\n", 30), ==, 0);
+	evbuffer_validate(buf);
+
+	/* None of them add to a frozen buffer. */
+	evbuffer_freeze(buf, 0);
+	tt_int_op(evbuffer_add_int(buf, 1), ==, -1);
+	tt_int_op(evbuffer_add_hex(buf, 1), ==, -1);
+	tt_int_op(evbuffer_add_header_line(buf, "a", 1, "b", 1), ==, -1);
+	tt_int_op(evbuffer_get_length(buf), ==, 30);
+
+end:
+	if (s)
+		free(s);
+	if (buf)
+		evbuffer_free(buf);
+}
+
 static void
 check_prepend(struct evbuffer *buffer,
     const struct evbuffer_cb_info *cbinfo,
@@ -2781,6 +3112,450 @@ end:
 		evbuffer_free(buf);
 }
 
+static ev_ssize_t
+naive_search(const char *s, size_t len, size_t from, const char *pat,
+    size_t patlen)
+{
+	size_t i;
+	for (i = from; i + patlen <= len; ++i) {
+		if (!memcmp(s + i, pat, patlen))
+			return i;
+	}
+	return -1;
+}
+
+static void
+test_evbuffer_search_simd(void *ptr)
+{
+	const char *impl = ptr;
+	struct evbuffer *buf = NULL;
+	struct evbuffer_ptr start, end, found;
+	static char flat[6000];
+	ev_uint32_t seed = 12345;
+	size_t off, eol_len;
+	int i, j;
+
+#define NEXT_RAND() (seed = seed * 1103515245 + 12345, (seed >> 16))
+
+	if (evutil_memsearch_select_(impl) < 0)
+		tt_skip();
+	tt_str_op(evutil_memsearch_get_impl_(), ==, impl);
+
+	/* Mostly 'a' and 'b', so that there are lots of near misses, with
+	 * the odd line ending; split into chains of 1 to 64 bytes. */
+	for (i = 0; i < (int)sizeof(flat); ++i) {
+		unsigned r = NEXT_RAND() % 64;
+		flat[i] = r == 0 ? '\r' : r == 1 ? '\n' : (r & 1) ? 'a' : 'b';
+	}
+	buf = evbuffer_new();
+	tt_assert(buf);
+	for (off = 0; off < sizeof(flat); ) {
+		size_t n = 1 + NEXT_RAND() % 64;
+		if (n > sizeof(flat) - off)
+			n = sizeof(flat) - off;
+		evbuffer_add_reference(buf, flat + off, n, NULL, NULL);
+		off += n;
+	}
+
+	for (i = 0; i < 400; ++i) {
+		size_t from = NEXT_RAND() % sizeof(flat);
+		size_t patlen = 1 + NEXT_RAND() % (i < 300 ? 12 : 48);
+		size_t at = NEXT_RAND() % (sizeof(flat) - patlen);
+		const char *pat = flat + at;
+		ev_ssize_t expect = naive_search(flat, sizeof(flat), from,
+		    pat, patlen);
+
+		tt_int_op(evbuffer_ptr_set(buf, &start, from,
+			EVBUFFER_PTR_SET), ==, 0);
+		found = evbuffer_search(buf, pat, patlen, &start);
+		tt_int_op(found.pos, ==, expect);
+		if (expect >= 0) {
+			/* An end right at the match still finds it; one byte
+			 * before it doesn't. */
+			tt_int_op(evbuffer_ptr_set(buf, &end, expect + patlen,
+				EVBUFFER_PTR_SET), ==, 0);
+			found = evbuffer_search_range(buf, pat, patlen,
+			    &start, &end);
+			tt_int_op(found.pos, ==, expect);
+			evbuffer_ptr_set(buf, &end, expect + patlen - 1,
+			    EVBUFFER_PTR_SET);
+			found = evbuffer_search_range(buf, pat, patlen,
+			    &start, &end);
+			tt_int_op(found.pos, ==, -1);
+		}
+	}
+
+	/* A pattern that isn't there at all. */
+	found = evbuffer_search(buf, "abba\n\nabba", 11, NULL);
+	tt_int_op(found.pos, ==,
+	    naive_search(flat, sizeof(flat), 0, "abba\n\nabba", 11));
+
+	for (i = 0; i < 200; ++i) {
+		size_t from = NEXT_RAND() % sizeof(flat);
+		ev_ssize_t any = -1, lf = -1, crlf;
+
+		for (j = from; j < (int)sizeof(flat); ++j) {
+			if (any < 0 && (flat[j] == '\r' || flat[j] == '\n'))
+				any = j;
+			if (flat[j] == '\n') {
+				lf = j;
+				break;
+			}
+		}
+		crlf = naive_search(flat, sizeof(flat), from, "\r\n", 2);
+
+		evbuffer_ptr_set(buf, &start, from, EVBUFFER_PTR_SET);
+		found = evbuffer_search_eol(buf, &start, &eol_len,
+		    EVBUFFER_EOL_ANY);
+		tt_int_op(found.pos, ==, any);
+		found = evbuffer_search_eol(buf, &start, &eol_len,
+		    EVBUFFER_EOL_LF);
+		tt_int_op(found.pos, ==, lf);
+		found = evbuffer_search_eol(buf, &start, &eol_len,
+		    EVBUFFER_EOL_CRLF_STRICT);
+		tt_int_op(found.pos, ==, crlf);
+		if (crlf >= 0)
+			tt_int_op(eol_len, ==, 2);
+		found = evbuffer_search_eol(buf, &start, &eol_len,
+		    EVBUFFER_EOL_CRLF);
+		if (lf > (ev_ssize_t)from && flat[lf - 1] == '\r') {
+			tt_int_op(found.pos, ==, lf - 1);
+			tt_int_op(eol_len, ==, 2);
+		} else {
+			tt_int_op(found.pos, ==, lf);
+		}
+	}
+#undef NEXT_RAND
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+}
+
+/* Write up to len bytes to a nonblocking socket; return how many made it. */
+static size_t
+fill_socket(evutil_socket_t fd, size_t len)
+{
+	char data[4096];
+	size_t sent = 0;
+
+	memset(data, 'x', sizeof(data));
+	while (sent < len) {
+		size_t n = len - sent < sizeof(data) ? len - sent : sizeof(data);
+		ev_ssize_t r = send(fd, data, (int)n, 0);
+		if (r <= 0)
+			break;
+		sent += r;
+	}
+	return sent;
+}
+
+static void
+test_evbuffer_read_adaptive(void *ptr)
+{
+	struct basic_test_data *testdata = ptr;
+	evutil_socket_t *pair = testdata->pair;
+	struct evbuffer *buf = NULL;
+	size_t queued;
+	int i, r, prev, largest;
+
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_get_max_read(buf), ==, EVBUFFER_MAX_READ_DEFAULT);
+	tt_int_op(evbuffer_set_max_read(buf, 1000), ==, 0);
+	tt_int_op(evbuffer_get_max_read(buf), ==, 1000);
+	tt_int_op(evbuffer_set_max_read(buf, 0), ==, 0);
+	tt_int_op(evbuffer_get_max_read(buf), ==, EVBUFFER_MAX_READ_DEFAULT);
+	tt_int_op(evbuffer_set_max_read(buf, 32768), ==, 0);
+
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+
+	/* Reads that keep coming back full double the read size, up to
+	 * the limit. */
+	queued = fill_socket(pair[0], 100000);
+	if (queued < 70000)
+		tt_skip();
+	prev = 0;
+	largest = 0;
+	for (i = 0; i < 5; ++i) {
+		r = evbuffer_read(buf, pair[1], -1);
+		tt_int_op(r, >, 0);
+		if (i == 0)
+			tt_int_op(r, ==, 4096);
+		else
+			tt_int_op(r, >=, prev);
+		tt_int_op(r, <=, 32768);
+		prev = largest = r;
+	}
+	tt_int_op(largest, >, 16384);
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	while (evbuffer_read(buf, pair[1], -1) > 0)
+		evbuffer_drain(buf, evbuffer_get_length(buf));
+
+	/* Small reads shrink it back down. */
+	for (i = 0; i < 8; ++i) {
+		tt_int_op(fill_socket(pair[0], 10), ==, 10);
+		tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 10);
+	}
+	evbuffer_drain(buf, evbuffer_get_length(buf));
+	tt_int_op(fill_socket(pair[0], 20000), ==, 20000);
+	tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 4096);
+
+	/* A caller-imposed limit doesn't count as a short read, so the size
+	 * keeps growing. */
+	tt_int_op(evbuffer_read(buf, pair[1], 100), ==, 100);
+	tt_int_op(evbuffer_read(buf, pair[1], 100), ==, 100);
+	tt_int_op(evbuffer_read(buf, pair[1], -1), >, 4096);
+
+	/* At 4096 or below, reads are fixed-size. */
+	tt_int_op(evbuffer_set_max_read(buf, 1000), ==, 0);
+	tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 1000);
+	tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 1000);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static int zerocopy_cleanup_called;
+static void
+zerocopy_cleanup(const void *data, size_t len, void *arg)
+{
+	++zerocopy_cleanup_called;
+}
+
+static void
+test_evbuffer_zerocopy(void *ptr)
+{
+	struct evbuffer *src = NULL, *dst = NULL;
+	evutil_socket_t pair[2] = { -1, -1 };
+	char *data = NULL;
+	char hdr[100];
+	size_t i;
+	int n, tries;
+
+	/* MSG_ZEROCOPY is TCP-only. */
+	if (evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, pair) == -1)
+		tt_abort_msg("ersatz_socketpair failed");
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+
+	src = evbuffer_new();
+	dst = evbuffer_new();
+	tt_assert(src && dst);
+	if (evbuffer_enable_zerocopy(src, pair[0], 0) < 0)
+		tt_skip();
+	tt_int_op(evbuffer_get_zerocopy_pending(src), ==, 0);
+
+	data = malloc(65536);
+	tt_assert(data);
+	for (i = 0; i < 65536; ++i)
+		data[i] = (char)(i * 7);
+	memset(hdr, 'h', sizeof(hdr));
+	zerocopy_cleanup_called = 0;
+	evbuffer_add(src, hdr, sizeof(hdr));
+	evbuffer_add_reference(src, data, 65536, zerocopy_cleanup, NULL);
+
+	/* The small chain goes out on its own, copied. */
+	tt_int_op(evbuffer_write(src, pair[0]), ==, sizeof(hdr));
+	tt_int_op(evbuffer_get_zerocopy_pending(src), ==, 0);
+
+	/* The large one is drained as it is sent, but its memory is kept
+	 * until the kernel lets go of it. */
+	for (tries = 0; evbuffer_get_length(src) && tries < 1000; ++tries) {
+		n = evbuffer_write(src, pair[0]);
+		if (n < 0)
+			tt_assert(EVUTIL_ERR_RW_RETRIABLE(errno));
+		if (evbuffer_get_length(src))
+			evbuffer_read(dst, pair[1], -1);
+	}
+	tt_int_op(evbuffer_get_length(src), ==, 0);
+	tt_int_op(evbuffer_get_zerocopy_pending(src), >, 0);
+	tt_int_op(zerocopy_cleanup_called, ==, 0);
+
+	for (tries = 0; evbuffer_get_length(dst) < sizeof(hdr) + 65536 &&
+	     tries < 1000; ++tries) {
+		if (evbuffer_read(dst, pair[1], -1) < 0)
+			tt_assert(EVUTIL_ERR_RW_RETRIABLE(errno));
+	}
+	tt_int_op(evbuffer_get_length(dst), ==, sizeof(hdr) + 65536);
+
+	/* Once the receiver has the data, the completions come in. */
+	for (tries = 0; evbuffer_get_zerocopy_pending(src) && tries < 100;
+	     ++tries) {
+		tt_int_op(evbuffer_reap_zerocopy(src), >=, 0);
+		if (evbuffer_get_zerocopy_pending(src)) {
+			struct timeval tv = { 0, 10000 };
+			evutil_usleep_(&tv);
+		}
+	}
+	tt_int_op(evbuffer_get_zerocopy_pending(src), ==, 0);
+	tt_int_op(zerocopy_cleanup_called, ==, 1);
+
+	tt_assert(!memcmp(evbuffer_pullup(dst, sizeof(hdr)), hdr,
+		sizeof(hdr)));
+	evbuffer_drain(dst, sizeof(hdr));
+	tt_assert(!memcmp(evbuffer_pullup(dst, 65536), data, 65536));
+
+end:
+	if (src)
+		evbuffer_free(src);
+	if (dst)
+		evbuffer_free(dst);
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+	if (data)
+		free(data);
+}
+
+/* Keep reaping src until the kernel is done with all of its sends. */
+static int
+zerocopy_wait_pending(struct evbuffer *src)
+{
+	int tries;
+
+	for (tries = 0; evbuffer_get_zerocopy_pending(src) && tries < 100;
+	     ++tries) {
+		if (evbuffer_reap_zerocopy(src) < 0)
+			return -1;
+		if (evbuffer_get_zerocopy_pending(src)) {
+			struct timeval tv = { 0, 10000 };
+			evutil_usleep_(&tv);
+		}
+	}
+	return evbuffer_get_zerocopy_pending(src) ? -1 : 0;
+}
+
+static void
+test_evbuffer_zerocopy_lifetime(void *ptr)
+{
+	struct evbuffer *src = NULL, *dst = NULL;
+	evutil_socket_t pair[2] = { -1, -1 };
+	char *data = NULL;
+	int tries;
+
+	if (evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, pair) == -1)
+		tt_abort_msg("ersatz_socketpair failed");
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+
+	src = evbuffer_new();
+	dst = evbuffer_new();
+	tt_assert(src && dst);
+	if (evbuffer_enable_zerocopy(src, pair[0], 0) < 0)
+		tt_skip();
+
+	data = calloc(1, 65536);
+	tt_assert(data);
+	zerocopy_cleanup_called = 0;
+	evbuffer_add_reference(src, data, 65536, zerocopy_cleanup, NULL);
+	for (tries = 0; evbuffer_get_length(src) && tries < 1000; ++tries) {
+		if (evbuffer_write(src, pair[0]) < 0)
+			tt_assert(EVUTIL_ERR_RW_RETRIABLE(errno));
+		if (evbuffer_get_length(src))
+			evbuffer_read(dst, pair[1], -1);
+	}
+	tt_int_op(evbuffer_get_length(src), ==, 0);
+	tt_int_op(evbuffer_get_zerocopy_pending(src), >, 0);
+
+	/* Freeing the buffer doesn't give the memory back to its owner
+	 * while the kernel may still be reading from it. */
+	evbuffer_free(src);
+	src = NULL;
+	tt_int_op(zerocopy_cleanup_called, ==, 0);
+
+	for (tries = 0; evbuffer_get_length(dst) < 65536 && tries < 1000;
+	     ++tries) {
+		if (evbuffer_read(dst, pair[1], -1) < 0)
+			tt_assert(EVUTIL_ERR_RW_RETRIABLE(errno));
+	}
+	tt_int_op(evbuffer_get_length(dst), ==, 65536);
+	evbuffer_drain(dst, 65536);
+
+	/* A new buffer on the same socket takes over the old sends. */
+	src = evbuffer_new();
+	tt_assert(src);
+	tt_int_op(evbuffer_enable_zerocopy(src, pair[0], 0), ==, 0);
+	tt_int_op(zerocopy_wait_pending(src), ==, 0);
+	tt_int_op(zerocopy_cleanup_called, ==, 1);
+
+	/* Once the kernel is done with part of a chain, the rest of the
+	 * chain can be written to again. */
+	evbuffer_add(src, data, 40000);
+	tt_int_op(evbuffer_write_atmost(src, pair[0], 20000), ==, 20000);
+	tt_int_op(evbuffer_get_zerocopy_pending(src), ==, 20000);
+	for (tries = 0; evbuffer_get_length(dst) < 20000 && tries < 1000;
+	     ++tries) {
+		if (evbuffer_read(dst, pair[1], -1) < 0)
+			tt_assert(EVUTIL_ERR_RW_RETRIABLE(errno));
+	}
+	tt_int_op(zerocopy_wait_pending(src), ==, 0);
+	evbuffer_add(src, "x", 1);
+	tt_int_op(evbuffer_peek(src, -1, NULL, NULL, 0), ==, 1);
+
+end:
+	if (src)
+		evbuffer_free(src);
+	if (dst)
+		evbuffer_free(dst);
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+	if (data)
+		free(data);
+}
+
+static void
+test_evbuffer_chain_cache(void *ptr)
+{
+	struct evbuffer *buf = NULL;
+	struct evbuffer_iovec v;
+	char data[10000];
+	void *first;
+
+	/* TT_NEED_THREADS: without a threading library to tell us about
+	 * thread exit, nothing gets cached. */
+	memset(data, 'x', sizeof(data));
+	evbuffer_chain_cache_trim(0);
+	buf = evbuffer_new();
+	tt_assert(buf);
+
+	/* A drained chain gets handed out again for the next add. */
+	tt_int_op(evbuffer_add(buf, data, 3000), ==, 0);
+	tt_int_op(evbuffer_peek(buf, -1, NULL, &v, 1), ==, 1);
+	first = v.iov_base;
+	tt_int_op(evbuffer_drain(buf, 3000), ==, 0);
+	tt_int_op(evbuffer_add(buf, data, 3000), ==, 0);
+	tt_int_op(evbuffer_peek(buf, -1, NULL, &v, 1), ==, 1);
+	tt_ptr_op(v.iov_base, ==, first);
+	tt_int_op(evbuffer_drain(buf, 3000), ==, 0);
+	tt_int_op(evbuffer_chain_cache_trim(0), >, 0);
+	tt_int_op(evbuffer_chain_cache_trim(0), ==, 0);
+
+	/* Chains above the size limit are freed right away. */
+	tt_int_op(evbuffer_set_chain_cache_limits(4096, 65536), ==, 0);
+	tt_int_op(evbuffer_add(buf, data, 10000), ==, 0);
+	tt_int_op(evbuffer_drain(buf, 10000), ==, 0);
+	tt_int_op(evbuffer_chain_cache_trim(0), ==, 0);
+
+	/* So is everything, once the cache is turned off. */
+	tt_int_op(evbuffer_set_chain_cache_limits(0, 0), ==, 0);
+	tt_int_op(evbuffer_add(buf, data, 3000), ==, 0);
+	tt_int_op(evbuffer_drain(buf, 3000), ==, 0);
+	tt_int_op(evbuffer_chain_cache_trim(0), ==, 0);
+
+	tt_int_op(evbuffer_set_chain_cache_limits((size_t)1 << 30, 0), ==, -1);
+
+end:
+	evbuffer_set_chain_cache_limits(65536, 262144);
+	if (buf)
+		evbuffer_free(buf);
+}
+
 static void *
 setup_passthrough(const struct testcase_t *testcase)
 {
@@ -2806,6 +3581,10 @@ struct testcase_t evbuffer_testcases[] = {
 	{ "remove_buffer_with_empty_front", test_evbuffer_remove_buffer_with_empty_front, 0, NULL, NULL },
 	{ "remove_buffer_adjust_last_with_datap_with_empty",
 	  test_evbuffer_remove_buffer_adjust_last_with_datap_with_empty, 0, NULL, NULL },
+	{ "remove_buffer_shared", test_evbuffer_remove_buffer_shared,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "ring", test_evbuffer_ring, 0, NULL, NULL },
+	{ "add_int", test_evbuffer_add_int, 0, NULL, NULL },
 	{ "add_buffer_with_empty", test_evbuffer_add_buffer_with_empty, 0, NULL, NULL },
 	{ "add_buffer_with_empty2", test_evbuffer_add_buffer_with_empty2, 0, NULL, NULL },
 	{ "reserve2", test_evbuffer_reserve2, 0, NULL, NULL },
@@ -2841,6 +3620,15 @@ struct testcase_t evbuffer_testcases[] = {
 	{ "copyout", test_evbuffer_copyout, 0, NULL, NULL},
 	{ "file_segment_add_cleanup_cb", test_evbuffer_file_segment_add_cleanup_cb, 0, NULL, NULL },
 	{ "pullup_with_empty", test_evbuffer_pullup_with_empty, 0, NULL, NULL },
+	{ "search_simd_scalar", test_evbuffer_search_simd, TT_FORK, &nil_setup, (void*)"scalar" },
+	{ "search_simd_sse2", test_evbuffer_search_simd, TT_FORK, &nil_setup, (void*)"sse2" },
+	{ "search_simd_avx2", test_evbuffer_search_simd, TT_FORK, &nil_setup, (void*)"avx2" },
+	{ "read_adaptive", test_evbuffer_read_adaptive, TT_FORK|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "zerocopy", test_evbuffer_zerocopy, TT_FORK, NULL, NULL },
+	{ "zerocopy_lifetime", test_evbuffer_zerocopy_lifetime, TT_FORK,
+	  NULL, NULL },
+	{ "chain_cache", test_evbuffer_chain_cache, TT_FORK|TT_NEED_THREADS,
+	  &basic_setup, NULL },
 
 #define ADDFILE_TEST(name, parameters)					\
 	{ name, test_evbuffer_add_file, TT_FORK|TT_NEED_BASE,		\
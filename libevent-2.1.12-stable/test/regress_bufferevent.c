@@ -1354,6 +1354,547 @@ end:
 		bufferevent_free(filter);
 }
 
+#define RELAY_TEST_BYTES (2*1024*1024)
+
+struct relay_test {
+	struct event_base *base;
+	struct event *writer, *reader, *back;
+	size_t sent, received;
+	char reply[16];
+	size_t reply_len;
+	int bad_data, n_eof, n_error;
+};
+
+static void
+relay_test_writecb(evutil_socket_t fd, short what, void *arg)
+{
+	struct relay_test *t = arg;
+	char buf[8192];
+	size_t i, n = RELAY_TEST_BYTES - t->sent;
+	ev_ssize_t r;
+
+	if (n > sizeof(buf))
+		n = sizeof(buf);
+	for (i = 0; i < n; ++i)
+		buf[i] = (char)((t->sent + i) % 251);
+	r = send(fd, buf, n, 0);
+	if (r > 0)
+		t->sent += r;
+	if (t->sent == RELAY_TEST_BYTES) {
+		shutdown(fd, SHUT_WR);
+		event_del(t->writer);
+	}
+}
+
+static void
+relay_test_readcb(evutil_socket_t fd, short what, void *arg)
+{
+	struct relay_test *t = arg;
+	char buf[8192];
+	ev_ssize_t i, r;
+
+	r = recv(fd, buf, sizeof(buf), 0);
+	if (r < 0)
+		return;
+	if (r == 0) {
+		/* Everything came through; answer on the other direction. */
+		event_del(t->reader);
+		send(fd, "reply", 5, 0);
+		shutdown(fd, SHUT_WR);
+		return;
+	}
+	for (i = 0; i < r; ++i, ++t->received) {
+		char want = t->received < 5 ? "early"[t->received] :
+		    (char)((t->received - 5) % 251);
+		if (buf[i] != want)
+			t->bad_data = 1;
+	}
+}
+
+static void
+relay_test_backcb(evutil_socket_t fd, short what, void *arg)
+{
+	struct relay_test *t = arg;
+	ev_ssize_t r;
+
+	r = recv(fd, t->reply + t->reply_len,
+	    sizeof(t->reply) - t->reply_len, 0);
+	if (r > 0) {
+		t->reply_len += r;
+	} else if (r == 0) {
+		event_del(t->back);
+		event_base_loopexit(t->base, NULL);
+	}
+}
+
+static void
+relay_test_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct relay_test *t = arg;
+
+	if (what & BEV_EVENT_EOF)
+		++t->n_eof;
+	if (what & BEV_EVENT_ERROR)
+		++t->n_error;
+}
+
+static void
+test_bufferevent_socket_relay(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct relay_test t;
+	evutil_socket_t a[2] = { -1, -1 }, b[2] = { -1, -1 };
+	struct bufferevent *bev_a = NULL, *bev_b = NULL;
+	struct timeval tv = { 10, 0 };
+
+	memset(&t, 0, sizeof(t));
+	t.base = data->base;
+
+	/* a[0] -> bev_a ==relay==> bev_b -> b[1], and back again. */
+	tt_assert(evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, a) == 0);
+	tt_assert(evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, b) == 0);
+	evutil_make_socket_nonblocking(a[0]);
+	evutil_make_socket_nonblocking(b[1]);
+	bev_a = bufferevent_socket_new(data->base, a[1], BEV_OPT_CLOSE_ON_FREE);
+	bev_b = bufferevent_socket_new(data->base, b[0], BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev_a && bev_b);
+	a[1] = b[0] = -1;
+	bufferevent_setcb(bev_a, NULL, NULL, relay_test_eventcb, &t);
+	bufferevent_setcb(bev_b, NULL, NULL, relay_test_eventcb, &t);
+
+	/* Bytes that were read before the relay started go out first. */
+	tt_int_op(send(a[0], "early", 5, 0), ==, 5);
+	bufferevent_enable(bev_a, EV_READ);
+	while (evbuffer_get_length(bufferevent_get_input(bev_a)) < 5)
+		event_base_loop(data->base, EVLOOP_ONCE);
+
+	tt_int_op(bufferevent_socket_relay(bev_a, bev_a), ==, -1);
+	if (bufferevent_socket_relay(bev_a, bev_b) < 0)
+		tt_skip();
+	tt_int_op(bufferevent_socket_relay(bev_b, bev_a), ==, 0);
+	tt_int_op(bufferevent_socket_relay(bev_a, bev_b), ==, -1);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(bev_a)), ==, 0);
+
+	/* Keep the pipe small, so that the source has to wait for the
+	 * destination. */
+	bufferevent_setwatermark(bev_a, EV_READ, 0, 16384);
+	bufferevent_enable(bev_a, EV_READ|EV_WRITE);
+	bufferevent_enable(bev_b, EV_READ|EV_WRITE);
+
+	t.writer = event_new(data->base, a[0], EV_WRITE|EV_PERSIST,
+	    relay_test_writecb, &t);
+	t.back = event_new(data->base, a[0], EV_READ|EV_PERSIST,
+	    relay_test_backcb, &t);
+	t.reader = event_new(data->base, b[1], EV_READ|EV_PERSIST,
+	    relay_test_readcb, &t);
+	event_add(t.writer, NULL);
+	event_add(t.back, NULL);
+	event_add(t.reader, NULL);
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+
+	tt_int_op(t.sent, ==, RELAY_TEST_BYTES);
+	tt_int_op(t.received, ==, RELAY_TEST_BYTES + 5);
+	tt_assert(!t.bad_data);
+	tt_int_op(t.reply_len, ==, 5);
+	tt_assert(!memcmp(t.reply, "reply", 5));
+	/* Each side saw its EOF, after the relay had passed it on. */
+	tt_int_op(t.n_eof, ==, 2);
+	tt_int_op(t.n_error, ==, 0);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(bev_a)), ==, 0);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(bev_b)), ==, 0);
+
+end:
+	if (t.writer)
+		event_free(t.writer);
+	if (t.reader)
+		event_free(t.reader);
+	if (t.back)
+		event_free(t.back);
+	if (bev_a)
+		bufferevent_free(bev_a);
+	if (bev_b)
+		bufferevent_free(bev_b);
+	if (a[0] >= 0)
+		evutil_closesocket(a[0]);
+	if (a[1] >= 0)
+		evutil_closesocket(a[1]);
+	if (b[0] >= 0)
+		evutil_closesocket(b[0]);
+	if (b[1] >= 0)
+		evutil_closesocket(b[1]);
+}
+
+/* Nothing is lost when the source goes first; the source hears about it
+ * when the destination goes first. */
+static void
+test_bufferevent_socket_relay_free(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct relay_test t;
+	evutil_socket_t a[2] = { -1, -1 }, b[2] = { -1, -1 }, c[2] = { -1, -1 };
+	struct bufferevent *bev_a = NULL, *bev_b = NULL, *bev_c = NULL;
+	char buf[2048];
+	size_t got = 0;
+	ev_ssize_t r;
+	int i;
+
+	memset(&t, 0, sizeof(t));
+	memset(buf, 'x', sizeof(buf));
+	tt_assert(evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, a) == 0);
+	tt_assert(evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, b) == 0);
+	tt_assert(evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, c) == 0);
+	evutil_make_socket_nonblocking(b[1]);
+	bev_a = bufferevent_socket_new(data->base, a[1], BEV_OPT_CLOSE_ON_FREE);
+	/* Each with a lock of its own. */
+	bev_b = bufferevent_socket_new(data->base, b[0],
+	    BEV_OPT_CLOSE_ON_FREE|BEV_OPT_THREADSAFE);
+	bev_c = bufferevent_socket_new(data->base, c[1],
+	    BEV_OPT_CLOSE_ON_FREE|BEV_OPT_THREADSAFE);
+	tt_assert(bev_a && bev_b && bev_c);
+	a[1] = b[0] = c[1] = -1;
+	bufferevent_setcb(bev_c, NULL, NULL, relay_test_eventcb, &t);
+
+	if (bufferevent_socket_relay(bev_a, bev_b) < 0)
+		tt_skip();
+	/* With bev_b not writing, what bev_a reads stays in the pipe. */
+	bufferevent_disable(bev_b, EV_WRITE);
+	bufferevent_enable(bev_a, EV_READ);
+	tt_int_op(send(a[0], buf, sizeof(buf), 0), ==, sizeof(buf));
+	for (i = 0; i < 10; ++i)
+		event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(bev_a)), ==, 0);
+	tt_int_op(recv(b[1], buf, sizeof(buf), 0), ==, -1);
+
+	/* bev_b still sends it once bev_a is gone... */
+	bufferevent_free(bev_a);
+	bev_a = NULL;
+	bufferevent_enable(bev_b, EV_WRITE);
+	for (i = 0; i < 10 && got < sizeof(buf); ++i) {
+		event_base_loop(data->base, EVLOOP_NONBLOCK);
+		while ((r = recv(b[1], buf, sizeof(buf), 0)) > 0)
+			got += r;
+	}
+	tt_int_op(got, ==, sizeof(buf));
+
+	/* ...and then lets go of the relay. */
+	tt_int_op(bufferevent_socket_relay(bev_c, bev_b), ==, 0);
+	bufferevent_disable(bev_b, EV_WRITE);
+	bufferevent_enable(bev_c, EV_READ);
+	tt_int_op(send(c[0], buf, sizeof(buf), 0), ==, sizeof(buf));
+	for (i = 0; i < 10; ++i)
+		event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_error, ==, 0);
+
+	/* Freeing bev_b loses what was in the pipe, and bev_c says so. */
+	bufferevent_free(bev_b);
+	bev_b = NULL;
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_error, ==, 1);
+	tt_int_op(t.n_eof, ==, 0);
+
+end:
+	if (bev_a)
+		bufferevent_free(bev_a);
+	if (bev_b)
+		bufferevent_free(bev_b);
+	if (bev_c)
+		bufferevent_free(bev_c);
+	if (a[0] >= 0)
+		evutil_closesocket(a[0]);
+	if (b[1] >= 0)
+		evutil_closesocket(b[1]);
+	if (c[0] >= 0)
+		evutil_closesocket(c[0]);
+}
+
+static void
+coalesce_writecb(struct bufferevent *bev, void *arg)
+{
+	++*(int *)arg;
+}
+
+static void
+test_bufferevent_coalesce_writes(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *bev = NULL;
+	char buf[4096], *big = NULL;
+	size_t big_len = 4 << 20, got = 0;
+	int n_writecb = 0, i;
+	ev_ssize_t r;
+
+	bev = bufferevent_socket_new(data->base, data->pair[0],
+	    BEV_OPT_COALESCE_WRITES);
+	tt_assert(bev);
+	bufferevent_setcb(bev, NULL, coalesce_writecb, NULL, &n_writecb);
+	bufferevent_enable(bev, EV_WRITE);
+	evutil_make_socket_nonblocking(data->pair[1]);
+
+	/* Several writes in a row go out together, once the loop gets to
+	 * them, without waiting for EV_WRITE. */
+	bufferevent_write(bev, "HTTP/1.1 200 OK\r\n", 17);
+	bufferevent_write(bev, "Content-Length: 5\r\n\r\n", 21);
+	bufferevent_write(bev, "hello", 5);
+	tt_assert(!event_pending(&bev->ev_write, EV_WRITE, NULL));
+	tt_int_op(recv(data->pair[1], buf, sizeof(buf), 0), ==, -1);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 0);
+	tt_int_op(n_writecb, ==, 1);
+	tt_assert(!event_pending(&bev->ev_write, EV_WRITE, NULL));
+	tt_int_op(recv(data->pair[1], buf, sizeof(buf), 0), ==, 43);
+	tt_assert(!memcmp(buf, "HTTP/1.1 200 OK\r\n", 17));
+	tt_assert(!memcmp(buf + 38, "hello", 5));
+
+	/* Nothing is written while writing is disabled. */
+	bufferevent_disable(bev, EV_WRITE);
+	bufferevent_write(bev, "x", 1);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 1);
+	bufferevent_enable(bev, EV_WRITE);
+	event_base_loop(data->base, EVLOOP_ONCE);
+	tt_int_op(recv(data->pair[1], buf, sizeof(buf), 0), ==, 1);
+
+	/* More than the socket will take falls back to waiting for it. */
+	big = malloc(big_len);
+	tt_assert(big);
+	for (i = 0; i < (int)big_len; ++i)
+		big[i] = (char)i;
+	bufferevent_write(bev, big, big_len);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_assert(evbuffer_get_length(bufferevent_get_output(bev)) > 0);
+	tt_assert(event_pending(&bev->ev_write, EV_WRITE, NULL));
+	while (got < big_len) {
+		r = recv(data->pair[1], big, big_len - got, 0);
+		if (r > 0)
+			got += r;
+		event_base_loop(data->base, EVLOOP_NONBLOCK);
+	}
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 0);
+	tt_assert(!event_pending(&bev->ev_write, EV_WRITE, NULL));
+
+	/* The coalesced flush runs at the bufferevent's priority, even if
+	 * it is already waiting to run. */
+	tt_int_op(event_base_priority_init(data->base, 4), ==, 0);
+	bufferevent_write(bev, "y", 1);
+	tt_int_op(bufferevent_priority_set(bev, 3), ==, 0);
+	tt_int_op(BEV_UPCAST(bev)->deferred_flush.evcb_pri, ==, 3);
+	tt_int_op(bufferevent_base_set(data->base, bev), ==, -1);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(recv(data->pair[1], buf, sizeof(buf), 0), ==, 1);
+	tt_int_op(bufferevent_base_set(data->base, bev), ==, 0);
+	tt_int_op(BEV_UPCAST(bev)->deferred_flush.evcb_pri, ==, 2);
+
+end:
+	if (bev)
+		bufferevent_free(bev);
+	if (big)
+		free(big);
+}
+
+static void
+test_bufferevent_sticky_events(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *bev = NULL;
+	struct evbuffer *input;
+	char buf[64], *big = NULL;
+	size_t big_len = 4 << 20, got = 0;
+	int i;
+	ev_ssize_t r;
+
+	if (!(event_base_get_features(data->base) & EV_FEATURE_ET))
+		tt_skip();
+
+	bev = bufferevent_socket_new(data->base, data->pair[0],
+	    BEV_OPT_STICKY_EVENTS);
+	tt_assert(bev);
+	input = bufferevent_get_input(bev);
+	bufferevent_enable(bev, EV_READ|EV_WRITE);
+	evutil_make_socket_nonblocking(data->pair[1]);
+	tt_assert(event_pending(&bev->ev_read, EV_READ, NULL));
+	tt_assert(event_pending(&bev->ev_write, EV_WRITE, NULL));
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+
+	/* Disabling leaves the events added; data that arrives meanwhile
+	 * is read once we enable reading again. */
+	bufferevent_disable(bev, EV_READ);
+	tt_assert(event_pending(&bev->ev_read, EV_READ, NULL));
+	tt_int_op(send(data->pair[1], "hello", 5, 0), ==, 5);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(input), ==, 0);
+	bufferevent_enable(bev, EV_READ);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(input), ==, 5);
+	evbuffer_drain(input, 5);
+
+	/* The same goes for reading suspended by the high watermark: the
+	 * socket does not become readable again, but we resume anyway. */
+	bufferevent_setwatermark(bev, EV_READ, 0, 10);
+	memset(buf, 'x', 30);
+	tt_int_op(send(data->pair[1], buf, 30, 0), ==, 30);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(input), ==, 10);
+	for (i = 0; i < 2; ++i) {
+		evbuffer_drain(input, 10);
+		event_base_loop(data->base, EVLOOP_NONBLOCK);
+		tt_int_op(evbuffer_get_length(input), ==, 10);
+	}
+	evbuffer_drain(input, 10);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(input), ==, 0);
+	bufferevent_setwatermark(bev, EV_READ, 0, 0);
+
+	/* Writes that fill the socket wait for it to drain. */
+	big = malloc(big_len);
+	tt_assert(big);
+	for (i = 0; i < (int)big_len; ++i)
+		big[i] = (char)i;
+	bufferevent_write(bev, big, big_len);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_assert(evbuffer_get_length(bufferevent_get_output(bev)) > 0);
+	while (got < big_len) {
+		r = recv(data->pair[1], big, big_len - got, 0);
+		if (r > 0)
+			got += r;
+		event_base_loop(data->base, EVLOOP_NONBLOCK);
+	}
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev)), ==, 0);
+
+	/* With nothing to do, the events are still there. */
+	bufferevent_disable(bev, EV_READ|EV_WRITE);
+	tt_assert(event_pending(&bev->ev_read, EV_READ, NULL));
+	tt_assert(event_pending(&bev->ev_write, EV_WRITE, NULL));
+	tt_assert(!event_pending(&bev->ev_write, EV_TIMEOUT, NULL));
+
+	/* A write made while writing is disabled goes out on enable, without
+	 * waiting for the socket to become writable again. */
+	bufferevent_write(bev, "abc", 3);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(recv(data->pair[1], buf, sizeof(buf), 0), ==, -1);
+	bufferevent_enable(bev, EV_WRITE);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(recv(data->pair[1], buf, sizeof(buf), 0), ==, 3);
+	tt_assert(!memcmp(buf, "abc", 3));
+
+end:
+	if (bev)
+		bufferevent_free(bev);
+	if (big)
+		free(big);
+}
+
+struct mem_domain_test {
+	int n_calls;
+	int over;
+	size_t held;
+};
+
+static void
+mem_domain_test_cb(struct evbuffer_mem_domain *domain, int over,
+    size_t held, void *arg)
+{
+	struct mem_domain_test *t = arg;
+	++t->n_calls;
+	t->over = over;
+	t->held = held;
+}
+
+static void
+test_bufferevent_mem_domain(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct mem_domain_test t;
+	struct evbuffer_mem_domain *domain = NULL;
+	struct bufferevent *bev1 = NULL, *bev2 = NULL;
+	struct evbuffer *queue = NULL;
+	char buf[1024];
+	int i;
+
+	memset(&t, 0, sizeof(t));
+	memset(buf, 'x', sizeof(buf));
+
+	tt_assert(!evbuffer_mem_domain_new(data->base, 1000, 2000));
+	domain = evbuffer_mem_domain_new(data->base, 1000, 500);
+	tt_assert(domain);
+	evbuffer_mem_domain_setcb(domain, mem_domain_test_cb, &t);
+
+	bev1 = bufferevent_socket_new(data->base, data->pair[0], 0);
+	queue = evbuffer_new();
+	tt_assert(bev1 && queue);
+	bufferevent_enable(bev1, EV_READ);
+
+	/* Bytes that are already in a buffer count when it joins. */
+	evbuffer_add(queue, buf, 600);
+	evbuffer_set_mem_domain(queue, domain);
+	tt_int_op(bufferevent_set_mem_domain(bev1, domain), ==, 0);
+	evbuffer_add(bufferevent_get_output(bev1), buf, 100);
+	tt_int_op(evbuffer_mem_domain_get_held(domain), ==, 700);
+
+	/* Going over the high-water mark stops reading. */
+	evbuffer_add(queue, buf, 301);
+	tt_int_op(evbuffer_mem_domain_get_held(domain), ==, 1001);
+	tt_assert(BEV_UPCAST(bev1)->read_suspended & BEV_SUSPEND_BUDGET);
+	tt_int_op(t.n_calls, ==, 0);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(t.n_calls, ==, 1);
+	tt_int_op(t.over, ==, 1);
+	tt_int_op(t.held, ==, 1001);
+
+	/* A bufferevent that joins while we are over budget doesn't read
+	 * either. */
+	bev2 = bufferevent_socket_new(data->base, data->pair[1], 0);
+	tt_assert(bev2);
+	bufferevent_enable(bev2, EV_READ);
+	tt_int_op(bufferevent_set_mem_domain(bev2, domain), ==, 0);
+	tt_assert(BEV_UPCAST(bev2)->read_suspended & BEV_SUSPEND_BUDGET);
+
+	/* The output drains, but bev2 leaves what arrives in the socket. */
+	for (i = 0; i < 10 && evbuffer_get_length(bufferevent_get_output(bev1));
+	     ++i)
+		event_base_loop(data->base, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_output(bev1)), ==, 0);
+	tt_int_op(evbuffer_mem_domain_get_held(domain), ==, 901);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(bev2)), ==, 0);
+
+	/* Staying between the watermarks changes nothing... */
+	evbuffer_drain(queue, 300);
+	tt_assert(BEV_UPCAST(bev1)->read_suspended & BEV_SUSPEND_BUDGET);
+	/* ... but dropping to the low-water mark starts reading again. */
+	evbuffer_drain(queue, 101);
+	tt_int_op(evbuffer_mem_domain_get_held(domain), ==, 500);
+	tt_assert(!(BEV_UPCAST(bev1)->read_suspended & BEV_SUSPEND_BUDGET));
+	tt_assert(!(BEV_UPCAST(bev2)->read_suspended & BEV_SUSPEND_BUDGET));
+	for (i = 0; i < 10 && !evbuffer_get_length(bufferevent_get_input(bev2));
+	     ++i)
+		event_base_loop(data->base, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(bev2)), ==, 100);
+	tt_int_op(evbuffer_mem_domain_get_held(domain), ==, 600);
+	tt_int_op(t.n_calls, ==, 2);
+	tt_int_op(t.over, ==, 0);
+
+	/* Leaving the domain takes a bufferevent's bytes with it. */
+	tt_int_op(bufferevent_set_mem_domain(bev2, NULL), ==, 0);
+	tt_int_op(evbuffer_mem_domain_get_held(domain), ==, 500);
+	evbuffer_free(queue);
+	queue = NULL;
+	tt_int_op(evbuffer_mem_domain_get_held(domain), ==, 0);
+	bufferevent_free(bev1);
+	bev1 = NULL;
+	evbuffer_mem_domain_free(domain);
+	domain = NULL;
+
+end:
+	if (bev1)
+		bufferevent_free(bev1);
+	if (bev2)
+		bufferevent_free(bev2);
+	if (queue)
+		evbuffer_free(queue);
+	if (domain)
+		evbuffer_mem_domain_free(domain);
+}
+
 struct testcase_t bufferevent_testcases[] = {
 
 	LEGACY(bufferevent, TT_ISOLATED),
@@ -1412,6 +1953,20 @@ struct testcase_t bufferevent_testcases[] = {
 #else
 	{ "bufferevent_zlib", NULL, TT_SKIP, NULL, NULL },
 #endif
+#ifdef EVENT__HAVE_COMPRESS
+	{ "bufferevent_compress", test_bufferevent_compress,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"zlib write" },
+	{ "bufferevent_compress_gzip", test_bufferevent_compress,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"gzip write" },
+	{ "bufferevent_compress_bytes", test_bufferevent_compress,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"zlib bytes" },
+	{ "bufferevent_compress_loop", test_bufferevent_compress,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"zlib loop" },
+	{ "bufferevent_compress_zstd", test_bufferevent_compress,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"zstd write" },
+#else
+	{ "bufferevent_compress", NULL, TT_SKIP, NULL, NULL },
+#endif
 
 	{ "bufferevent_connect_fail_eventcb_defer",
 	  test_bufferevent_connect_fail_eventcb,
@@ -1429,6 +1984,21 @@ struct testcase_t bufferevent_testcases[] = {
 	{ "bufferevent_filter_data_stuck",
 	  test_bufferevent_filter_data_stuck,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_socket_relay",
+	  test_bufferevent_socket_relay,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_socket_relay_free",
+	  test_bufferevent_socket_relay_free,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_coalesce_writes",
+	  test_bufferevent_coalesce_writes,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_sticky_events",
+	  test_bufferevent_sticky_events,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
+	{ "bufferevent_mem_domain",
+	  test_bufferevent_mem_domain,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &basic_setup, NULL },
 
 	END_OF_TESTCASES,
 };
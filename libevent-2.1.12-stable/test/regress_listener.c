@@ -269,6 +269,125 @@ end:
 		evconnlistener_free(listener);
 }
 
+#if defined(__linux__) && defined(SO_REUSEPORT)
+#define GROUP_N_CONNS 16
+
+static int group_accepted[2];
+static struct event_base *group_bases[2];
+
+static void
+acceptcb_group(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *addr, int socklen, void *arg)
+{
+	int *total = arg;
+	struct event_base *base = evconnlistener_get_base(listener);
+
+	++*total;
+	if (base == group_bases[0])
+		++group_accepted[0];
+	else if (base == group_bases[1])
+		++group_accepted[1];
+	evutil_closesocket(fd);
+}
+
+static void
+regress_listener_group(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct evconnlistener_group *group = NULL;
+	struct sockaddr_in sin;
+	struct sockaddr_storage ss0, ss1;
+	ev_socklen_t slen0 = sizeof(ss0), slen1 = sizeof(ss1);
+	evutil_socket_t fds[GROUP_N_CONNS];
+	unsigned int flags = LEV_OPT_CLOSE_ON_EXEC;
+	int total = 0, i;
+
+	for (i = 0; i < GROUP_N_CONNS; ++i)
+		fds[i] = EVUTIL_INVALID_SOCKET;
+	group_bases[0] = data->base;
+	group_bases[1] = event_base_new();
+	tt_assert(group_bases[1]);
+
+	if (data->setup_data && strstr((char*)data->setup_data, "cpu"))
+		flags |= LEV_OPT_REUSEPORT_STEER_BY_CPU;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001); /* 127.0.0.1 */
+	sin.sin_port = 0; /* "You pick!" */
+
+	group = evconnlistener_group_new_bind(group_bases, 2, acceptcb_group,
+	    &total, flags, -1, (struct sockaddr *)&sin, sizeof(sin));
+	if (!group && (flags & LEV_OPT_REUSEPORT_STEER_BY_CPU))
+		tt_skip();
+	tt_assert(group);
+	tt_int_op(evconnlistener_group_get_size(group), ==, 2);
+	tt_ptr_op(evconnlistener_group_get_listener(group, 2), ==, NULL);
+	tt_ptr_op(evconnlistener_get_base(
+		    evconnlistener_group_get_listener(group, 0)), ==,
+	    group_bases[0]);
+	tt_ptr_op(evconnlistener_get_base(
+		    evconnlistener_group_get_listener(group, 1)), ==,
+	    group_bases[1]);
+
+	/* Both sockets are on the port the kernel picked for the first. */
+	tt_assert(getsockname(evconnlistener_get_fd(
+		    evconnlistener_group_get_listener(group, 0)),
+		(struct sockaddr*)&ss0, &slen0) == 0);
+	tt_assert(getsockname(evconnlistener_get_fd(
+		    evconnlistener_group_get_listener(group, 1)),
+		(struct sockaddr*)&ss1, &slen1) == 0);
+	tt_int_op(((struct sockaddr_in*)&ss0)->sin_port, !=, 0);
+	tt_int_op(((struct sockaddr_in*)&ss0)->sin_port, ==,
+	    ((struct sockaddr_in*)&ss1)->sin_port);
+
+	for (i = 0; i < GROUP_N_CONNS; ++i)
+		evutil_socket_connect_(&fds[i], (struct sockaddr*)&ss0, slen0);
+
+	for (i = 0; i < 1000 && total < GROUP_N_CONNS; ++i) {
+		struct timeval tv = { 0, 1000 };
+		event_base_loop(group_bases[0], EVLOOP_NONBLOCK);
+		event_base_loop(group_bases[1], EVLOOP_NONBLOCK);
+		evutil_usleep_(&tv);
+	}
+	tt_int_op(total, ==, GROUP_N_CONNS);
+	tt_int_op(group_accepted[0] + group_accepted[1], ==, GROUP_N_CONNS);
+
+	/* A disabled group accepts nothing, however long we wait... */
+	tt_int_op(evconnlistener_group_disable(group), ==, 0);
+	evutil_closesocket(fds[0]);
+	fds[0] = EVUTIL_INVALID_SOCKET;
+	evutil_socket_connect_(&fds[0], (struct sockaddr*)&ss0, slen0);
+	for (i = 0; i < 100; ++i) {
+		struct timeval tv = { 0, 1000 };
+		event_base_loop(group_bases[0], EVLOOP_NONBLOCK);
+		event_base_loop(group_bases[1], EVLOOP_NONBLOCK);
+		evutil_usleep_(&tv);
+	}
+	tt_int_op(total, ==, GROUP_N_CONNS);
+
+	/* ...and takes the waiting connection once enabled again. */
+	tt_int_op(evconnlistener_group_enable(group), ==, 0);
+	for (i = 0; i < 1000 && total < GROUP_N_CONNS + 1; ++i) {
+		struct timeval tv = { 0, 1000 };
+		event_base_loop(group_bases[0], EVLOOP_NONBLOCK);
+		event_base_loop(group_bases[1], EVLOOP_NONBLOCK);
+		evutil_usleep_(&tv);
+	}
+	tt_int_op(total, ==, GROUP_N_CONNS + 1);
+
+end:
+	for (i = 0; i < GROUP_N_CONNS; ++i) {
+		if (fds[i] != EVUTIL_INVALID_SOCKET)
+			evutil_closesocket(fds[i]);
+	}
+	if (group)
+		evconnlistener_group_free(group);
+	if (group_bases[1])
+		event_base_free(group_bases[1]);
+}
+#endif
+
 #ifdef EVENT__HAVE_SETRLIMIT
 static void
 regress_listener_error_unlock(void *arg)
@@ -332,6 +451,14 @@ struct testcase_t listener_testcases[] = {
 	{ "immediate_close", regress_listener_immediate_close,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL, },
 
+#if defined(__linux__) && defined(SO_REUSEPORT)
+	{ "group", regress_listener_group,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL, },
+
+	{ "group_steer_by_cpu", regress_listener_group,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (char*)"cpu", },
+#endif
+
 	END_OF_TESTCASES,
 };
 
@@ -425,6 +425,7 @@ struct testcase_t thread_testcases[] = {
 struct testgroup_t testgroups[] = {
 	{ "main/", main_testcases },
 	{ "heap/", minheap_testcases },
+	{ "timerwheel/", timerwheel_testcases },
 	{ "et/", edgetriggered_testcases },
 	{ "finalize/", finalize_testcases },
 	{ "evbuffer/", evbuffer_testcases },
@@ -988,6 +988,275 @@ end:
 		event_base_loop(base, EVLOOP_ONCE);
 }
 
+struct ktls_context
+{
+	struct bufferevent *server;
+	struct evbuffer *got;
+	size_t want;
+	/* The file the server sends, and its length. */
+	int fd;
+	size_t file_len;
+	/* What bufferevent_openssl_set_ktls() said before and after the
+	 * handshake. */
+	int set_ktls;
+	int set_ktls_open;
+	short ktls;
+};
+static void
+ktls_readcb(struct bufferevent *bev, void *arg)
+{
+	struct ktls_context *ctx = arg;
+
+	bufferevent_read_buffer(bev, ctx->got);
+	if (evbuffer_get_length(ctx->got) >= ctx->want)
+		event_base_loopexit(bufferevent_get_base(bev), NULL);
+}
+static void
+ktls_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct ktls_context *ctx = arg;
+
+	TT_BLATHER(("ktls_eventcb(%p): %i", bev, what));
+	if (what & BEV_EVENT_CONNECTED) {
+		struct evbuffer *out;
+
+		if (bev != ctx->server)
+			return;
+		/* Too late to ask now. */
+		ctx->set_ktls_open = bufferevent_openssl_set_ktls(bev, 1);
+		ctx->ktls = bufferevent_openssl_get_ktls(bev);
+		out = bufferevent_get_output(bev);
+		evbuffer_add(out, "head", 4);
+		evbuffer_add_file(out, ctx->fd, 0, ctx->file_len);
+		ctx->fd = -1;
+		evbuffer_add(out, "tail", 4);
+	} else {
+		event_base_loopexit(bufferevent_get_base(bev), NULL);
+	}
+}
+static void
+ktls_acceptcb(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *addr, int socklen, void *arg)
+{
+	struct ktls_context *ctx = arg;
+	struct event_base *base = evconnlistener_get_base(listener);
+	SSL *ssl = SSL_new(get_ssl_ctx());
+
+	SSL_use_certificate(ssl, the_cert);
+	SSL_use_PrivateKey(ssl, the_key);
+
+	ctx->server = bufferevent_openssl_socket_new(
+		base, fd, ssl, BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+	ctx->set_ktls = bufferevent_openssl_set_ktls(ctx->server, 1);
+	bufferevent_setcb(ctx->server, NULL, NULL, ktls_eventcb, ctx);
+	bufferevent_enable(ctx->server, EV_READ|EV_WRITE);
+
+	evconnlistener_disable(listener);
+}
+/* Ask for kTLS on both ends and send a file and some data over it.  This
+ * has to work whether or not the kernel takes over. */
+static void
+regress_bufferevent_openssl_ktls(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evconnlistener *listener = NULL;
+	struct bufferevent *bev = NULL;
+	struct sockaddr_in sin;
+	struct sockaddr_storage ss;
+	ev_socklen_t slen = sizeof(ss);
+	struct ktls_context ctx;
+	struct timeval tv = { 10, 0 };
+	char *file_data = NULL, *tmpfilename = NULL;
+	const size_t file_len = 300000;
+	unsigned char *got;
+	size_t i;
+	int r;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fd = -1;
+	tt_assert(ctx.got = evbuffer_new());
+	tt_assert(file_data = malloc(file_len));
+	for (i = 0; i < file_len; ++i)
+		file_data[i] = (char)(i * 7 + (i >> 11));
+	ctx.fd = regress_make_tmpfile(file_data, file_len, &tmpfilename);
+	tt_int_op(ctx.fd, >=, 0);
+	ctx.file_len = file_len;
+	ctx.want = file_len + 8;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+	listener = evconnlistener_new_bind(base, ktls_acceptcb, &ctx,
+	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE,
+	    -1, (struct sockaddr *)&sin, sizeof(sin));
+	tt_assert(listener);
+	tt_assert(getsockname(evconnlistener_get_fd(listener),
+		(struct sockaddr*)&ss, &slen) == 0);
+
+	bev = bufferevent_openssl_socket_new(base, -1, SSL_new(get_ssl_ctx()),
+	    BUFFEREVENT_SSL_CONNECTING, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev);
+	r = bufferevent_openssl_set_ktls(bev, 1);
+	tt_int_op(bufferevent_openssl_get_ktls(bev), ==, 0);
+	bufferevent_setcb(bev, ktls_readcb, NULL, ktls_eventcb, &ctx);
+	tt_assert(!bufferevent_socket_connect(bev, (struct sockaddr*)&ss, slen));
+	tt_assert(!bufferevent_enable(bev, EV_READ|EV_WRITE));
+
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+
+	TT_BLATHER(("kTLS: client %d, server %d",
+		(int)bufferevent_openssl_get_ktls(bev), (int)ctx.ktls));
+	/* Whether we can ask depends on the OpenSSL we were built with;
+	 * whether we get it depends on the kernel. */
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	tt_int_op(r, ==, 0);
+	tt_int_op(ctx.set_ktls, ==, 0);
+#else
+	tt_int_op(r, ==, -1);
+	tt_int_op(ctx.set_ktls, ==, -1);
+	tt_int_op(ctx.ktls, ==, 0);
+#endif
+	tt_int_op(ctx.set_ktls_open, ==, -1);
+	tt_int_op(ctx.ktls & ~(EV_READ|EV_WRITE), ==, 0);
+
+	tt_int_op(evbuffer_get_length(ctx.got), ==, file_len + 8);
+	got = evbuffer_pullup(ctx.got, -1);
+	tt_assert(!memcmp(got, "head", 4));
+	tt_assert(!memcmp(got + 4, file_data, file_len));
+	tt_assert(!memcmp(got + 4 + file_len, "tail", 4));
+
+end:
+	if (bev)
+		bufferevent_free(bev);
+	if (ctx.server)
+		bufferevent_free(ctx.server);
+	if (listener)
+		evconnlistener_free(listener);
+	if (ctx.fd >= 0)
+		close(ctx.fd);
+	if (tmpfilename) {
+		unlink(tmpfilename);
+		free(tmpfilename);
+	}
+	if (ctx.got)
+		evbuffer_free(ctx.got);
+	free(file_data);
+}
+
+#define SMALL_MSG_LEN 16
+#define SMALL_MSG_COUNT 1000
+struct small_writes_context
+{
+	struct bufferevent *client;
+	struct evbuffer *got;
+	struct rwcount rw;
+	/* rw.write when the handshake finished. */
+	size_t handshake_writes;
+	char msgs[SMALL_MSG_LEN * SMALL_MSG_COUNT];
+};
+static void
+small_writes_readcb(struct bufferevent *bev, void *arg)
+{
+	struct small_writes_context *ctx = arg;
+
+	bufferevent_read_buffer(bev, ctx->got);
+	if (evbuffer_get_length(ctx->got) >= sizeof(ctx->msgs))
+		event_base_loopexit(bufferevent_get_base(bev), NULL);
+}
+static void
+small_writes_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct small_writes_context *ctx = arg;
+	struct evbuffer *msgs;
+	int i;
+
+	TT_BLATHER(("small_writes_eventcb(%p): %i", bev, what));
+	if (!(what & BEV_EVENT_CONNECTED)) {
+		event_base_loopexit(bufferevent_get_base(bev), NULL);
+		return;
+	}
+	if (bev != ctx->client)
+		return;
+
+	/* One chain per message, all queued before the next write. */
+	ctx->handshake_writes = ctx->rw.write;
+	msgs = evbuffer_new();
+	for (i = 0; i < SMALL_MSG_COUNT; ++i)
+		evbuffer_add_reference(msgs, ctx->msgs + i * SMALL_MSG_LEN,
+		    SMALL_MSG_LEN, NULL, NULL);
+	bufferevent_write_buffer(bev, msgs);
+	evbuffer_free(msgs);
+}
+/* Many small chains in the output buffer should go out as a few full
+ * records, not one record and one send() each. */
+static void
+regress_bufferevent_openssl_small_writes(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct bufferevent *client = NULL, *server = NULL;
+	/* The client's BIO points into this until the base finalizes it. */
+	static struct small_writes_context ctx_;
+	struct small_writes_context *ctx = &ctx_;
+	struct timeval tv = { 10, 0 };
+	SSL *ssl;
+	BIO *bio;
+	size_t i;
+
+	memset(ctx, 0, sizeof(*ctx));
+	tt_assert(ctx->got = evbuffer_new());
+	for (i = 0; i < sizeof(ctx->msgs); ++i)
+		ctx->msgs[i] = (char)(i * 13 + i / SMALL_MSG_LEN);
+
+	ssl = SSL_new(get_ssl_ctx());
+	tt_assert(ssl);
+	client = ctx->client = bufferevent_openssl_socket_new(base,
+	    data->pair[0], ssl, BUFFEREVENT_SSL_CONNECTING,
+	    BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(client);
+	data->pair[0] = -1;
+	ctx->rw.fd = bufferevent_getfd(client);
+	bio = BIO_new_rwcount(0);
+	tt_assert(bio);
+	BIO_set_data(bio, &ctx->rw);
+	SSL_set_bio(ssl, bio, bio);
+
+	ssl = SSL_new(get_ssl_ctx());
+	tt_assert(ssl);
+	SSL_use_certificate(ssl, the_cert);
+	SSL_use_PrivateKey(ssl, the_key);
+	server = bufferevent_openssl_socket_new(base, data->pair[1], ssl,
+	    BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(server);
+	data->pair[1] = -1;
+
+	bufferevent_setcb(client, NULL, NULL, small_writes_eventcb, ctx);
+	bufferevent_setcb(server, small_writes_readcb, NULL,
+	    small_writes_eventcb, ctx);
+	bufferevent_enable(client, EV_READ|EV_WRITE);
+	bufferevent_enable(server, EV_READ|EV_WRITE);
+
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+
+	tt_int_op(evbuffer_get_length(ctx->got), ==, sizeof(ctx->msgs));
+	tt_assert(!memcmp(evbuffer_pullup(ctx->got, -1), ctx->msgs,
+		sizeof(ctx->msgs)));
+	TT_BLATHER(("%d messages in %d writes", SMALL_MSG_COUNT,
+		(int)(ctx->rw.write - ctx->handshake_writes)));
+	tt_int_op(ctx->rw.write - ctx->handshake_writes, <=, 4);
+
+end:
+	if (client)
+		bufferevent_free(client);
+	if (server)
+		bufferevent_free(server);
+	if (ctx->got)
+		evbuffer_free(ctx->got);
+}
+
 struct testcase_t ssl_testcases[] = {
 #define T(a) ((void *)(a))
 	{ "bufferevent_socketpair", regress_bufferevent_openssl,
@@ -1072,6 +1341,11 @@ struct testcase_t ssl_testcases[] = {
 	{ "bufferevent_wm_filter_defer", regress_bufferevent_openssl_wm,
 	  TT_FORK|TT_NEED_BASE, &ssl_setup, T(REGRESS_OPENSSL_FILTER|REGRESS_DEFERRED_CALLBACKS) },
 
+	{ "bufferevent_ktls", regress_bufferevent_openssl_ktls,
+	  TT_FORK|TT_NEED_BASE, &ssl_setup, NULL },
+	{ "bufferevent_small_writes", regress_bufferevent_openssl_small_writes,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &ssl_setup, NULL },
+
 #undef T
 
 	END_OF_TESTCASES,
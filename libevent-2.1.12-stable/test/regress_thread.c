@@ -56,6 +56,11 @@
 
 #include "event2/event.h"
 #include "event2/event_struct.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#ifdef EVENT__HAVE_LIBZ
+#include "event2/bufferevent_compress.h"
+#endif
 #include "event2/thread.h"
 #include "event2/util.h"
 #include "evthread-internal.h"
@@ -564,6 +569,323 @@ end:
 	;
 }
 
+#define POST_N_THREADS 4
+#define POST_N_PER_THREAD 20000
+static struct event_base *post_base;
+static int post_next_seq[POST_N_THREADS];
+static int post_n_out_of_order;
+static int post_n_run;
+
+static void
+post_count_cb(void *arg)
+{
+	ev_intptr_t v = (ev_intptr_t)arg;
+	int id = (int)(v / POST_N_PER_THREAD);
+	int seq = (int)(v % POST_N_PER_THREAD);
+
+	/* Posts from one thread must run in the order they were made. */
+	if (seq != post_next_seq[id])
+		++post_n_out_of_order;
+	post_next_seq[id] = seq + 1;
+	if (++post_n_run == POST_N_THREADS * POST_N_PER_THREAD)
+		event_base_loopbreak(post_base);
+}
+
+static THREAD_FN
+post_subthread(void *arg)
+{
+	ev_intptr_t id = (ev_intptr_t)arg;
+	int i;
+
+	for (i = 0; i < POST_N_PER_THREAD; ++i) {
+		if (event_base_post(post_base, post_count_cb,
+			(void *)(id * POST_N_PER_THREAD + i)) < 0)
+			break;
+		/* Sometimes let the loop drain the queue, so that we also
+		 * exercise waking it up from empty. */
+		if (i % 5000 == 4999)
+			SLEEP_MS(10);
+	}
+
+	THREAD_RETURN();
+}
+
+static void
+post_nested_cb(void *arg)
+{
+	int *n = arg;
+
+	/* Posting from a posted callback must neither be lost nor run
+	 * before we return. */
+	if (++*n < 3)
+		tt_int_op(event_base_post(post_base, post_nested_cb, n), ==, 0);
+	if (*n == 3)
+		event_base_loopbreak(post_base);
+end:
+	;
+}
+
+static void
+post_free_cb(void *arg)
+{
+	++*(int *)arg;
+}
+
+static void
+thread_post(void *arg)
+{
+	struct basic_test_data *data = arg;
+	THREAD_T threads[POST_N_THREADS];
+	ev_intptr_t i;
+	int n_nested = 0, n_freed = 0;
+	struct event_base *base2 = NULL;
+
+	post_base = data->base;
+	memset(post_next_seq, 0, sizeof(post_next_seq));
+	post_n_out_of_order = post_n_run = 0;
+
+	for (i = 0; i < POST_N_THREADS; ++i)
+		THREAD_START(threads[i], post_subthread, (void *)i);
+	event_base_loop(data->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	for (i = 0; i < POST_N_THREADS; ++i)
+		THREAD_JOIN(threads[i]);
+
+	tt_int_op(post_n_run, ==, POST_N_THREADS * POST_N_PER_THREAD);
+	tt_int_op(post_n_out_of_order, ==, 0);
+
+	tt_int_op(event_base_post(data->base, post_nested_cb, &n_nested), ==, 0);
+	event_base_loop(data->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	tt_int_op(n_nested, ==, 3);
+
+	/* Whatever is still queued when the base goes away gets run. */
+	base2 = event_base_new();
+	tt_assert(base2);
+	tt_int_op(event_base_post(base2, post_free_cb, &n_freed), ==, 0);
+	tt_int_op(event_base_post(base2, post_free_cb, &n_freed), ==, 0);
+	event_base_free(base2);
+	base2 = NULL;
+	tt_int_op(n_freed, ==, 2);
+
+end:
+	if (base2)
+		event_base_free(base2);
+}
+
+#define PAIR_CROSS_TOTAL (16 << 20)
+#define PAIR_CROSS_CHUNK 16384
+
+struct pair_cross_reader {
+	struct event_base *base;
+	struct bufferevent *bev;
+	size_t n_read;
+	int n_bad;
+	int got_eof;
+};
+
+static void
+pair_cross_readcb(struct bufferevent *bev, void *arg)
+{
+	struct pair_cross_reader *r = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+	unsigned char buf[4096];
+	int i, n;
+
+	while ((n = evbuffer_remove(input, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; ++i) {
+			if (buf[i] != (unsigned char)((r->n_read + i) % 251))
+				++r->n_bad;
+		}
+		r->n_read += n;
+	}
+}
+
+static void
+pair_cross_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct pair_cross_reader *r = arg;
+
+	if (what & BEV_EVENT_EOF) {
+		r->got_eof = 1;
+		event_base_loopbreak(r->base);
+	}
+}
+
+static THREAD_FN
+pair_cross_subthread(void *arg)
+{
+	struct pair_cross_reader *r = arg;
+
+	event_base_loop(r->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	bufferevent_free(r->bev);
+	event_base_loop(r->base, EVLOOP_NONBLOCK);
+	THREAD_RETURN();
+}
+
+static size_t pair_cross_n_written;
+
+static void
+pair_cross_writecb(struct bufferevent *bev, void *arg)
+{
+	unsigned char buf[PAIR_CROSS_CHUNK];
+	int i;
+
+	if (pair_cross_n_written == PAIR_CROSS_TOTAL) {
+		event_base_loopbreak(bufferevent_get_base(bev));
+		return;
+	}
+	for (i = 0; i < PAIR_CROSS_CHUNK; ++i)
+		buf[i] = (unsigned char)((pair_cross_n_written + i) % 251);
+	bufferevent_write(bev, buf, sizeof(buf));
+	pair_cross_n_written += sizeof(buf);
+}
+
+static void
+thread_pair_cross(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct pair_cross_reader r;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	THREAD_T thread;
+
+	memset(&r, 0, sizeof(r));
+	pair_cross_n_written = 0;
+	r.base = event_base_new();
+	tt_assert(r.base);
+	tt_int_op(bufferevent_pair_new_cross(data->base, r.base, 0, pair),
+	    ==, 0);
+	tt_ptr_op(bufferevent_get_base(pair[0]), ==, data->base);
+	tt_ptr_op(bufferevent_get_base(pair[1]), ==, r.base);
+	tt_ptr_op(bufferevent_pair_get_partner(pair[0]), ==, NULL);
+
+	/* A small watermark on the reading side, so that the writer has to
+	 * wait for it now and then. */
+	r.bev = pair[1];
+	bufferevent_setcb(pair[1], pair_cross_readcb, NULL,
+	    pair_cross_eventcb, &r);
+	bufferevent_setwatermark(pair[1], EV_READ, 0, 65536);
+	bufferevent_enable(pair[1], EV_READ);
+	bufferevent_setcb(pair[0], NULL, pair_cross_writecb, NULL, NULL);
+	bufferevent_enable(pair[0], EV_WRITE);
+
+	THREAD_START(thread, pair_cross_subthread, &r);
+	pair_cross_writecb(pair[0], NULL);
+	event_base_loop(data->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	/* The reader sees EOF once it has everything; let our loop run once
+	 * more so that the writer really goes away. */
+	bufferevent_free(pair[0]);
+	pair[0] = NULL;
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	THREAD_JOIN(thread);
+
+	tt_int_op(pair_cross_n_written, ==, PAIR_CROSS_TOTAL);
+	tt_int_op(r.n_read, ==, PAIR_CROSS_TOTAL);
+	tt_int_op(r.n_bad, ==, 0);
+	tt_assert(r.got_eof);
+
+end:
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (r.base)
+		event_base_free(r.base);
+}
+
+#ifndef EVENT__DISABLE_MM_REPLACEMENT
+/* Bytes allocated and not yet freed since chain_cache_exit started
+ * counting; only one thread allocates at a time. */
+static ev_ssize_t chain_cache_n_live;
+static ev_ssize_t chain_cache_n_cached;
+
+static void *
+chain_cache_malloc(size_t sz)
+{
+	size_t *p = malloc(sizeof(size_t) + sz);
+	if (!p)
+		return NULL;
+	*p = sz;
+	chain_cache_n_live += sz;
+	return p + 1;
+}
+
+static void *
+chain_cache_realloc(void *ptr, size_t sz)
+{
+	size_t *p = ptr ? (size_t *)ptr - 1 : NULL;
+	size_t old = p ? *p : 0;
+	if (!(p = realloc(p, sizeof(size_t) + sz)))
+		return NULL;
+	*p = sz;
+	chain_cache_n_live += (ev_ssize_t)sz - (ev_ssize_t)old;
+	return p + 1;
+}
+
+static void
+chain_cache_free(void *ptr)
+{
+	size_t *p = ptr ? (size_t *)ptr - 1 : NULL;
+	if (!p)
+		return;
+	chain_cache_n_live -= *p;
+	free(p);
+}
+
+static THREAD_FN
+chain_cache_subthread(void *arg)
+{
+	struct evbuffer *buf = evbuffer_new();
+	char data[3000];
+
+#ifdef EVENT__HAVE_LIBZ
+	struct event_base *base = event_base_new();
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct bufferevent *bev = NULL;
+#endif
+
+	memset(data, 'x', sizeof(data));
+	if (buf) {
+		evbuffer_add(buf, data, sizeof(data));
+		evbuffer_free(buf);
+	}
+#ifdef EVENT__HAVE_LIBZ
+	/* A compressing bufferevent gives its compressor to the pool. */
+	if (base && !bufferevent_pair_new(base, 0, pair)) {
+		bev = bufferevent_compress_new(pair[0], BEV_COMPRESS_ZLIB, -1,
+		    BEV_COMPRESS_FLUSH_WRITE, 0, BEV_OPT_CLOSE_ON_FREE);
+		if (bev)
+			bufferevent_free(bev);
+		else
+			bufferevent_free(pair[0]);
+		bufferevent_free(pair[1]);
+	}
+	if (base)
+		event_base_free(base);
+#endif
+	/* What we freed stays behind in this thread's caches... */
+	chain_cache_n_cached = chain_cache_n_live;
+	THREAD_RETURN();
+}
+
+static void
+thread_chain_cache_exit(void *arg)
+{
+	THREAD_T thread;
+
+	/* Memory from here on comes with its size in front, so nothing
+	 * allocated earlier may be freed until we put malloc back. */
+	event_set_mem_functions(chain_cache_malloc, chain_cache_realloc,
+	    chain_cache_free);
+	chain_cache_n_live = chain_cache_n_cached = 0;
+	THREAD_START(thread, chain_cache_subthread, NULL);
+	THREAD_JOIN(thread);
+	event_set_mem_functions(malloc, realloc, free);
+
+	/* ...until it exits. */
+	tt_int_op(chain_cache_n_cached, >=, 3000);
+	tt_int_op(chain_cache_n_live, ==, 0);
+end:
+	;
+}
+#endif
+
 #define TEST(name, f)							\
 	{ #name, thread_##name, TT_FORK|TT_NEED_THREADS|TT_NEED_BASE|(f),	\
 	  &basic_setup, NULL }
@@ -584,6 +906,12 @@ struct testcase_t thread_testcases[] = {
 	 * looking into it now. / ellzey
 	 ******/
 	TEST(no_events, TT_RETRIABLE),
+#endif
+	TEST(post, 0),
+	TEST(pair_cross, 0),
+#ifndef EVENT__DISABLE_MM_REPLACEMENT
+	{ "chain_cache_exit", thread_chain_cache_exit,
+	  TT_FORK|TT_NEED_THREADS, &basic_setup, NULL },
 #endif
 	END_OF_TESTCASES
 };
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2009-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "../timerwheel-internal.h"
+#include "event-internal.h"
+
+#include <stdlib.h>
+#include "event2/event_struct.h"
+
+#include "tinytest.h"
+#include "tinytest_macros.h"
+#include "regress.h"
+
+#define N_EVENTS 1024
+
+static void
+set_random_timeout(struct event *ev, const struct timeval *start)
+{
+	struct timeval delay;
+	/* Mostly spread over the first few levels, with a few far enough
+	 * out to be parked at the end of the wheel. */
+	if (test_weakrand() % 64 == 0)
+		delay.tv_sec = 100000000 + test_weakrand() % 1000;
+	else
+		delay.tv_sec = test_weakrand() % (test_weakrand() % 2 ? 2 : 5000);
+	delay.tv_usec = test_weakrand() % 1000000;
+	evutil_timeradd(start, &delay, &ev->ev_timeout);
+	ev->ev_res = 0;
+}
+
+static void
+expire_all(struct timer_wheel *w, const struct timeval *now, int *n_fired)
+{
+	struct event *e;
+	int i;
+
+	timer_wheel_advance_(w, now);
+	while ((e = timer_wheel_expired_(w))) {
+		tt_want(evutil_timercmp(&e->ev_timeout, now, <=));
+		tt_want(e->ev_res == 0);
+		e->ev_res = 1;
+		timer_wheel_erase_(w, e);
+		++*n_fired;
+	}
+	/* Nothing that is due may be left behind. */
+	TIMER_WHEEL_FOREACH(e, w, i) {
+		tt_want(evutil_timercmp(&e->ev_timeout, now, >));
+	}
+}
+
+static void
+test_wheel_randomized(void *ptr)
+{
+	struct timer_wheel w;
+	struct event *inserted[N_EVENTS];
+	struct timeval start, now, step, next;
+	int i, n_fired = 0;
+
+	start.tv_sec = 1000;
+	start.tv_usec = 250000;
+	tt_int_op(timer_wheel_ctor_(&w, &start), ==, 0);
+
+	for (i = 0; i < N_EVENTS; ++i) {
+		inserted[i] = malloc(sizeof(struct event));
+		set_random_timeout(inserted[i], &start);
+		timer_wheel_push_(&w, inserted[i]);
+	}
+	tt_int_op(timer_wheel_size_(&w), ==, N_EVENTS);
+
+	for (i = 0; i < N_EVENTS / 2; ++i)
+		timer_wheel_erase_(&w, inserted[i]);
+	tt_int_op(timer_wheel_size_(&w), ==, N_EVENTS / 2);
+
+	/* Walk forward in irregular steps, sometimes jumping straight to
+	 * the time that the wheel asks to be woken up at. */
+	now = start;
+	while (timer_wheel_next_timeout_(&w, &next) == 0) {
+		if (test_weakrand() % 2) {
+			step.tv_sec = 0;
+			step.tv_usec = test_weakrand() % 300000;
+			evutil_timeradd(&now, &step, &now);
+		}
+		if (evutil_timercmp(&next, &now, >))
+			now = next;
+		expire_all(&w, &now, &n_fired);
+	}
+	tt_int_op(n_fired, ==, N_EVENTS / 2);
+	tt_assert(timer_wheel_empty_(&w));
+	tt_assert(timer_wheel_any_(&w) == NULL);
+
+end:
+	for (i = 0; i < N_EVENTS; ++i)
+		free(inserted[i]);
+
+	timer_wheel_dtor_(&w);
+}
+
+struct fire_order_data {
+	struct event_base *base;
+	struct timeval scheduled;
+	struct timeval *last;
+	int n_early;
+	int n_out_of_order;
+	int *n_fired;
+};
+
+static void
+fire_order_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct fire_order_data *d = arg;
+	struct timeval now;
+
+	event_gettime_monotonic(d->base, &now);
+	if (evutil_timercmp(&now, &d->scheduled, <))
+		++d->n_early;
+	/* Timeouts in the same millisecond may run in any order. */
+	if (timer_wheel_tick_(&d->scheduled) < timer_wheel_tick_(d->last))
+		++d->n_out_of_order;
+	*d->last = d->scheduled;
+	++*d->n_fired;
+}
+
+static void
+test_wheel_base(void *ptr)
+{
+	struct event_config *cfg = NULL;
+	struct event_base *base = NULL;
+	struct event *evs[64];
+	struct fire_order_data data[64];
+	struct timeval start, delay, last;
+	int i, n_fired = 0, n_early = 0, n_out_of_order = 0;
+
+	memset(evs, 0, sizeof(evs));
+	cfg = event_config_new();
+	tt_assert(cfg);
+	event_config_set_flag(cfg, EVENT_BASE_FLAG_TIMER_WHEEL);
+	base = event_base_new_with_config(cfg);
+	tt_assert(base);
+
+	event_gettime_monotonic(base, &start);
+	evutil_timerclear(&last);
+	for (i = 0; i < 64; ++i) {
+		delay.tv_sec = 0;
+		delay.tv_usec = (test_weakrand() % 200) * 1000 +
+		    test_weakrand() % 1000;
+		data[i].base = base;
+		data[i].last = &last;
+		data[i].n_early = data[i].n_out_of_order = 0;
+		data[i].n_fired = &n_fired;
+		evutil_timeradd(&start, &delay, &data[i].scheduled);
+		evs[i] = evtimer_new(base, fire_order_cb, &data[i]);
+		tt_assert(evs[i]);
+		evtimer_add(evs[i], &delay);
+	}
+	/* Half of them get cancelled, some of those get rescheduled. */
+	for (i = 0; i < 32; ++i)
+		evtimer_del(evs[i]);
+	for (i = 0; i < 16; ++i) {
+		delay.tv_sec = 0;
+		delay.tv_usec = 300 * 1000;
+		evutil_timeradd(&start, &delay, &data[i].scheduled);
+		evtimer_add(evs[i], &delay);
+	}
+	event_base_assert_ok_(base);
+
+	event_base_dispatch(base);
+
+	for (i = 0; i < 64; ++i) {
+		n_early += data[i].n_early;
+		n_out_of_order += data[i].n_out_of_order;
+	}
+	tt_int_op(n_fired, ==, 48);
+	tt_int_op(n_early, ==, 0);
+	tt_int_op(n_out_of_order, ==, 0);
+
+end:
+	for (i = 0; i < 64; ++i) {
+		if (evs[i])
+			event_free(evs[i]);
+	}
+	if (base)
+		event_base_free(base);
+	if (cfg)
+		event_config_free(cfg);
+}
+
+struct testcase_t timerwheel_testcases[] = {
+	{ "randomized", test_wheel_randomized, TT_FORK, NULL, NULL },
+	{ "base", test_wheel_base, TT_FORK, NULL, NULL },
+	END_OF_TESTCASES
+};
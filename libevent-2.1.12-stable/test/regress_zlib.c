@@ -54,6 +54,9 @@
 #include "event2/event_compat.h"
 #include "event2/buffer.h"
 #include "event2/bufferevent.h"
+#ifdef EVENT__HAVE_COMPRESS
+#include "event2/bufferevent_compress.h"
+#endif
 
 #include "regress.h"
 #include "mm-internal.h"
@@ -346,3 +349,129 @@ end:
 	if (pair[1] >= 0)
 		evutil_closesocket(pair[1]);
 }
+
+#ifdef EVENT__HAVE_COMPRESS
+/*
+ * bufferevent_compress_new() over a bufferevent pair
+ */
+
+static void
+compress_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *got = arg;
+
+	bufferevent_read_buffer(bev, got);
+}
+
+/* Run the loop until got holds want bytes, or we give up. */
+static void
+compress_wait(struct event_base *base, struct evbuffer *got, size_t want)
+{
+	int i;
+
+	for (i = 0; i < 100 && evbuffer_get_length(got) < want; ++i)
+		event_base_loop(base, EVLOOP_NONBLOCK);
+}
+
+void
+test_bufferevent_compress(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	const char *type = data->setup_data;
+	enum bufferevent_compress_format format = BEV_COMPRESS_ZLIB;
+	enum bufferevent_compress_flush flush = BEV_COMPRESS_FLUSH_WRITE;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct bufferevent *bev1 = NULL, *bev2 = NULL;
+	struct evbuffer *got = NULL;
+	unsigned char *buffer = NULL;
+	const size_t len = 200000;
+	size_t i, off;
+
+	if (strstr(type, "gzip"))
+		format = BEV_COMPRESS_GZIP;
+	else if (strstr(type, "zstd"))
+		format = BEV_COMPRESS_ZSTD;
+	if (strstr(type, "bytes"))
+		flush = BEV_COMPRESS_FLUSH_BYTES;
+	else if (strstr(type, "loop"))
+		flush = BEV_COMPRESS_FLUSH_LOOP;
+
+	tt_assert(buffer = malloc(len + 1000));
+	for (i = 0; i < len + 1000; ++i)
+		buffer[i] = (unsigned char)((i * i / 7) ^ (i >> 5));
+	tt_assert(got = evbuffer_new());
+	tt_int_op(bufferevent_pair_new(base, 0, pair), ==, 0);
+
+	/* Things we do not support. */
+	tt_ptr_op(bufferevent_compress_new(pair[0], BEV_COMPRESS_ZLIB, 10,
+		BEV_COMPRESS_FLUSH_WRITE, 0, 0), ==, NULL);
+	tt_ptr_op(bufferevent_compress_new(pair[0], BEV_COMPRESS_ZLIB, -1,
+		BEV_COMPRESS_FLUSH_BYTES, 0, 0), ==, NULL);
+
+	bev1 = bufferevent_compress_new(pair[0], format, -1, flush, 4096,
+	    BEV_OPT_CLOSE_ON_FREE);
+#ifndef EVENT__HAVE_ZSTD
+	if (format == BEV_COMPRESS_ZSTD) {
+		tt_ptr_op(bev1, ==, NULL);
+		tt_skip();
+	}
+#endif
+	tt_assert(bev1);
+	pair[0] = NULL;
+	bev2 = bufferevent_compress_new(pair[1], format, -1,
+	    BEV_COMPRESS_FLUSH_WRITE, 0, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev2);
+	pair[1] = NULL;
+	bufferevent_setcb(bev2, compress_readcb, NULL, NULL, got);
+	bufferevent_enable(bev2, EV_READ);
+
+	/* The flush policy decides when the other side can see the data. */
+	bufferevent_write(bev1, buffer, 1000);
+	if (flush == BEV_COMPRESS_FLUSH_LOOP)
+		tt_int_op(evbuffer_get_length(got), ==, 0);
+	compress_wait(base, got, 1000);
+	if (flush == BEV_COMPRESS_FLUSH_BYTES) {
+		tt_int_op(evbuffer_get_length(got), ==, 0);
+		bufferevent_write(bev1, buffer + 1000, 4000);
+		compress_wait(base, got, 5000);
+		tt_int_op(evbuffer_get_length(got), ==, 5000);
+	} else {
+		tt_int_op(evbuffer_get_length(got), ==, 1000);
+	}
+
+	/* Uneven writes, so the data is spread over many chains. */
+	off = evbuffer_get_length(got);
+	for (i = 1; off < len; ++i) {
+		size_t n = i * 1237 % 9000 + 1;
+		if (n > len - off)
+			n = len - off;
+		bufferevent_write(bev1, buffer + off, n);
+		off += n;
+	}
+	bufferevent_flush(bev1, EV_WRITE, BEV_FINISHED);
+	compress_wait(base, got, len);
+	tt_int_op(evbuffer_get_length(got), ==, len);
+	tt_assert(!memcmp(evbuffer_pullup(got, -1), buffer, len));
+
+	/* Whatever comes after the end of a stream starts another. */
+	bufferevent_write(bev1, buffer + len, 1000);
+	bufferevent_flush(bev1, EV_WRITE, BEV_FLUSH);
+	compress_wait(base, got, len + 1000);
+	tt_int_op(evbuffer_get_length(got), ==, len + 1000);
+	tt_assert(!memcmp(evbuffer_pullup(got, -1), buffer, len + 1000));
+
+end:
+	if (bev1)
+		bufferevent_free(bev1);
+	if (bev2)
+		bufferevent_free(bev2);
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (pair[1])
+		bufferevent_free(pair[1]);
+	if (got)
+		evbuffer_free(got);
+	free(buffer);
+}
+#endif
@@ -93,6 +93,12 @@ int evutil_configure_monotonic_time_(struct evutil_monotonic_timer *mt,
 EVENT2_EXPORT_SYMBOL
 int evutil_gettime_monotonic_(struct evutil_monotonic_timer *mt, struct timeval *tv);
 
+/** Return a reading of a precise monotonic clock, in nanoseconds, for
+ * measuring short intervals.  Readings are only meaningful relative to
+ * each other. */
+EVENT2_EXPORT_SYMBOL
+ev_uint64_t evutil_monotonic_nsec_(void);
+
 
 #ifdef __cplusplus
 }
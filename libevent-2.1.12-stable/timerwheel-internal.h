@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TIMERWHEEL_INTERNAL_H_INCLUDED_
+#define TIMERWHEEL_INTERNAL_H_INCLUDED_
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "event2/util.h"
+#include "util-internal.h"
+#include "mm-internal.h"
+
+#include <string.h>
+
+/*
+ * A hierarchical timing wheel, usable in place of the min-heap for events
+ * with (non-common) timeouts.  Insertion and removal are O(1); finding the
+ * next timeout is O(levels).
+ *
+ * Time is measured in ticks of one millisecond of monotonic time.  Level 0
+ * has one slot per tick; each slot of level N covers a whole rotation of
+ * level N-1.  When the wheel advances past the start of a slot on a higher
+ * level, the events in that slot are "cascaded" down into the lower levels.
+ * Events are never run early: an event in the current tick's slot is only
+ * expired once its exact ev_timeout has passed.
+ *
+ * Each slot is an unordered list threaded through the
+ * ev_timeout_pos.ev_next_with_common_timeout field of struct event, which
+ * is otherwise unused for events that are not on a common-timeout queue.
+ * Lists are headless so that an event can be unlinked without knowing which
+ * slot it is in.
+ */
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 6
+/* Index of the list of expired events, stored after the last real slot. */
+#define TIMER_WHEEL_NSLOTS (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SIZE)
+#define TIMER_WHEEL_EXPIRED TIMER_WHEEL_NSLOTS
+
+typedef struct timer_wheel
+{
+	/* TIMER_WHEEL_NSLOTS slot lists, followed by the expired list. */
+	struct event **slots;
+	/* Bit i of occupied[n] is set if slot i of level n may be nonempty. */
+	ev_uint64_t occupied[TIMER_WHEEL_LEVELS];
+	/* Where to append the next expired event. */
+	struct event **expired_tail;
+	/* The tick that the wheel has advanced to. */
+	ev_uint64_t now_tick;
+	/* The number of events in the wheel. */
+	unsigned n;
+} timer_wheel_t;
+
+#define TIMER_WHEEL_NEXT_(e) ((e)->ev_timeout_pos.ev_next_with_common_timeout.tqe_next)
+#define TIMER_WHEEL_PREV_(e) ((e)->ev_timeout_pos.ev_next_with_common_timeout.tqe_prev)
+
+/** Iterate over every event in the wheel, using 'i' as a scratch index. The
+ * body must not add or remove events. */
+#define TIMER_WHEEL_FOREACH(e, w, i)					\
+	for ((i) = 0; (i) <= TIMER_WHEEL_NSLOTS; ++(i))			\
+		for ((e) = (w)->slots[(i)]; (e); (e) = TIMER_WHEEL_NEXT_(e))
+
+static inline int	     timer_wheel_ctor_(timer_wheel_t* w, const struct timeval *now);
+static inline void	     timer_wheel_dtor_(timer_wheel_t* w);
+static inline int	     timer_wheel_empty_(timer_wheel_t* w);
+static inline unsigned	     timer_wheel_size_(timer_wheel_t* w);
+static inline void	     timer_wheel_push_(timer_wheel_t* w, struct event* e);
+static inline void	     timer_wheel_erase_(timer_wheel_t* w, struct event* e);
+static inline struct event*  timer_wheel_any_(timer_wheel_t* w);
+static inline int	     timer_wheel_next_timeout_(timer_wheel_t* w, struct timeval *tv);
+static inline void	     timer_wheel_advance_(timer_wheel_t* w, const struct timeval *now);
+static inline struct event*  timer_wheel_expired_(timer_wheel_t* w);
+
+static inline ev_uint64_t
+timer_wheel_tick_(const struct timeval *tv)
+{
+	return (ev_uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static inline int
+timer_wheel_ctz_(ev_uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		++n;
+	}
+	return n;
+#endif
+}
+
+static inline void
+timer_wheel_link_(struct event **pos, struct event *e)
+{
+	if ((TIMER_WHEEL_NEXT_(e) = *pos) != NULL)
+		TIMER_WHEEL_PREV_(*pos) = &TIMER_WHEEL_NEXT_(e);
+	*pos = e;
+	TIMER_WHEEL_PREV_(e) = pos;
+}
+
+static inline void
+timer_wheel_unlink_(struct event *e)
+{
+	if (TIMER_WHEEL_NEXT_(e) != NULL)
+		TIMER_WHEEL_PREV_(TIMER_WHEEL_NEXT_(e)) = TIMER_WHEEL_PREV_(e);
+	*TIMER_WHEEL_PREV_(e) = TIMER_WHEEL_NEXT_(e);
+}
+
+/* Put 'e' into the slot for its timeout, relative to the current tick. */
+static inline void
+timer_wheel_place_(timer_wheel_t* w, struct event* e)
+{
+	ev_uint64_t expires = timer_wheel_tick_(&e->ev_timeout);
+	ev_uint64_t delta;
+	int level = 0, idx;
+
+	if (expires < w->now_tick)
+		expires = w->now_tick;
+	delta = expires - w->now_tick;
+	while (level < TIMER_WHEEL_LEVELS - 1 &&
+	    delta >= ((ev_uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1))))
+		++level;
+	if (delta >= ((ev_uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))) {
+		/* Too far out for the wheel: park it in the farthest slot,
+		 * and let cascading bring it closer. */
+		expires = w->now_tick - 1 +
+		    ((ev_uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS));
+	}
+	idx = (int)((expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+	timer_wheel_link_(&w->slots[level * TIMER_WHEEL_SIZE + idx], e);
+	w->occupied[level] |= (ev_uint64_t)1 << idx;
+}
+
+/* Return the first tick at which the wheel needs to do something: either a
+ * nonempty level 0 slot comes due, or a nonempty slot on a higher level
+ * needs to be cascaded.  Set *level_out to the level of that slot.  If
+ * 'skip_current' is set, ignore the level 0 slot for the current tick.
+ * Returns EV_UINT64_MAX if the wheel is empty. */
+static inline ev_uint64_t
+timer_wheel_next_tick_(timer_wheel_t* w, int skip_current, int *level_out)
+{
+	ev_uint64_t best = EV_UINT64_MAX;
+	int level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		const int shift = TIMER_WHEEL_BITS * level;
+		/* On level 0, the current slot is due now; on higher levels,
+		 * the current slot was cascaded already and holds events
+		 * for its next rotation. */
+		const int first = (level == 0 && !skip_current) ? 0 : 1;
+		const int cur = (int)((w->now_tick >> shift) & TIMER_WHEEL_MASK);
+		const int start = (cur + first) & TIMER_WHEEL_MASK;
+		ev_uint64_t bits = w->occupied[level], tick;
+		int dist = 0;
+
+		if (!bits)
+			continue;
+		if (start)
+			bits = (bits >> start) | (bits << (TIMER_WHEEL_SIZE - start));
+		for (;;) {
+			int idx;
+			if (!bits)
+				break;
+			dist = timer_wheel_ctz_(bits);
+			idx = (start + dist) & TIMER_WHEEL_MASK;
+			if (w->slots[level * TIMER_WHEEL_SIZE + idx])
+				break;
+			/* Stale bit: the slot was emptied by erase. */
+			w->occupied[level] &= ~((ev_uint64_t)1 << idx);
+			bits &= bits - 1;
+		}
+		if (!bits)
+			continue;
+		dist += first;
+		if (level == 0)
+			tick = w->now_tick + dist;
+		else
+			tick = ((w->now_tick >> shift) + dist) << shift;
+		/* On a tie, prefer the higher level: its events may be due
+		 * earlier within the tick than the ones on level 0. */
+		if (tick < best || (tick == best && level > 0)) {
+			best = tick;
+			*level_out = level;
+		}
+	}
+	return best;
+}
+
+/* Move every event in the slots that start at the current tick down to the
+ * lower levels. */
+static inline void
+timer_wheel_cascade_(timer_wheel_t* w)
+{
+	int level;
+	for (level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+		const int shift = TIMER_WHEEL_BITS * level;
+		int idx;
+		struct event *e, *reversed = NULL;
+		struct event **slot;
+
+		if (w->now_tick & (((ev_uint64_t)1 << shift) - 1))
+			break;
+		idx = (int)((w->now_tick >> shift) & TIMER_WHEEL_MASK);
+		slot = &w->slots[level * TIMER_WHEEL_SIZE + idx];
+		w->occupied[level] &= ~((ev_uint64_t)1 << idx);
+		/* Reverse the list first, so that relinking keeps events
+		 * in the order they were added. */
+		while ((e = *slot) != NULL) {
+			timer_wheel_unlink_(e);
+			timer_wheel_link_(&reversed, e);
+		}
+		while ((e = reversed) != NULL) {
+			timer_wheel_unlink_(e);
+			timer_wheel_place_(w, e);
+		}
+	}
+}
+
+/* Move every event in the current level 0 slot whose timeout is no later
+ * than 'now' onto the expired list. */
+static inline void
+timer_wheel_collect_(timer_wheel_t* w, const struct timeval *now)
+{
+	const int idx = (int)(w->now_tick & TIMER_WHEEL_MASK);
+	struct event **pos = w->expired_tail;
+	struct event *e, *next;
+
+	for (e = w->slots[idx]; e; e = next) {
+		next = TIMER_WHEEL_NEXT_(e);
+		if (evutil_timercmp(&e->ev_timeout, now, >))
+			continue;
+		timer_wheel_unlink_(e);
+		/* Slots are LIFO; inserting each event at the same place
+		 * restores the order in which they were added. */
+		if (*pos == NULL)
+			w->expired_tail = &TIMER_WHEEL_NEXT_(e);
+		timer_wheel_link_(pos, e);
+	}
+}
+
+int timer_wheel_ctor_(timer_wheel_t* w, const struct timeval *now)
+{
+	memset(w, 0, sizeof(*w));
+	w->slots = mm_calloc(TIMER_WHEEL_NSLOTS + 1, sizeof(struct event *));
+	if (!w->slots)
+		return -1;
+	w->expired_tail = &w->slots[TIMER_WHEEL_EXPIRED];
+	w->now_tick = timer_wheel_tick_(now);
+	return 0;
+}
+
+void timer_wheel_dtor_(timer_wheel_t* w) { if (w->slots) mm_free(w->slots); }
+int timer_wheel_empty_(timer_wheel_t* w) { return 0u == w->n; }
+unsigned timer_wheel_size_(timer_wheel_t* w) { return w->n; }
+
+void timer_wheel_push_(timer_wheel_t* w, struct event* e)
+{
+	timer_wheel_place_(w, e);
+	++w->n;
+}
+
+void timer_wheel_erase_(timer_wheel_t* w, struct event* e)
+{
+	if (w->expired_tail == &TIMER_WHEEL_NEXT_(e))
+		w->expired_tail = TIMER_WHEEL_PREV_(e);
+	timer_wheel_unlink_(e);
+	--w->n;
+}
+
+struct event* timer_wheel_any_(timer_wheel_t* w)
+{
+	int i;
+	if (!w->n)
+		return NULL;
+	for (i = TIMER_WHEEL_NSLOTS; i >= 0; --i) {
+		if (w->slots[i])
+			return w->slots[i];
+	}
+	return NULL;
+}
+
+/* Set *tv to the earliest time at which timer_wheel_advance_() will have
+ * work to do.  Return -1 if the wheel is empty. */
+int timer_wheel_next_timeout_(timer_wheel_t* w, struct timeval *tv)
+{
+	ev_uint64_t tick;
+	int level = 0;
+
+	if (w->slots[TIMER_WHEEL_EXPIRED]) {
+		*tv = w->slots[TIMER_WHEEL_EXPIRED]->ev_timeout;
+		return 0;
+	}
+	tick = timer_wheel_next_tick_(w, 0, &level);
+	if (tick == EV_UINT64_MAX)
+		return -1;
+	if (level == 0) {
+		/* Find the exact time of the earliest event in the slot. */
+		struct event *e = w->slots[tick & TIMER_WHEEL_MASK];
+		*tv = e->ev_timeout;
+		for (e = TIMER_WHEEL_NEXT_(e); e; e = TIMER_WHEEL_NEXT_(e)) {
+			if (evutil_timercmp(&e->ev_timeout, tv, <))
+				*tv = e->ev_timeout;
+		}
+	} else {
+		tv->tv_sec = (time_t)(tick / 1000);
+		tv->tv_usec = (long)(tick % 1000) * 1000;
+	}
+	return 0;
+}
+
+/* Advance the wheel to 'now', cascading as needed, and move every event
+ * whose timeout has passed onto the expired list. */
+void timer_wheel_advance_(timer_wheel_t* w, const struct timeval *now)
+{
+	const ev_uint64_t target = timer_wheel_tick_(now);
+	for (;;) {
+		ev_uint64_t next;
+		int level;
+		timer_wheel_collect_(w, now);
+		if (w->now_tick >= target)
+			break;
+		next = timer_wheel_next_tick_(w, 1, &level);
+		if (next > target) {
+			/* Nothing to expire or cascade in between. */
+			w->now_tick = target;
+			timer_wheel_collect_(w, now);
+			break;
+		}
+		w->now_tick = next;
+		timer_wheel_cascade_(w);
+	}
+}
+
+/* Return the first expired event, or NULL if there are none.  The caller
+ * is expected to remove it with timer_wheel_erase_(). */
+struct event* timer_wheel_expired_(timer_wheel_t* w)
+{
+	return w->slots[TIMER_WHEEL_EXPIRED];
+}
+
+#endif /* TIMERWHEEL_INTERNAL_H_INCLUDED_ */
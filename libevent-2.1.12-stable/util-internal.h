@@ -310,6 +310,23 @@ int evutil_resolve_(int family, const char *hostname, struct sockaddr *sa,
 
 const char *evutil_getenv_(const char *name);
 
+/** Return a pointer to the first byte in [s, s+len) that is equal to c1 or
+ * to c2, or NULL if there is none. */
+const char *evutil_memchr2_(const char *s, size_t len, int c1, int c2);
+/** Return a pointer to the first occurrence of the patlen-byte pattern pat
+ * within [s, s+len), or NULL if there is none. */
+const char *evutil_memmem_(const char *s, size_t len,
+    const char *pat, size_t patlen);
+/** Make evutil_memchr2_() and evutil_memmem_() use the named implementation
+ * ("scalar", "sse2" or "avx2"), or the best one if name is NULL.  Return 0
+ * on success, -1 if that implementation isn't available here. */
+EVENT2_EXPORT_SYMBOL
+int evutil_memsearch_select_(const char *name);
+/** Return the name of the implementation evutil_memchr2_() and
+ * evutil_memmem_() are using. */
+EVENT2_EXPORT_SYMBOL
+const char *evutil_memsearch_get_impl_(void);
+
 /* Structure to hold the state of our weak random number generator.
  */
 struct evutil_weakrand_state {
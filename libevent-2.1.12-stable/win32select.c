@@ -324,6 +324,8 @@ win32_dispatch(struct event_base *base, struct timeval *tv)
 	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
 
 	event_debug(("%s: select returned %d", __func__, res));
+	if (res >= 0)
+		event_base_record_dispatch_events_(base, res);
 
 	if (res <= 0) {
 		event_debug(("%s: %s", __func__,